@@ -20,7 +20,9 @@ out vec4 FragColor;
 
 in vec2 TexCoords;
 
-uniform sampler2D depthMap;
+// the shadow cascades, one layer shown
+uniform sampler2DArray depthMap;
+uniform int layer;
 uniform float zNear;
 uniform float zFar;
 
@@ -33,7 +35,7 @@ float LinearizeDepth(float depth)
 
 void main()
 {             
-    float depthValue = texture(depthMap, TexCoords).r;
+    float depthValue = texture(depthMap, vec3(TexCoords, layer)).r;
     // FragColor = vec4(vec3(LinearizeDepth(depthValue) / zFar), 1.0); // perspective
     FragColor = vec4(vec3(depthValue), 1.0); // orthographic
 }
\ No newline at end of file
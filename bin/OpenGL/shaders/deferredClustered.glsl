@@ -0,0 +1,73 @@
+-- Vertex
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aTexCoords;
+
+out vec2 TexCoords;
+
+void main()
+{
+    TexCoords = aTexCoords;
+    gl_Position = vec4(aPos, 1.0);
+}
+
+-- Fragment
+
+layout (location = 0) out vec4 FragColor;
+
+in vec2 TexCoords;
+
+#include "gBufferPacking.Octahedral"
+#include "gBufferPacking.Decode"
+
+// filled by LightClusters every frame
+uniform samplerBuffer clusterLights;          // two texels per light: position and radius, then color
+uniform usamplerBuffer clusterRanges;         // offset and count into clusterLightIndices of every froxel
+uniform usamplerBuffer clusterLightIndices;
+uniform int clusterTileSize;
+uniform int clusterTilesX;
+uniform int clusterTilesY;
+uniform int clusterSlices;
+uniform float clusterDepthScale;              // slice = log(depth) * scale + bias
+uniform float clusterDepthBias;
+uniform mat4 view;
+uniform vec3 viewPos;
+uniform float lightIntensity;
+uniform float glossiness;
+
+void main()
+{
+	vec3 FragPos = gBufferPosition(TexCoords);
+	vec3 Normal = gBufferNormal(TexCoords);
+	vec3 Diffuse = gBufferDiffuse(TexCoords);
+	vec4 Specular = gBufferSpecular(TexCoords);
+
+	// find the froxel of the pixel
+	float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+	int slice = clamp(int(floor(log(viewDepth) * clusterDepthScale + clusterDepthBias)), 0, clusterSlices - 1);
+	ivec2 tile = min(ivec2(gl_FragCoord.xy) / clusterTileSize, ivec2(clusterTilesX - 1, clusterTilesY - 1));
+	uvec2 range = texelFetch(clusterRanges, (slice * clusterTilesY + tile.y) * clusterTilesX + tile.x).xy;
+
+	vec3 viewDir  = normalize(viewPos - FragPos);
+	vec3 lighting = vec3(0.0);
+	for (uint i = 0u; i < range.y; i++)
+	{
+		int light = int(texelFetch(clusterLightIndices, int(range.x + i)).r);
+		vec4 lightPositionRadius = texelFetch(clusterLights, 2 * light);
+		vec3 lightColor = texelFetch(clusterLights, 2 * light + 1).rgb;
+		vec3 lightPosition = lightPositionRadius.xyz;
+
+		// same Phong lighting as deferredPointLightInstanced
+		vec3 ambient  = Diffuse * 0.2;
+		vec3 lightDir = normalize(lightPosition - FragPos);
+		vec3 diffuse = max(dot(Normal, lightDir), 0.0) * Diffuse * lightColor;
+		vec3 halfwayDir = normalize(lightDir + viewDir);
+		float spec = pow(max(dot(Normal, halfwayDir), 0.0), glossiness) * Specular.a;
+		vec3 specular = lightColor * spec * Specular.rgb;
+		float distToL = length(lightPosition - FragPos);
+		float attenuation = 1.0 - pow(smoothstep(0.0, 1.0, clamp(distToL/lightPositionRadius.w, 0.0, 1.0)), 4.0);
+		lighting += (ambient + diffuse + specular) * attenuation;
+	}
+
+    FragColor = vec4(lighting * lightIntensity, 1.0);
+}
@@ -1,24 +1,21 @@
 
 -- Vertex
 
-layout (location = 0) in vec3 aPos;
-layout (location = 2) in vec4 aInstanceParam;  // (RGB) light color and (A) is light radius
-layout (location = 3) in mat4 aInstanceMatrix;
+#include "lightProxy.Instance"
 
 out vec3 lightColor;
 out vec3 lightPosition;
 out float lightRadius;
-
-uniform mat4 projection;
-uniform mat4 view;
+flat out int lightIndex;
 
 void main()
 {
-	lightColor = aInstanceParam.rgb;
-	lightRadius = aInstanceParam.w;
-	// extract light position from the instance model matrix
-	lightPosition = vec3(aInstanceMatrix[3]);
-    gl_Position = projection * view * aInstanceMatrix * vec4(lightRadius * aPos, 1.0);
+	lightIndex = int(aLightIndex);
+	vec4 sphere = texelFetch(lightPositionRadius, int(aLightIndex));
+	lightColor = texelFetch(lightColors, int(aLightIndex)).rgb;
+	lightRadius = sphere.w;
+	lightPosition = sphere.xyz;
+    gl_Position = proxyPosition(sphere);
 }
 
 -- Fragment
@@ -28,11 +25,13 @@ layout (location = 0) out vec4 FragColor;
 in vec3 lightColor;
 in float lightRadius;
 in vec3 lightPosition;
+flat in int lightIndex;
+
+#include "gBufferPacking.Octahedral"
+#include "gBufferPacking.Decode"
+#include "pointShadow.Faces"
+#include "pointShadow.Sample"
 
-uniform sampler2D gPosition;
-uniform sampler2D gNormal;
-uniform sampler2D gDiffuse;
-uniform sampler2D gSpecular;
 uniform vec3 viewPos;
 uniform float lightIntensity;
 uniform vec2 screenSize;
@@ -41,10 +40,10 @@ uniform float glossiness;
 void main()
 {
 	vec2 uvCoords = gl_FragCoord.xy / screenSize;
-	vec3 FragPos = texture(gPosition, uvCoords).rgb;
-	vec3 Normal = texture(gNormal, uvCoords).rgb;
-	vec3 Diffuse = texture(gDiffuse, uvCoords).rgb;
-	vec4 Specular = texture(gSpecular, uvCoords);
+	vec3 FragPos = gBufferPosition(uvCoords);
+	vec3 Normal = gBufferNormal(uvCoords);
+	vec3 Diffuse = gBufferDiffuse(uvCoords);
+	vec4 Specular = gBufferSpecular(uvCoords);
 	
 	// do Phong lighting calculation
 	vec3 ambient  = Diffuse * 0.2; // ambient contribution
@@ -60,7 +59,9 @@ void main()
 	// attenuation
 	float distToL = length(lightPosition - FragPos);
 	float attenuation = 1.0 - pow(smoothstep(0.0, 1.0, clamp(distToL/lightRadius, 0.0, 1.0)), 4.0);
-	vec3 result = ambient + diffuse + specular;
+	// the shadow only takes the direct light away
+	float shadow = pointShadow(lightIndex, FragPos - lightPosition, lightRadius);
+	vec3 result = ambient + (diffuse + specular) * shadow;
 	float noZTestFix = step(0.0, lightRadius - distToL); //0.0 if distToL > radius, 1.0 otherwise
 	vec4 outColor = vec4(result, noZTestFix) * attenuation * lightIntensity;
 	
@@ -18,12 +18,17 @@ out vec4 FragColor;
 
 in vec2 TexCoords;
 
-uniform sampler2D gPosition;
-uniform sampler2D gNormal;
-uniform sampler2D gDiffuse;
-uniform sampler2D gSpecular;
-uniform sampler2D shadowMap;
-uniform mat4 lightSpaceMatrix;
+#include "gBufferPacking.Octahedral"
+#include "gBufferPacking.Decode"
+
+// one layer per cascade, see shadow_cascades.h
+uniform sampler2DArray shadowMap;
+uniform bool enableShadows;       // the shadow map isn't rendered (or bound) when false
+uniform mat4 lightSpaceMatrices[4];
+uniform int cascadeCount;
+uniform vec4 cascadeSplits;       // view depth each cascade ends at
+uniform vec4 cascadeDepthRanges;  // world size of each cascade's depth range
+uniform vec4 viewDepthAxis;       // view depth = dot(xyz, position) + w
 uniform float glossiness;
 
 struct Light {
@@ -49,31 +54,37 @@ uniform vec4 offset[nsamples] = { vec4(0.000000, 0.000000, 0.0, 0.0),
 								  vec4(-0.994499, 0.478925, 0.0, 0.0),
 								  vec4(-0.558746, -1.160249, 0.0, 0.0) };
 								  
-float getOcclusionCoef(vec4 shadowCoord, float bias)
+float getOcclusionCoef(vec4 shadowCoord, float cascade, float bias)
 {
 	// get the stored depth
-	float shadow_d = texture(shadowMap, shadowCoord.xy).r; 
-	float diff = shadow_d - (shadowCoord.z + bias);
+	float shadow_d = texture(shadowMap, vec3(shadowCoord.xy, cascade)).r; 
 	return shadowCoord.z - bias > shadow_d  ? 0.0 : 1.0;  	
 }
 
 // using percent closer filtering technique
 float percentCloserFilteredShadow (vec3 fragPos, vec3 normal)
 {
-	vec4 fragPosLightSpace = lightSpaceMatrix * vec4(fragPos, 1.0);
+	// the first cascade reaching the fragment's depth, past the last one there is no shadow
+	float depth = dot(viewDepthAxis.xyz, fragPos) + viewDepthAxis.w;
+	int cascade = 0;
+	while (cascade < cascadeCount && depth > cascadeSplits[cascade])
+		cascade++;
+	if (cascade == cascadeCount)
+		return 1.0;
+	vec4 fragPosLightSpace = lightSpaceMatrices[cascade] * vec4(fragPos, 1.0);
 	// perform perspective divide
     vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
 	// transform to [0,1] range
     projCoords = projCoords * 0.5 + 0.5;
-	// calculate bias
+	// calculate bias, in world units so it doesn't change with the cascade's depth range
 	vec3 lightDir = normalize(gLight.Position - fragPos);
-	float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
+	float bias = max(0.45 * (1.0 - dot(normal, lightDir)), 0.045) / cascadeDepthRanges[cascade];
 	float scale = 1.0 / textureSize(shadowMap, 0).x; 
 	// sum shadow samples
 	float shadowCoef = 0.0;
 	for(int i=0; i<nsamples; i++)
 	{
-		shadowCoef += getOcclusionCoef(vec4(projCoords, 0.0) + scale*offset[i], bias);
+		shadowCoef += getOcclusionCoef(vec4(projCoords, 0.0) + scale*offset[i], float(cascade), bias);
 	}
 	shadowCoef /= nsamples;
 	
@@ -87,10 +98,10 @@ float percentCloserFilteredShadow (vec3 fragPos, vec3 normal)
 void main()
 {             
     // retrieve data from gbuffer
-    vec3 FragPos = texture(gPosition, TexCoords).rgb;
-    vec3 Normal = texture(gNormal, TexCoords).rgb;
-    vec3 Diffuse = texture(gDiffuse, TexCoords).rgb;
-    vec4 Specular = texture(gSpecular, TexCoords);
+    vec3 FragPos = gBufferPosition(TexCoords);
+    vec3 Normal = gBufferNormal(TexCoords);
+    vec3 Diffuse = gBufferDiffuse(TexCoords);
+    vec4 Specular = gBufferSpecular(TexCoords);
 	
 	// do Phong lighting calculation
 	vec3 ambient  = Diffuse * 0.2; // hard-coded ambient component
@@ -109,7 +120,7 @@ void main()
 	diffuse *= attenuation;
 	specular *= attenuation;
 	// calculate shadow using PCF
-	float shadow = percentCloserFilteredShadow(FragPos, Normal);
+	float shadow = enableShadows ? percentCloserFilteredShadow(FragPos, Normal) : 1.0;
 	
 	vec3 result = ambient + (diffuse + specular) * shadow;
 			
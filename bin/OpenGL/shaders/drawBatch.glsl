@@ -0,0 +1,38 @@
+-- Object
+
+// objects of the draw batch (draw_batch.h), eight texels per object: the transform's columns, the normal matrix's
+// columns with the diffuse color in w, the specular color
+uniform samplerBuffer objectData;
+// object of every instance, an instanced draw's start at objectIndex
+uniform isamplerBuffer objectInstances;
+uniform int objectIndex;
+
+int batchObject()
+{
+    return texelFetch(objectInstances, objectIndex + gl_InstanceID).r * 8;
+}
+
+mat4 objectTransform()
+{
+    int base = batchObject();
+    return mat4(texelFetch(objectData, base), texelFetch(objectData, base + 1),
+                texelFetch(objectData, base + 2), texelFetch(objectData, base + 3));
+}
+
+mat3 objectNormalMatrix()
+{
+    int base = batchObject();
+    return mat3(texelFetch(objectData, base + 4).xyz, texelFetch(objectData, base + 5).xyz,
+                texelFetch(objectData, base + 6).xyz);
+}
+
+vec3 objectDiffuse()
+{
+    int base = batchObject();
+    return vec3(texelFetch(objectData, base + 4).w, texelFetch(objectData, base + 5).w, texelFetch(objectData, base + 6).w);
+}
+
+vec4 objectSpecular()
+{
+    return texelFetch(objectData, batchObject() + 7);
+}
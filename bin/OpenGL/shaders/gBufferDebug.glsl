@@ -18,22 +18,25 @@ out vec4 FragColor;
 
 in vec2 TexCoords;
 
-uniform sampler2D gPosition;
-uniform sampler2D gNormal;
-uniform sampler2D gDiffuse;
-uniform sampler2D gSpecular;
+#include "gBufferPacking.Octahedral"
+#include "gBufferPacking.Decode"
+
 uniform int gBufferMode;
 
 void main()
 {             
     // retrieve data from gbuffer
-    vec3 FragPos = texture(gPosition, TexCoords).rgb;
-    vec3 Normal = texture(gNormal, TexCoords).rgb;
-    vec3 Diffuse = texture(gDiffuse, TexCoords).rgb;
-    vec3 Specular = texture(gSpecular, TexCoords).rgb;
+    vec3 FragPos = gBufferPosition(TexCoords);
+    vec3 Normal = gBufferNormal(TexCoords);
+    vec3 Diffuse = gBufferDiffuse(TexCoords);
+    vec3 Specular = gBufferSpecular(TexCoords).rgb;
 	vec3 outColor = vec3(0.0);
 	
-	if(gBufferMode == 1) // world position
+	if(gBufferDepth(TexCoords) == 1.0) // background, nothing was written
+	{
+		outColor = vec3(0.0);
+	}
+	else if(gBufferMode == 1) // world position
 	{
 		outColor = FragPos;
 	}
@@ -20,6 +20,7 @@ void main()
     TexCoords = aTexCoords;
     
     mat3 normalMatrix = transpose(inverse(mat3(model)));
+    // the floor's vertex array always has float normals
     Normal = normalMatrix * aNormal;
 
     gl_Position = projection * view * worldPos;
@@ -27,13 +28,13 @@ void main()
 
 -- Fragment
 
-layout (location = 0) out vec3 gPosition;
-layout (location = 1) out vec3 gNormal;
-layout (location = 2) out vec3 gDiffuse;
-layout (location = 3) out vec4 gSpecular;
+#include "gBufferPacking.Encode"
+
+layout (location = 0) out vec2 gNormal;
+layout (location = 1) out vec4 gDiffuse;
+layout (location = 2) out vec4 gSpecular;
 
 in vec2 TexCoords;
-in vec3 FragPos;
 in vec3 Normal;
 
 uniform sampler2D texture_diffuse1;
@@ -42,12 +43,10 @@ uniform vec4 specularCol;
 
 void main()
 {    
-    // store the fragment position vector in the first gbuffer texture
-    gPosition = FragPos;
-    // also store the per-fragment normals into the gbuffer
-    gNormal = normalize(Normal);
+    // the position is reconstructed from the depth, store the per-fragment normals into the first gbuffer texture
+    gNormal = encodeNormal(normalize(Normal));
     // and the diffuse per-fragment color
-    gDiffuse.rgb = texture(texture_diffuse1, TexCoords).rgb;
+    gDiffuse = vec4(texture(texture_diffuse1, TexCoords).rgb, 1.0);
     // specular per-fragment color
     gSpecular = specularCol;
 }
\ No newline at end of file
@@ -0,0 +1,32 @@
+-- Instance
+
+// light proxies (light_proxies.h): the proxy mesh vertex and the index of the light, whose position,
+// radius and color come from the light buffers (light_system.h)
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in uint aLightIndex;
+
+uniform samplerBuffer lightPositionRadius;
+uniform samplerBuffer lightColors;
+uniform mat4 projection;
+uniform mat4 view;
+// 1 while drawing screen rectangles, the corners of the quad mesh are in aPos.xy
+uniform int proxyQuad;
+
+// tangents bounding a sphere along one view axis: center offset a along the axis, depth d and radius r, d > r
+vec2 tangentBounds(float a, float d, float r)
+{
+    float root = r * sqrt(a * a + d * d - r * r);
+    return vec2(a * d - root, a * d + root) / (d * d - r * r);
+}
+
+// clip space position of the proxy vertex around a sphere (xyz center, w radius)
+vec4 proxyPosition(vec4 sphere)
+{
+    if (proxyQuad == 0)
+        return projection * view * vec4(sphere.xyz + sphere.w * aPos, 1.0);
+    vec3 center = (view * vec4(sphere.xyz, 1.0)).xyz;
+    vec2 boundsX = tangentBounds(center.x, -center.z, sphere.w) * projection[0][0];
+    vec2 boundsY = tangentBounds(center.y, -center.z, sphere.w) * projection[1][1];
+    vec2 corner = aPos.xy * 0.5 + 0.5;
+    return vec4(mix(boundsX.x, boundsX.y, corner.x), mix(boundsY.x, boundsY.y, corner.y), 0.0, 1.0);
+}
@@ -1,6 +1,9 @@
 
 -- Vertex
 
+#include "drawBatch.Object"
+#include "gBufferPacking.Octahedral"
+
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
@@ -8,45 +11,53 @@ layout (location = 2) in vec2 aTexCoords;
 out vec3 FragPos;
 out vec2 TexCoords;
 out vec3 Normal;
+// material of the object
+flat out vec3 Diffuse;
+flat out vec4 Specular;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+// set when the mesh stores its normals octahedral encoded in aNormal.xy
+uniform bool octahedralNormals;
+
+vec3 decodeNormal()
+{
+    return octahedralNormals ? decodeOctahedral(aNormal.xy) : aNormal;
+}
 
 void main()
 {
-    vec4 worldPos = model * vec4(aPos, 1.0);
+    vec4 worldPos = objectTransform() * vec4(aPos, 1.0);
     FragPos = worldPos.xyz; 
     TexCoords = aTexCoords;
     
-    mat3 normalMatrix = transpose(inverse(mat3(model)));
-    Normal = normalMatrix * aNormal;
+    // transpose(inverse(mat3(model))), computed once per object by the batch
+    Normal = objectNormalMatrix() * decodeNormal();
+    Diffuse = objectDiffuse();
+    Specular = objectSpecular();
 
     gl_Position = projection * view * worldPos;
 }
 
 -- Fragment
 
-layout (location = 0) out vec3 gPosition;
-layout (location = 1) out vec3 gNormal;
-layout (location = 2) out vec3 gDiffuse;
-layout (location = 3) out vec4 gSpecular;
+#include "gBufferPacking.Encode"
+
+layout (location = 0) out vec2 gNormal;
+layout (location = 1) out vec4 gDiffuse;
+layout (location = 2) out vec4 gSpecular;
 
 in vec2 TexCoords;
-in vec3 FragPos;
 in vec3 Normal;
-
-uniform vec3 diffuseCol;
-uniform vec4 specularCol;
+flat in vec3 Diffuse;
+flat in vec4 Specular;
 
 void main()
 {    
-    // store the fragment position vector in the first gbuffer texture
-    gPosition = FragPos;
-    // also store the per-fragment normals into the gbuffer
-    gNormal = normalize(Normal);
+    // the position is reconstructed from the depth, store the per-fragment normals into the first gbuffer texture
+    gNormal = encodeNormal(normalize(Normal));
     // the diffuse per-fragment color
-    gDiffuse = diffuseCol;
+    gDiffuse = vec4(Diffuse, 1.0);
 	// and the specular per-fragment color
-	gSpecular = specularCol;
+	gSpecular = Specular;
 }
\ No newline at end of file
@@ -0,0 +1,58 @@
+-- Octahedral
+
+// unit vector from its octahedral encoding in [-1, 1], for the G-buffer and the compact vertex normals. Includes
+// don't nest, shaders including gBufferPacking.Decode include this section before it
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+-- Encode
+
+// octahedral normal remapped to [0, 1] for the unsigned normalized RG16 target
+vec2 encodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return e * 0.5 + 0.5;
+}
+
+-- Decode
+
+// G-buffer layout: depth (position reconstructed from it), RG16 octahedral normal,
+// RGBA8 diffuse and RGBA8 specular (rgb color, a strength)
+uniform sampler2D gDepth;
+uniform sampler2D gNormal;
+uniform sampler2D gDiffuse;
+uniform sampler2D gSpecular;
+uniform mat4 inverseViewProjection;
+
+float gBufferDepth(vec2 uv)
+{
+    return texture(gDepth, uv).r;
+}
+
+// world space position
+vec3 gBufferPosition(vec2 uv)
+{
+    vec4 position = inverseViewProjection * vec4(vec3(uv, gBufferDepth(uv)) * 2.0 - 1.0, 1.0);
+    return position.xyz / position.w;
+}
+
+vec3 gBufferNormal(vec2 uv)
+{
+    return decodeOctahedral(texture(gNormal, uv).rg * 2.0 - 1.0);
+}
+
+vec3 gBufferDiffuse(vec2 uv)
+{
+    return texture(gDiffuse, uv).rgb;
+}
+
+vec4 gBufferSpecular(vec2 uv)
+{
+    return texture(gSpecular, uv);
+}
@@ -0,0 +1,163 @@
+-- Faces
+
+// cube faces of point_shadows.h, in the order of their layers: the axis a face looks along and the axes of its
+// x and y, a direction d from the light lands on (dot(d, right), dot(d, up)) / dot(d, forward)
+const vec3 faceForward[6] = vec3[6](vec3(1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0),
+                                    vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0));
+const vec3 faceRight[6] = vec3[6](vec3(0.0, 0.0, -1.0), vec3(0.0, 0.0, 1.0), vec3(1.0, 0.0, 0.0),
+                                  vec3(1.0, 0.0, 0.0), vec3(1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0));
+const vec3 faceUp[6] = vec3[6](vec3(0.0, 1.0, 0.0), vec3(0.0, 1.0, 0.0), vec3(0.0, 0.0, -1.0),
+                               vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 0.0), vec3(0.0, 1.0, 0.0));
+
+-- Vertex
+
+#include "drawBatch.Object"
+
+layout (location = 0) in vec3 aPos;
+
+// true while drawing the clearing triangle, whose aPos is in clip space
+uniform bool clearFaces;
+
+out vec3 vWorldPos;
+
+void main()
+{
+    if (clearFaces)
+    {
+        vWorldPos = vec3(0.0);
+        gl_Position = vec4(aPos, 1.0);
+        return;
+    }
+    vWorldPos = (objectTransform() * vec4(aPos, 1.0)).xyz;
+    gl_Position = vec4(vWorldPos, 1.0);
+}
+
+-- Geometry
+
+#include "pointShadow.Faces"
+
+layout (triangles) in;
+// every update times every face
+layout (triangle_strip, max_vertices = 72) out;
+
+// the lights drawn into this tier (xyz center, w radius) and the first layer of their slots
+uniform int updateCount;
+uniform vec4 updateSpheres[4];
+uniform int updateLayers[4];
+uniform bool clearFaces;
+
+in vec3 vWorldPos[];
+out vec3 gWorldPos;
+flat out int gUpdate;
+
+void main()
+{
+    for (int u = 0; u < updateCount; u++)
+    {
+        vec3 center = updateSpheres[u].xyz;
+        float far = updateSpheres[u].w;
+        float near = far * 0.01;
+        for (int face = 0; face < 6; face++)
+        {
+            if (!clearFaces)
+            {
+                // skip the faces whose frustum has the triangle outside one of its side planes or its far plane
+                vec3 d0 = vWorldPos[0] - center, d1 = vWorldPos[1] - center, d2 = vWorldPos[2] - center;
+                vec3 f = vec3(dot(d0, faceForward[face]), dot(d1, faceForward[face]), dot(d2, faceForward[face]));
+                vec3 x = vec3(dot(d0, faceRight[face]), dot(d1, faceRight[face]), dot(d2, faceRight[face]));
+                vec3 y = vec3(dot(d0, faceUp[face]), dot(d1, faceUp[face]), dot(d2, faceUp[face]));
+                if (all(lessThan(f, x)) || all(lessThan(f, -x)) || all(lessThan(f, y)) || all(lessThan(f, -y)) ||
+                    all(greaterThan(f, vec3(far))))
+                    continue;
+            }
+            for (int i = 0; i < 3; i++)
+            {
+                if (clearFaces)
+                {
+                    gl_Position = gl_in[i].gl_Position;
+                }
+                else
+                {
+                    vec3 d = vWorldPos[i] - center;
+                    float w = dot(d, faceForward[face]);
+                    gl_Position = vec4(dot(d, faceRight[face]), dot(d, faceUp[face]),
+                                       (w * (far + near) - 2.0 * far * near) / (far - near), w);
+                }
+                gWorldPos = vWorldPos[i];
+                gUpdate = u;
+                gl_Layer = updateLayers[u] + face;
+                EmitVertex();
+            }
+            EndPrimitive();
+        }
+    }
+}
+
+-- Fragment
+
+uniform vec4 updateSpheres[4];
+uniform bool clearFaces;
+
+in vec3 gWorldPos;
+flat in int gUpdate;
+
+void main()
+{
+    // distance to the light over its radius, the cleared faces are as far as the light reaches
+    vec4 sphere = updateSpheres[gUpdate];
+    gl_FragDepth = clearFaces ? 1.0 : length(gWorldPos - sphere.xyz) / sphere.w;
+}
+
+-- Sample
+
+// include pointShadow.Faces first, includes don't nest
+
+// tier * 256 + slot of every light, -1 for the unshadowed ones (point_shadows.h)
+uniform isamplerBuffer lightShadowSlots;
+uniform bool enablePointShadows;
+uniform sampler2DArray pointShadowTier0;
+uniform sampler2DArray pointShadowTier1;
+uniform sampler2DArray pointShadowTier2;
+
+float pointShadowDepth(int tier, vec3 coord)
+{
+    if (tier == 0)
+        return textureLod(pointShadowTier0, coord, 0.0).r;
+    if (tier == 1)
+        return textureLod(pointShadowTier1, coord, 0.0).r;
+    return textureLod(pointShadowTier2, coord, 0.0).r;
+}
+
+// 1 where a light of the buffers reaches lightToFrag unblocked, 0 in its shadow
+float pointShadow(int light, vec3 lightToFrag, float radius)
+{
+    if (!enablePointShadows)
+        return 1.0;
+    int slot = texelFetch(lightShadowSlots, light).r;
+    if (slot < 0)
+        return 1.0;
+    int tier = slot / 256;
+    slot -= tier * 256;
+
+    // the face along the major axis of the direction
+    vec3 a = abs(lightToFrag);
+    int face = a.x >= a.y && a.x >= a.z ? (lightToFrag.x > 0.0 ? 0 : 1) :
+               a.y >= a.z ? (lightToFrag.y > 0.0 ? 2 : 3) : (lightToFrag.z > 0.0 ? 4 : 5);
+    vec2 uv = vec2(dot(lightToFrag, faceRight[face]), dot(lightToFrag, faceUp[face])) /
+              dot(lightToFrag, faceForward[face]) * 0.5 + 0.5;
+    float layer = float(slot * 6 + face);
+
+    // a texel spans about 2 * distance / size world units, the bias covers a couple of them
+    float size = float(tier == 0 ? textureSize(pointShadowTier0, 0).x :
+                       tier == 1 ? textureSize(pointShadowTier1, 0).x : textureSize(pointShadowTier2, 0).x);
+    float dist = length(lightToFrag);
+    float depth = (dist - 4.0 * dist / size - 0.02) / radius;
+
+    float texel = 1.0 / size;
+    float lit = 0.0;
+    lit += step(depth, pointShadowDepth(tier, vec3(uv + vec2(-0.5, -0.5) * texel, layer)));
+    lit += step(depth, pointShadowDepth(tier, vec3(uv + vec2(0.5, -0.5) * texel, layer)));
+    lit += step(depth, pointShadowDepth(tier, vec3(uv + vec2(-0.5, 0.5) * texel, layer)));
+    lit += step(depth, pointShadowDepth(tier, vec3(uv + vec2(0.5, 0.5) * texel, layer)));
+    return lit * 0.25;
+}
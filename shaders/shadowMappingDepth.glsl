@@ -1,14 +1,15 @@
 
 -- Vertex
 
+#include "drawBatch.Object"
+
 layout (location = 0) in vec3 aPos;
 
 uniform mat4 lightSpaceMatrix;
-uniform mat4 model;
 
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+    gl_Position = lightSpaceMatrix * objectTransform() * vec4(aPos, 1.0);
 }
 
 -- Fragment
@@ -10,6 +10,19 @@
 #include "shader_s.h"
 #include "arcball_camera.h"
 #include "framebuffer.h"
+#include "render_graph.h"
+#include "light_clusters.h"
+#include "gpu_counter.h"
+#include "frame_reuse.h"
+#include "light_bvh.h"
+#include "light_proxies.h"
+#include "light_system.h"
+#include "point_shadows.h"
+#include "scene_bvh.h"
+#include "shadow_cascades.h"
+#include "shadow_caster_tracker.h"
+#include "texture_cache.h"
+#include "mapped_file.h"
 
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_glfw.h"
@@ -36,6 +49,12 @@ using namespace gl;
 #endif
 
 #include <iostream>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <sstream>
+#include <random>
+#include <chrono>
 #include <experimental/filesystem>
 namespace fs = std::experimental::filesystem;
 
@@ -48,6 +67,13 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
 unsigned int loadTexture(const char *path, bool gammaCorrection);
 void renderQuad();
+std::string shaderSource(const char* key);
+void benchmarkModelLoading(const std::vector<std::string>& modelPaths, int iterations);
+void benchmarkObjParsing(const std::vector<std::string>& modelPaths, int iterations);
+bool verifyParallelLoading(const std::vector<std::string>& modelPaths);
+bool verifyTextureCompression(const std::vector<std::string>& imagePaths);
+void benchmarkLightClusters(const std::vector<size_t>& lightCounts, int iterations);
+void benchmarkLightSystem(size_t lightCount, int iterations);
 
 
 // settings
@@ -57,6 +83,7 @@ const float MAX_CAMERA_DISTANCE = 200.0f;
 const unsigned int LIGHT_GRID_WIDTH = 10;  // point light grid size
 const unsigned int LIGHT_GRID_HEIGHT = 3;  // point light vertical grid height
 const float INITIAL_POINT_LIGHT_RADIUS = 0.663f;
+const double STREAMING_BUDGET_MS = 4.0;    // time per frame spent uploading streamed meshes
 
 #define M_PI       3.14159265358979323846   // pi
 
@@ -84,15 +111,45 @@ struct SceneLight {
 
 };
 
-// buffer for light instance data
-unsigned int matrixBuffer;
-unsigned int colorSizeBuffer;
+void configurePointLights(LightSystem& lights, float radius = 1.0f, float separation = 1.0f, float yOffset = 0.0f);
+void updatePointLights(LightSystem& lights, float separation, float yOffset, float radiusScale);
+void sceneBounds(const std::vector<Model*>& models, const std::vector<SceneBvh::Bounds>& objectBounds, glm::vec3& boundsMin, glm::vec3& boundsMax);
+uint64_t modelSignature(const Model& model);
+void placeInstances(std::vector<glm::vec3>& positions, std::vector<Model*>& models, Model* model, size_t count);
 
-void configurePointLights(std::vector<glm::mat4>& modelMatrices, std::vector<glm::vec4>& modelColorSizes, float radius = 1.0f, float separation = 1.0f, float yOffset = 0.0f);
-void updatePointLights(std::vector<glm::mat4>& modelMatrices, std::vector<glm::vec4>& modelColorSizes, float separation, float yOffset, float radiusScale);
-
-int main()
+int main(int argc, char** argv)
 {
+    std::chrono::high_resolution_clock::time_point startupTime = std::chrono::high_resolution_clock::now();
+
+    // texture check: compress, cache and software decode the given images (wood.png by default) and
+    // compare them with the source, runs without a window or GL context
+    if (argc > 1 && strcmp(argv[1], "--verify-textures") == 0)
+    {
+        std::vector<std::string> images(argv + 2, argv + argc);
+        if (images.empty())
+            images.push_back(PATH + "/OpenGL/images/wood.png");
+        // the cache holds images the way the app decodes them
+        stbi_set_flip_vertically_on_load(true);
+        return verifyTextureCompression(images) ? 0 : 1;
+    }
+
+    // clustering benchmark: time the CPU light assignment for growing numbers of random lights, no GL context either
+    if (argc > 1 && strcmp(argv[1], "--benchmark-clusters") == 0)
+    {
+        std::vector<size_t> lightCounts = { 300, 10000, 100000 };
+        if (argc > 2)
+            lightCounts.assign(1, size_t(atoi(argv[2])));
+        benchmarkLightClusters(lightCounts, 20);
+        return 0;
+    }
+
+    // light system benchmark: time the per-frame animation and culling of a million (or the given number of) lights
+    if (argc > 1 && strcmp(argv[1], "--benchmark-lights") == 0)
+    {
+        benchmarkLightSystem(argc > 2 ? size_t(atoi(argv[2])) : 1000000, 20);
+        return 0;
+    }
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
@@ -100,6 +157,9 @@ int main()
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    // the point light volumes are stencil masked against the g-buffer depth blitted into the default framebuffer
+    glfwWindowHint(GLFW_DEPTH_BITS, 24);
+    glfwWindowHint(GLFW_STENCIL_BITS, 8);
 
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
@@ -131,6 +191,37 @@ int main()
     // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
     stbi_set_flip_vertically_on_load(true);
 
+    // startup benchmark: compare cold imports against warm mesh cache loads and exit
+    // parse benchmark: OBJ parsing throughput of ASSIMP against the native OBJ loader and exit
+    // load check: make sure the parallel loader produces the same meshes as a serial load and exit
+    if (argc > 1 && (strcmp(argv[1], "--benchmark-load") == 0 || strcmp(argv[1], "--benchmark-obj") == 0 ||
+        strcmp(argv[1], "--verify-load") == 0))
+    {
+        std::vector<std::string> benchmarkModels = {
+            PATH + "/OpenGL/models/Lucy.obj",
+            PATH + "/OpenGL/models/Dragon.obj",
+            PATH + "/OpenGL/models/Bunny.obj",
+            PATH + "/OpenGL/models/Sphere.obj"
+        };
+        int result = 0;
+        if (strcmp(argv[1], "--benchmark-load") == 0)
+            benchmarkModelLoading(benchmarkModels, argc > 2 ? atoi(argv[2]) : 3);
+        else if (strcmp(argv[1], "--benchmark-obj") == 0)
+            benchmarkObjParsing(benchmarkModels, argc > 2 ? atoi(argv[2]) : 3);
+        else
+            result = verifyParallelLoading(benchmarkModels) ? 0 : 1;
+        glfwTerminate();
+        return result;
+    }
+
+    // --keep-geometry keeps the CPU copy of the scene's vertices and indices after the upload, to compare memory use
+    CpuGeometry sceneCpuGeometry = CpuGeometry::Release;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--keep-geometry") == 0)
+            sceneCpuGeometry = CpuGeometry::Keep;
+    }
+
     // Setup Dear ImGui context
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -150,24 +241,30 @@ int main()
     glswInit();
     glswSetPath("OpenGL/shaders/", ".glsl");
     glswAddDirectiveToken("", "#version 330 core");
+    // shaders share code through #include "effect.section" lines, e.g. the G-buffer decoding
 
     // Shader for writing into a depth texture
-    Shader shaderDepthWrite(glswGetShader("shadowMappingDepth.Vertex"), glswGetShader("shadowMappingDepth.Fragment"));
+    Shader shaderDepthWrite(shaderSource("shadowMappingDepth.Vertex").c_str(), shaderSource("shadowMappingDepth.Fragment").c_str());
     // Shader for visualiazing the depth texture
-    Shader shaderDebugDepthMap(glswGetShader("debugQuad.Vertex"), glswGetShader("debugQuad.Fragment"));
+    Shader shaderDebugDepthMap(shaderSource("debugQuad.Vertex").c_str(), shaderSource("debugQuad.Fragment").c_str());
     // G-Buffer pass shader for models w/o textures and just Kd, Ks, etc colors 
-    Shader shaderGeometryPass(glswGetShader("gBuffer.Vertex"), glswGetShader("gBuffer.Fragment"));
+    Shader shaderGeometryPass(shaderSource("gBuffer.Vertex").c_str(), shaderSource("gBuffer.Fragment").c_str());
     // G-Buffer pass shader for the models with textures (diffuse, specular, etc)
-    Shader shaderTexturedGeometryPass(glswGetShader("gBufferTextured.Vertex"), glswGetShader("gBufferTextured.Fragment"));
+    Shader shaderTexturedGeometryPass(shaderSource("gBufferTextured.Vertex").c_str(), shaderSource("gBufferTextured.Fragment").c_str());
     // First pass of deferred shader that will render the scene with a global light and shadow mapping
-    Shader shaderLightingPass(glswGetShader("deferredShading.Vertex"), glswGetShader("deferredShading.Fragment"));
+    Shader shaderLightingPass(shaderSource("deferredShading.Vertex").c_str(), shaderSource("deferredShading.Fragment").c_str());
     // Shader for debugging the G-Buffer contents
-    Shader shaderGBufferDebug(glswGetShader("gBufferDebug.Vertex"), glswGetShader("gBufferDebug.Fragment"));
+    Shader shaderGBufferDebug(shaderSource("gBufferDebug.Vertex").c_str(), shaderSource("gBufferDebug.Fragment").c_str());
     // Shader to render the light geometry for visualization and debugging
-    Shader shaderGlobalLightSphere(glswGetShader("deferredLight.Vertex"), glswGetShader("deferredLight.Fragment"));
-    Shader shaderLightSphere(glswGetShader("deferredLightInstanced.Vertex"), glswGetShader("deferredLightInstanced.Fragment"));
+    Shader shaderGlobalLightSphere(shaderSource("deferredLight.Vertex").c_str(), shaderSource("deferredLight.Fragment").c_str());
+    Shader shaderLightSphere(shaderSource("deferredLightInstanced.Vertex").c_str(), shaderSource("deferredLightInstanced.Fragment").c_str());
     // Shader for a final composite rendering of point(area) lights with generated G-Buffer
-    Shader shaderPointLightingPass(glswGetShader("deferredPointLightInstanced.Vertex"), glswGetShader("deferredPointLightInstanced.Fragment"));
+    Shader shaderPointLightingPass(shaderSource("deferredPointLightInstanced.Vertex").c_str(), shaderSource("deferredPointLightInstanced.Fragment").c_str());
+    // Shader drawing the casters into the cube faces of the point lights whose shadow maps are updated
+    Shader shaderPointShadow(shaderSource("pointShadow.Vertex").c_str(), shaderSource("pointShadow.Fragment").c_str(),
+        shaderSource("pointShadow.Geometry").c_str());
+    // Shader shading every pixel with the point lights of its cluster in one full-screen pass
+    Shader shaderClusteredLightingPass(shaderSource("deferredClustered.Vertex").c_str(), shaderSource("deferredClustered.Fragment").c_str());
 
     // set up vertex data (and buffer(s)) and configure vertex attributes
     // ------------------------------------------------------------------
@@ -208,11 +305,24 @@ int main()
     //std::string ajaxPath = PATH + "/OpenGL/models/Ajax.obj";
     std::string lucyPath = PATH + "/OpenGL/models/Lucy.obj";
     //std::string modelPath = PATH + "/OpenGL/models/Aphrodite.obj";
-    Model meshModelA(lucyPath);
-    //Model meshModelB(dragonPath);
-   // Model meshModelC(bunnyPath);
     std::string spherePath = PATH + "/OpenGL/models/Sphere.obj";
-    Model lightModel(spherePath);
+    Model meshModelA;
+    //Model meshModelB;
+   // Model meshModelC;
+    // the sphere marking the global light, it's small enough to load right away
+    Model lightModel(spherePath, false, VertexLayout::compact(VERTEX_POSITION | VERTEX_NORMAL), sceneCpuGeometry);
+    // scene models are imported in parallel on the worker threads while the render loop runs, every frame
+    // uploads some of the finished meshes and draws what's resident. Coarse previews come first.
+    // the geometry and shadow passes only read positions and normals
+    VertexLayout sceneLayout = VertexLayout::compact(VERTEX_POSITION | VERTEX_NORMAL);
+    ModelLoader sceneLoader;
+    sceneLoader.setPreviews(true);
+    sceneLoader.load(meshModelA, lucyPath, false, sceneLayout, sceneCpuGeometry);
+    //sceneLoader.load(meshModelB, dragonPath, false, sceneLayout, sceneCpuGeometry);
+    //sceneLoader.load(meshModelC, bunnyPath, false, sceneLayout, sceneCpuGeometry);
+    // startup metrics in milliseconds since main() was entered, negative until reached
+    double timeToFirstFrame = -1.0;
+    double timeToFullDetail = -1.0;
     std::vector<glm::vec3> objectPositions;
     objectPositions.push_back(glm::vec3(0.0, 1.0, 0.0));
    /* objectPositions.push_back(glm::vec3(2.5, 1.0, -0.5));
@@ -223,46 +333,41 @@ int main()
    // meshModels.push_back(&meshModelB);
     //meshModels.push_back(&meshModelC);
 
-    // configure depth map framebuffer for shadow generation
-    // -----------------------
-    const unsigned int SHADOW_WIDTH = 2048, SHADOW_HEIGHT = 2048;
-    unsigned int depthMapFBO;
-    glGenFramebuffers(1, &depthMapFBO);
-    // create depth texture
-    unsigned int depthMap;
-    glGenTextures(1, &depthMap);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-    // attach depth texture as FBO's depth buffer
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    // configure g-buffer framebuffer
-    // ------------------------------
-    FrameBuffer gBuffer(SCR_WIDTH, SCR_HEIGHT);
-    gBuffer.attachTexture(GL_RGB16F, GL_NEAREST); // Position color buffer
-    gBuffer.attachTexture(GL_RGB16F, GL_NEAREST); // Normal color buffer
-    gBuffer.attachTexture(GL_RGB, GL_NEAREST);    // Diffuse (Kd)
-    gBuffer.attachTexture(GL_RGBA, GL_NEAREST);   // Specular (Ks)
-    gBuffer.bindOutput();                         // calls glDrawBuffers[i] for all attached textures
-    gBuffer.attachRender(GL_DEPTH_COMPONENT);     // attach Depth render buffer
-    gBuffer.check();
-    FrameBuffer::unbind();                        // unbind framebuffer for now
+    // render targets
+    // --------------
+    // the g-buffer textures are transient textures of the render graph, declared again every frame. The graph only
+    // allocates what the enabled passes use and shares textures between passes that don't overlap.
+    // 16 bytes per pixel: the lighting reconstructs positions from the sampled depth (gBufferPacking.glsl), normals
+    // are octahedral encoded. RG16 instead of RG16_SNORM, signed normalized formats aren't color-renderable in GL 3.3
+    const RenderTextureDesc gNormalDesc = { SCR_WIDTH, SCR_HEIGHT, GL_RG16, GL_NEAREST, GL_CLAMP_TO_EDGE, 0 };
+    const RenderTextureDesc gDiffuseDesc = { SCR_WIDTH, SCR_HEIGHT, GL_RGBA8, GL_NEAREST, GL_CLAMP_TO_EDGE, 0 };
+    const RenderTextureDesc gSpecularDesc = { SCR_WIDTH, SCR_HEIGHT, GL_RGBA8, GL_NEAREST, GL_CLAMP_TO_EDGE, 0 };
+    // same format as the default framebuffer's depth, the point light pass blits it for the stencil mask
+    const RenderTextureDesc gDepthDesc = { SCR_WIDTH, SCR_HEIGHT, GL_DEPTH24_STENCIL8, GL_NEAREST, GL_CLAMP_TO_EDGE, 0 };
+    RenderGraph renderGraph;
+    // the global light's shadow, cascades fitted to the view frustum in one texture array imported into the graph
+    ShadowCascades shadowCascades;
+    // what the shadow casters looked like, the static ones' shadow maps are kept while they don't change
+    ShadowCasterTracker shadowCasters;
+    std::vector<bool> casterDynamic;    // the floor, then the models
+    // point lights sorted into view space clusters for the clustered lighting pass
+    LightClusters lightClusters;
+    lightClusters.setView(SCR_WIDTH, SCR_HEIGHT, glm::radians(45.0f), 0.1f, 150.0f);
 
     // lighting info
     // -------------
-    // instance array data for our light volumes
-    std::vector<glm::mat4> modelMatrices;
-    std::vector<glm::vec4> modelColorSizes;
+    // point lights, also the instance data of the light volumes
+    LightSystem pointLights;
+    // and the hierarchy over their spheres that frustum culls them
+    LightBvh lightBvh;
+    // proxy meshes the light volumes are drawn with, chosen by size on screen
+    LightProxies lightProxies;
+    lightProxies.setView(SCR_HEIGHT, glm::radians(45.0f), 0.1f);
+    // hierarchy over the world bounds of the models, culls them for the camera and the shadows
+    SceneBvh sceneBvh;
+    // cube shadow maps of the point lights that matter most on screen, a few of them redrawn per frame
+    PointShadows pointShadows;
+    pointShadows.setView(SCR_HEIGHT, glm::radians(45.0f), 0.1f);
 
     // single global light
     SceneLight globalLight(glm::vec3(-2.5f, 5.0f, -1.25f), glm::vec3(1.0f, 1.0f, 1.0f), 0.125f);
@@ -271,8 +376,20 @@ int main()
     int gBufferMode = 0;
     bool enableShadows = true;
     bool drawPointLights = false;
+    int pointLightMode = 0;         // 0 light volumes, 1 clustered
+    bool pointLightShadows = true;
+    int shadowedPointLights = (int)pointShadows.maxLights();
+    bool stencilLightVolumes = true;
+    bool animatePointLights = false;
+    bool cullPointLights = true;
     bool showDepthMap = false;
+    int shownCascade = 0;
+    int cascadeCount = SHADOW_MAX_CASCADES;
+    float shadowDistance = 30.0f;
+    float cascadeSplitLambda = 0.75f;
     bool drawPointLightsWireframe = true;
+    bool reuseStaticFrames = true;
+    bool waitForEvents = false;     // block in glfwWaitEvents() while idle instead of polling
     glm::vec3 diffuseColor = glm::vec3(0.847f, 0.52f, 0.19f);
     glm::vec4 specularColor = glm::vec4(1.0f, 1.0f, 1.0f, 0.8f);
     float glossiness = 16.0f;
@@ -282,55 +399,28 @@ int main()
     float pointLightRadius = INITIAL_POINT_LIGHT_RADIUS;
     float pointLightVerticalOffset = 0.636f;
     float pointLightSeparation = 0.670f;
+    int modelInstances = 1;         // copies of the first model, laid out around it
+    bool instancedDraws = true;
+    float cameraLodError = 1.0f;    // pixels
+    float shadowLodError = 4.0f;    // shadow map texels, the shadow pass tolerates coarser meshes
+    bool cullClusters = true;
+    bool cullObjects = true;
+    size_t geometryTriangles = 0;
+    size_t shadowTriangles = 0;
+    size_t shadowDrawCalls = 0;
+    size_t shadowInstances = 0;     // objects the shadow passes drew instanced
+    size_t cameraObjects = 0;       // objects drawn by the geometry pass
+    size_t casterObjects = 0;       // and by the shadow passes, over all cascades and lights
+    size_t objectNodesVisited = 0;
 
-    const int totalLights = LIGHT_GRID_WIDTH * LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT;
     // initialize point lights
-    configurePointLights(modelMatrices, modelColorSizes, pointLightRadius, pointLightSeparation, pointLightVerticalOffset);
-    
-    // configure instanced array of model transform matrices
-    // -------------------------
-    glGenBuffers(1, &matrixBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, matrixBuffer);
-    glBufferData(GL_ARRAY_BUFFER, totalLights * sizeof(glm::mat4), &modelMatrices[0], GL_STATIC_DRAW);
-
-    // light model has only one mesh
-    unsigned int VAO = lightModel.meshes[0].VAO;
-    glBindVertexArray(VAO);
-
-    // set attribute pointers for matrix (4 times vec4)
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)0);
-    glEnableVertexAttribArray(4);
-    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4)));
-    glEnableVertexAttribArray(5);
-    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(2 * sizeof(glm::vec4)));
-    glEnableVertexAttribArray(6);
-    glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(3 * sizeof(glm::vec4)));
-
-    glVertexAttribDivisor(3, 1);
-    glVertexAttribDivisor(4, 1);
-    glVertexAttribDivisor(5, 1);
-    glVertexAttribDivisor(6, 1);
-
-    // configure instanced array of light colors
-    // -------------------------
-    unsigned int colorSizeBuffer;
-    glGenBuffers(1, &colorSizeBuffer);
-   
-    glBindVertexArray(VAO);
-    // set attribute pointers for light color + radius (vec4)
-    glEnableVertexAttribArray(2);
-    glBindBuffer(GL_ARRAY_BUFFER, colorSizeBuffer);
-    glBufferData(GL_ARRAY_BUFFER, totalLights * sizeof(glm::vec4), &modelColorSizes[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
-    glVertexAttribDivisor(2, 1);
+    configurePointLights(pointLights, pointLightRadius, pointLightSeparation, pointLightVerticalOffset);
 
-    glBindVertexArray(0);
     
     // shader configuration
     // --------------------
     shaderLightingPass.use();
-    shaderLightingPass.setUniformInt("gPosition", 0);
+    shaderLightingPass.setUniformInt("gDepth", 0);
     shaderLightingPass.setUniformInt("gNormal", 1);
     shaderLightingPass.setUniformInt("gDiffuse", 2);
     shaderLightingPass.setUniformInt("gSpecular", 3);
@@ -338,15 +428,22 @@ int main()
 
     // deferred point lighting shader
     shaderPointLightingPass.use();
-    shaderPointLightingPass.setUniformInt("gPosition", 0);
+    shaderPointLightingPass.setUniformInt("gDepth", 0);
     shaderPointLightingPass.setUniformInt("gNormal", 1);
     shaderPointLightingPass.setUniformInt("gDiffuse", 2);
     shaderPointLightingPass.setUniformInt("gSpecular", 3);
     shaderPointLightingPass.setUniformVec2f("screenSize", SCR_WIDTH, SCR_HEIGHT);
 
+    // clustered point lighting shader
+    shaderClusteredLightingPass.use();
+    shaderClusteredLightingPass.setUniformInt("gDepth", 0);
+    shaderClusteredLightingPass.setUniformInt("gNormal", 1);
+    shaderClusteredLightingPass.setUniformInt("gDiffuse", 2);
+    shaderClusteredLightingPass.setUniformInt("gSpecular", 3);
+
     // G-Buffer debug shader
     shaderGBufferDebug.use();
-    shaderGBufferDebug.setUniformInt("gPosition", 0);
+    shaderGBufferDebug.setUniformInt("gDepth", 0);
     shaderGBufferDebug.setUniformInt("gNormal", 1);
     shaderGBufferDebug.setUniformInt("gDiffuse", 2);
     shaderGBufferDebug.setUniformInt("gSpecular", 3);
@@ -357,6 +454,18 @@ int main()
     shaderDebugDepthMap.setUniformInt("depthMap", 0);
 
 
+    // per pass draw lists, copies of a model drawing the same level go out instanced
+    DrawBatch shadowBatch, geometryBatch;
+    // levels of detail each object last had in the camera and the shadow views, indexed like the objects. Every
+    // cascade is a view of its own, sharing one state would move the levels back and forth between them each frame.
+    std::vector<LodState> cameraLods;
+    std::vector<LodState> cascadeLods[SHADOW_MAX_CASCADES];
+    std::vector<LodState> pointShadowLods[POINT_SHADOW_TIERS];
+    // fragments the point light shaders ran for
+    GpuCounter lightFragments(GL_SAMPLES_PASSED);
+    // the last lit frame, presented again while the camera and the scene stay put
+    FrameReuse frameReuse(SCR_WIDTH, SCR_HEIGHT);
+
     // render loop
     // -----------
     while (!glfwWindowShouldClose(window))
@@ -371,215 +480,20 @@ int main()
         // -----
         processInput(window);
 
-        // render
-        // ------
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glEnable(GL_DEPTH_TEST);
-
-        // 1. render depth of scene to texture (from light's perspective)
-        // --------------------------------------------------------------
-        glm::mat4 lightProjection, lightView;
-        glm::mat4 lightSpaceMatrix;
-        glm::mat4 model = glm::mat4(1.0f);
-        float zNear = 1.0f, zFar = 10.0f;
-
-        if (enableShadows) {
-            lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, zNear, zFar);
-            lightView = glm::lookAt(globalLight.position, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
-            lightSpaceMatrix = lightProjection * lightView;
-            // render scene from light's point of view
-            shaderDepthWrite.use();
-            shaderDepthWrite.setUniformMat4("lightSpaceMatrix", lightSpaceMatrix);
-            shaderDepthWrite.setUniformMat4("model", model);
-
-            glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-            glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-            glClear(GL_DEPTH_BUFFER_BIT);
-            // render the textured floor
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, woodTexture);
-            glBindVertexArray(planeVAO);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
-
-            for (unsigned int i = 0; i < objectPositions.size(); i++)
-            {
-                model = glm::mat4(1.0f);
-                model = glm::translate(model, objectPositions[i]);
-                model = glm::scale(model, glm::vec3(1.0f));
-                shaderDepthWrite.setUniformMat4("model", model);
-                meshModels[i]->draw(shaderDepthWrite);
-            }
-            FrameBuffer::unbind();
-        }
-        else {
-            // just clear the depth texture if shadows aren't being generated
-            glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-            glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-            glClear(GL_DEPTH_BUFFER_BIT);
-        }
-        
-        // 2. geometry pass: render scene's geometry/color data into gbuffer
-        // -----------------------------------------------------------------
-        // reset viewport
-        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-        gBuffer.bindOutput();
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 150.0f);
-        glm::mat4 view = arcballCamera.transform();
-        model = glm::mat4(1.0f);
-        shaderTexturedGeometryPass.use();
-        shaderTexturedGeometryPass.setUniformMat4("projection", projection);
-        shaderTexturedGeometryPass.setUniformMat4("view", view);
-        shaderTexturedGeometryPass.setUniformMat4("model", model);
-        glm::vec4 floorSpecular = glm::vec4(0.5f, 0.5f, 0.5f, 0.8f);
-        shaderTexturedGeometryPass.setUniformVec4f("specularCol", floorSpecular);
-        // render the textured floor
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, woodTexture);
-        glBindVertexArray(planeVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-
-        // render non-textured models
-        shaderGeometryPass.use();
-        shaderGeometryPass.setUniformMat4("projection", projection);
-        shaderGeometryPass.setUniformMat4("view", view);
-        shaderGeometryPass.setUniformMat4("model", model);
-        shaderGeometryPass.setUniformVec3f("diffuseCol", diffuseColor);
-        glm::vec4 specular = glm::vec4(1.0f, 1.0f, 1.0f, 0.1f);
-        glm::vec4 spec = glm::vec4(1.0f, 1.0f, 1.0f, 0.1f);
-        shaderGeometryPass.setUniformVec4f("specularCol", specularColor);
-        for (unsigned int i = 0; i < objectPositions.size(); i++)
-        {
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, objectPositions[i]);
-            model = glm::scale(model, glm::vec3(1.0f));
-            shaderGeometryPass.setUniformMat4("model", model);
-            meshModels[i]->draw(shaderGeometryPass);
-        }
-        FrameBuffer::unbind();
-
-        // 3. lighting pass: calculate lighting by iterating over a screen filled quad pixel-by-pixel using the gbuffer's content and shadow map
-        // -----------------------------------------------------------------------------------------------------------------------
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        if (gBufferMode == 0)
+        // upload the textures and meshes that finished loading since the last frame
+        TextureLoader::shared().update();
+        sceneLoader.update(STREAMING_BUDGET_MS);
+        if (timeToFullDetail < 0.0 && sceneLoader.idle() && TextureLoader::shared().pending() == 0)
         {
-            shaderLightingPass.use();
-            // bind all of our input textures
-            gBuffer.bindInput();
-
-            // bind depth texture
-            glActiveTexture(GL_TEXTURE4);
-            glBindTexture(GL_TEXTURE_2D, depthMap);
-
-            shaderLightingPass.setUniformVec3f("gLight.Position", globalLight.position);
-            shaderLightingPass.setUniformVec3f("gLight.Color", globalLight.color);
-            shaderLightingPass.setUniformFloat("gLight.Linear", gLinearAttenuation);
-            shaderLightingPass.setUniformFloat("gLight.Quadratic", gQuadraticAttenuation);
-
-            glm::vec3 camPosition = arcballCamera.eye();
-            shaderLightingPass.setUniformVec3f("viewPos", camPosition);
-            shaderLightingPass.setUniformMat4("lightSpaceMatrix", lightSpaceMatrix);
-            shaderLightingPass.setUniformFloat("glossiness", glossiness);
-        }
-        else // for G-Buffer debuging 
-        {
-            shaderGBufferDebug.use();
-            shaderGBufferDebug.setUniformInt("gBufferMode", gBufferMode);
-            // bind all of our input textures
-            gBuffer.bindInput();
-        }
-        
-        // finally render quad
-        renderQuad();
-
-        static bool colorSizeBufferDirty = false;
-
-        // 3.5 lighting pass: render point lights on top of main scene with additive blending and utilizing G-Buffer for lighting.
-        // -----------------------------------------------------------------------------------------------------------------------
-        if (gBufferMode == 0) {
-            shaderPointLightingPass.use();
-            gBuffer.bindInput();
-            shaderPointLightingPass.setUniformMat4("projection", projection);
-            shaderPointLightingPass.setUniformMat4("view", view);
-
-            glEnable(GL_CULL_FACE);
-            // only render the back faces of the light volume spheres
-            glFrontFace(GL_CW);
-            glDisable(GL_DEPTH_TEST);
-            // enable additive blending
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_ONE, GL_ONE);
-            glm::vec3 camPosition = arcballCamera.eye();
-            shaderPointLightingPass.setUniformVec3f("viewPos", camPosition);
-            shaderPointLightingPass.setUniformFloat("lightIntensity", pointLightIntensity);
-            shaderPointLightingPass.setUniformFloat("glossiness", glossiness);
-            glBindVertexArray(lightModel.meshes[0].VAO);
-            // don't update the color and size buffer every frame
-            if (colorSizeBufferDirty) {
-                glBindBuffer(GL_ARRAY_BUFFER, colorSizeBuffer);
-                glBufferData(GL_ARRAY_BUFFER, LIGHT_GRID_WIDTH * LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT * sizeof(glm::vec4), &modelColorSizes[0], GL_STATIC_DRAW);
-            }
-            glDrawElementsInstanced(GL_TRIANGLES, lightModel.meshes[0].indices.size(), GL_UNSIGNED_INT, 0, totalLights);
-            glBindVertexArray(0);
-
-            glDisable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-            glFrontFace(GL_CCW);
-            glDisable(GL_CULL_FACE);
-        }
-
-        // strictly used for debugging point light volumes (sizes, positions, etc)
-        if (drawPointLights && gBufferMode == 0) {
-            // re-enable the depth testing 
-            glEnable(GL_DEPTH_TEST);
-            // copy content of geometry's depth buffer to default framebuffer's depth buffer
-            // ----------------------------------------------------------------------------------
-            gBuffer.bindRead();
-            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // write to default framebuffer
-            // blit to default framebuffer. 
-            glBlitFramebuffer(0, 0, SCR_WIDTH, SCR_HEIGHT, 0, 0, SCR_WIDTH, SCR_HEIGHT, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-            // unbind framebuffer for now
-            FrameBuffer::unbind();
-
-            // render lights on top of scene with Z-testing
-            // --------------------------------
-            shaderLightSphere.use();
-            shaderLightSphere.setUniformMat4("projection", projection);
-            shaderLightSphere.setUniformMat4("view", view);
-
-            glPolygonMode(GL_FRONT_AND_BACK, drawPointLightsWireframe ? GL_LINE : GL_FILL);
-            glBindVertexArray(lightModel.meshes[0].VAO);
-            glDrawElementsInstanced(GL_TRIANGLES, lightModel.meshes[0].indices.size(), GL_UNSIGNED_INT, 0, totalLights);
-            glBindVertexArray(0);
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-            shaderGlobalLightSphere.use();
-            shaderGlobalLightSphere.setUniformMat4("projection", projection);
-            shaderGlobalLightSphere.setUniformMat4("view", view);
-            // render the global light model
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, globalLight.position);
-            shaderGlobalLightSphere.setUniformMat4("model", model);
-            shaderGlobalLightSphere.setUniformVec3f("lightColor", globalLight.color);
-            shaderGlobalLightSphere.setUniformFloat("lightRadius", globalLight.radius);
-            lightModel.draw(shaderGlobalLightSphere);
-        }
-
-        if (showDepthMap) {
-            // render Depth map to quad for visual debugging
-            // ---------------------------------------------
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, glm::vec3(0.7f, -0.7f, 0.0f));
-            model = glm::scale(model, glm::vec3(0.3f, 0.3f, 1.0f)); // Make it 30% of total screen size
-            shaderDebugDepthMap.use();
-            shaderDebugDepthMap.setUniformMat4("transform", model);
-            shaderDebugDepthMap.setUniformFloat("zNear", zNear);
-            shaderDebugDepthMap.setUniformFloat("zFar", zFar);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, depthMap);
-            renderQuad();
+            timeToFullDetail = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startupTime).count();
+            MemoryUsage loadedMemory = currentMemoryUsage();
+            std::cout << "Scene loaded" << (sceneCpuGeometry == CpuGeometry::Keep ? " keeping" : " releasing") << " CPU geometry, RSS "
+                << toMegabytes(loadedMemory.resident) << " MB, peak " << toMegabytes(loadedMemory.peakResident) << " MB" << std::endl;
+            std::cout << "Time to full detail: " << timeToFullDetail << " ms" << std::endl;
         }
 
+        // build the UI first, the frame below renders with its settings. The statistics it shows are the last frame's.
+        // ------------------------------------------------------------------------------------------------------------
         // Start the Dear ImGui frame
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
@@ -595,30 +509,50 @@ int main()
                 ImGui::ColorEdit3("Diffuse (Kd)", (float*)&diffuseColor);   // Edit 3 floats representing Kd color (r, g, b)
                 ImGui::ColorEdit4("Specular (Ks)", (float*)&specularColor); // Edit 4 floats representing Ks color (r, g, b, alpha)
                 ImGui::SliderFloat("Glossiness", &glossiness, 8.0, 128.0f);
+                ImGui::SliderFloat("LOD error (px)", &cameraLodError, 0.25f, 16.0f, "%.2f");
+                ImGui::SliderFloat("Shadow LOD error (texels)", &shadowLodError, 0.25f, 32.0f, "%.2f");
+                ImGui::Checkbox("Cluster culling", &cullClusters);
+                ImGui::SameLine(); ImGui::Checkbox("Object culling", &cullObjects);
+                if (ImGui::SliderInt("Instances", &modelInstances, 1, 10000))
+                    placeInstances(objectPositions, meshModels, &meshModelA, (size_t)modelInstances);
+                ImGui::SameLine(); ImGui::Checkbox("Instanced draws", &instancedDraws);
+                if (!objectPositions.empty())
+                    ImGui::DragFloat3("Position", &objectPositions[0].x, 0.01f);
             }
             if (ImGui::CollapsingHeader("Lighting Config")) {
                 if (ImGui::CollapsingHeader("Global Light")) {
+                    ImGui::DragFloat3("Light position", &globalLight.position.x, 0.01f);
                     ImGui::Text("Attenuation");
                     ImGui::SliderFloat("Linear", &gLinearAttenuation, 0.022f, 0.7f);
                     ImGui::SliderFloat("Quadratic", &gQuadraticAttenuation, 0.0019f, 1.8f);
                     ImGui::Checkbox("Enabled shadows", &enableShadows);
+                    ImGui::SliderInt("Cascades", &cascadeCount, 1, SHADOW_MAX_CASCADES);
+                    ImGui::SliderFloat("Shadow distance", &shadowDistance, 5.0f, 150.0f, "%.1f");
+                    ImGui::SliderFloat("Split lambda", &cascadeSplitLambda, 0.0f, 1.0f, "%.2f");
                 }
 
                 if (ImGui::CollapsingHeader("Point Lights")) {
+                    const char* pointLightModes[] = { "Light volumes", "Clustered" };
+                    ImGui::Combo("Shading", &pointLightMode, pointLightModes, IM_ARRAYSIZE(pointLightModes));
+                    if (pointLightMode == 0) {
+                        ImGui::Checkbox("Stencil masked volumes", &stencilLightVolumes);
+                        ImGui::Checkbox("Shadows", &pointLightShadows);
+                        if (pointLightShadows) {
+                            ImGui::SameLine(); ImGui::SliderInt("Shadowed lights", &shadowedPointLights, 1, 24);
+                        }
+                    }
                     ImGui::SliderFloat("Intensity", &pointLightIntensity, 0.0f, 3.0f, "%.3f");
                     if (ImGui::SliderFloat("Radius", &pointLightRadius, 0.3f, 2.5f, "%.3f")) {
-                        updatePointLights(modelMatrices, modelColorSizes, pointLightSeparation, pointLightVerticalOffset, pointLightRadius);
-                        colorSizeBufferDirty = true;
-                    }
-                    else {
-                        colorSizeBufferDirty = false;
+                        updatePointLights(pointLights, pointLightSeparation, pointLightVerticalOffset, pointLightRadius);
                     }
                     if (ImGui::SliderFloat("Separation", &pointLightSeparation, 0.4f, 1.5f, "%.3f")) {
-                        updatePointLights(modelMatrices, modelColorSizes, pointLightSeparation, pointLightVerticalOffset, pointLightRadius);
+                        updatePointLights(pointLights, pointLightSeparation, pointLightVerticalOffset, pointLightRadius);
                     }
                     if (ImGui::SliderFloat("Vertical Offset", &pointLightVerticalOffset, -2.0f, 3.0f)) {
-                        updatePointLights(modelMatrices, modelColorSizes, pointLightSeparation, pointLightVerticalOffset, pointLightRadius);
+                        updatePointLights(pointLights, pointLightSeparation, pointLightVerticalOffset, pointLightRadius);
                     }
+                    ImGui::Checkbox("Animate", &animatePointLights);
+                    ImGui::SameLine(); ImGui::Checkbox("Frustum culling", &cullPointLights);
                 } 
             }
             if (ImGui::CollapsingHeader("Debug")) {
@@ -628,26 +562,687 @@ int main()
                 ImGui::Checkbox("Point lights volumes", &drawPointLights);
                 ImGui::SameLine(); ImGui::Checkbox("Wireframe", &drawPointLightsWireframe);
                 ImGui::Checkbox("Show depth texture", &showDepthMap);
+                if (showDepthMap)
+                    ImGui::SliderInt("Cascade", &shownCascade, 0, cascadeCount - 1);
+                ImGui::Checkbox("Reuse static frames", &reuseStaticFrames);
+                if (reuseStaticFrames) {
+                    ImGui::SameLine(); ImGui::Checkbox("Wait for events", &waitForEvents);
+                }
             }
                                                                     
             //ImGui::ShowDemoWindow();
 
             ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
-            ImGui::Text("Point lights in scene: %i", LIGHT_GRID_WIDTH * LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT);
+            ImGui::Text("Point lights in scene: %u", (unsigned int)pointLights.size());
+            const LightSystem::Stats& lightStats = pointLights.stats();
+            const LightBvh::Stats& cullStats = lightBvh.stats();
+            ImGui::Text("Light update: %u lights in %.2f ms, %.1f KB uploaded", (unsigned int)lightStats.updatedLights,
+                lightStats.updateMilliseconds, lightStats.uploadedBytes / 1024.0);
+            if (cullPointLights) {
+                ImGui::Text("Light culling: %u visible, %u culled, %u nodes visited", (unsigned int)cullStats.visibleLights,
+                    (unsigned int)cullStats.culledLights, (unsigned int)cullStats.nodesVisited);
+                ImGui::Text("Light BVH: %u nodes, %s %u leaves in %.2f ms, cull %.2f ms", (unsigned int)lightBvh.nodeCount(),
+                    cullStats.rebuilt ? "built" : "refit", (unsigned int)cullStats.refitLeaves, cullStats.updateMilliseconds, cullStats.cullMilliseconds);
+            }
+            if (pointLightMode == 0 || drawPointLights) {
+                const LightProxies::Stats& proxyStats = lightProxies.stats();
+                ImGui::Text("Light proxies: %u quads, %u / %u / %u icospheres, %u triangles", (unsigned int)proxyStats.lights[LIGHT_PROXY_QUAD],
+                    (unsigned int)proxyStats.lights[LIGHT_PROXY_ICOSPHERE_0], (unsigned int)proxyStats.lights[LIGHT_PROXY_ICOSPHERE_1],
+                    (unsigned int)proxyStats.lights[LIGHT_PROXY_ICOSPHERE_2], (unsigned int)proxyStats.triangles);
+            }
+            if (pointLightMode == 0 && pointLightShadows) {
+                const PointShadows::Stats& pointShadowStats = pointShadows.stats();
+                ImGui::Text("Point shadows: %u lights, %u drawn, %u updated, %u waiting, select %.2f ms", (unsigned int)pointShadowStats.shadowed,
+                    (unsigned int)pointShadowStats.published, (unsigned int)pointShadowStats.updated, (unsigned int)pointShadowStats.waiting,
+                    pointShadowStats.selectMilliseconds);
+            }
+            MemoryUsage memory = currentMemoryUsage();
+            ImGui::Text("Memory: %.1f MB resident, %.1f MB peak", toMegabytes(memory.resident), toMegabytes(memory.peakResident));
+            ImGui::Text("Textures: %.1f MB (%.1f MB as RGBA8)", toMegabytes(TextureLoader::shared().uploadedBytes()),
+                toMegabytes(TextureLoader::shared().uncompressedBytes()));
+            if (cullObjects) {
+                const SceneBvh::Stats& objectStats = sceneBvh.stats();
+                ImGui::Text("Object culling: %u of %u drawn, %u shadow casters, %u nodes visited", (unsigned int)cameraObjects,
+                    (unsigned int)objectStats.objects, (unsigned int)casterObjects, (unsigned int)objectNodesVisited);
+                ImGui::Text("Scene BVH: %u nodes, %s %u objects in %.3f ms", (unsigned int)sceneBvh.nodeCount(),
+                    objectStats.rebuilt ? "built" : "refit", (unsigned int)objectStats.refitObjects, objectStats.updateMilliseconds);
+            }
+            ImGui::Text("Triangles submitted: %u geometry, %u shadow", (unsigned int)geometryTriangles, (unsigned int)shadowTriangles);
+            ImGui::Text("Draw calls: %u geometry, %u shadow", (unsigned int)geometryBatch.callCount(), (unsigned int)shadowDrawCalls);
+            if (instancedDraws) {
+                ImGui::Text("Instancing: %u geometry instances of %u objects in %u calls, %u shadow instances",
+                    (unsigned int)geometryBatch.instanceCount(), (unsigned int)cameraObjects, (unsigned int)geometryBatch.instancedCallCount(),
+                    (unsigned int)shadowInstances);
+            }
+            if (enableShadows) {
+                ImGui::Text("Shadow cascades: %d x %d^2, ending at", shadowCascades.count(), shadowCascades.size());
+                for (int i = 0; i < shadowCascades.count(); i++) {
+                    ImGui::SameLine(); ImGui::Text("%.1f (%.2f texels/unit)", shadowCascades.cascade(i).splitFar,
+                        shadowCascades.size() / shadowCascades.cascade(i).extent);
+                }
+                const ShadowCascades::Stats& cacheStats = shadowCascades.stats();
+                ImGui::Text("Shadow cache: %d cascades drawn, %d reused, %d with %u dynamic casters", cacheStats.staticDrawn,
+                    cacheStats.staticCached, cacheStats.composited, (unsigned int)shadowCasters.dynamicCount());
+            }
+            const FrameReuse::Stats& reuseStats = frameReuse.stats();
+            ImGui::Text("Frames: %u rendered, %u reused, %u idle in a row", (unsigned int)reuseStats.renderedFrames,
+                (unsigned int)reuseStats.reusedFrames, (unsigned int)reuseStats.idleFrames);
+            const RenderGraph::Stats& graphStats = renderGraph.stats();
+            ImGui::Text("Render graph: %u of %u passes, %u target binds", (unsigned int)graphStats.executedPasses,
+                (unsigned int)graphStats.declaredPasses, (unsigned int)graphStats.framebufferBinds);
+            ImGui::Text("Render targets: %.1f MB (%.1f MB unaliased)", toMegabytes(graphStats.transientBytes), toMegabytes(graphStats.unaliasedBytes));
+            ImGui::Text("Point light fragments shaded: %u", (unsigned int)lightFragments.value());
+            if (pointLightMode == 1) {
+                const LightClusters::Stats& clusterStats = lightClusters.stats();
+                ImGui::Text("Clusters: %u visible lights, %u list entries, %u max per cluster, %.2f ms", (unsigned int)clusterStats.visibleLights,
+                    (unsigned int)clusterStats.lightIndices, (unsigned int)clusterStats.maxLightsPerCluster, clusterStats.assignMilliseconds);
+            }
+            if (timeToFullDetail < 0.0)
+                ImGui::Text("Streaming: %u meshes at full detail", (unsigned int)sceneLoader.residentMeshes());
+            else
+                ImGui::Text("Startup: %.0f ms to first frame, %.0f ms to full detail", timeToFirstFrame, timeToFullDetail);
             ImGui::End();
 
         }
 
         // Rendering
         ImGui::Render();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        // render
+        // ------
+        // the frame is declared as a render graph: passes say what they read and write, the graph drops the ones
+        // nothing on screen depends on (the shadow pass with shadows off, the lighting in g-buffer debug views),
+        // binds their render targets and hands out the transient textures
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 150.0f);
+        glm::mat4 view = arcballCamera.transform();
+        glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+        // the global light shadows like a directional light shining at the origin
+        glm::vec3 lightDirection = glm::normalize(-globalLight.position);
+        geometryTriangles = 0;
+        shadowTriangles = 0;
+        shadowDrawCalls = 0;
+        shadowInstances = 0;
+        casterObjects = 0;
+        objectNodesVisited = 0;
+
+        renderGraph.reset();
+        RenderGraph::Resource backbuffer = renderGraph.backbuffer(SCR_WIDTH, SCR_HEIGHT);
+        RenderGraph::Resource shadowMap, gNormal, gDiffuse, gSpecular, gDepth;
+
+        std::vector<glm::mat4> objectTransforms(objectPositions.size());
+        for (unsigned int i = 0; i < objectPositions.size(); i++)
+        {
+            glm::mat4 model = glm::mat4(1.0f);
+            model = glm::translate(model, objectPositions[i]);
+            model = glm::scale(model, glm::vec3(1.0f));
+            objectTransforms[i] = model;
+        }
+        // materials of the geometry pass, the copies of a model are tinted apart
+        std::vector<DrawBatch::Material> objectMaterials(objectPositions.size());
+        for (unsigned int i = 0; i < objectPositions.size(); i++)
+        {
+            glm::vec3 tint = i == 0 ? glm::vec3(1.0f) : glm::vec3(0.75f) + 0.25f * glm::fract(glm::vec3(0.618f, 0.414f, 0.732f) * float(i));
+            objectMaterials[i] = DrawBatch::Material{ diffuseColor * tint, specularColor };
+        }
+        cameraLods.resize(objectPositions.size());
+        for (std::vector<LodState>& lods : cascadeLods)
+            lods.resize(objectPositions.size());
+        for (std::vector<LodState>& lods : pointShadowLods)
+            lods.resize(objectPositions.size());
+        shadowBatch.setInstancing(instancedDraws);
+        geometryBatch.setInstancing(instancedDraws);
+        // world bounds of the objects, the tree refits the ones that moved. The floor is drawn by every pass.
+        std::vector<SceneBvh::Bounds> objectBounds(objectPositions.size());
+        for (unsigned int i = 0; i < objectPositions.size(); i++)
+        {
+            const Model& model = *meshModels[i];
+            objectBounds[i] = SceneBvh::transformBounds(model.boundsMin, model.boundsMax, model.boundsRadius, objectTransforms[i]);
+        }
+        sceneBvh.update(objectBounds.data(), objectBounds.size());
+        // the objects of the scene touching a frustum or a sphere, all of them without culling
+        std::vector<uint32_t> allObjects(objectPositions.size());
+        for (unsigned int i = 0; i < objectPositions.size(); i++)
+            allObjects[i] = i;
+        auto cullFrustum = [&](const glm::mat4& viewProjection, std::vector<uint32_t>& objects) {
+            objects.clear();
+            if (cullObjects)
+                objectNodesVisited += sceneBvh.cull(viewProjection, objects);
+            else
+                objects = allObjects;
+        };
+        // queue objects of a view with their levels of detail in it, seen from eyes[object] instead of the view's eye
+        // when given. Cluster culling trims every copy of a model differently, models with enough copies in the view
+        // draw whole levels so the copies can be instanced.
+        std::vector<std::pair<const Model*, size_t>> modelCopies;
+        auto drawObjects = [&](DrawBatch& batch, const std::vector<uint32_t>& objects, const LodView& view, std::vector<LodState>& lods,
+            const DrawBatch::Material* materials, const glm::vec3* eyes) {
+            modelCopies.clear();
+            for (uint32_t i : objects)
+            {
+                auto copies = std::find_if(modelCopies.begin(), modelCopies.end(),
+                    [&](const std::pair<const Model*, size_t>& entry) { return entry.first == meshModels[i]; });
+                if (copies == modelCopies.end())
+                    modelCopies.push_back(std::make_pair(meshModels[i], size_t(1)));
+                else
+                    copies->second++;
+            }
+            LodView objectView = view;
+            for (uint32_t i : objects)
+            {
+                bool instanced = false;
+                if (instancedDraws)
+                {
+                    for (const std::pair<const Model*, size_t>& entry : modelCopies)
+                        instanced |= entry.first == meshModels[i] && entry.second >= DrawBatch::MIN_INSTANCES;
+                }
+                objectView.cullClusters = view.cullClusters && !instanced;
+                objectView.eye = eyes ? eyes[i] : view.eye;
+                if (materials)
+                    meshModels[i]->draw(batch, objectTransforms[i], objectView, lods[i], materials[i]);
+                else
+                    meshModels[i]->draw(batch, objectTransforms[i], objectView, lods[i]);
+            }
+        };
+
+        // 1. render depth of scene to the shadow cascades (from light's perspective)
+        // --------------------------------------------------------------------------
+        uint64_t casterVersion;
+        {
+            glm::vec3 sceneMin, sceneMax;
+            sceneBounds(meshModels, objectBounds, sceneMin, sceneMax);
+            shadowCascades.setCount(cascadeCount);
+            shadowCascades.setSplits(shadowDistance, cascadeSplitLambda);
+            shadowCascades.fit(view, glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, lightDirection, sceneMin, sceneMax);
+            // casters that moved lately are drawn on top of the cached static ones every frame
+            shadowCasters.begin();
+            casterDynamic.resize(objectPositions.size() + 1);
+            casterDynamic[0] = shadowCasters.add(0, glm::mat4(1.0f), 0);
+            for (unsigned int i = 0; i < objectPositions.size(); i++)
+                casterDynamic[i + 1] = shadowCasters.add(i + 1, objectTransforms[i], modelSignature(*meshModels[i]));
+            shadowCasters.end();
+            // the cached shadow maps hold the casters as drawn with the shadow level of detail settings, a change
+            // of these redraws them like a change of the static casters
+            const float casterSettings[3] = { shadowLodError, cullClusters ? 1.0f : 0.0f, instancedDraws ? 1.0f : 0.0f };
+            casterVersion = ShadowCasterTracker::hash(casterSettings, sizeof(casterSettings), shadowCasters.staticVersion());
+            shadowCascades.setCasters(casterVersion, shadowCasters.dynamicCount() > 0);
+
+            std::vector<uint32_t> casterVisible;
+            RenderGraph::PassBuilder pass = renderGraph.addPass("shadow map", [&](RenderGraph& graph) {
+                glEnable(GL_DEPTH_TEST);
+                shaderDepthWrite.use();
+                // render the static or the dynamic casters from light's point of view, fitted to a cascade's slice of the view
+                auto drawCasters = [&](int cascade, bool dynamic) {
+                    const ShadowCascades::Cascade& fitted = shadowCascades.cascade(cascade);
+                    shaderDepthWrite.setUniformMat4("lightSpaceMatrix", fitted.viewProjection);
+                    LodView shadowLodView = LodView::orthographicView(fitted.viewProjection, lightDirection, fitted.extent,
+                        (float)shadowCascades.size(), shadowLodError);
+                    shadowLodView.cullClusters = cullClusters;
+
+                    // the cascade's box reaches back to the scene's near end, it holds every caster of its slice
+                    cullFrustum(fitted.viewProjection, casterVisible);
+                    casterVisible.erase(std::remove_if(casterVisible.begin(), casterVisible.end(),
+                        [&](uint32_t i) { return casterDynamic[i + 1] != dynamic; }), casterVisible.end());
+                    casterObjects += casterVisible.size();
+                    shadowBatch.clear();
+                    unsigned int floorObject = shadowBatch.addObject(glm::mat4(1.0f));
+                    drawObjects(shadowBatch, casterVisible, shadowLodView, cascadeLods[cascade], nullptr, nullptr);
+                    shadowTriangles += shadowBatch.submit(shaderDepthWrite);
+                    shadowDrawCalls += shadowBatch.callCount();
+                    shadowInstances += shadowBatch.instanceCount();
+                    // render the textured floor, its transform is in the batch's buffer
+                    if (casterDynamic[0] == dynamic)
+                    {
+                        shaderDepthWrite.setUniformInt("objectIndex", floorObject);
+                        glActiveTexture(GL_TEXTURE0);
+                        glBindTexture(GL_TEXTURE_2D, woodTexture);
+                        glBindVertexArray(planeVAO);
+                        glDrawArrays(GL_TRIANGLES, 0, 6);
+                    }
+                };
+                for (int cascade = 0; cascade < shadowCascades.count(); cascade++)
+                {
+                    if (shadowCascades.bindStatic(cascade))
+                    {
+                        glClear(GL_DEPTH_BUFFER_BIT);
+                        drawCasters(cascade, false);
+                    }
+                    if (shadowCascades.bindDynamic(cascade))
+                        drawCasters(cascade, true);
+                }
+            });
+            shadowMap = pass.overwrite(shadowCascades.import(renderGraph));
+        }
+
+        // 2. geometry pass: render scene's geometry/color data into gbuffer
+        // -----------------------------------------------------------------
+        std::vector<uint32_t> cameraVisible;
+        cullFrustum(projection * view, cameraVisible);
+        cameraObjects = cameraVisible.size();
+        {
+            RenderGraph::PassBuilder pass = renderGraph.addPass("geometry", [&](RenderGraph& graph) {
+                glEnable(GL_DEPTH_TEST);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                glm::mat4 model = glm::mat4(1.0f);
+                shaderTexturedGeometryPass.use();
+                shaderTexturedGeometryPass.setUniformMat4("projection", projection);
+                shaderTexturedGeometryPass.setUniformMat4("view", view);
+                shaderTexturedGeometryPass.setUniformMat4("model", model);
+                glm::vec4 floorSpecular = glm::vec4(0.5f, 0.5f, 0.5f, 0.8f);
+                shaderTexturedGeometryPass.setUniformVec4f("specularCol", floorSpecular);
+                // render the textured floor
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, woodTexture);
+                glBindVertexArray(planeVAO);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+
+                // render non-textured models
+                shaderGeometryPass.use();
+                shaderGeometryPass.setUniformMat4("projection", projection);
+                shaderGeometryPass.setUniformMat4("view", view);
+                LodView cameraLodView = LodView::perspective(projection * view, arcballCamera.eye(), glm::radians(45.0f), (float)SCR_HEIGHT, cameraLodError);
+                cameraLodView.cullClusters = cullClusters;
+                geometryBatch.clear();
+                drawObjects(geometryBatch, cameraVisible, cameraLodView, cameraLods, objectMaterials.data(), nullptr);
+                geometryTriangles = geometryBatch.submit(shaderGeometryPass);
+            });
+            gNormal = pass.create("gNormal", gNormalDesc);
+            gDiffuse = pass.create("gDiffuse", gDiffuseDesc);
+            gSpecular = pass.create("gSpecular", gSpecularDesc);
+            gDepth = pass.create("gDepth", gDepthDesc);
+        }
+
+        // binds the g-buffer to texture units 0 to 3 for the shader in use, which reconstructs positions with the inverse view projection
+        auto bindGBuffer = [&](RenderGraph& graph, Shader& shader) {
+            shader.setUniformMat4("inverseViewProjection", inverseViewProjection);
+            graph.bindTexture(0, gDepth);
+            graph.bindTexture(1, gNormal);
+            graph.bindTexture(2, gDiffuse);
+            graph.bindTexture(3, gSpecular);
+        };
+
+        // 3. lighting pass: calculate lighting by iterating over a screen filled quad pixel-by-pixel using the gbuffer's content and shadow map
+        // -----------------------------------------------------------------------------------------------------------------------
+        RenderGraph::Resource screen;
+        {
+            RenderGraph::PassBuilder pass = renderGraph.addPass("global light", [&](RenderGraph& graph) {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                shaderLightingPass.use();
+                // bind all of our input textures
+                bindGBuffer(graph, shaderLightingPass);
+
+                // bind depth texture
+                if (enableShadows)
+                    graph.bindTexture(4, shadowMap);
+                shaderLightingPass.setUniformBool("enableShadows", enableShadows);
+
+                shaderLightingPass.setUniformVec3f("gLight.Position", globalLight.position);
+                shaderLightingPass.setUniformVec3f("gLight.Color", globalLight.color);
+                shaderLightingPass.setUniformFloat("gLight.Linear", gLinearAttenuation);
+                shaderLightingPass.setUniformFloat("gLight.Quadratic", gQuadraticAttenuation);
+
+                glm::vec3 camPosition = arcballCamera.eye();
+                shaderLightingPass.setUniformVec3f("viewPos", camPosition);
+                shadowCascades.setUniforms(shaderLightingPass);
+                shaderLightingPass.setUniformFloat("glossiness", glossiness);
+
+                // finally render quad
+                renderQuad();
+            });
+            pass.read(gDepth);
+            pass.read(gNormal);
+            pass.read(gDiffuse);
+            pass.read(gSpecular);
+            if (enableShadows)
+                pass.read(shadowMap);
+            screen = pass.overwrite(backbuffer);
+        }
+
+        // move the lights and upload what changed, nothing when they are static and the UI left them alone
+        pointLights.update(animatePointLights ? deltaTime : 0.0f);
+        pointLights.upload();
+        // refit the light hierarchy and draw and cluster only the lights in the view frustum
+        if (cullPointLights) {
+            lightBvh.update(pointLights);
+            lightBvh.cull(pointLights, projection * view);
+        }
+        const size_t lightCount = cullPointLights ? lightBvh.visibleCount() : pointLights.size();
+        const glm::vec4* lightPositionRadius = cullPointLights ? lightBvh.visiblePositionRadius() : pointLights.positionRadius();
+        const glm::vec4* lightColors = cullPointLights ? lightBvh.visibleColors() : pointLights.colors();
+        // the volumes are batched by proxy, picked from their size on screen
+        if (pointLightMode == 0 || drawPointLights) {
+            lightProxies.classify(pointLights.positionRadius(), cullPointLights ? lightBvh.visibleLights().data() : nullptr, lightCount, view);
+            lightProxies.upload();
+        }
+
+        // 3.4 point light shadows: rank the visible lights, then draw the casters into the cube faces of the few
+        // lights whose shadow maps are new or out of date this frame
+        // ---------------------------------------------------------------------------------------------------------
+        RenderGraph::Resource pointShadowTiers[POINT_SHADOW_TIERS];
+        if (pointLightMode == 0 && pointLightShadows)
+        {
+            pointShadows.setMaxLights((size_t)shadowedPointLights);
+            pointShadows.select(pointLights, cullPointLights ? lightBvh.visibleLights().data() : nullptr, lightCount, view,
+                casterVersion, shadowCasters.dynamicCount() > 0);
+
+            std::vector<uint32_t> pointShadowCasters;
+            std::vector<glm::vec3> pointShadowEyes(objectPositions.size());
+            RenderGraph::PassBuilder pass = renderGraph.addPass("point shadows", [&](RenderGraph& graph) {
+                shaderPointShadow.use();
+                // the cube faces see triangles from both sides
+                glDisable(GL_CULL_FACE);
+                for (int tier = 0; tier < POINT_SHADOW_TIERS; tier++)
+                {
+                    if (!pointShadows.beginTier(tier, shaderPointShadow))
+                        continue;
+                    // one pass for all the lights of the tier, the geometry shader sends the triangles to their faces.
+                    // The faces are culled by the geometry shader.
+                    LodView pointShadowLodView = LodView::perspective(glm::mat4(1.0f), glm::vec3(pointShadows.updateSphere(tier, 0)), glm::radians(90.0f),
+                        (float)POINT_SHADOW_TIER_SIZE[tier], shadowLodError);
+                    pointShadowLodView.cullClusters = false;
+
+                    // the objects within reach of any of the tier's lights
+                    pointShadowCasters.clear();
+                    if (cullObjects)
+                    {
+                        for (size_t update = 0; update < pointShadows.updateCount(tier); update++)
+                            objectNodesVisited += sceneBvh.cullSphere(pointShadows.updateSphere(tier, update), pointShadowCasters);
+                        std::sort(pointShadowCasters.begin(), pointShadowCasters.end());
+                        pointShadowCasters.erase(std::unique(pointShadowCasters.begin(), pointShadowCasters.end()), pointShadowCasters.end());
+                    }
+                    else
+                    {
+                        pointShadowCasters = allObjects;
+                    }
+                    casterObjects += pointShadowCasters.size();
+                    // a caster's level of detail is picked for the nearest of the lights it is drawn for
+                    for (uint32_t i : pointShadowCasters)
+                    {
+                        glm::vec3 center(objectBounds[i].sphere);
+                        float nearest = FLT_MAX;
+                        for (size_t update = 0; update < pointShadows.updateCount(tier); update++)
+                        {
+                            glm::vec3 light(pointShadows.updateSphere(tier, update));
+                            float distance = glm::length(light - center);
+                            if (distance < nearest)
+                            {
+                                nearest = distance;
+                                pointShadowEyes[i] = light;
+                            }
+                        }
+                    }
+
+                    shadowBatch.clear();
+                    unsigned int floorObject = shadowBatch.addObject(glm::mat4(1.0f));
+                    drawObjects(shadowBatch, pointShadowCasters, pointShadowLodView, pointShadowLods[tier], nullptr, pointShadowEyes.data());
+                    shadowTriangles += shadowBatch.submit(shaderPointShadow);
+                    shadowDrawCalls += shadowBatch.callCount();
+                    shadowInstances += shadowBatch.instanceCount();
+                    shaderPointShadow.setUniformInt("objectIndex", floorObject);
+                    glBindVertexArray(planeVAO);
+                    glDrawArrays(GL_TRIANGLES, 0, 6);
+                }
+                pointShadows.finish(pointLights.size());
+            });
+            pointShadows.import(renderGraph, pointShadowTiers);
+            for (int tier = 0; tier < POINT_SHADOW_TIERS; tier++)
+                pointShadowTiers[tier] = pass.write(pointShadowTiers[tier]);
+        }
+
+        // 3.5 lighting pass: render point lights on top of main scene with additive blending and utilizing G-Buffer for lighting.
+        // -----------------------------------------------------------------------------------------------------------------------
+        if (pointLightMode == 0)
+        {
+            RenderGraph::PassBuilder pass = renderGraph.addPass("point lights", [&](RenderGraph& graph) {
+                if (stencilLightVolumes) {
+                    // mark the pixels whose g-buffer surface lies inside a volume: against the scene's depth, back faces
+                    // behind the surface increment and front faces behind it decrement. A surface in front of or behind a
+                    // volume gets both or neither, one inside only the back face. A volume around the camera has no front
+                    // faces on screen, which leaves its back faces counting the surfaces inside it as they should.
+                    graph.bindRead(gDepth);
+                    glBlitFramebuffer(0, 0, SCR_WIDTH, SCR_HEIGHT, 0, 0, SCR_WIDTH, SCR_HEIGHT, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+                    glClear(GL_STENCIL_BUFFER_BIT);
+                    shaderLightSphere.use();
+                    shaderLightSphere.setUniformMat4("projection", projection);
+                    shaderLightSphere.setUniformMat4("view", view);
+                    pointLights.bind(shaderLightSphere);
+                    glEnable(GL_DEPTH_TEST);
+                    glDepthMask(GL_FALSE);
+                    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                    glEnable(GL_STENCIL_TEST);
+                    glStencilFunc(GL_ALWAYS, 0, 0xFF);
+                    glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+                    glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+                    // the quads have no back faces to count, they are drawn unmasked
+                    for (int proxy = LIGHT_PROXY_ICOSPHERE_0; proxy < LIGHT_PROXY_COUNT; proxy++)
+                        lightProxies.draw(LightProxy(proxy), shaderLightSphere);
+                    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                    glDepthMask(GL_TRUE);
+                    // then light only the marked pixels, every volume is marked before any is lit so a pixel inside
+                    // any volume is shaded by all the volumes covering it on screen
+                    glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+                    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+                }
+
+                shaderPointLightingPass.use();
+                bindGBuffer(graph, shaderPointLightingPass);
+                shaderPointLightingPass.setUniformMat4("projection", projection);
+                shaderPointLightingPass.setUniformMat4("view", view);
+                pointLights.bind(shaderPointLightingPass);
+                pointShadows.bind(shaderPointLightingPass);
+                shaderPointLightingPass.setUniformBool("enablePointShadows", pointLightShadows);
+
+                glEnable(GL_CULL_FACE);
+                // only render the back faces of the light volume spheres
+                glFrontFace(GL_CW);
+                glDisable(GL_DEPTH_TEST);
+                // enable additive blending
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_ONE, GL_ONE);
+                glm::vec3 camPosition = arcballCamera.eye();
+                shaderPointLightingPass.setUniformVec3f("viewPos", camPosition);
+                shaderPointLightingPass.setUniformFloat("lightIntensity", pointLightIntensity);
+                shaderPointLightingPass.setUniformFloat("glossiness", glossiness);
+                lightFragments.begin();
+                for (int proxy = LIGHT_PROXY_ICOSPHERE_0; proxy < LIGHT_PROXY_COUNT; proxy++)
+                    lightProxies.draw(LightProxy(proxy), shaderPointLightingPass);
+                // a quad is a single face covering the light once, outside the stencil mask
+                glDisable(GL_STENCIL_TEST);
+                glDisable(GL_CULL_FACE);
+                lightProxies.draw(LIGHT_PROXY_QUAD, shaderPointLightingPass);
+                lightFragments.end();
+
+                glDisable(GL_BLEND);
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                glFrontFace(GL_CCW);
+            });
+            pass.read(gDepth);
+            pass.read(gNormal);
+            pass.read(gDiffuse);
+            pass.read(gSpecular);
+            if (pointLightShadows) {
+                for (int tier = 0; tier < POINT_SHADOW_TIERS; tier++)
+                    pass.read(pointShadowTiers[tier]);
+            }
+            screen = pass.write(screen);
+        }
+        // or sort the lights into view space clusters on the worker threads and shade them all in one full-screen pass
+        else
+        {
+            lightClusters.assign(lightPositionRadius, lightCount, view);
+
+            RenderGraph::PassBuilder pass = renderGraph.addPass("clustered lights", [&](RenderGraph& graph) {
+                lightClusters.upload(lightPositionRadius, lightColors, lightCount);
+                shaderClusteredLightingPass.use();
+                bindGBuffer(graph, shaderClusteredLightingPass);
+                lightClusters.bind(shaderClusteredLightingPass);
+                shaderClusteredLightingPass.setUniformMat4("view", view);
+                glm::vec3 camPosition = arcballCamera.eye();
+                shaderClusteredLightingPass.setUniformVec3f("viewPos", camPosition);
+                shaderClusteredLightingPass.setUniformFloat("lightIntensity", pointLightIntensity);
+                shaderClusteredLightingPass.setUniformFloat("glossiness", glossiness);
+
+                glDisable(GL_DEPTH_TEST);
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_ONE, GL_ONE);
+                lightFragments.begin();
+                renderQuad();
+                lightFragments.end();
+                glDisable(GL_BLEND);
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            });
+            pass.read(gDepth);
+            pass.read(gNormal);
+            pass.read(gDiffuse);
+            pass.read(gSpecular);
+            screen = pass.write(screen);
+        }
+
+        // for G-Buffer debuging, replaces the lit image
+        if (gBufferMode != 0)
+        {
+            RenderGraph::PassBuilder pass = renderGraph.addPass("g-buffer view", [&](RenderGraph& graph) {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                shaderGBufferDebug.use();
+                shaderGBufferDebug.setUniformInt("gBufferMode", gBufferMode);
+                // bind all of our input textures
+                bindGBuffer(graph, shaderGBufferDebug);
+                renderQuad();
+            });
+            pass.read(gDepth);
+            pass.read(gNormal);
+            pass.read(gDiffuse);
+            pass.read(gSpecular);
+            screen = pass.overwrite(backbuffer);
+        }
+
+        // strictly used for debugging point light volumes (sizes, positions, etc)
+        if (drawPointLights && gBufferMode == 0) {
+            RenderGraph::PassBuilder pass = renderGraph.addPass("light volumes", [&](RenderGraph& graph) {
+                // re-enable the depth testing 
+                glEnable(GL_DEPTH_TEST);
+                // copy content of geometry's depth buffer to default framebuffer's depth buffer
+                // ----------------------------------------------------------------------------------
+                graph.bindRead(gDepth);
+                // blit to default framebuffer, which the graph keeps bound for drawing
+                glBlitFramebuffer(0, 0, SCR_WIDTH, SCR_HEIGHT, 0, 0, SCR_WIDTH, SCR_HEIGHT, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+                // render lights on top of scene with Z-testing
+                // --------------------------------
+                shaderLightSphere.use();
+                shaderLightSphere.setUniformMat4("projection", projection);
+                shaderLightSphere.setUniformMat4("view", view);
+
+                pointLights.bind(shaderLightSphere);
+
+                glPolygonMode(GL_FRONT_AND_BACK, drawPointLightsWireframe ? GL_LINE : GL_FILL);
+                lightProxies.drawAll(LIGHT_PROXY_ICOSPHERE_2, shaderLightSphere);
+                glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+                shaderGlobalLightSphere.use();
+                shaderGlobalLightSphere.setUniformMat4("projection", projection);
+                shaderGlobalLightSphere.setUniformMat4("view", view);
+                // render the global light model
+                glm::mat4 model = glm::mat4(1.0f);
+                model = glm::translate(model, globalLight.position);
+                shaderGlobalLightSphere.setUniformMat4("model", model);
+                shaderGlobalLightSphere.setUniformVec3f("lightColor", globalLight.color);
+                shaderGlobalLightSphere.setUniformFloat("lightRadius", globalLight.radius);
+                lightModel.draw(shaderGlobalLightSphere);
+            });
+            pass.read(gDepth);
+            screen = pass.write(screen);
+        }
+
+        if (showDepthMap && enableShadows) {
+            RenderGraph::PassBuilder pass = renderGraph.addPass("shadow map view", [&](RenderGraph& graph) {
+                // render Depth map to quad for visual debugging
+                // ---------------------------------------------
+                glm::mat4 model = glm::mat4(1.0f);
+                model = glm::translate(model, glm::vec3(0.7f, -0.7f, 0.0f));
+                model = glm::scale(model, glm::vec3(0.3f, 0.3f, 1.0f)); // Make it 30% of total screen size
+                shaderDebugDepthMap.use();
+                shaderDebugDepthMap.setUniformMat4("transform", model);
+                shaderDebugDepthMap.setUniformInt("layer", std::min(shownCascade, shadowCascades.count() - 1));
+                graph.bindTexture(0, shadowMap);
+                renderQuad();
+            });
+            pass.read(shadowMap);
+            screen = pass.write(screen);
+        }
+
+        // 4. frame reuse: when nothing the image depends on changed since the last frame rendered, present that
+        // frame again. The scene passes lose their readers and the graph culls them, only the UI is drawn.
+        // -------------------------------------------------------------------------------------------------------
+        frameReuse.begin();
+        frameReuse.add(view);
+        frameReuse.add(globalLight.position);
+        frameReuse.add(globalLight.color);
+        for (const glm::vec3& position : objectPositions)
+            frameReuse.add(position);
+        // what the models draw (streamed meshes included), and the textures streamed in
+        frameReuse.add(casterVersion);
+        frameReuse.add(TextureLoader::shared().uploadedBytes());
+        frameReuse.add(pointLights.layoutVersion());
+        frameReuse.add(pointLights.positionVersion());
+        const float frameSettings[] = { gLinearAttenuation, gQuadraticAttenuation, shadowDistance, cascadeSplitLambda, glossiness,
+            pointLightIntensity, cameraLodError, shadowLodError, diffuseColor.x, diffuseColor.y, diffuseColor.z,
+            specularColor.x, specularColor.y, specularColor.z, specularColor.w };
+        frameReuse.add(frameSettings, sizeof(frameSettings));
+        const int frameModes[] = { gBufferMode, enableShadows, cascadeCount, pointLightMode, stencilLightVolumes, cullPointLights,
+            pointLightShadows, shadowedPointLights, cullClusters, cullObjects, modelInstances, instancedDraws, drawPointLights, drawPointLightsWireframe, showDepthMap, shownCascade };
+        frameReuse.add(frameModes, sizeof(frameModes));
+        // moving casters and point shadow maps still being drawn change the image from frame to frame
+        if (shadowCasters.dynamicCount() > 0 || (pointLightMode == 0 && pointLightShadows && pointShadows.stats().updated > 0))
+            frameReuse.invalidate();
+
+        if (reuseStaticFrames && frameReuse.reuse())
+        {
+            RenderGraph::PassBuilder pass = renderGraph.addPass("reused frame", [&](RenderGraph& graph) {
+                frameReuse.present();
+            });
+            screen = pass.overwrite(backbuffer);
+        }
+        else if (reuseStaticFrames)
+        {
+            // keep the scene without the UI for the frames to come
+            RenderGraph::PassBuilder pass = renderGraph.addPass("keep frame", [&](RenderGraph& graph) {
+                frameReuse.store();
+            });
+            pass.read(screen);
+            renderGraph.present(pass.overwrite(frameReuse.import(renderGraph)));
+        }
+
+        // UI on top of everything
+        {
+            RenderGraph::PassBuilder pass = renderGraph.addPass("imgui", [&](RenderGraph& graph) {
+                ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            });
+            screen = pass.write(screen);
+        }
+        renderGraph.present(screen);
+        renderGraph.execute();
+        FrameBuffer::unbind();
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
         glfwSwapBuffers(window);
-        glfwPollEvents();
+        // an idle viewer sleeps until there is input, once the UI had a frame to settle and nothing is streaming in
+        if (waitForEvents && reuseStaticFrames && frameReuse.stats().idleFrames >= 2 && sceneLoader.idle() &&
+            TextureLoader::shared().pending() == 0)
+            glfwWaitEvents();
+        else
+            glfwPollEvents();
+
+        if (timeToFirstFrame < 0.0)
+        {
+            timeToFirstFrame = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startupTime).count();
+            std::cout << "Time to first frame: " << timeToFirstFrame << " ms, " << sceneLoader.residentMeshes() << " meshes at full detail" << std::endl;
+        }
     }
 
+    // the loader's jobs may still be running when the window is closed early, let them finish while there's a context
+    sceneLoader.finish();
+
     // optional: de-allocate all resources once they've outlived their purpose:
     // ------------------------------------------------------------------------
     glDeleteVertexArrays(1, &planeVAO);
@@ -659,10 +1254,13 @@ int main()
 }
 
 // Node: separation < 1.0 will cause lights to penetrate each other, and > 1.0 they will separate (1.0 is just touching)
-void configurePointLights(std::vector<glm::mat4>& modelMatrices, std::vector<glm::vec4>& modelColorSizes, float radius, float separation, float yOffset)
+void configurePointLights(LightSystem& lights, float radius, float separation, float yOffset)
 {
-    srand(glfwGetTime());
-    // add some uniformly spaced point lights
+    std::mt19937 random((unsigned int)std::chrono::high_resolution_clock::now().time_since_epoch().count());
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    lights.clear();
+    lights.reserve(LIGHT_GRID_WIDTH * LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT);
+    // add some uniformly spaced point lights, light index = x * LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT + z * LIGHT_GRID_HEIGHT + y
     for (unsigned int lightIndexX = 0; lightIndexX < LIGHT_GRID_WIDTH; lightIndexX++)
     {
         for (unsigned int lightIndexZ = 0; lightIndexZ < LIGHT_GRID_WIDTH; lightIndexZ++)
@@ -673,34 +1271,50 @@ void configurePointLights(std::vector<glm::mat4>& modelMatrices, std::vector<glm
                 float xPos = (lightIndexX - (LIGHT_GRID_WIDTH - 1.0f) / 2.0f) * (diameter * separation);
                 float zPos = (lightIndexZ - (LIGHT_GRID_WIDTH - 1.0f) / 2.0f) * (diameter * separation);
                 float yPos = (lightIndexY - (LIGHT_GRID_HEIGHT - 1.0f) / 2.0f) * (diameter * separation) + yOffset;
-                double angle = double(rand()) * 2.0 * M_PI / (double(RAND_MAX));
-                double length = double(rand()) * 0.5 / (double(RAND_MAX));
-                float xOffset = cos(angle) * length;
-                float zOffset = sin(angle) * length;
-                xPos += xOffset;
-                zPos += zOffset;
-                // also calculate random color
-                float rColor = ((rand() % 100) / 200.0f) + 0.5; // between 0.5 and 1.0
-                float gColor = ((rand() % 100) / 200.0f) + 0.5; // between 0.5 and 1.0
-                float bColor = ((rand() % 100) / 200.0f) + 0.5; // between 0.5 and 1.0
-
-                int curLight = lightIndexX * LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT + lightIndexZ * LIGHT_GRID_HEIGHT + lightIndexY;
-                glm::mat4 model = glm::mat4(1.0f);
-                model = glm::translate(model, glm::vec3(xPos, yPos, zPos));
-                // now add to list of matrices
-                modelMatrices.emplace_back(model);
-                modelColorSizes.emplace_back(glm::vec4(rColor, gColor, bColor, radius));
+                // also calculate random color between 0.5 and 1.0
+                glm::vec3 color(0.5f + 0.5f * unit(random), 0.5f + 0.5f * unit(random), 0.5f + 0.5f * unit(random));
+                size_t light = lights.add(glm::vec3(xPos, yPos, zPos), radius, color);
+                // the random offset from the grid point is the light's orbit, animating the lights moves them along it
+                float speed = 0.5f + unit(random);
+                lights.setOrbit(light, 0.5f * unit(random), 2.0f * float(M_PI) * unit(random), unit(random) < 0.5f ? -speed : speed);
             }
         }
     }
 }
 
-void updatePointLights(std::vector<glm::mat4>& modelMatrices, std::vector<glm::vec4>& modelColorSizes, float separation, float yOffset, float radius)
+// world space box around the floor and the models, which cast and receive the global light's shadow
+void sceneBounds(const std::vector<Model*>& models, const std::vector<SceneBvh::Bounds>& objectBounds, glm::vec3& boundsMin, glm::vec3& boundsMax)
+{
+    boundsMin = glm::vec3(-10.0f, -0.5f, -10.0f);
+    boundsMax = glm::vec3(10.0f, -0.5f, 10.0f);
+    for (size_t i = 0; i < objectBounds.size(); i++)
+    {
+        // models whose meshes are still streaming in aren't drawn yet either
+        if (models[i]->meshes.empty())
+            continue;
+        boundsMin = glm::min(boundsMin, objectBounds[i].min);
+        boundsMax = glm::max(boundsMax, objectBounds[i].max);
+    }
+}
+
+// what of a model is drawn, it changes as the meshes stream in and previews are replaced
+uint64_t modelSignature(const Model& model)
+{
+    uint64_t signature = ShadowCasterTracker::hash(nullptr, 0);
+    for (const Mesh& mesh : model.meshes)
+    {
+        const unsigned int parts[4] = { (unsigned int)mesh.baseVertex, mesh.firstIndex, mesh.vertexCount, mesh.indexCount };
+        signature = ShadowCasterTracker::hash(parts, sizeof(parts), signature);
+    }
+    return signature;
+}
+
+void updatePointLights(LightSystem& lights, float separation, float yOffset, float radius)
 {
     if (separation < 0.0f) {
         return;
     }
-    // add some uniformly spaced point lights
+    // move the grid points, the lights keep their orbits. Only the lights are touched, update() and upload() do the rest
     for (unsigned int lightIndexX = 0; lightIndexX < LIGHT_GRID_WIDTH; lightIndexX++)
     {
         for (unsigned int lightIndexZ = 0; lightIndexZ < LIGHT_GRID_WIDTH; lightIndexZ++)
@@ -712,20 +1326,387 @@ void updatePointLights(std::vector<glm::mat4>& modelMatrices, std::vector<glm::v
                 float xPos = (lightIndexX - (LIGHT_GRID_WIDTH - 1.0f) / 2.0f) * (diameter * separation);
                 float zPos = (lightIndexZ - (LIGHT_GRID_WIDTH - 1.0f) / 2.0f) * (diameter * separation);
                 float yPos = (lightIndexY - (LIGHT_GRID_HEIGHT - 1.0f) / 2.0f) * (diameter * separation);
-                
-                // modify matrix translation
-                modelMatrices[curLight][3] = glm::vec4(xPos, yPos + yOffset, zPos, 1.0);
-                modelColorSizes[curLight].w = radius;
+
+                lights.setAnchor(curLight, glm::vec3(xPos, yPos + yOffset, zPos));
+                lights.setRadius(curLight, radius);
+            }
+        }
+    }
+}
+
+
+// Loads every model in the list repeatedly, once without a mesh cache (cold: a full import, by the OBJ loader for
+// .obj files and ASSIMP for the rest) and once with the cache written by the cold load (warm), and prints the
+// average times
+// ---------------------------------------------------------------------------------------------------
+void benchmarkModelLoading(const std::vector<std::string>& modelPaths, int iterations)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    iterations = std::max(iterations, 1);
+
+    std::cout << "Model load benchmark (" << iterations << " iterations)" << std::endl;
+    for (const std::string& path : modelPaths)
+    {
+        if (!fs::exists(path)) {
+            std::cout << "  skipping missing model " << path << std::endl;
+            continue;
+        }
+
+        double coldTotal = 0.0, warmTotal = 0.0;
+        for (int i = 0; i < iterations; i++)
+        {
+            fs::remove(MeshCache::cachePath(path));
+            auto start = Clock::now();
+            {
+                Model cold(path);
             }
+            coldTotal += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+            start = Clock::now();
+            {
+                Model warm(path);
+            }
+            warmTotal += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
         }
+
+        double cold = coldTotal / iterations, warm = warmTotal / iterations;
+        std::cout << "  " << fs::path(path).filename().string() << ": cold (" << (ObjLoader::canLoad(path) ? "OBJ loader" : "ASSIMP")
+            << ") " << cold << " ms, warm (mesh cache) " << warm << " ms (" << (warm > 0.0 ? cold / warm : 0.0) << "x)" << std::endl;
     }
 
-    // update the instance matrix buffer
-    glBindBuffer(GL_ARRAY_BUFFER, matrixBuffer);
-    glBufferData(GL_ARRAY_BUFFER, LIGHT_GRID_WIDTH * LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT * sizeof(glm::mat4), &modelMatrices[0], GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // whole scene, cold: one model after the other on this thread versus all of them through the thread pool
+    std::vector<std::string> scenePaths;
+    for (const std::string& path : modelPaths)
+    {
+        if (fs::exists(path))
+            scenePaths.push_back(path);
+    }
+    double serialTotal = 0.0, parallelTotal = 0.0;
+    for (int i = 0; i < iterations; i++)
+    {
+        for (const std::string& path : scenePaths)
+            fs::remove(MeshCache::cachePath(path));
+        auto start = Clock::now();
+        {
+            std::vector<std::unique_ptr<Model>> models;
+            for (const std::string& path : scenePaths)
+                models.emplace_back(new Model(path));
+        }
+        serialTotal += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        for (const std::string& path : scenePaths)
+            fs::remove(MeshCache::cachePath(path));
+        start = Clock::now();
+        {
+            std::vector<std::unique_ptr<Model>> models;
+            ModelLoader loader;
+            for (const std::string& path : scenePaths)
+            {
+                models.emplace_back(new Model());
+                loader.load(*models.back(), path);
+            }
+            loader.finish();
+        }
+        parallelTotal += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+    double serial = serialTotal / iterations, parallel = parallelTotal / iterations;
+    std::cout << "  scene (" << scenePaths.size() << " models, " << ThreadPool::shared().size() << " workers): serial "
+        << serial << " ms, parallel " << parallel << " ms (" << (parallel > 0.0 ? serial / parallel : 0.0) << "x)" << std::endl;
+    // the loaded models are gone again, what's left resident is the loader's steady state
+    MemoryUsage memory = currentMemoryUsage();
+    std::cout << "  memory: RSS " << toMegabytes(memory.resident) << " MB, peak " << toMegabytes(memory.peakResident) << " MB" << std::endl;
+}
+
+// Parses every model with ASSIMP (import and conversion to MeshData, the old path), with the OBJ loader on
+// one thread and with the OBJ loader on the thread pool, and prints the throughput of each in MB/s
+// ---------------------------------------------------------------------------------------------------------
+void benchmarkObjParsing(const std::vector<std::string>& modelPaths, int iterations)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    iterations = std::max(iterations, 1);
+
+    std::cout << "OBJ parse benchmark (" << iterations << " iterations, " << ThreadPool::shared().size() << " workers)" << std::endl;
+    for (const std::string& path : modelPaths)
+    {
+        if (!fs::exists(path) || !ObjLoader::canLoad(path))
+            continue;
+        const double megabytes = double(fs::file_size(path)) / (1024.0 * 1024.0);
+
+        double assimpTotal = 0.0, serialTotal = 0.0, parallelTotal = 0.0;
+        size_t assimpTriangles = 0, objTriangles = 0, objVertices = 0;
+        for (int i = 0; i < iterations; i++)
+        {
+            std::vector<MeshData> meshes;
+            auto start = Clock::now();
+            ModelLoader::importWithAssimp(path, meshes);
+            assimpTotal += std::chrono::duration<double>(Clock::now() - start).count();
+            assimpTriangles = 0;
+            for (const MeshData& mesh : meshes)
+                assimpTriangles += mesh.indices.size() / 3;
+
+            start = Clock::now();
+            ObjLoader::load(path, meshes, nullptr);
+            serialTotal += std::chrono::duration<double>(Clock::now() - start).count();
+
+            start = Clock::now();
+            ObjLoader::load(path, meshes);
+            parallelTotal += std::chrono::duration<double>(Clock::now() - start).count();
+            objTriangles = objVertices = 0;
+            for (const MeshData& mesh : meshes)
+            {
+                objTriangles += mesh.indices.size() / 3;
+                objVertices += mesh.vertices.size();
+            }
+        }
+
+        auto throughput = [megabytes, iterations](double seconds) { return seconds > 0.0 ? megabytes * iterations / seconds : 0.0; };
+        std::cout << "  " << fs::path(path).filename().string() << " (" << megabytes << " MB): ASSIMP " << throughput(assimpTotal)
+            << " MB/s, OBJ loader " << throughput(serialTotal) << " MB/s on one thread, " << throughput(parallelTotal) << " MB/s parallel ("
+            << (parallelTotal > 0.0 ? assimpTotal / parallelTotal : 0.0) << "x), " << objTriangles << " triangles ("
+            << assimpTriangles << " through ASSIMP), " << objVertices << " vertices" << std::endl;
+    }
 }
 
+// Imports every model once serially and once through the parallel ModelLoader (both without a mesh cache)
+// and checks that both produce identical meshes
+// ---------------------------------------------------------------------------------------------------------
+bool verifyParallelLoading(const std::vector<std::string>& modelPaths)
+{
+    std::vector<std::string> paths;
+    for (const std::string& path : modelPaths)
+    {
+        if (fs::exists(path))
+            paths.push_back(path);
+    }
+
+    std::vector<std::unique_ptr<Model>> serialModels, parallelModels;
+    for (const std::string& path : paths)
+    {
+        fs::remove(MeshCache::cachePath(path));
+        // the comparison needs the CPU copies of the geometry
+        serialModels.emplace_back(new Model(path, false, VertexLayout(), CpuGeometry::Keep));
+    }
+    {
+        ModelLoader loader;
+        for (const std::string& path : paths)
+        {
+            fs::remove(MeshCache::cachePath(path));
+            parallelModels.emplace_back(new Model());
+            loader.load(*parallelModels.back(), path, false, VertexLayout(), CpuGeometry::Keep);
+        }
+        loader.finish();
+    }
+
+    bool identical = true;
+    for (size_t m = 0; m < paths.size(); m++)
+    {
+        const Model& serial = *serialModels[m];
+        const Model& parallel = *parallelModels[m];
+        bool same = serial.meshes.size() == parallel.meshes.size();
+        for (size_t i = 0; same && i < serial.meshes.size(); i++)
+        {
+            const Mesh& a = serial.meshes[i];
+            const Mesh& b = parallel.meshes[i];
+            same = a.indices == b.indices && a.vertices.size() == b.vertices.size() &&
+                memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size() * sizeof(Vertex)) == 0 &&
+                a.textures.size() == b.textures.size();
+            for (size_t t = 0; same && t < a.textures.size(); t++)
+                same = a.textures[t].type == b.textures[t].type && a.textures[t].path == b.textures[t].path;
+        }
+        std::cout << (same ? "  match    " : "  MISMATCH ") << paths[m] << " (" << serial.meshes.size() << " meshes)" << std::endl;
+        identical = identical && same;
+    }
+    std::cout << (identical ? "Parallel loading matches serial loading" : "Parallel loading differs from serial loading") << std::endl;
+    return identical;
+}
+
+// Runs the texture cache pipeline on every image without GL: compress, write and read back the cache file,
+// decode the blocks in software and measure the PSNR of the base level against the source image
+// ---------------------------------------------------------------------------------------------------------
+bool verifyTextureCompression(const std::vector<std::string>& imagePaths)
+{
+    // BC1 stays well above this on photographic textures, anything lower means a broken encoder
+    const double MIN_PSNR = 30.0;
+
+    bool passed = true;
+    for (const std::string& path : imagePaths)
+    {
+        MappedFile file(path);
+        CompressedTexture texture, cached;
+        int width = 0, height = 0, components = 0;
+        unsigned char* source = file.isOpen() ? stbi_load_from_memory(file.data(), int(file.size()), &width, &height, &components, 4) : nullptr;
+        if (!source || !TextureCache::compress(file.data(), file.size(), texture))
+        {
+            std::cout << "  FAILED   " << path << " (unable to decode)" << std::endl;
+            stbi_image_free(source);
+            passed = false;
+            continue;
+        }
+
+        const std::string cachePath = TextureCache::cachePath(TextureCache::contentHash(file.data(), file.size()));
+        bool roundTrip = TextureCache::write(cachePath, texture) && TextureCache::read(cachePath, cached) &&
+            cached.format == texture.format && cached.levels.size() == texture.levels.size() && cached.data == texture.data;
+
+        // compare the channels the format keeps
+        std::vector<unsigned char> decoded(size_t(width) * height * 4);
+        decompressImage(cached.data.data(), width, height, cached.format, decoded.data());
+        const int channels = texture.format == BlockFormat::BC4 ? 1 : (texture.format == BlockFormat::BC1 ? 3 : 4);
+        double squaredError = 0.0;
+        for (size_t i = 0; i < size_t(width) * height; i++)
+        {
+            for (int c = 0; c < channels; c++)
+            {
+                double difference = double(source[i * 4 + c]) - double(decoded[i * 4 + c]);
+                squaredError += difference * difference;
+            }
+        }
+        stbi_image_free(source);
+        double meanSquaredError = squaredError / (double(width) * height * channels);
+        double psnr = meanSquaredError > 0.0 ? 10.0 * log10(255.0 * 255.0 / meanSquaredError) : 99.0;
+
+        size_t uncompressed = 0;
+        for (const MipLevel& level : texture.levels)
+            uncompressed += size_t(level.width) * level.height * 4;
+        bool ok = roundTrip && psnr >= MIN_PSNR;
+        std::cout << (ok ? "  ok       " : "  FAILED   ") << path << ": " << blockFormatName(texture.format) << ", "
+            << texture.levels.size() << " levels, " << texture.data.size() / 1024 << " KB (" << uncompressed / 1024 << " KB as RGBA8), PSNR "
+            << psnr << " dB, cache " << (roundTrip ? "round trip ok" : "round trip FAILED") << std::endl;
+        passed = passed && ok;
+    }
+    std::cout << (passed ? "Texture compression verified" : "Texture compression failed") << std::endl;
+    return passed;
+}
+
+// Times LightClusters::assign() without GL for random lights spread over a 40 x 10 x 40 volume in front of the
+// default camera, averaged over the iterations after a warm up
+// -------------------------------------------------------------------------------------------------------------
+void benchmarkLightClusters(const std::vector<size_t>& lightCounts, int iterations)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    iterations = std::max(iterations, 1);
+
+    LightClusters clusters;
+    clusters.setView(SCR_WIDTH, SCR_HEIGHT, glm::radians(45.0f), 0.1f, 150.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 8.0f, 30.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    std::cout << "Light clustering benchmark (" << clusters.tilesX() << " x " << clusters.tilesY() << " x " << CLUSTER_DEPTH_SLICES
+        << " clusters, " << ThreadPool::shared().size() << " workers)" << std::endl;
+    srand(1);
+    for (size_t count : lightCounts)
+    {
+        std::vector<glm::vec4> lights(count);
+        for (glm::vec4& light : lights)
+        {
+            light = glm::vec4(40.0f * rand() / RAND_MAX - 20.0f, 10.0f * rand() / RAND_MAX - 0.5f, 40.0f * rand() / RAND_MAX - 20.0f,
+                0.3f + 2.2f * rand() / RAND_MAX);
+        }
+
+        clusters.assign(lights.data(), lights.size(), view);
+        auto start = Clock::now();
+        for (int i = 0; i < iterations; i++)
+            clusters.assign(lights.data(), lights.size(), view);
+        double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / iterations;
+
+        const LightClusters::Stats& stats = clusters.stats();
+        std::cout << "  " << count << " lights: " << milliseconds << " ms, " << stats.visibleLights << " visible, "
+            << stats.lightIndices << " list entries, " << stats.maxLightsPerCluster << " max per cluster" << std::endl;
+    }
+}
+
+// shaderSource() returns the glsw shader with every #include "effect.section" line replaced by that section
+// (without its directives), includes can't nest
+// ----------------------------------------------------------------------------------------------------------
+std::string shaderSource(const char* key)
+{
+    const char* shader = glswGetShader(key);
+    if (!shader)
+    {
+        std::cout << "ERROR::SHADER::SOURCE " << glswGetError() << std::endl;
+        return std::string();
+    }
+
+    std::istringstream lines(shader);
+    std::string source, line;
+    while (std::getline(lines, line))
+    {
+        const std::string directive = "#include \"";
+        size_t end = line.rfind('"');
+        if (line.compare(0, directive.size(), directive) != 0 || end < directive.size())
+        {
+            source += line + "\n";
+            continue;
+        }
+
+        std::string includeKey = line.substr(directive.size(), end - directive.size());
+        const char* include = glswGetShader(includeKey.c_str());
+        if (!include)
+        {
+            std::cout << "ERROR::SHADER::INCLUDE " << includeKey << " in " << key << ": " << glswGetError() << std::endl;
+            continue;
+        }
+        std::istringstream includeLines(include);
+        while (std::getline(includeLines, line))
+        {
+            if (line.compare(0, 8, "#version") != 0)
+                source += line + "\n";
+        }
+    }
+    return source;
+}
+
+// Times LightSystem::update() for randomly placed orbiting lights, once moving all of them a frame's worth
+// and once refreshing after a single light changed, averaged over the iterations after a warm up
+// ---------------------------------------------------------------------------------------------------------
+void benchmarkLightSystem(size_t lightCount, int iterations)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    iterations = std::max(iterations, 1);
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    LightSystem lights;
+    lights.reserve(lightCount);
+    for (size_t i = 0; i < lightCount; i++)
+    {
+        size_t light = lights.add(glm::vec3(40.0f * unit(random) - 20.0f, 10.0f * unit(random), 40.0f * unit(random) - 20.0f),
+            0.3f + 2.2f * unit(random), glm::vec3(unit(random), unit(random), unit(random)));
+        lights.setOrbit(light, unit(random), 2.0f * float(M_PI) * unit(random), 2.0f * unit(random) - 1.0f);
+    }
+    std::cout << "Light system benchmark (" << lightCount << " lights, " << ThreadPool::shared().size() << " workers)" << std::endl;
+
+    lights.update(1.0f / 60.0f);
+    auto start = Clock::now();
+    for (int i = 0; i < iterations; i++)
+        lights.update(1.0f / 60.0f);
+    double animated = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / iterations;
+
+    start = Clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        lights.setRadius(lightCount / 2, 1.0f + 0.01f * i);
+        lights.update(0.0f);
+    }
+    double single = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / iterations;
+    std::cout << "  animate all: " << animated << " ms, one light changed: " << single << " ms ("
+        << lights.stats().updatedLights << " lights refreshed)" << std::endl;
+
+    // frustum culling of the animated lights from the default camera
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 150.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 8.0f, 30.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    LightBvh bvh;
+    bvh.update(lights);
+    double built = bvh.stats().updateMilliseconds;
+    double refit = 0.0, culled = 0.0;
+    for (int i = 0; i < iterations; i++)
+    {
+        lights.update(1.0f / 60.0f);
+        bvh.update(lights);
+        bvh.cull(lights, projection * view);
+        refit += bvh.stats().updateMilliseconds;
+        culled += bvh.stats().cullMilliseconds;
+    }
+    std::cout << "  light BVH: build " << built << " ms, refit " << refit / iterations << " ms, cull " << culled / iterations
+        << " ms (" << bvh.stats().visibleLights << " visible, " << bvh.stats().culledLights << " culled)" << std::endl;
+}
 
 // renderQuad() renders a 1x1 XY quad in NDC
 // -----------------------------------------
@@ -847,50 +1828,35 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     }
 }
 
-// utility function for loading a 2D texture from file
-// ---------------------------------------------------
+// utility function for loading a 2D texture from file, decoded in the background by the shared TextureLoader
+// ---------------------------------------------------------------------------------------------------------
 unsigned int loadTexture(char const * path, bool gammaCorrection)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum internalFormat;
-        GLenum dataFormat;
-        if (nrComponents == 1)
-        {
-            internalFormat = dataFormat = GL_RED;
-        }
-        else if (nrComponents == 3)
-        {
-            internalFormat = gammaCorrection ? GL_SRGB : GL_RGB;
-            dataFormat = GL_RGB;
-        }
-        else if (nrComponents == 4)
-        {
-            internalFormat = gammaCorrection ? GL_SRGB_ALPHA : GL_RGBA;
-            dataFormat = GL_RGBA;
-        }
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, dataFormat, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, internalFormat == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT); // use GL_CLAMP_TO_EDGE to prevent semi-transparent borders. Due to interpolation it takes texels from next repeat 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, internalFormat == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return TextureLoader::shared().load(path, gammaCorrection, true);
+}
 
-        stbi_image_free(data);
-    }
-    else
+// the first model at the first position and count - 1 copies of it around, on a square spiral
+void placeInstances(std::vector<glm::vec3>& positions, std::vector<Model*>& models, Model* model, size_t count)
+{
+    const float spacing = 1.5f;
+    const glm::vec3 center = positions.empty() ? glm::vec3(0.0f, 1.0f, 0.0f) : positions[0];
+    positions.resize(count);
+    models.resize(count);
+    for (size_t i = 0; i < count; i++)
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        models[i] = model;
+        if (i == 0)
+            continue;
+        // ring r holds the 8r cells whose larger coordinate is r, walked one side of 2r cells after the other
+        int ring = int(std::ceil((std::sqrt(double(i) + 1.0) - 1.0) * 0.5));
+        int offset = int(i) - (2 * ring - 1) * (2 * ring - 1);
+        int side = offset / (2 * ring);
+        int step = offset % (2 * ring);
+        int x, z;
+        if (side == 0) { x = ring; z = -ring + 1 + step; }
+        else if (side == 1) { x = ring - 1 - step; z = ring; }
+        else if (side == 2) { x = -ring; z = ring - 1 - step; }
+        else { x = -ring + 1 + step; z = -ring; }
+        positions[i] = center + glm::vec3(float(x), 0.0f, float(z)) * spacing;
     }
-
-    return textureID;
-}
\ No newline at end of file
+}
@@ -0,0 +1,392 @@
+#include "block_compression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+// quantizes a 0-255 color to RGB565
+uint16_t packColor565(const float color[3])
+{
+    int r = int(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    int g = int(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+    int b = int(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    return uint16_t((r << 11) | (g << 5) | b);
+}
+
+// expands RGB565 to 0-255 by replicating the high bits, the way the hardware does
+void unpackColor565(uint16_t packed, int color[3])
+{
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+// colors of a BC1 block, the fourth one is transparent black in three color mode
+void colorPalette(uint16_t c0, uint16_t c1, bool fourColor, int palette[4][4])
+{
+    unpackColor565(c0, palette[0]);
+    unpackColor565(c1, palette[1]);
+    palette[0][3] = palette[1][3] = 255;
+    for (int c = 0; c < 3; c++)
+    {
+        if (fourColor)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        else
+        {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+    palette[2][3] = 255;
+    palette[3][3] = fourColor ? 255 : 0;
+}
+
+// values of an alpha (BC3) or red (BC4) block
+void alphaPalette(int a0, int a1, int palette[8])
+{
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0 > a1)
+    {
+        for (int k = 2; k < 8; k++)
+            palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+    }
+    else
+    {
+        for (int k = 2; k < 6; k++)
+            palette[k] = ((6 - k) * a0 + (k - 1) * a1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+// copies the 4x4 RGBA block at block coordinates (bx, by), texels past the edges repeat the last row/column
+void loadBlock(const unsigned char* rgba, int width, int height, int bx, int by, unsigned char block[64])
+{
+    for (int y = 0; y < 4; y++)
+    {
+        const unsigned char* row = rgba + size_t(std::min(by * 4 + y, height - 1)) * width * 4;
+        for (int x = 0; x < 4; x++)
+            memcpy(block + (y * 4 + x) * 4, row + std::min(bx * 4 + x, width - 1) * 4, 4);
+    }
+}
+
+// picks the closest of the four colors for every texel, returns the squared error of the block
+unsigned int fitColorIndices(const unsigned char block[64], uint16_t c0, uint16_t c1, unsigned char indices[16])
+{
+    int palette[4][4];
+    colorPalette(c0, c1, true, palette);
+    unsigned int error = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        unsigned int best = ~0u;
+        for (int p = 0; p < 4; p++)
+        {
+            int dr = block[i * 4] - palette[p][0];
+            int dg = block[i * 4 + 1] - palette[p][1];
+            int db = block[i * 4 + 2] - palette[p][2];
+            unsigned int distance = unsigned(dr * dr + dg * dg + db * db);
+            if (distance < best)
+            {
+                best = distance;
+                indices[i] = (unsigned char)p;
+            }
+        }
+        error += best;
+    }
+    return error;
+}
+
+// BC1 color block: endpoints along the principal axis of the colors, then refined by least squares
+void encodeColorBlock(const unsigned char block[64], unsigned char out[8])
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; i++)
+    {
+        for (int c = 0; c < 3; c++)
+            mean[c] += block[i * 4 + c];
+    }
+    for (int c = 0; c < 3; c++)
+        mean[c] /= 16.0f;
+
+    // covariance xx, xy, xz, yy, yz, zz
+    float covariance[6] = {};
+    for (int i = 0; i < 16; i++)
+    {
+        float r = block[i * 4] - mean[0], g = block[i * 4 + 1] - mean[1], b = block[i * 4 + 2] - mean[2];
+        covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+        covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+    }
+
+    // principal axis by power iteration
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+        float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+        float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+        float scale = std::max(std::fabs(x), std::max(std::fabs(y), std::fabs(z)));
+        if (scale < 1e-6f)
+            break;
+        axis[0] = x / scale; axis[1] = y / scale; axis[2] = z / scale;
+    }
+    float length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+
+    float endpoint0[3], endpoint1[3];
+    if (length < 1e-6f)
+    {
+        // flat block
+        memcpy(endpoint0, mean, sizeof(mean));
+        memcpy(endpoint1, mean, sizeof(mean));
+    }
+    else
+    {
+        for (int c = 0; c < 3; c++)
+            axis[c] /= length;
+        float minT = 0.0f, maxT = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            float t = (block[i * 4] - mean[0]) * axis[0] + (block[i * 4 + 1] - mean[1]) * axis[1] + (block[i * 4 + 2] - mean[2]) * axis[2];
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            endpoint0[c] = mean[c] + axis[c] * maxT;
+            endpoint1[c] = mean[c] + axis[c] * minT;
+        }
+    }
+
+    uint16_t c0 = packColor565(endpoint0), c1 = packColor565(endpoint1);
+    unsigned char indices[16];
+    unsigned int error = fitColorIndices(block, c0, c1, indices);
+
+    // least squares endpoints for the chosen indices, kept while they lower the error
+    static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+    for (int iteration = 0; iteration < 2 && error > 0 && c0 != c1; iteration++)
+    {
+        float aa = 0.0f, bb = 0.0f, ab = 0.0f, ax[3] = {}, bx[3] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            float a = weights[indices[i]], b = 1.0f - a;
+            aa += a * a; bb += b * b; ab += a * b;
+            for (int c = 0; c < 3; c++)
+            {
+                ax[c] += a * block[i * 4 + c];
+                bx[c] += b * block[i * 4 + c];
+            }
+        }
+        float determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) < 1e-6f)
+            break;
+        for (int c = 0; c < 3; c++)
+        {
+            endpoint0[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+            endpoint1[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+        }
+        uint16_t refined0 = packColor565(endpoint0), refined1 = packColor565(endpoint1);
+        unsigned char refinedIndices[16];
+        unsigned int refinedError = fitColorIndices(block, refined0, refined1, refinedIndices);
+        if (refinedError >= error)
+            break;
+        c0 = refined0;
+        c1 = refined1;
+        error = refinedError;
+        memcpy(indices, refinedIndices, sizeof(indices));
+    }
+
+    // four color mode needs c0 > c1, swapping the endpoints mirrors the palette
+    if (c0 < c1)
+    {
+        std::swap(c0, c1);
+        for (int i = 0; i < 16; i++)
+            indices[i] ^= 1;
+    }
+    else if (c0 == c1)
+    {
+        memset(indices, 0, sizeof(indices));
+    }
+
+    out[0] = (unsigned char)(c0 & 0xff);
+    out[1] = (unsigned char)(c0 >> 8);
+    out[2] = (unsigned char)(c1 & 0xff);
+    out[3] = (unsigned char)(c1 >> 8);
+    for (int row = 0; row < 4; row++)
+    {
+        out[4 + row] = (unsigned char)(indices[row * 4] | (indices[row * 4 + 1] << 2) | (indices[row * 4 + 2] << 4) | (indices[row * 4 + 3] << 6));
+    }
+}
+
+// BC3 alpha / BC4 block of one channel: the range of the values in eight steps
+void encodeAlphaBlock(const unsigned char values[16], unsigned char out[8])
+{
+    int a0 = values[0], a1 = values[0];
+    for (int i = 1; i < 16; i++)
+    {
+        a0 = std::max(a0, int(values[i]));
+        a1 = std::min(a1, int(values[i]));
+    }
+    out[0] = (unsigned char)a0;
+    out[1] = (unsigned char)a1;
+
+    int palette[8];
+    alphaPalette(a0, a1, palette);
+    uint64_t bits = 0;
+    if (a0 != a1)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            for (int k = 1; k < 8; k++)
+            {
+                if (std::abs(values[i] - palette[k]) < std::abs(values[i] - palette[best]))
+                    best = k;
+            }
+            bits |= uint64_t(best) << (3 * i);
+        }
+    }
+    for (int i = 0; i < 6; i++)
+        out[2 + i] = (unsigned char)(bits >> (8 * i));
+}
+
+void decodeColorBlock(const unsigned char in[8], bool alwaysFourColor, unsigned char block[64])
+{
+    uint16_t c0 = uint16_t(in[0] | (in[1] << 8));
+    uint16_t c1 = uint16_t(in[2] | (in[3] << 8));
+    int palette[4][4];
+    colorPalette(c0, c1, alwaysFourColor || c0 > c1, palette);
+    for (int i = 0; i < 16; i++)
+    {
+        int index = (in[4 + i / 4] >> (2 * (i % 4))) & 3;
+        for (int c = 0; c < 4; c++)
+            block[i * 4 + c] = (unsigned char)palette[index][c];
+    }
+}
+
+// writes the decoded channel to every stride-th byte of values
+void decodeAlphaBlock(const unsigned char in[8], unsigned char* values, int stride)
+{
+    int palette[8];
+    alphaPalette(in[0], in[1], palette);
+    uint64_t bits = 0;
+    for (int i = 0; i < 6; i++)
+        bits |= uint64_t(in[2 + i]) << (8 * i);
+    for (int i = 0; i < 16; i++)
+        values[i * stride] = (unsigned char)palette[(bits >> (3 * i)) & 7];
+}
+
+}
+
+size_t blockBytes(BlockFormat format)
+{
+    return format == BlockFormat::BC3 ? 16 : 8;
+}
+
+size_t compressedSize(BlockFormat format, int width, int height)
+{
+    return size_t((width + 3) / 4) * size_t((height + 3) / 4) * blockBytes(format);
+}
+
+const char* blockFormatName(BlockFormat format)
+{
+    switch (format)
+    {
+    case BlockFormat::BC1: return "BC1";
+    case BlockFormat::BC3: return "BC3";
+    default: return "BC4";
+    }
+}
+
+BlockFormat chooseBlockFormat(const unsigned char* rgba, int width, int height, int components)
+{
+    if (components == 1)
+        return BlockFormat::BC4;
+    if (components == 3)
+        return BlockFormat::BC1;
+    const size_t texels = size_t(width) * height;
+    for (size_t i = 0; i < texels; i++)
+    {
+        if (rgba[i * 4 + 3] != 255)
+            return BlockFormat::BC3;
+    }
+    return BlockFormat::BC1;
+}
+
+void compressImage(const unsigned char* rgba, int width, int height, BlockFormat format, unsigned char* blocks)
+{
+    const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    unsigned char block[64], channel[16];
+    for (int by = 0; by < blocksY; by++)
+    {
+        for (int bx = 0; bx < blocksX; bx++)
+        {
+            loadBlock(rgba, width, height, bx, by, block);
+            switch (format)
+            {
+            case BlockFormat::BC1:
+                encodeColorBlock(block, blocks);
+                break;
+            case BlockFormat::BC3:
+                for (int i = 0; i < 16; i++)
+                    channel[i] = block[i * 4 + 3];
+                encodeAlphaBlock(channel, blocks);
+                encodeColorBlock(block, blocks + 8);
+                break;
+            case BlockFormat::BC4:
+                for (int i = 0; i < 16; i++)
+                    channel[i] = block[i * 4];
+                encodeAlphaBlock(channel, blocks);
+                break;
+            }
+            blocks += blockBytes(format);
+        }
+    }
+}
+
+void decompressImage(const unsigned char* blocks, int width, int height, BlockFormat format, unsigned char* rgba)
+{
+    const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    unsigned char block[64];
+    for (int by = 0; by < blocksY; by++)
+    {
+        for (int bx = 0; bx < blocksX; bx++)
+        {
+            switch (format)
+            {
+            case BlockFormat::BC1:
+                decodeColorBlock(blocks, false, block);
+                break;
+            case BlockFormat::BC3:
+                // the color half of BC3 is always in four color mode
+                decodeColorBlock(blocks + 8, true, block);
+                decodeAlphaBlock(blocks, block + 3, 4);
+                break;
+            case BlockFormat::BC4:
+                decodeAlphaBlock(blocks, block, 4);
+                for (int i = 0; i < 16; i++)
+                {
+                    block[i * 4 + 1] = block[i * 4 + 2] = block[i * 4];
+                    block[i * 4 + 3] = 255;
+                }
+                break;
+            }
+            blocks += blockBytes(format);
+
+            // only the texels inside the image
+            for (int y = 0; y < 4 && by * 4 + y < height; y++)
+            {
+                int columns = std::min(4, width - bx * 4);
+                memcpy(rgba + (size_t(by * 4 + y) * width + bx * 4) * 4, block + y * 16, size_t(columns) * 4);
+            }
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef _BLOCK_COMPRESSION_H_
+#define _BLOCK_COMPRESSION_H_
+
+#include <cstddef>
+
+// GPU block compressed formats, every 4x4 texel block is encoded in a fixed number of bytes
+enum class BlockFormat {
+    BC1,                          // RGB, 8 bytes per block (DXT1)
+    BC3,                          // RGBA, BC1 color plus an interpolated alpha block, 16 bytes per block (DXT5)
+    BC4                           // single channel, 8 bytes per block (RGTC1)
+};
+
+// bytes of one 4x4 block
+size_t blockBytes(BlockFormat format);
+// bytes of a width x height image, partial blocks at the edges count as whole ones
+size_t compressedSize(BlockFormat format, int width, int height);
+// short name for logging
+const char* blockFormatName(BlockFormat format);
+
+// Picks the format for an RGBA8 image decoded from a file with the given number of channels. Images
+// whose alpha channel is fully opaque get BC1.
+BlockFormat chooseBlockFormat(const unsigned char* rgba, int width, int height, int components);
+
+// Encodes an RGBA8 image into compressedSize(format, width, height) bytes at blocks. BC4 encodes the red channel.
+void compressImage(const unsigned char* rgba, int width, int height, BlockFormat format, unsigned char* blocks);
+
+// Decodes blocks back to RGBA8 (width * height * 4 bytes). BC4 is replicated into RGB with opaque alpha.
+// This is the software path for drivers without the format and for headless verification.
+void decompressImage(const unsigned char* blocks, int width, int height, BlockFormat format, unsigned char* rgba);
+
+
+#endif
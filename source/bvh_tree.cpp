@@ -0,0 +1,185 @@
+#include "bvh_tree.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <numeric>
+
+namespace {
+
+double boxArea(const glm::vec3& min, const glm::vec3& max)
+{
+    glm::vec3 extent = glm::max(max - min, glm::vec3(0.0f));
+    return 2.0 * (double(extent.x) * extent.y + double(extent.y) * extent.z + double(extent.z) * extent.x);
+}
+
+}
+
+const uint32_t BvhTree::NONE;
+const uint32_t BvhTree::ALL_PLANES;
+
+BvhTree::BvhTree()
+    :
+    build_area(0.0)
+{
+}
+
+void BvhTree::split(size_t leafSize, size_t slotAlign)
+{
+    const size_t count = build_centers.size();
+    tree_nodes.clear();
+    leaf_nodes.clear();
+    slot_items.clear();
+    item_leaf.assign(count, 0);
+    item_slot.assign(count, 0);
+    build_order.resize(count);
+    std::iota(build_order.begin(), build_order.end(), 0u);
+
+    Node root = {};
+    root.min = glm::vec3(FLT_MAX);
+    root.max = glm::vec3(-FLT_MAX);
+    root.parent = NONE;
+    tree_nodes.reserve(count / 2 + 1);
+    tree_nodes.push_back(root);
+    if (count > 0)
+        splitNode(0, 0, count, leafSize, slotAlign);
+}
+
+void BvhTree::splitNode(uint32_t node, size_t begin, size_t end, size_t leafSize, size_t slotAlign)
+{
+    const uint32_t first = uint32_t(slot_items.size());
+    if (end - begin <= leafSize)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            item_leaf[build_order[i]] = node;
+            item_slot[build_order[i]] = uint32_t(slot_items.size());
+            slot_items.push_back(build_order[i]);
+        }
+        while (slot_items.size() % slotAlign)
+            slot_items.push_back(NONE);
+        tree_nodes[node].first = first;
+        tree_nodes[node].count = uint32_t(slot_items.size()) - first;
+        tree_nodes[node].child = 0;
+        leaf_nodes.push_back(node);
+        return;
+    }
+
+    // split at the median of the centers along the longest axis of their bounds
+    glm::vec3 centerMin(FLT_MAX), centerMax(-FLT_MAX);
+    for (size_t i = begin; i < end; i++)
+    {
+        centerMin = glm::min(centerMin, build_centers[build_order[i]]);
+        centerMax = glm::max(centerMax, build_centers[build_order[i]]);
+    }
+    glm::vec3 extent = centerMax - centerMin;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    size_t middle = begin + (end - begin) / 2;
+    const std::vector<glm::vec3>& centers = build_centers;
+    std::nth_element(build_order.begin() + begin, build_order.begin() + middle, build_order.begin() + end,
+        [&centers, axis](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+
+    Node child = {};
+    child.parent = node;
+    uint32_t left = uint32_t(tree_nodes.size());
+    tree_nodes.push_back(child);
+    tree_nodes.push_back(child);
+    tree_nodes[node].child = left;
+    tree_nodes[node].first = first;
+    splitNode(left, begin, middle, leafSize, slotAlign);
+    splitNode(left + 1, middle, end, leafSize, slotAlign);
+    tree_nodes[node].count = uint32_t(slot_items.size()) - first;
+}
+
+void BvhTree::mergeChildren(uint32_t node)
+{
+    const Node& left = tree_nodes[tree_nodes[node].child];
+    const Node& right = tree_nodes[tree_nodes[node].child + 1];
+    tree_nodes[node].min = glm::min(left.min, right.min);
+    tree_nodes[node].max = glm::max(left.max, right.max);
+}
+
+void BvhTree::finishBuild()
+{
+    mergeAll();
+    refit_marks.assign(tree_nodes.size(), 0);
+    build_area = leafArea();
+}
+
+bool BvhTree::markRefit(uint32_t item)
+{
+    uint32_t leaf = item_leaf[item];
+    if (refit_marks[leaf])
+        return false;
+    refit_marks[leaf] = 1;
+    refit_nodes.push_back(leaf);
+    // collect the ancestors, up to the first one an earlier leaf already collected
+    for (uint32_t node = tree_nodes[leaf].parent; node != NONE && !refit_marks[node]; node = tree_nodes[node].parent)
+    {
+        refit_marks[node] = 1;
+        refit_nodes.push_back(node);
+    }
+    return true;
+}
+
+void BvhTree::refitMarked()
+{
+    // children come after their parent, merging in reverse index order sees every child refit first
+    std::sort(refit_nodes.begin(), refit_nodes.end(), [](uint32_t a, uint32_t b) { return a > b; });
+    for (uint32_t node : refit_nodes)
+    {
+        if (tree_nodes[node].child)
+            mergeChildren(node);
+        refit_marks[node] = 0;
+    }
+    refit_nodes.clear();
+}
+
+void BvhTree::mergeAll()
+{
+    for (size_t node = tree_nodes.size(); node-- > 0;)
+    {
+        if (tree_nodes[node].child)
+            mergeChildren(uint32_t(node));
+    }
+}
+
+double BvhTree::leafArea() const
+{
+    double area = 0.0;
+    for (uint32_t leaf : leaf_nodes)
+        area += boxArea(tree_nodes[leaf].min, tree_nodes[leaf].max);
+    return area;
+}
+
+void BvhTree::frustumPlanes(const glm::mat4& viewProjection, glm::vec4* planes)
+{
+    // planes from the rows of the view projection
+    glm::vec4 rows[4];
+    for (int row = 0; row < 4; row++)
+        rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+    for (int plane = 0; plane < 6; plane++)
+    {
+        glm::vec4 equation = (plane & 1) ? rows[3] - rows[plane / 2] : rows[3] + rows[plane / 2];
+        planes[plane] = equation / glm::length(glm::vec3(equation));
+    }
+}
+
+bool BvhTree::boxInFrustum(const glm::vec4* planes, const glm::vec3& min, const glm::vec3& max, uint32_t& mask)
+{
+    for (int plane = 0; plane < 6; plane++)
+    {
+        if (!(mask & (1u << plane)))
+            continue;
+        const glm::vec4& p = planes[plane];
+        // the corner farthest along the normal decides outside, the nearest one fully inside
+        float farthest = p.w + p.x * (p.x > 0.0f ? max.x : min.x) + p.y * (p.y > 0.0f ? max.y : min.y)
+            + p.z * (p.z > 0.0f ? max.z : min.z);
+        if (farthest < 0.0f)
+            return false;
+        float nearest = p.w + p.x * (p.x > 0.0f ? min.x : max.x) + p.y * (p.y > 0.0f ? min.y : max.y)
+            + p.z * (p.z > 0.0f ? min.z : max.z);
+        if (nearest >= 0.0f)
+            mask &= ~(1u << plane);
+    }
+    return true;
+}
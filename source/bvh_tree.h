@@ -0,0 +1,143 @@
+#ifndef _BVH_TREE_H_
+#define _BVH_TREE_H_
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The part of a bounding volume hierarchy LightBvh and SceneBvh share: median split builds over items (lights,
+// objects) by their centers, refits after items moved and the frustum walk. The tree keeps the items in slot order
+// and the leaf and slot of every item; what an item's bounds are is left to the owner, which computes the box of a
+// leaf from the items in its slots and hands it over with setBounds(). No GL calls.
+class BvhTree
+{
+public:
+    // inner nodes have two children at child and child + 1, leaves have child 0. Every node covers the slots
+    // [first, first + count) of the tree ordered items
+    struct Node {
+        glm::vec3 min;
+        uint32_t first;
+        glm::vec3 max;
+        uint32_t count;
+        uint32_t child;
+        uint32_t parent;
+    };
+
+    // a subtree still to cull and the planes it straddles
+    struct CullTask {
+        uint32_t node;
+        uint32_t planes;
+    };
+
+    // item of a padding slot, parent of the root
+    static const uint32_t NONE = UINT32_MAX;
+    static const uint32_t ALL_PLANES = 0x3F;
+
+    BvhTree();
+
+    // Rebuild over count items, center(item) places an item for the splits. Leaves hold at most leafSize items
+    // and are padded with NONE slots to a multiple of slotAlign. The owner then bounds every leaf and calls
+    // finishBuild(), which merges the inner nodes and keeps the leaf area degraded() compares against.
+    template <typename Center>
+    void build(size_t count, size_t leafSize, size_t slotAlign, Center center)
+    {
+        build_centers.resize(count);
+        for (size_t item = 0; item < count; item++)
+            build_centers[item] = center(uint32_t(item));
+        split(leafSize, slotAlign);
+    }
+    void finishBuild();
+
+    // Partial refit: markRefit() collects the leaf of a moved item and its ancestors, and returns true when the
+    // leaf wasn't collected yet so the owner bounds it again. refitMarked() then merges the collected ancestors.
+    bool markRefit(uint32_t item);
+    void refitMarked();
+    // merge every inner node from its children, after the owner bounded all the leaves
+    void mergeAll();
+    // items that moved far from where the tree put them leave overlapping, oversized nodes behind. True once the
+    // leaf boxes add up to much more than they did when the tree was built
+    bool degraded() const { return leafArea() > 2.0 * build_area; }
+
+    void setBounds(uint32_t node, const glm::vec3& min, const glm::vec3& max)
+    {
+        tree_nodes[node].min = min;
+        tree_nodes[node].max = max;
+    }
+
+    // Walk the subtree of root against frustum planes the node is known to straddle (mask), inside(node) for every
+    // subtree inside all of them and leaf(node, mask) for every straddling leaf. Returns the nodes visited.
+    template <typename Inside, typename Leaf>
+    size_t cull(const glm::vec4* planes, uint32_t root, uint32_t mask, Inside inside, Leaf leaf) const
+    {
+        size_t visited = 0;
+        // the tree is balanced, its depth stays far below the stack size
+        CullTask stack[64];
+        int top = 0;
+        stack[top++] = { root, mask };
+        while (top > 0)
+        {
+            CullTask task = stack[--top];
+            const Node& node = tree_nodes[task.node];
+            visited++;
+            if (task.planes && !boxInFrustum(planes, node.min, node.max, task.planes))
+                continue;
+            if (task.planes == 0)
+            {
+                inside(node);
+            }
+            else if (node.child == 0)
+            {
+                leaf(node, task.planes);
+            }
+            else
+            {
+                stack[top++] = { node.child + 1, task.planes };
+                stack[top++] = { node.child, task.planes };
+            }
+        }
+        return visited;
+    }
+
+    // planes (xyz normal, w distance) of the frustum of a view projection, left, right, bottom, top, near and far
+    static void frustumPlanes(const glm::mat4& viewProjection, glm::vec4* planes);
+    // false when the box is outside one of the planes in mask, clears the planes it is fully inside of
+    static bool boxInFrustum(const glm::vec4* planes, const glm::vec3& min, const glm::vec3& max, uint32_t& mask);
+
+    bool empty() const { return tree_nodes.empty() || tree_nodes[0].count == 0; }
+    const std::vector<Node>& nodes() const { return tree_nodes; }
+    const std::vector<uint32_t>& leaves() const { return leaf_nodes; }
+    // item of every slot, NONE for padding
+    const std::vector<uint32_t>& slots() const { return slot_items; }
+    size_t itemCount() const { return item_leaf.size(); }
+    uint32_t itemLeaf(uint32_t item) const { return item_leaf[item]; }
+    uint32_t itemSlot(uint32_t item) const { return item_slot[item]; }
+
+private:
+    BvhTree(const BvhTree&) = delete;
+    BvhTree& operator=(const BvhTree&) = delete;
+
+    void split(size_t leafSize, size_t slotAlign);
+    // split the items [begin, end) of the build order into the subtree of node
+    void splitNode(uint32_t node, size_t begin, size_t end, size_t leafSize, size_t slotAlign);
+    void mergeChildren(uint32_t node);
+    // sum of the leaf box areas, how loose the tree has become since it was built
+    double leafArea() const;
+
+    std::vector<Node> tree_nodes;
+    std::vector<uint32_t> leaf_nodes;
+    std::vector<uint32_t> slot_items;
+    std::vector<uint32_t> item_leaf;
+    std::vector<uint32_t> item_slot;
+    // scratch of build()
+    std::vector<glm::vec3> build_centers;
+    std::vector<uint32_t> build_order;
+    // scratch of the partial refit, marked nodes are cleared again after it
+    std::vector<uint8_t> refit_marks;
+    std::vector<uint32_t> refit_nodes;
+    double build_area;
+};
+
+
+#endif
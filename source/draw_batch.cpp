@@ -0,0 +1,220 @@
+#include "draw_batch.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <functional>
+
+DrawBatch::DrawBatch()
+    :
+    instancing(true),
+    calls(0),
+    instanced_calls(0),
+    instances(0),
+    transform_buffer(0),
+    transform_texture(0),
+    instance_buffer(0),
+    instance_texture(0)
+{
+    glGenBuffers(1, &transform_buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, transform_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, OBJECT_TEXELS * sizeof(glm::vec4), NULL, GL_STREAM_DRAW);
+    glGenTextures(1, &transform_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, transform_texture);
+    // an object is OBJECT_TEXELS RGBA32F texels, a matrix one per column
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, transform_buffer);
+
+    glGenBuffers(1, &instance_buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, instance_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(GLint), NULL, GL_STREAM_DRAW);
+    glGenTextures(1, &instance_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, instance_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, instance_buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void DrawBatch::clear()
+{
+    objects.clear();
+    draws.clear();
+}
+
+unsigned int DrawBatch::addObject(const glm::mat4& transform, const Material& material)
+{
+    // the normal matrix is the same for every vertex of the object, computed once here instead of per vertex
+    glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+    for (int column = 0; column < 4; column++)
+        objects.push_back(transform[column]);
+    for (int column = 0; column < 3; column++)
+        objects.push_back(glm::vec4(normalMatrix[column], material.diffuse[column]));
+    objects.push_back(material.specular);
+    return (unsigned int)(objects.size() / OBJECT_TEXELS) - 1;
+}
+
+void DrawBatch::add(Mesh& mesh, unsigned int object, unsigned int firstIndex, unsigned int count)
+{
+    if (count == 0)
+        return;
+
+    // extend the previous draw when the range continues it
+    if (!draws.empty())
+    {
+        Draw& last = draws.back();
+        if (last.mesh == &mesh && last.object == object && last.firstIndex + last.count == firstIndex)
+        {
+            last.count += count;
+            return;
+        }
+    }
+    draws.push_back(Draw{ &mesh, object, firstIndex, count });
+}
+
+size_t DrawBatch::submit(Shader& shader)
+{
+    calls = 0;
+    instanced_calls = 0;
+    instances = 0;
+    if (objects.empty())
+        return 0;
+
+    // every object is its own entry of the object list, the instances of the instanced draws follow
+    const size_t objectCount = objects.size() / OBJECT_TEXELS;
+    object_list.resize(objectCount);
+    for (size_t i = 0; i < objectCount; i++)
+        object_list[i] = GLint(i);
+
+    // sort the draws by range to find the ones drawn for several objects, grouped by arena and textures
+    instanced_draws.clear();
+    instanced.assign(draws.size(), 0);
+    if (instancing && draws.size() >= MIN_INSTANCES)
+    {
+        order.resize(draws.size());
+        for (size_t i = 0; i < draws.size(); i++)
+            order[i] = (unsigned int)i;
+        const std::vector<Draw>& all = draws;
+        std::sort(order.begin(), order.end(), [&all](unsigned int a, unsigned int b) {
+            const Draw& x = all[a];
+            const Draw& y = all[b];
+            if (x.mesh->arena != y.mesh->arena)
+                return std::less<GeometryArena*>()(x.mesh->arena, y.mesh->arena);
+            if (x.mesh != y.mesh)
+                return std::less<Mesh*>()(x.mesh, y.mesh);
+            if (x.firstIndex != y.firstIndex)
+                return x.firstIndex < y.firstIndex;
+            if (x.count != y.count)
+                return x.count < y.count;
+            return a < b;
+        });
+        for (size_t begin = 0; begin < order.size(); )
+        {
+            const Draw& first = draws[order[begin]];
+            size_t end = begin + 1;
+            while (end < order.size() && draws[order[end]].mesh == first.mesh && draws[order[end]].firstIndex == first.firstIndex &&
+                draws[order[end]].count == first.count)
+            {
+                end++;
+            }
+            if (end - begin >= MIN_INSTANCES)
+            {
+                instanced_draws.push_back(Instanced{ first.mesh, first.firstIndex, first.count, (unsigned int)object_list.size(),
+                    (unsigned int)(end - begin) });
+                for (size_t i = begin; i < end; i++)
+                {
+                    object_list.push_back(GLint(draws[order[i]].object));
+                    instanced[order[i]] = 1;
+                }
+            }
+            begin = end;
+        }
+    }
+
+    // orphan and refill the object buffers
+    glBindBuffer(GL_TEXTURE_BUFFER, transform_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, objects.size() * sizeof(glm::vec4), objects.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, instance_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, object_list.size() * sizeof(GLint), object_list.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0 + TRANSFORM_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, transform_texture);
+    glActiveTexture(GL_TEXTURE0 + INSTANCE_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, instance_texture);
+    glActiveTexture(GL_TEXTURE0);
+    shader.setUniformInt("objectData", TRANSFORM_TEXTURE_UNIT);
+    shader.setUniformInt("objectInstances", INSTANCE_TEXTURE_UNIT);
+
+    size_t triangles = 0;
+    GLuint boundVAO = 0;
+    int boundObject = -1;
+    for (const Instanced& draw : instanced_draws)
+    {
+        GeometryArena* arena = draw.mesh->arena;
+        draw.mesh->bindTextures(shader);
+        if (int(draw.first) != boundObject)
+        {
+            shader.setUniformInt("objectIndex", int(draw.first));
+            boundObject = int(draw.first);
+        }
+        if (arena->vao() != boundVAO)
+        {
+            glBindVertexArray(arena->vao());
+            boundVAO = arena->vao();
+        }
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, GLsizei(draw.count), arena->indexType(),
+            (void*)(size_t(draw.mesh->firstIndex + draw.firstIndex) * arena->indexSize()), GLsizei(draw.instances), draw.mesh->baseVertex);
+        triangles += size_t(draw.count / 3) * draw.instances;
+        instances += draw.instances;
+        instanced_calls++;
+        calls++;
+    }
+
+    // the rest in the order they were added
+    order.clear();
+    for (size_t i = 0; i < draws.size(); i++)
+    {
+        if (!instanced[i])
+            order.push_back((unsigned int)i);
+    }
+    for (size_t begin = 0; begin < order.size(); )
+    {
+        // a run shares the arena, the object and the textures (meshes without textures share them all)
+        const Draw& first = draws[order[begin]];
+        GeometryArena* arena = first.mesh->arena;
+        const Mesh* textured = first.mesh->textures.empty() ? nullptr : first.mesh;
+        size_t end = begin + 1;
+        while (end < order.size() && draws[order[end]].mesh->arena == arena && draws[order[end]].object == first.object &&
+            (draws[order[end]].mesh->textures.empty() ? nullptr : draws[order[end]].mesh) == textured)
+        {
+            end++;
+        }
+
+        counts.clear();
+        offsets.clear();
+        base_vertices.clear();
+        for (size_t i = begin; i < end; i++)
+        {
+            const Draw& draw = draws[order[i]];
+            counts.push_back(GLsizei(draw.count));
+            offsets.push_back((void*)(size_t(draw.mesh->firstIndex + draw.firstIndex) * arena->indexSize()));
+            base_vertices.push_back(draw.mesh->baseVertex);
+            triangles += draw.count / 3;
+        }
+
+        first.mesh->bindTextures(shader);
+        if (int(first.object) != boundObject)
+        {
+            shader.setUniformInt("objectIndex", int(first.object));
+            boundObject = int(first.object);
+        }
+        if (arena->vao() != boundVAO)
+        {
+            glBindVertexArray(arena->vao());
+            boundVAO = arena->vao();
+        }
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), arena->indexType(), offsets.data(), GLsizei(counts.size()), base_vertices.data());
+        calls++;
+        begin = end;
+    }
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+    return triangles;
+}
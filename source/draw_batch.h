@@ -0,0 +1,106 @@
+#ifndef _DRAW_BATCH_H_
+#define _DRAW_BATCH_H_
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+
+#include "shader_s.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Mesh;
+
+// Collects the draws of a render pass and submits them grouped by what they draw. Draws of the same index range
+// of a mesh for several objects (copies of a model at the same level of detail) become one
+// glDrawElementsInstancedBaseVertex, the rest go out with glMultiDrawElementsBaseVertex, one call per run of draws
+// sharing a geometry arena, an object and textures. The objects go to a texture buffer the vertex shader reads
+// with texelFetch: OBJECT_TEXELS RGBA32F texels per object holding its transform, its normal matrix and its
+// material (objectData sampler). A second buffer lists the objects of every draw, the shader finds its object at
+// objectIndex + gl_InstanceID (objectInstances sampler, objectIndex uniform); its first entries are the objects
+// themselves, so a draw of a single object just sets objectIndex to the object.
+class DrawBatch
+{
+public:
+    // per object parameters of the geometry pass
+    struct Material {
+        glm::vec3 diffuse;
+        glm::vec4 specular;       // rgb color, a intensity
+    };
+
+    // texture units of the objectData and objectInstances samplerBuffers
+    static const GLint TRANSFORM_TEXTURE_UNIT = 8;
+    static const GLint INSTANCE_TEXTURE_UNIT = 9;
+    // texels per object: the transform's columns, the normal matrix's columns with the diffuse color in w, specular
+    static const int OBJECT_TEXELS = 8;
+    // draws of the same range needed to draw it instanced
+    static const size_t MIN_INSTANCES = 2;
+
+    DrawBatch();
+    // GL objects are left to the context teardown
+
+    // Forget the draws and objects of the previous submit
+    void clear();
+    // Add an object, returns the objectIndex the shader uses to fetch it
+    unsigned int addObject(const glm::mat4& transform, const Material& material = Material{ glm::vec3(1.0f), glm::vec4(0.0f) });
+    // Whether submit() draws repeated ranges instanced, on by default
+    void setInstancing(bool enabled) { instancing = enabled; }
+    // Queue count indices of mesh starting at firstIndex (relative to the mesh's own first index)
+    void add(Mesh& mesh, unsigned int object, unsigned int firstIndex, unsigned int count);
+    // Upload the objects and issue the draws. The shader has to be in use. The object buffers stay
+    // bound so draws outside the batch can select one of its objects. Returns the triangles drawn.
+    size_t submit(Shader& shader);
+
+    size_t objectCount() const { return objects.size() / OBJECT_TEXELS; }
+    size_t drawCount() const { return draws.size(); }
+    // draw calls issued by the last submit, and of those the instanced ones and the draws they replaced
+    size_t callCount() const { return calls; }
+    size_t instancedCallCount() const { return instanced_calls; }
+    size_t instanceCount() const { return instances; }
+
+private:
+    struct Draw {
+        Mesh* mesh;
+        unsigned int object;
+        unsigned int firstIndex;
+        unsigned int count;
+    };
+
+    DrawBatch(const DrawBatch&) = delete;
+    DrawBatch& operator=(const DrawBatch&) = delete;
+
+    // draws of one range for several objects, whose objects are object_list[first, first + count)
+    struct Instanced {
+        Mesh* mesh;
+        unsigned int firstIndex;
+        unsigned int count;
+        unsigned int first;
+        unsigned int instances;
+    };
+
+    std::vector<glm::vec4> objects;
+    std::vector<Draw> draws;
+    bool instancing;
+    size_t calls;
+    size_t instanced_calls;
+    size_t instances;
+    GLuint transform_buffer;
+    GLuint transform_texture;
+    // objectIndex + gl_InstanceID to object, the objects themselves then the instances of every instanced draw
+    std::vector<GLint> object_list;
+    GLuint instance_buffer;
+    GLuint instance_texture;
+    // draws sorted by range, the instanced draws found in them and whether a draw is one of their instances
+    std::vector<unsigned int> order;
+    std::vector<Instanced> instanced_draws;
+    std::vector<uint8_t> instanced;
+    // glMultiDrawElementsBaseVertex arguments, kept to avoid allocating every frame
+    std::vector<GLsizei> counts;
+    std::vector<void*> offsets;
+    std::vector<GLint> base_vertices;
+};
+
+
+#endif
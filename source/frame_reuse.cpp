@@ -0,0 +1,90 @@
+#include "frame_reuse.h"
+
+#include "shadow_caster_tracker.h"
+
+FrameReuse::FrameReuse(int width, int height)
+    :
+    width(width),
+    height(height),
+    key(0),
+    invalidated(false),
+    rendered_key(0),
+    cached_key(0),
+    cached(false),
+    texture(0),
+    frame_stats()
+{
+}
+
+void FrameReuse::begin()
+{
+    key = ShadowCasterTracker::hash(nullptr, 0);
+    invalidated = false;
+}
+
+void FrameReuse::add(const void* data, size_t bytes)
+{
+    key = ShadowCasterTracker::hash(data, bytes, key);
+}
+
+void FrameReuse::invalidate()
+{
+    invalidated = true;
+}
+
+bool FrameReuse::reuse()
+{
+    if (cached && !invalidated && key == cached_key)
+    {
+        frame_stats.reusedFrames++;
+        frame_stats.idleFrames++;
+        return true;
+    }
+    // the cache holds a frame with other contents until this one is stored
+    rendered_key = key;
+    cached = false;
+    frame_stats.renderedFrames++;
+    frame_stats.idleFrames = 0;
+    return false;
+}
+
+void FrameReuse::createTarget()
+{
+    if (texture)
+        return;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    framebuffer.reset(new FrameBuffer(width, height));
+    framebuffer->attachShared(texture, GL_RGBA8);
+    framebuffer->check();
+}
+
+RenderGraph::Resource FrameReuse::import(RenderGraph& graph)
+{
+    createTarget();
+    return graph.importTexture("last frame", texture, RenderTextureDesc{ width, height, GL_RGBA8, GL_NEAREST, GL_CLAMP_TO_EDGE, 0 });
+}
+
+void FrameReuse::store()
+{
+    createTarget();
+    framebuffer->bindOutput();
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    cached_key = rendered_key;
+    cached = true;
+}
+
+void FrameReuse::present()
+{
+    createTarget();
+    framebuffer->bindRead();
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+}
@@ -0,0 +1,69 @@
+#ifndef _FRAME_REUSE_H_
+#define _FRAME_REUSE_H_
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include "framebuffer.h"
+#include "render_graph.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Reuse of the last lit frame while nothing it shows changes. Every frame builds a key from what the scene's image
+// depends on (camera, lights, materials, models, settings); when it matches the key of the last frame rendered,
+// reuse() says so and the frame only presents the cached image, the scene passes have no readers and the render graph
+// culls them. Rendered frames copy the scene into the cache before the UI is drawn on top, so only the UI is redrawn
+// over a reused frame. Work spread over frames (shadow maps still being drawn) invalidates the frame.
+class FrameReuse
+{
+public:
+    struct Stats {
+        size_t renderedFrames;
+        size_t reusedFrames;
+        size_t idleFrames;           // frames reused in a row, up to the last one
+    };
+
+    FrameReuse(int width, int height);
+    // GL objects are left to the context teardown
+
+    // Start the key of a new frame
+    void begin();
+    // Add something the image depends on, by its bytes
+    void add(const void* data, size_t bytes);
+    template <typename T>
+    void add(const T& value) { add(&value, sizeof(T)); }
+    // The frame differs from the last one whatever the key says
+    void invalidate();
+    // Whether the cached image is this frame's, once the key is complete. Call once per frame.
+    bool reuse();
+
+    // The cached image as a render graph resource
+    RenderGraph::Resource import(RenderGraph& graph);
+    // Copy the backbuffer into the cache, from a pass reading the finished scene and overwriting import()
+    void store();
+    // Copy the cache into the backbuffer, from a pass overwriting it
+    void present();
+
+    const Stats& stats() const { return frame_stats; }
+
+private:
+    FrameReuse(const FrameReuse&) = delete;
+    FrameReuse& operator=(const FrameReuse&) = delete;
+
+    void createTarget();
+
+    int width;
+    int height;
+    uint64_t key;
+    bool invalidated;
+    uint64_t rendered_key;       // of the frame being rendered, the cache's once store() ran
+    uint64_t cached_key;
+    bool cached;
+    GLuint texture;
+    std::unique_ptr<FrameBuffer> framebuffer;
+    Stats frame_stats;
+};
+
+
+#endif
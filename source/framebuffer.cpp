@@ -16,7 +16,8 @@ FrameBuffer::FrameBuffer()
     frame_id(0),
     depth_id(0),
     stencil_id(0),
-    buffers(0)
+    buffers(0),
+    has_depth(false)
 {
     glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &max_color_attachments);
     buffers = new GLenum[max_color_attachments];
@@ -31,7 +32,8 @@ FrameBuffer::FrameBuffer(int width_, int height_)
     frame_id(0),
     depth_id(0),
     stencil_id(0),
-    buffers(0)
+    buffers(0),
+    has_depth(false)
 {
     glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &max_color_attachments);
     buffers = new GLenum[max_color_attachments];
@@ -42,12 +44,10 @@ FrameBuffer::FrameBuffer(int width_, int height_)
 
 FrameBuffer::~FrameBuffer()
 {
-    GLuint tex_id;
-    vector<GLuint>::const_iterator cii;
-    for (cii = tex_ids.begin(); cii != tex_ids.end(); cii++)
+    for (size_t i = 0; i < tex_ids.size(); i++)
     {
-        tex_id = *cii;
-        glDeleteTextures(1, &tex_id);
+        if (tex_owned[i])
+            glDeleteTextures(1, &tex_ids[i]);
     }
 
     if (depth_id)
@@ -131,68 +131,14 @@ void FrameBuffer::attachTexture(GLenum iformat, GLint filter) throw(domain_error
         throw out_of_range("FrameBuffer::attachTexture - GL_MAX_COLOR_ATTACHMENTS exceeded");
     }
 
-    attachment = GL_COLOR_ATTACHMENT0 + tex_ids.size(); // common attachment for color textures
-
-    if (iformat == GL_RGBA16F || iformat == GL_RGBA32F) {
-        format = GL_RGBA;
-        type = GL_FLOAT;
-    }
-    else if (iformat == GL_RGB16F || iformat == GL_RGB32F) {
-        format = GL_RGB;
-        type = GL_FLOAT;
-    }
-    else if (iformat == GL_LUMINANCE16_ALPHA16) {
-        format = GL_LUMINANCE_ALPHA;
-        type = GL_FLOAT;
-    }
-    else if (iformat == GL_LUMINANCE16) {
-        format = GL_LUMINANCE;
-        type = GL_FLOAT;
-    }
-    else if (iformat == GL_RGBA8 || iformat == GL_RGBA || iformat == 4) {
-        format = GL_RGBA;
-        type = GL_UNSIGNED_BYTE;
-    }
-    else if (iformat == GL_RGB8 || iformat == GL_RGB || iformat == 3) {
-        format = GL_RGB;
-        type = GL_UNSIGNED_BYTE;
-    }
-    else if (iformat == GL_LUMINANCE8_ALPHA8 || iformat == GL_LUMINANCE_ALPHA || iformat == 2) {
-        format = GL_LUMINANCE_ALPHA;
-        type = GL_UNSIGNED_BYTE;
-    }
-    else if (iformat == GL_LUMINANCE8 || iformat == GL_LUMINANCE16 || iformat == GL_LUMINANCE || iformat == 1) {
-        format = GL_LUMINANCE;
-        type = GL_UNSIGNED_BYTE;
-    }
-    else if (iformat == GL_DEPTH_COMPONENT24 || iformat == GL_DEPTH_COMPONENT) {
-        format = GL_DEPTH_COMPONENT;
-        type = GL_UNSIGNED_INT;
-        attachment = GL_DEPTH_ATTACHMENT;
-        filter = GL_NEAREST;
-    }
-    else if (iformat == GL_STENCIL_INDEX1 || iformat == GL_STENCIL_INDEX4 || iformat == GL_STENCIL_INDEX8 ||
-        iformat == GL_STENCIL_INDEX16 || iformat == GL_STENCIL_INDEX) {
-        format = GL_STENCIL_INDEX;
-        type = GL_UNSIGNED_BYTE;
-        attachment = GL_STENCIL_ATTACHMENT;
-        filter = GL_NEAREST;
-    }
-    else if (iformat == GL_DEPTH24_STENCIL8 || iformat == GL_DEPTH_STENCIL)
+    describeFormat(iformat, format, type, attachment);
+    if (attachment == GL_COLOR_ATTACHMENT0 && format != GL_TEXTURE_2D_MULTISAMPLE)
     {
-        format = GL_DEPTH_STENCIL;
-        type = GL_UNSIGNED_INT_24_8;
-        attachment = GL_DEPTH_STENCIL_ATTACHMENT;
-        filter = GL_NEAREST;
+        attachment = GL_COLOR_ATTACHMENT0 + tex_ids.size(); // common attachment for color textures
     }
-    else if (iformat == GL_TEXTURE_2D_MULTISAMPLE)
+    else if (attachment != GL_COLOR_ATTACHMENT0)
     {
-        format = GL_TEXTURE_2D_MULTISAMPLE;
-        type = GL_RGB;
-        attachment = GL_COLOR_ATTACHMENT0;
-    }
-    else {
-        throw invalid_argument("FrameBuffer::attachTexture - unrecognized internal format");
+        filter = GL_NEAREST;
     }
 
     glGenTextures(1, &tex_id);
@@ -226,6 +172,68 @@ void FrameBuffer::attachTexture(GLenum iformat, GLint filter) throw(domain_error
     }
 
     tex_ids.push_back(tex_id);
+    tex_owned.push_back(true);
+    buffers[tex_ids.size() - 1] = attachment;
+}
+
+void FrameBuffer::attachShared(GLuint texture, GLenum iformat) throw(out_of_range, invalid_argument)
+{
+    attachSharedTexture(texture, iformat, TEXTURE_2D);
+}
+
+void FrameBuffer::attachSharedLayer(GLuint texture, GLenum iformat, GLint layer) throw(out_of_range, invalid_argument)
+{
+    if (layer < 0)
+    {
+        throw out_of_range("FrameBuffer::attachSharedLayer - negative layer");
+    }
+    attachSharedTexture(texture, iformat, layer);
+}
+
+void FrameBuffer::attachSharedLayered(GLuint texture, GLenum iformat) throw(out_of_range, invalid_argument)
+{
+    attachSharedTexture(texture, iformat, ALL_LAYERS);
+}
+
+void FrameBuffer::attachSharedTexture(GLuint texture, GLenum iformat, GLint layer) throw(out_of_range, invalid_argument)
+{
+    GLenum format;
+    GLenum type;
+    GLenum attachment;
+
+    describeFormat(iformat, format, type, attachment);
+    if (format == GL_TEXTURE_2D_MULTISAMPLE)
+    {
+        throw invalid_argument("FrameBuffer::attachShared - multisampled textures aren't supported");
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, frame_id);
+    if (attachment != GL_COLOR_ATTACHMENT0)
+    {
+        // not a draw buffer, the depth and stencil tests write it
+        if (layer == TEXTURE_2D)
+            glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture, 0);
+        else if (layer == ALL_LAYERS)
+            glFramebufferTexture(GL_FRAMEBUFFER, attachment, texture, 0);
+        else
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, attachment, texture, 0, layer);
+        has_depth = true;
+        return;
+    }
+
+    if (int(tex_ids.size()) == max_color_attachments)
+    {
+        throw out_of_range("FrameBuffer::attachShared - GL_MAX_COLOR_ATTACHMENTS exceeded");
+    }
+    attachment = GL_COLOR_ATTACHMENT0 + tex_ids.size();
+    if (layer == TEXTURE_2D)
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture, 0);
+    else if (layer == ALL_LAYERS)
+        glFramebufferTexture(GL_FRAMEBUFFER, attachment, texture, 0);
+    else
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, attachment, texture, 0, layer);
+    tex_ids.push_back(texture);
+    tex_owned.push_back(false);
     buffers[tex_ids.size() - 1] = attachment;
 }
 
@@ -249,13 +257,18 @@ void FrameBuffer::bindInput(int num) throw(out_of_range)
 
 void FrameBuffer::bindOutput() throw(domain_error)
 {
-    if (tex_ids.empty())
+    if (tex_ids.empty() && !has_depth)
     {
         throw domain_error("FrameBuffer::bindOutput - no textures to bind");
     }
 
     glBindFramebuffer(GL_FRAMEBUFFER, frame_id);
-    if (tex_ids.size() == 1)
+    if (tex_ids.empty())
+    {
+        // depth only, e.g. a shadow map
+        glDrawBuffer(GL_NONE);
+    }
+    else if (tex_ids.size() == 1)
     {
         glDrawBuffer(buffers[0]);
     }
@@ -294,6 +307,12 @@ void FrameBuffer::check()
     GLenum status;
 
     glBindFramebuffer(GL_FRAMEBUFFER, frame_id);
+    if (tex_ids.empty() && has_depth)
+    {
+        // a depth only FBO is incomplete while it reads or draws a color attachment it doesn't have
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
     status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
     if (status != GL_FRAMEBUFFER_COMPLETE)
     {
@@ -307,4 +326,87 @@ void FrameBuffer::unbind()
 {
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glDrawBuffer(GL_BACK);
-}
\ No newline at end of file
+}
+
+void FrameBuffer::describeFormat(GLenum iformat, GLenum& format, GLenum& type, GLenum& attachment) throw(invalid_argument)
+{
+    attachment = GL_COLOR_ATTACHMENT0;
+    if (iformat == GL_RGBA16F || iformat == GL_RGBA32F) {
+        format = GL_RGBA;
+        type = GL_FLOAT;
+    }
+    else if (iformat == GL_RGB16F || iformat == GL_RGB32F) {
+        format = GL_RGB;
+        type = GL_FLOAT;
+    }
+    else if (iformat == GL_RG16F || iformat == GL_RG32F) {
+        format = GL_RG;
+        type = GL_FLOAT;
+    }
+    else if (iformat == GL_RG16) {
+        format = GL_RG;
+        type = GL_UNSIGNED_SHORT;
+    }
+    else if (iformat == GL_RG16_SNORM) {
+        format = GL_RG;
+        type = GL_SHORT;
+    }
+    else if (iformat == GL_RG8 || iformat == GL_RG) {
+        format = GL_RG;
+        type = GL_UNSIGNED_BYTE;
+    }
+    else if (iformat == GL_RGB10_A2) {
+        format = GL_RGBA;
+        type = GL_UNSIGNED_INT_2_10_10_10_REV;
+    }
+    else if (iformat == GL_LUMINANCE16_ALPHA16) {
+        format = GL_LUMINANCE_ALPHA;
+        type = GL_FLOAT;
+    }
+    else if (iformat == GL_LUMINANCE16) {
+        format = GL_LUMINANCE;
+        type = GL_FLOAT;
+    }
+    else if (iformat == GL_RGBA8 || iformat == GL_RGBA || iformat == 4) {
+        format = GL_RGBA;
+        type = GL_UNSIGNED_BYTE;
+    }
+    else if (iformat == GL_RGB8 || iformat == GL_RGB || iformat == 3) {
+        format = GL_RGB;
+        type = GL_UNSIGNED_BYTE;
+    }
+    else if (iformat == GL_LUMINANCE8_ALPHA8 || iformat == GL_LUMINANCE_ALPHA || iformat == 2) {
+        format = GL_LUMINANCE_ALPHA;
+        type = GL_UNSIGNED_BYTE;
+    }
+    else if (iformat == GL_LUMINANCE8 || iformat == GL_LUMINANCE16 || iformat == GL_LUMINANCE || iformat == 1) {
+        format = GL_LUMINANCE;
+        type = GL_UNSIGNED_BYTE;
+    }
+    else if (iformat == GL_DEPTH_COMPONENT24 || iformat == GL_DEPTH_COMPONENT) {
+        format = GL_DEPTH_COMPONENT;
+        type = GL_UNSIGNED_INT;
+        attachment = GL_DEPTH_ATTACHMENT;
+    }
+    else if (iformat == GL_STENCIL_INDEX1 || iformat == GL_STENCIL_INDEX4 || iformat == GL_STENCIL_INDEX8 ||
+        iformat == GL_STENCIL_INDEX16 || iformat == GL_STENCIL_INDEX) {
+        format = GL_STENCIL_INDEX;
+        type = GL_UNSIGNED_BYTE;
+        attachment = GL_STENCIL_ATTACHMENT;
+    }
+    else if (iformat == GL_DEPTH24_STENCIL8 || iformat == GL_DEPTH_STENCIL)
+    {
+        format = GL_DEPTH_STENCIL;
+        type = GL_UNSIGNED_INT_24_8;
+        attachment = GL_DEPTH_STENCIL_ATTACHMENT;
+    }
+    else if (iformat == GL_TEXTURE_2D_MULTISAMPLE)
+    {
+        format = GL_TEXTURE_2D_MULTISAMPLE;
+        type = GL_RGB;
+        attachment = GL_COLOR_ATTACHMENT0;
+    }
+    else {
+        throw invalid_argument("FrameBuffer::describeFormat - unrecognized internal format");
+    }
+}
@@ -21,6 +21,14 @@ public:
     void attachRender(GLenum iformat, bool multisample = false) throw(std::domain_error, std::invalid_argument);
     // Attach a texture to the FBO
     void attachTexture(GLenum iformat, GLint filter = GL_LINEAR) throw(std::domain_error, std::out_of_range, std::invalid_argument);
+    // Attach a 2D texture owned by someone else (e.g. a render graph), it is left alone by the destructor.
+    // Depth and stencil formats go to their attachment points, colors to the next color attachment.
+    void attachShared(GLuint texture, GLenum iformat) throw(std::out_of_range, std::invalid_argument);
+    // Attach one layer of a 2D array texture owned by someone else, like attachShared()
+    void attachSharedLayer(GLuint texture, GLenum iformat, GLint layer) throw(std::out_of_range, std::invalid_argument);
+    // Attach every layer of a 2D array texture owned by someone else for layered rendering, a geometry shader
+    // picks the layer of each primitive with gl_Layer
+    void attachSharedLayered(GLuint texture, GLenum iformat) throw(std::out_of_range, std::invalid_argument);
     // Bind the FBO as input, for reading from
     void bindInput();
     // Bind the nth texture of the FBO as input
@@ -37,8 +45,18 @@ public:
     void check();
     // Disable rendering to FBO
     static void unbind();
+    // Pixel format and type to specify a texture of the given internal format with, and the attachment point
+    // it goes to (GL_COLOR_ATTACHMENT0 for every color format)
+    static void describeFormat(GLenum iformat, GLenum& format, GLenum& type, GLenum& attachment) throw(std::invalid_argument);
 
 private:
+    // what attachSharedTexture() attaches besides a single layer
+    static const GLint TEXTURE_2D = -1;
+    static const GLint ALL_LAYERS = -2;
+
+    // glFramebufferTexture2D for TEXTURE_2D, glFramebufferTexture for ALL_LAYERS, glFramebufferTextureLayer otherwise
+    void attachSharedTexture(GLuint texture, GLenum iformat, GLint layer) throw(std::out_of_range, std::invalid_argument);
+
     int max_color_attachments;    // maximum number of color attachments allowed
     int width;                    // width of this RT
     int height;                   // height of this RT
@@ -47,6 +65,8 @@ private:
     GLuint depth_id;              // depth render buffer id
     GLuint stencil_id;            // stencil render buffer id
     std::vector<GLuint> tex_ids;  // ids of render target textures
+    std::vector<bool> tex_owned;  // whether the texture of the same index gets deleted with the FBO
+    bool has_depth;               // a depth or stencil texture is attached through attachShared()
 
 };
 
@@ -0,0 +1,107 @@
+#include "geometry_arena.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <tuple>
+
+namespace {
+
+// smallest buffer the arena allocates, avoids many small reallocations while a scene loads
+const size_t MIN_ARENA_CAPACITY = 4 * 1024 * 1024;
+
+}
+
+GeometryArena::GeometryArena(const VertexLayout& layout, GLenum indexType)
+    :
+    vertex_layout(layout),
+    index_type(indexType),
+    vao_id(0),
+    vertex_buffer(0),
+    index_buffer(0),
+    vertex_count(0),
+    index_count(0),
+    vertex_capacity(0),
+    index_capacity(0)
+{
+    glGenBuffers(1, &vertex_buffer);
+    glGenBuffers(1, &index_buffer);
+    vao_id = createVertexArray();
+}
+
+GLuint GeometryArena::createVertexArray() const
+{
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+    vertex_layout.setupAttributes();
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+    glBindVertexArray(0);
+    return vao;
+}
+
+void GeometryArena::allocate(const void* vertexData, size_t vertexCount, const void* indexData, size_t indexCount,
+    GLint& baseVertex, unsigned int& firstIndex)
+{
+    const size_t stride = vertex_layout.stride();
+    reserve(vertex_buffer, vertex_capacity, vertex_count * stride, (vertex_count + vertexCount) * stride);
+    reserve(index_buffer, index_capacity, index_count * indexSize(), (index_count + indexCount) * indexSize());
+
+    // the copy targets leave the element buffer binding of whatever VAO is bound alone
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vertex_buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, vertex_count * stride, vertexCount * stride, vertexData);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, index_buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, index_count * indexSize(), indexCount * indexSize(), indexData);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    baseVertex = GLint(vertex_count);
+    firstIndex = (unsigned int)index_count;
+    vertex_count += vertexCount;
+    index_count += indexCount;
+}
+
+void GeometryArena::reserve(GLuint buffer, size_t& capacity, size_t used, size_t required)
+{
+    if (required <= capacity)
+        return;
+
+    size_t newCapacity = std::max(std::max(required, capacity * 2), MIN_ARENA_CAPACITY);
+    if (used == 0)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, newCapacity, NULL, GL_STATIC_DRAW);
+    }
+    else
+    {
+        // park the contents in a temporary buffer while the storage is re-specified
+        GLuint temporary;
+        glGenBuffers(1, &temporary);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, temporary);
+        glBufferData(GL_COPY_WRITE_BUFFER, used, NULL, GL_STREAM_COPY);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+
+        glBindBuffer(GL_COPY_READ_BUFFER, temporary);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, newCapacity, NULL, GL_STATIC_DRAW);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glDeleteBuffers(1, &temporary);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    capacity = newCapacity;
+}
+
+GeometryArena& GeometryArena::get(const VertexLayout& layout, GLenum indexType)
+{
+    // shortIndices only decides the index type, which is part of the key already
+    typedef std::tuple<unsigned int, int, bool, GLenum> Key;
+    static std::map<Key, std::unique_ptr<GeometryArena>> arenas;
+
+    Key key(layout.streams, int(layout.normalFormat), layout.halfTexCoords, indexType);
+    std::unique_ptr<GeometryArena>& arena = arenas[key];
+    if (!arena)
+        arena.reset(new GeometryArena(layout, indexType));
+    return *arena;
+}
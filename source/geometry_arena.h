@@ -0,0 +1,60 @@
+#ifndef _GEOMETRY_ARENA_H_
+#define _GEOMETRY_ARENA_H_
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include "vertex_layout.h"
+
+#include <cstddef>
+
+// Vertex and index buffers shared by all meshes of one vertex layout and index type. Meshes get a
+// range of each buffer and are drawn with a base vertex, so any number of them can be submitted with
+// a single VAO bind and one multi-draw call. Ranges are never given back, meshes live as long as the app.
+class GeometryArena
+{
+public:
+    GeometryArena(const VertexLayout& layout, GLenum indexType);
+    // GL objects are left to the context teardown, the shared arenas outlive the context
+    ~GeometryArena() {}
+
+    // Copy vertices (already in the arena's layout) and indices into the arena. Returns the base vertex
+    // and the first index of the mesh's ranges. GL thread only.
+    void allocate(const void* vertexData, size_t vertexCount, const void* indexData, size_t indexCount,
+        GLint& baseVertex, unsigned int& firstIndex);
+
+    // Vertex array with the layout's attributes and the arena's element buffer
+    GLuint vao() const { return vao_id; }
+    GLenum indexType() const { return index_type; }
+    size_t indexSize() const { return index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int); }
+    const VertexLayout& layout() const { return vertex_layout; }
+    // Bytes in use
+    size_t vertexBytes() const { return vertex_count * vertex_layout.stride(); }
+    size_t indexBytes() const { return index_count * indexSize(); }
+
+    // Creates another vertex array over the arena's buffers, e.g. to add instance attributes without
+    // touching the shared one. The caller owns it.
+    GLuint createVertexArray() const;
+
+    // Arena shared by every mesh with the given layout and index type, created on first use
+    static GeometryArena& get(const VertexLayout& layout, GLenum indexType);
+
+private:
+    GeometryArena(const GeometryArena&) = delete;
+    GeometryArena& operator=(const GeometryArena&) = delete;
+
+    // grows a buffer to hold at least required bytes, keeping its name so vertex arrays stay valid
+    static void reserve(GLuint buffer, size_t& capacity, size_t used, size_t required);
+
+    VertexLayout vertex_layout;
+    GLenum index_type;
+    GLuint vao_id;
+    GLuint vertex_buffer;
+    GLuint index_buffer;
+    size_t vertex_count;           // vertices allocated
+    size_t index_count;            // indices allocated
+    size_t vertex_capacity;        // buffer sizes in bytes
+    size_t index_capacity;
+};
+
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef GPU_COUNTER_H
+#define GPU_COUNTER_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <cstdint>
+
+// GPU query (samples passed, time elapsed, ...) read back a few frames late so the CPU never waits on it.
+// begin() and end() bracket the measured draws once per frame, value() is the latest result available.
+class GpuCounter
+{
+public:
+    static const int LATENCY = 3;          // frames in flight, one query each
+
+    explicit GpuCounter(GLenum target = GL_SAMPLES_PASSED)
+        : target(target), queries(), issued(), current(0), last(0)
+    {
+    }
+
+    ~GpuCounter()
+    {
+        if (queries[0])
+            glDeleteQueries(LATENCY, queries);
+    }
+
+    void begin()
+    {
+        if (!queries[0])
+            glGenQueries(LATENCY, queries);
+        // the query about to be reused is the oldest one, collect it first
+        collect(current);
+        glBeginQuery(target, queries[current]);
+    }
+
+    void end()
+    {
+        glEndQuery(target);
+        issued[current] = true;
+        current = (current + 1) % LATENCY;
+    }
+
+    // latest available result, polled without blocking
+    uint64_t value()
+    {
+        for (int i = 1; i <= LATENCY; i++)
+            collect((current + i) % LATENCY);
+        return last;
+    }
+
+private:
+    GpuCounter(const GpuCounter&) = delete;
+    GpuCounter& operator=(const GpuCounter&) = delete;
+
+    void collect(int index)
+    {
+        if (!issued[index])
+            return;
+        GLint available = 0;
+        glGetQueryObjectiv(queries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+        GLuint64 result = 0;
+        glGetQueryObjectui64v(queries[index], GL_QUERY_RESULT, &result);
+        last = result;
+        issued[index] = false;
+    }
+
+    GLenum target;
+    GLuint queries[LATENCY];
+    bool issued[LATENCY];
+    int current;
+    uint64_t last;
+};
+
+#endif
@@ -0,0 +1,276 @@
+#include "light_bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIGHT_BVH_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace {
+
+// leaves refit by one job of a full refit
+const size_t REFIT_LEAVES_PER_JOB = 2048;
+// lights scattered to their slots or packed for upload by one job
+const size_t PACK_LIGHTS_PER_JOB = 16384;
+
+}
+
+LightBvh::LightBvh(ThreadPool* pool)
+    :
+    pool(pool),
+    layout_version(UINT64_MAX),
+    position_version(UINT64_MAX),
+    frame_stats()
+{
+}
+
+void LightBvh::update(const LightSystem& lights)
+{
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    frame_stats.rebuilt = false;
+    frame_stats.refitLeaves = 0;
+
+    if (tree.nodes().empty() || lights.layoutVersion() != layout_version)
+    {
+        build(lights);
+    }
+    else if (lights.positionVersion() != position_version)
+    {
+        // a single update() since the last refit tells which lights moved, refit just their leaves unless that is
+        // most of the tree anyway
+        const LightSystem::Stats& moved = lights.stats();
+        if (lights.positionVersion() == position_version + 1 && moved.updatedLights * 4 < lights.size())
+        {
+            refitLights(moved.firstUpdated, moved.firstUpdated + moved.updatedLights, lights.positionRadius());
+        }
+        else
+        {
+            refitAll(lights.positionRadius());
+            if (tree.degraded())
+                build(lights);
+        }
+        position_version = lights.positionVersion();
+    }
+    frame_stats.updateMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void LightBvh::build(const LightSystem& lights)
+{
+    const glm::vec4* positionRadius = lights.positionRadius();
+    // pad to whole SSE batches with spheres no plane test accepts
+    tree.build(lights.size(), LIGHT_BVH_LEAF_SIZE, 4, [positionRadius](uint32_t light) { return glm::vec3(positionRadius[light]); });
+    slot_spheres.assign(tree.slots().size(), glm::vec4(0.0f, 0.0f, 0.0f, -FLT_MAX));
+    for (uint32_t leaf : tree.leaves())
+        refitLeaf(leaf, positionRadius);
+    tree.finishBuild();
+
+    layout_version = lights.layoutVersion();
+    position_version = lights.positionVersion();
+    frame_stats.rebuilt = true;
+    frame_stats.refitLeaves = tree.leaves().size();
+}
+
+void LightBvh::refitLeaf(uint32_t leaf, const glm::vec4* positionRadius)
+{
+    const BvhTree::Node& node = tree.nodes()[leaf];
+    const std::vector<uint32_t>& slots = tree.slots();
+    for (uint32_t slot = node.first; slot < node.first + node.count; slot++)
+    {
+        if (slots[slot] != BvhTree::NONE)
+            slot_spheres[slot] = positionRadius[slots[slot]];
+    }
+    boundLeaf(leaf);
+}
+
+void LightBvh::boundLeaf(uint32_t leaf)
+{
+    const BvhTree::Node& node = tree.nodes()[leaf];
+    const std::vector<uint32_t>& slots = tree.slots();
+    glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+    for (uint32_t slot = node.first; slot < node.first + node.count; slot++)
+    {
+        if (slots[slot] == BvhTree::NONE)
+            continue;
+        const glm::vec4& sphere = slot_spheres[slot];
+        min = glm::min(min, glm::vec3(sphere) - glm::vec3(sphere.w));
+        max = glm::max(max, glm::vec3(sphere) + glm::vec3(sphere.w));
+    }
+    tree.setBounds(leaf, min, max);
+}
+
+void LightBvh::refitLights(size_t begin, size_t end, const glm::vec4* positionRadius)
+{
+    for (size_t light = begin; light < end; light++)
+    {
+        if (tree.markRefit(uint32_t(light)))
+        {
+            refitLeaf(tree.itemLeaf(uint32_t(light)), positionRadius);
+            frame_stats.refitLeaves++;
+        }
+    }
+    tree.refitMarked();
+}
+
+void LightBvh::refitAll(const glm::vec4* positionRadius)
+{
+    // scatter the lights to their slots in light order, reading the positions sequentially instead of
+    // gathering them in the spatial order of the tree, then bound the leaves from their slots
+    const size_t lights = tree.itemCount();
+    const size_t scatterJobs = (lights + PACK_LIGHTS_PER_JOB - 1) / PACK_LIGHTS_PER_JOB;
+    parallelFor(scatterJobs > 1 ? pool : nullptr, scatterJobs, [&](size_t job) {
+        size_t end = std::min((job + 1) * PACK_LIGHTS_PER_JOB, lights);
+        for (size_t light = job * PACK_LIGHTS_PER_JOB; light < end; light++)
+            slot_spheres[tree.itemSlot(uint32_t(light))] = positionRadius[light];
+    });
+    const std::vector<uint32_t>& leaves = tree.leaves();
+    const size_t jobs = (leaves.size() + REFIT_LEAVES_PER_JOB - 1) / REFIT_LEAVES_PER_JOB;
+    parallelFor(jobs > 1 ? pool : nullptr, jobs, [&](size_t job) {
+        size_t end = std::min((job + 1) * REFIT_LEAVES_PER_JOB, leaves.size());
+        for (size_t i = job * REFIT_LEAVES_PER_JOB; i < end; i++)
+            boundLeaf(leaves[i]);
+    });
+    tree.mergeAll();
+    frame_stats.refitLeaves = leaves.size();
+}
+
+void LightBvh::cull(const LightSystem& lights, const glm::mat4& viewProjection)
+{
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    BvhTree::frustumPlanes(viewProjection, frustum_planes);
+
+    size_t visited = 0;
+    cull_tasks.clear();
+    if (!tree.empty())
+        cull_tasks.push_back({ 0, BvhTree::ALL_PLANES });
+
+    // split the top of the tree into subtrees for the workers
+    const bool parallel = pool && lights.size() >= LIGHT_BVH_PARALLEL_LIGHTS;
+    std::vector<BvhTree::CullTask> split;
+    while (parallel && !cull_tasks.empty() && cull_tasks.size() < LIGHT_BVH_CULL_JOBS)
+    {
+        split.clear();
+        bool descended = false;
+        for (const BvhTree::CullTask& task : cull_tasks)
+        {
+            const BvhTree::Node& node = tree.nodes()[task.node];
+            if (node.child == 0 || task.planes == 0)
+            {
+                split.push_back(task);
+                continue;
+            }
+            descended = true;
+            visited++;
+            uint32_t planes = task.planes;
+            if (!BvhTree::boxInFrustum(frustum_planes, node.min, node.max, planes))
+                continue;
+            split.push_back({ node.child, planes });
+            split.push_back({ node.child + 1, planes });
+        }
+        cull_tasks.swap(split);
+        if (!descended)
+            break;
+    }
+
+    job_visible.resize(std::max(job_visible.size(), cull_tasks.size()));
+    job_visited.assign(cull_tasks.size(), 0);
+    parallelFor(parallel ? pool : nullptr, cull_tasks.size(), [&](size_t job) {
+        job_visible[job].clear();
+        job_visited[job] = cullNode(cull_tasks[job].node, cull_tasks[job].planes, job_visible[job]);
+    });
+
+    size_t visible = 0;
+    for (size_t job = 0; job < cull_tasks.size(); job++)
+    {
+        visible += job_visible[job].size();
+        visited += job_visited[job];
+    }
+    // the jobs collected slots, pack their lights for the instance buffers. The spheres come from the slots
+    // in tree order, only the colors are gathered from the lights
+    visible_lights.resize(visible);
+    visible_position_radius.resize(visible);
+    visible_colors.resize(visible);
+    const glm::vec4* colors = lights.colors();
+    const std::vector<uint32_t>& slots = tree.slots();
+    parallelFor(parallel ? pool : nullptr, cull_tasks.size(), [&](size_t job) {
+        size_t offset = 0;
+        for (size_t previous = 0; previous < job; previous++)
+            offset += job_visible[previous].size();
+        for (uint32_t slot : job_visible[job])
+        {
+            uint32_t light = slots[slot];
+            visible_lights[offset] = light;
+            visible_position_radius[offset] = slot_spheres[slot];
+            visible_colors[offset] = colors[light];
+            offset++;
+        }
+    });
+
+    frame_stats.visibleLights = visible;
+    frame_stats.culledLights = lights.size() - visible;
+    frame_stats.nodesVisited = visited;
+    frame_stats.cullMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+size_t LightBvh::cullNode(uint32_t root, uint32_t planes, std::vector<uint32_t>& visible) const
+{
+    const std::vector<uint32_t>& slots = tree.slots();
+    return tree.cull(frustum_planes, root, planes,
+        [&](const BvhTree::Node& node) {
+            // inside every plane, the whole subtree is visible
+            for (uint32_t slot = node.first; slot < node.first + node.count; slot++)
+            {
+                if (slots[slot] != BvhTree::NONE)
+                    visible.push_back(slot);
+            }
+        },
+        [&](const BvhTree::Node& leaf, uint32_t leafPlanes) { cullLeaf(leaf, leafPlanes, visible); });
+}
+
+void LightBvh::cullLeaf(const BvhTree::Node& leaf, uint32_t planes, std::vector<uint32_t>& visible) const
+{
+    for (uint32_t slot = leaf.first; slot < leaf.first + leaf.count; slot += 4)
+    {
+#ifdef LIGHT_BVH_SSE
+        // a sphere is outside when its center is further than its radius behind a plane
+        __m128 x = _mm_loadu_ps(&slot_spheres[slot].x);
+        __m128 y = _mm_loadu_ps(&slot_spheres[slot + 1].x);
+        __m128 z = _mm_loadu_ps(&slot_spheres[slot + 2].x);
+        __m128 radius = _mm_loadu_ps(&slot_spheres[slot + 3].x);
+        _MM_TRANSPOSE4_PS(x, y, z, radius);
+        __m128 inside = _mm_cmpeq_ps(radius, radius);
+        for (int plane = 0; plane < 6; plane++)
+        {
+            if (!(planes & (1u << plane)))
+                continue;
+            const glm::vec4& p = frustum_planes[plane];
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(p.x)), _mm_mul_ps(y, _mm_set1_ps(p.y))),
+                _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(p.z)), _mm_set1_ps(p.w)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            if (mask & (1 << lane))
+                visible.push_back(slot + lane);
+        }
+#else
+        for (uint32_t i = slot; i < slot + 4; i++)
+        {
+            const glm::vec4& sphere = slot_spheres[i];
+            bool inside = true;
+            for (int plane = 0; plane < 6 && inside; plane++)
+            {
+                const glm::vec4& p = frustum_planes[plane];
+                if (planes & (1u << plane))
+                    inside = p.x * sphere.x + p.y * sphere.y + p.z * sphere.z + p.w + sphere.w >= 0.0f;
+            }
+            if (inside)
+                visible.push_back(i);
+        }
+#endif
+    }
+}
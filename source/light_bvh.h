@@ -0,0 +1,91 @@
+#ifndef _LIGHT_BVH_H_
+#define _LIGHT_BVH_H_
+
+#include <glm/glm.hpp>
+
+#include "bvh_tree.h"
+#include "light_system.h"
+#include "thread_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// most lights in a leaf of the hierarchy
+const size_t LIGHT_BVH_LEAF_SIZE = 8;
+// subtrees the cull is split into for the thread pool, when there are enough lights to be worth it
+const size_t LIGHT_BVH_CULL_JOBS = 64;
+const size_t LIGHT_BVH_PARALLEL_LIGHTS = 16384;
+
+// Bounding volume hierarchy over the spheres of a LightSystem, used to frustum cull the point lights. update()
+// rebuilds the tree with median splits after lights were added or removed, and otherwise refits the bounds of
+// the leaves holding the lights the last LightSystem::update() moved. cull() walks the tree against the six
+// planes of a view projection, accepts whole subtrees inside the frustum and tests the lights of straddling
+// leaves four at a time with SSE when available, then packs the visible lights. No GL calls.
+class LightBvh
+{
+public:
+    // what the last update() and cull() did
+    struct Stats {
+        size_t visibleLights;
+        size_t culledLights;
+        size_t nodesVisited;
+        size_t refitLeaves;
+        bool rebuilt;
+        double updateMilliseconds;
+        double cullMilliseconds;
+    };
+
+    explicit LightBvh(ThreadPool* pool = &ThreadPool::shared());
+
+    // Bring the tree up to date with the lights, after LightSystem::update()
+    void update(const LightSystem& lights);
+    // Collect the lights whose spheres touch the frustum of viewProjection, in tree order
+    void cull(const LightSystem& lights, const glm::mat4& viewProjection);
+
+    size_t visibleCount() const { return visible_lights.size(); }
+    // indices into the LightSystem of the visible lights
+    const std::vector<uint32_t>& visibleLights() const { return visible_lights; }
+    // position/radius and color of the visible lights, packed like LightSystem::positionRadius() and colors()
+    const glm::vec4* visiblePositionRadius() const { return visible_position_radius.data(); }
+    const glm::vec4* visibleColors() const { return visible_colors.data(); }
+    size_t nodeCount() const { return tree.nodes().size(); }
+    const Stats& stats() const { return frame_stats; }
+
+private:
+    LightBvh(const LightBvh&) = delete;
+    LightBvh& operator=(const LightBvh&) = delete;
+
+    void build(const LightSystem& lights);
+    // copy the spheres of a leaf into its slots and recompute its bounds
+    void refitLeaf(uint32_t leaf, const glm::vec4* positionRadius);
+    // recompute the bounds of a leaf from its slots
+    void boundLeaf(uint32_t leaf);
+    // refit the leaves of the lights [begin, end) and their ancestors
+    void refitLights(size_t begin, size_t end, const glm::vec4* positionRadius);
+    void refitAll(const glm::vec4* positionRadius);
+    // append the visible slots of a subtree
+    size_t cullNode(uint32_t node, uint32_t planes, std::vector<uint32_t>& visible) const;
+    void cullLeaf(const BvhTree::Node& leaf, uint32_t planes, std::vector<uint32_t>& visible) const;
+
+    ThreadPool* pool;
+    // the lights in slots, leaves are padded to a multiple of four slots
+    BvhTree tree;
+    // position and radius of the slots, padding never passes a plane
+    std::vector<glm::vec4> slot_spheres;
+    // the LightSystem state the tree matches
+    uint64_t layout_version;
+    uint64_t position_version;
+    // frustum planes (xyz normal, w distance) of the last cull
+    glm::vec4 frustum_planes[6];
+    std::vector<BvhTree::CullTask> cull_tasks;
+    std::vector<std::vector<uint32_t>> job_visible;
+    std::vector<size_t> job_visited;
+    std::vector<uint32_t> visible_lights;
+    std::vector<glm::vec4> visible_position_radius;
+    std::vector<glm::vec4> visible_colors;
+    Stats frame_stats;
+};
+
+
+#endif
@@ -0,0 +1,335 @@
+#include "light_clusters.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIGHT_CLUSTERS_SSE
+#include <xmmintrin.h>
+#endif
+
+using std::vector;
+
+LightClusters::LightClusters(ThreadPool* pool)
+    :
+    pool(pool),
+    width(0),
+    height(0),
+    fovy(0.0f),
+    z_near(0.0f),
+    z_far(0.0f),
+    projection_x(1.0f),
+    projection_y(1.0f),
+    slice_scale(0.0f),
+    slice_bias(0.0f),
+    tiles_x(0),
+    tiles_y(0),
+    assign_stats(),
+    buffers(),
+    textures()
+{
+}
+
+void LightClusters::setView(int width_, int height_, float fovy_, float zNear, float zFar)
+{
+    if (width_ == width && height_ == height && fovy_ == fovy && zNear == z_near && zFar == z_far)
+        return;
+    width = width_;
+    height = height_;
+    fovy = fovy_;
+    z_near = zNear;
+    z_far = zFar;
+
+    // same scale factors as glm::perspective
+    projection_y = 1.0f / tanf(fovy * 0.5f);
+    projection_x = projection_y * float(height) / float(width);
+    slice_scale = float(CLUSTER_DEPTH_SLICES) / logf(z_far / z_near);
+    slice_bias = -slice_scale * logf(z_near);
+    tiles_x = (width + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE;
+    tiles_y = (height + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE;
+
+    // view space box of every froxel, from the tile's corner rays between the slice's depths
+    size_t count = size_t(tiles_x) * tiles_y * CLUSTER_DEPTH_SLICES;
+    cluster_min.resize(count);
+    cluster_max.resize(count);
+    for (int slice = 0; slice < CLUSTER_DEPTH_SLICES; slice++)
+    {
+        float nearDepth = z_near * powf(z_far / z_near, float(slice) / CLUSTER_DEPTH_SLICES);
+        float farDepth = z_near * powf(z_far / z_near, float(slice + 1) / CLUSTER_DEPTH_SLICES);
+        for (int y = 0; y < tiles_y; y++)
+        {
+            float tanMinY = (2.0f * y * CLUSTER_TILE_SIZE / height - 1.0f) / projection_y;
+            float tanMaxY = (2.0f * std::min((y + 1) * CLUSTER_TILE_SIZE, height) / height - 1.0f) / projection_y;
+            for (int x = 0; x < tiles_x; x++)
+            {
+                float tanMinX = (2.0f * x * CLUSTER_TILE_SIZE / width - 1.0f) / projection_x;
+                float tanMaxX = (2.0f * std::min((x + 1) * CLUSTER_TILE_SIZE, width) / width - 1.0f) / projection_x;
+                size_t index = (size_t(slice) * tiles_y + y) * tiles_x + x;
+                cluster_min[index] = glm::vec3(std::min(tanMinX * nearDepth, tanMinX * farDepth), std::min(tanMinY * nearDepth, tanMinY * farDepth), nearDepth);
+                cluster_max[index] = glm::vec3(std::max(tanMaxX * nearDepth, tanMaxX * farDepth), std::max(tanMaxY * nearDepth, tanMaxY * farDepth), farDepth);
+            }
+        }
+    }
+}
+
+void LightClusters::assign(const glm::vec4* positionRadius, size_t count, const glm::mat4& view)
+{
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    view_lights.resize(count);
+    light_ranges.resize(count);
+    slice_lights.resize(CLUSTER_DEPTH_SLICES);
+    slice_pairs.resize(CLUSTER_DEPTH_SLICES);
+    slice_indices.resize(CLUSTER_DEPTH_SLICES);
+
+    size_t jobs = (count + CLUSTER_LIGHTS_PER_JOB - 1) / CLUSTER_LIGHTS_PER_JOB;
+    parallelFor(pool, jobs, [&](size_t job) {
+        computeBounds(positionRadius, job * CLUSTER_LIGHTS_PER_JOB, std::min(count, (job + 1) * CLUSTER_LIGHTS_PER_JOB), view);
+    });
+
+    // bucket the lights by slice so a slice's job doesn't scan every light
+    for (vector<uint32_t>& lights : slice_lights)
+        lights.clear();
+    for (size_t light = 0; light < count; light++)
+    {
+        const LightRange& range = light_ranges[light];
+        if (range.x0 > range.x1)
+            continue;
+        for (int slice = range.z0; slice <= range.z1; slice++)
+            slice_lights[slice].push_back(uint32_t(light));
+    }
+
+    // every slice writes its own lists, no locking needed
+    clusters.resize(size_t(tiles_x) * tiles_y * CLUSTER_DEPTH_SLICES);
+    parallelFor(pool, CLUSTER_DEPTH_SLICES, [this](size_t slice) { fillSlice(int(slice)); });
+
+    size_t total = 0;
+    for (const vector<uint32_t>& indices : slice_indices)
+        total += indices.size();
+    light_indices.resize(total);
+    const size_t tilesPerSlice = size_t(tiles_x) * tiles_y;
+    size_t offset = 0;
+    assign_stats.maxLightsPerCluster = 0;
+    for (int slice = 0; slice < CLUSTER_DEPTH_SLICES; slice++)
+    {
+        std::copy(slice_indices[slice].begin(), slice_indices[slice].end(), light_indices.begin() + offset);
+        for (size_t i = 0; i < tilesPerSlice; i++)
+        {
+            glm::uvec2& cluster = clusters[slice * tilesPerSlice + i];
+            cluster.x += (unsigned int)offset;
+            assign_stats.maxLightsPerCluster = std::max(assign_stats.maxLightsPerCluster, size_t(cluster.y));
+        }
+        offset += slice_indices[slice].size();
+    }
+
+    assign_stats.lights = count;
+    assign_stats.visibleLights = 0;
+    for (const LightRange& range : light_ranges)
+        assign_stats.visibleLights += range.x0 <= range.x1 ? 1 : 0;
+    assign_stats.lightIndices = total;
+    assign_stats.assignMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void LightClusters::computeBounds(const glm::vec4* positionRadius, size_t begin, size_t end, const glm::mat4& view)
+{
+    // the x and y bounds are the tangents of the planes through the eye touching the sphere,
+    // k = (a * d -+ r * sqrt(a^2 + d^2 - r^2)) / (d^2 - r^2) for a view space coordinate a at depth d
+    size_t i = begin;
+#ifdef LIGHT_CLUSTERS_SSE
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 px = _mm_loadu_ps(&positionRadius[i].x);
+        __m128 py = _mm_loadu_ps(&positionRadius[i + 1].x);
+        __m128 pz = _mm_loadu_ps(&positionRadius[i + 2].x);
+        __m128 radius = _mm_loadu_ps(&positionRadius[i + 3].x);
+        _MM_TRANSPOSE4_PS(px, py, pz, radius);
+
+        __m128 cx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(view[0][0]), px), _mm_mul_ps(_mm_set1_ps(view[1][0]), py)),
+            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(view[2][0]), pz), _mm_set1_ps(view[3][0])));
+        __m128 cy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(view[0][1]), px), _mm_mul_ps(_mm_set1_ps(view[1][1]), py)),
+            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(view[2][1]), pz), _mm_set1_ps(view[3][1])));
+        __m128 cz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(view[0][2]), px), _mm_mul_ps(_mm_set1_ps(view[1][2]), py)),
+            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(view[2][2]), pz), _mm_set1_ps(view[3][2])));
+        __m128 depth = _mm_sub_ps(zero, cz);
+
+        __m128 depth2MinusRadius2 = _mm_sub_ps(_mm_mul_ps(depth, depth), _mm_mul_ps(radius, radius));
+        __m128 tangentX = _mm_sqrt_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(cx, cx), depth2MinusRadius2), zero));
+        __m128 tangentY = _mm_sqrt_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(cy, cy), depth2MinusRadius2), zero));
+        // a sphere crossing the near plane covers the whole screen anyway, froxelRange() doesn't use its tangents
+        __m128 invDenominator = _mm_div_ps(_mm_set1_ps(1.0f), _mm_max_ps(depth2MinusRadius2, _mm_set1_ps(1e-6f)));
+        __m128 ax = _mm_mul_ps(cx, depth), ay = _mm_mul_ps(cy, depth);
+        __m128 rx = _mm_mul_ps(radius, tangentX), ry = _mm_mul_ps(radius, tangentY);
+
+        alignas(16) float minX[4], maxX[4], minY[4], maxY[4], x[4], y[4], d[4], r[4];
+        _mm_store_ps(minX, _mm_mul_ps(_mm_sub_ps(ax, rx), invDenominator));
+        _mm_store_ps(maxX, _mm_mul_ps(_mm_add_ps(ax, rx), invDenominator));
+        _mm_store_ps(minY, _mm_mul_ps(_mm_sub_ps(ay, ry), invDenominator));
+        _mm_store_ps(maxY, _mm_mul_ps(_mm_add_ps(ay, ry), invDenominator));
+        _mm_store_ps(x, cx);
+        _mm_store_ps(y, cy);
+        _mm_store_ps(d, depth);
+        _mm_store_ps(r, radius);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            view_lights[i + lane] = glm::vec4(x[lane], y[lane], d[lane], r[lane]);
+            light_ranges[i + lane] = froxelRange(d[lane], r[lane], minX[lane], maxX[lane], minY[lane], maxY[lane]);
+        }
+    }
+#endif
+    for (; i < end; i++)
+    {
+        glm::vec4 center = view * glm::vec4(glm::vec3(positionRadius[i]), 1.0f);
+        float radius = positionRadius[i].w;
+        float depth = -center.z;
+        float depth2MinusRadius2 = depth * depth - radius * radius;
+        float tangentX = sqrtf(std::max(center.x * center.x + depth2MinusRadius2, 0.0f));
+        float tangentY = sqrtf(std::max(center.y * center.y + depth2MinusRadius2, 0.0f));
+        float invDenominator = 1.0f / std::max(depth2MinusRadius2, 1e-6f);
+        view_lights[i] = glm::vec4(center.x, center.y, depth, radius);
+        light_ranges[i] = froxelRange(depth, radius, (center.x * depth - radius * tangentX) * invDenominator, (center.x * depth + radius * tangentX) * invDenominator,
+            (center.y * depth - radius * tangentY) * invDenominator, (center.y * depth + radius * tangentY) * invDenominator);
+    }
+}
+
+LightClusters::LightRange LightClusters::froxelRange(float depth, float radius, float tanMinX, float tanMaxX, float tanMinY, float tanMaxY) const
+{
+    const LightRange empty = { 1, 0, 1, 0, 1, 0 };
+    if (depth + radius < z_near || depth - radius > z_far)
+        return empty;
+
+    LightRange range;
+    range.z0 = uint16_t(depthSlice(std::max(depth - radius, z_near)));
+    range.z1 = uint16_t(depthSlice(std::min(depth + radius, z_far)));
+    if (depth - radius <= z_near)
+    {
+        // the sphere reaches the eye's side of the near plane, its projection is unbounded
+        range.x0 = 0;
+        range.x1 = uint16_t(tiles_x - 1);
+        range.y0 = 0;
+        range.y1 = uint16_t(tiles_y - 1);
+        return range;
+    }
+
+    // tangents to NDC to tiles, tile y grows upwards like gl_FragCoord
+    float minX = (tanMinX * projection_x * 0.5f + 0.5f) * width / CLUSTER_TILE_SIZE;
+    float maxX = (tanMaxX * projection_x * 0.5f + 0.5f) * width / CLUSTER_TILE_SIZE;
+    float minY = (tanMinY * projection_y * 0.5f + 0.5f) * height / CLUSTER_TILE_SIZE;
+    float maxY = (tanMaxY * projection_y * 0.5f + 0.5f) * height / CLUSTER_TILE_SIZE;
+    if (maxX < 0.0f || maxY < 0.0f || minX >= float(tiles_x) || minY >= float(tiles_y))
+        return empty;
+    range.x0 = uint16_t(std::max(int(minX), 0));
+    range.x1 = uint16_t(std::min(int(maxX), tiles_x - 1));
+    range.y0 = uint16_t(std::max(int(minY), 0));
+    range.y1 = uint16_t(std::min(int(maxY), tiles_y - 1));
+    return range;
+}
+
+void LightClusters::fillSlice(int slice)
+{
+    const size_t tilesPerSlice = size_t(tiles_x) * tiles_y;
+    const size_t firstCluster = slice * tilesPerSlice;
+    vector<uint32_t> counts(tilesPerSlice, 0);
+    // (tile, light) pairs of the lights intersecting the slice's froxels
+    vector<uint32_t>& pairs = slice_pairs[slice];
+    pairs.clear();
+    for (uint32_t light : slice_lights[slice])
+    {
+        const LightRange& range = light_ranges[light];
+        const glm::vec4& sphere = view_lights[light];
+        const float radius2 = sphere.w * sphere.w;
+        for (int y = range.y0; y <= range.y1; y++)
+        {
+            for (int x = range.x0; x <= range.x1; x++)
+            {
+                // the tile range is the sphere's screen space box, drop the froxels only that box reaches
+                size_t tile = size_t(y) * tiles_x + x;
+                glm::vec3 closest = glm::clamp(glm::vec3(sphere), cluster_min[firstCluster + tile], cluster_max[firstCluster + tile]);
+                glm::vec3 offset = closest - glm::vec3(sphere);
+                if (glm::dot(offset, offset) > radius2)
+                    continue;
+                pairs.push_back(uint32_t(tile));
+                pairs.push_back(light);
+                counts[tile]++;
+            }
+        }
+    }
+
+    // counting sort by tile, the offsets are relative to the slice until assign() concatenates the slices
+    uint32_t offset = 0;
+    for (size_t tile = 0; tile < tilesPerSlice; tile++)
+    {
+        clusters[firstCluster + tile] = glm::uvec2(offset, counts[tile]);
+        offset += counts[tile];
+    }
+    vector<uint32_t>& indices = slice_indices[slice];
+    indices.resize(offset);
+    for (size_t i = 0; i < pairs.size(); i += 2)
+    {
+        glm::uvec2& cluster = clusters[firstCluster + pairs[i]];
+        indices[cluster.x + --counts[pairs[i]]] = pairs[i + 1];
+    }
+}
+
+int LightClusters::depthSlice(float depth) const
+{
+    int slice = int(floorf(logf(depth) * slice_scale + slice_bias));
+    return std::min(std::max(slice, 0), CLUSTER_DEPTH_SLICES - 1);
+}
+
+glm::uvec2 LightClusters::cluster(int x, int y, int slice) const
+{
+    return clusters[(size_t(slice) * tiles_y + y) * tiles_x + x];
+}
+
+void LightClusters::upload(const glm::vec4* positionRadius, const glm::vec4* colors, size_t count)
+{
+    if (!buffers[0])
+    {
+        glGenBuffers(3, buffers);
+        glGenTextures(3, textures);
+        const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+        for (int i = 0; i < 3; i++)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // two texels per light: position and radius, then color
+    vector<glm::vec4> lights(count * 2);
+    for (size_t i = 0; i < count; i++)
+    {
+        lights[2 * i] = positionRadius[i];
+        lights[2 * i + 1] = glm::vec4(glm::vec3(colors[i]), 0.0f);
+    }
+    // reallocating the storage every frame lets the driver hand out a fresh buffer instead of waiting on the last frame
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[0]);
+    glBufferData(GL_TEXTURE_BUFFER, std::max(lights.size() * sizeof(glm::vec4), size_t(16)), lights.empty() ? NULL : lights.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[1]);
+    glBufferData(GL_TEXTURE_BUFFER, clusters.size() * sizeof(glm::uvec2), clusters.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[2]);
+    glBufferData(GL_TEXTURE_BUFFER, std::max(light_indices.size() * sizeof(uint32_t), size_t(16)), light_indices.empty() ? NULL : light_indices.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::bind(Shader& shader, GLuint firstUnit) const
+{
+    const char* samplers[3] = { "clusterLights", "clusterRanges", "clusterLightIndices" };
+    for (GLuint i = 0; i < 3; i++)
+    {
+        glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+        glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        shader.setUniformInt(samplers[i], int(firstUnit + i));
+    }
+    glActiveTexture(GL_TEXTURE0);
+    shader.setUniformInt("clusterTileSize", CLUSTER_TILE_SIZE);
+    shader.setUniformInt("clusterTilesX", tiles_x);
+    shader.setUniformInt("clusterTilesY", tiles_y);
+    shader.setUniformInt("clusterSlices", CLUSTER_DEPTH_SLICES);
+    shader.setUniformFloat("clusterDepthScale", slice_scale);
+    shader.setUniformFloat("clusterDepthBias", slice_bias);
+}
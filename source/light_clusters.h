@@ -0,0 +1,101 @@
+#ifndef _LIGHT_CLUSTERS_H_
+#define _LIGHT_CLUSTERS_H_
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+
+#include "shader_s.h"
+#include "thread_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// screen tile of a cluster in pixels
+const int CLUSTER_TILE_SIZE = 64;
+// depth slices between the near and far plane, exponentially spaced
+const int CLUSTER_DEPTH_SLICES = 24;
+// lights handled by one job of the bounds pass
+const size_t CLUSTER_LIGHTS_PER_JOB = 4096;
+
+// Assigns point lights to the froxels (screen tile x depth slice) of a perspective view on the CPU and
+// uploads the result as texture buffers, so a single full-screen pass can shade every pixel with just the
+// lights of its froxel (see deferredClustered.glsl). The light bounds are computed four lights at a time
+// with SSE when available, then every depth slice is filled by its own job on the thread pool.
+class LightClusters
+{
+public:
+    // what the last assign() did
+    struct Stats {
+        size_t lights;
+        size_t visibleLights;         // lights touching at least one froxel
+        size_t lightIndices;          // froxel light list entries
+        size_t maxLightsPerCluster;
+        double assignMilliseconds;
+    };
+
+    // texture units of the light data, the froxel ranges and the light lists, bind() uses the three from firstUnit on
+    static const GLuint DEFAULT_TEXTURE_UNIT = 5;
+
+    explicit LightClusters(ThreadPool* pool = &ThreadPool::shared());
+    // GL objects are left to the context teardown
+
+    // Froxel grid of a view, recomputed only when one of the values changes
+    void setView(int width, int height, float fovy, float zNear, float zFar);
+    // Sort the lights (world space position and radius) into the froxels of the view. No GL calls,
+    // so it can be timed without a context.
+    void assign(const glm::vec4* positionRadius, size_t count, const glm::mat4& view);
+    // Upload the froxel lists and the lights (position and radius followed by the color of each). GL thread only.
+    void upload(const glm::vec4* positionRadius, const glm::vec4* colors, size_t count);
+    // Bind the texture buffers and set the clustering uniforms of a shader in use
+    void bind(Shader& shader, GLuint firstUnit = DEFAULT_TEXTURE_UNIT) const;
+
+    const Stats& stats() const { return assign_stats; }
+    // light range of a froxel, offset into lightIndices() and count
+    glm::uvec2 cluster(int x, int y, int slice) const;
+    const std::vector<uint32_t>& lightIndices() const { return light_indices; }
+    int tilesX() const { return tiles_x; }
+    int tilesY() const { return tiles_y; }
+
+private:
+    // froxels touched by a light, empty when x0 > x1
+    struct LightRange {
+        uint16_t x0, x1, y0, y1, z0, z1;
+    };
+
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    // view space center and radius, and the froxel range of lights [begin, end)
+    void computeBounds(const glm::vec4* positionRadius, size_t begin, size_t end, const glm::mat4& view);
+    // froxel range of a light from its view space center, depth (positive) and the tangents bounding it in x and y
+    LightRange froxelRange(float depth, float radius, float tanMinX, float tanMaxX, float tanMinY, float tanMaxY) const;
+    // the light lists of one depth slice
+    void fillSlice(int slice);
+    int depthSlice(float depth) const;
+
+    ThreadPool* pool;
+    int width, height;
+    float fovy, z_near, z_far;
+    float projection_x, projection_y;         // the projection's x and y scale, tangent to NDC
+    float slice_scale, slice_bias;            // slice = log(depth) * scale + bias
+    int tiles_x, tiles_y;
+    std::vector<glm::vec3> cluster_min;       // view space bounds of every froxel, depth negated
+    std::vector<glm::vec3> cluster_max;
+    // per frame data
+    std::vector<glm::vec4> view_lights;       // view space center (depth negated) and radius
+    std::vector<LightRange> light_ranges;
+    std::vector<std::vector<uint32_t>> slice_lights;   // lights overlapping each slice
+    std::vector<std::vector<uint32_t>> slice_pairs;    // (tile, light) pairs of each slice before sorting
+    std::vector<std::vector<uint32_t>> slice_indices;  // light lists of each slice, cluster by cluster
+    std::vector<glm::uvec2> clusters;         // offset and count of every froxel, x fastest then y then slice
+    std::vector<uint32_t> light_indices;
+    Stats assign_stats;
+    // texture buffers
+    GLuint buffers[3];
+    GLuint textures[3];
+};
+
+
+#endif
@@ -0,0 +1,229 @@
+#include "light_proxies.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <utility>
+
+namespace {
+
+const int PROXY_TRIANGLES[LIGHT_PROXY_COUNT] = { 2, 20, 80, 320 };
+
+uint16_t midpoint(std::vector<glm::vec3>& vertices, std::map<std::pair<uint16_t, uint16_t>, uint16_t>& midpoints, uint16_t a, uint16_t b)
+{
+    std::pair<uint16_t, uint16_t> edge(std::min(a, b), std::max(a, b));
+    std::map<std::pair<uint16_t, uint16_t>, uint16_t>::iterator found = midpoints.find(edge);
+    if (found != midpoints.end())
+        return found->second;
+    uint16_t vertex = uint16_t(vertices.size());
+    vertices.push_back(glm::normalize(vertices[a] + vertices[b]));
+    midpoints[edge] = vertex;
+    return vertex;
+}
+
+}
+
+LightProxies::LightProxies(ThreadPool* pool)
+    :
+    pool(pool),
+    focal_length(1.0f),
+    z_near(0.1f),
+    batch_first(),
+    batch_count(),
+    vertex_array(0),
+    vertex_buffer(0),
+    index_buffer(0),
+    instance_buffer(0),
+    instance_capacity(0),
+    index_count(),
+    index_offset(),
+    base_vertex(),
+    classify_stats()
+{
+}
+
+void LightProxies::generateIcosphere(int subdivisions, std::vector<glm::vec3>& vertices, std::vector<uint16_t>& indices)
+{
+    const float t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+    const glm::vec3 icosahedron[12] = {
+        glm::vec3(-1.0f, t, 0.0f), glm::vec3(1.0f, t, 0.0f), glm::vec3(-1.0f, -t, 0.0f), glm::vec3(1.0f, -t, 0.0f),
+        glm::vec3(0.0f, -1.0f, t), glm::vec3(0.0f, 1.0f, t), glm::vec3(0.0f, -1.0f, -t), glm::vec3(0.0f, 1.0f, -t),
+        glm::vec3(t, 0.0f, -1.0f), glm::vec3(t, 0.0f, 1.0f), glm::vec3(-t, 0.0f, -1.0f), glm::vec3(-t, 0.0f, 1.0f)
+    };
+    const uint16_t faces[60] = {
+        0, 11, 5,  0, 5, 1,  0, 1, 7,  0, 7, 10,  0, 10, 11,
+        1, 5, 9,  5, 11, 4,  11, 10, 2,  10, 7, 6,  7, 1, 8,
+        3, 9, 4,  3, 4, 2,  3, 2, 6,  3, 6, 8,  3, 8, 9,
+        4, 9, 5,  2, 4, 11,  6, 2, 10,  8, 6, 7,  9, 8, 1
+    };
+    vertices.clear();
+    for (const glm::vec3& vertex : icosahedron)
+        vertices.push_back(glm::normalize(vertex));
+    indices.assign(faces, faces + 60);
+
+    // split every triangle in four, the new vertices pushed out onto the sphere
+    for (int level = 0; level < subdivisions; level++)
+    {
+        std::map<std::pair<uint16_t, uint16_t>, uint16_t> midpoints;
+        std::vector<uint16_t> split;
+        split.reserve(indices.size() * 4);
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            uint16_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            uint16_t ab = midpoint(vertices, midpoints, a, b);
+            uint16_t bc = midpoint(vertices, midpoints, b, c);
+            uint16_t ca = midpoint(vertices, midpoints, c, a);
+            uint16_t triangles[12] = { a, ab, ca,  b, bc, ab,  c, ca, bc,  ab, bc, ca };
+            split.insert(split.end(), triangles, triangles + 12);
+        }
+        indices.swap(split);
+    }
+
+    // the vertices lie on the unit sphere and the faces cut inside it, grow the mesh until the face
+    // closest to the center touches the sphere
+    float closest = 1.0f;
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        const glm::vec3& a = vertices[indices[i]];
+        glm::vec3 normal = glm::normalize(glm::cross(vertices[indices[i + 1]] - a, vertices[indices[i + 2]] - a));
+        closest = std::min(closest, glm::dot(normal, a));
+    }
+    for (glm::vec3& vertex : vertices)
+        vertex = vertex * (1.0f / closest);
+}
+
+void LightProxies::setView(int height, float fovy, float zNear)
+{
+    focal_length = 0.5f * float(height) / std::tan(0.5f * fovy);
+    z_near = zNear;
+}
+
+void LightProxies::classify(const glm::vec4* positionRadius, const uint32_t* lights, size_t count, const glm::mat4& view)
+{
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    light_proxy.resize(count);
+    const size_t jobs = (count + LIGHT_PROXY_LIGHTS_PER_JOB - 1) / LIGHT_PROXY_LIGHTS_PER_JOB;
+    parallelFor(jobs > 1 ? pool : nullptr, jobs, [&](size_t job) {
+        size_t end = std::min((job + 1) * LIGHT_PROXY_LIGHTS_PER_JOB, count);
+        for (size_t i = job * LIGHT_PROXY_LIGHTS_PER_JOB; i < end; i++)
+        {
+            const glm::vec4& sphere = positionRadius[lights ? lights[i] : i];
+            // only the view space depth matters
+            float depth = -(view[0][2] * sphere.x + view[1][2] * sphere.y + view[2][2] * sphere.z + view[3][2]);
+            float pixels = sphere.w * focal_length / depth;
+            LightProxy proxy;
+            if (depth - sphere.w <= z_near)
+                proxy = LIGHT_PROXY_ICOSPHERE_2;
+            else if (pixels <= LIGHT_PROXY_QUAD_PIXELS)
+                proxy = LIGHT_PROXY_QUAD;
+            else if (pixels <= LIGHT_PROXY_ICOSPHERE_0_PIXELS)
+                proxy = LIGHT_PROXY_ICOSPHERE_0;
+            else if (pixels <= LIGHT_PROXY_ICOSPHERE_1_PIXELS)
+                proxy = LIGHT_PROXY_ICOSPHERE_1;
+            else
+                proxy = LIGHT_PROXY_ICOSPHERE_2;
+            light_proxy[i] = uint8_t(proxy);
+        }
+    });
+
+    // counting sort of the light indices by proxy
+    std::fill(batch_count, batch_count + LIGHT_PROXY_COUNT, 0);
+    for (size_t i = 0; i < count; i++)
+        batch_count[light_proxy[i]]++;
+    size_t offsets[LIGHT_PROXY_COUNT];
+    size_t first = 0;
+    classify_stats.triangles = 0;
+    for (int proxy = 0; proxy < LIGHT_PROXY_COUNT; proxy++)
+    {
+        batch_first[proxy] = offsets[proxy] = first;
+        first += batch_count[proxy];
+        classify_stats.lights[proxy] = batch_count[proxy];
+        classify_stats.triangles += batch_count[proxy] * PROXY_TRIANGLES[proxy];
+    }
+    grouped_lights.resize(count);
+    for (size_t i = 0; i < count; i++)
+        grouped_lights[offsets[light_proxy[i]]++] = lights ? lights[i] : uint32_t(i);
+    classify_stats.classifyMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void LightProxies::createMeshes()
+{
+    if (vertex_array)
+        return;
+
+    // all proxies in one vertex and index buffer, the quad's corners span [-1, 1] and are placed by the shader
+    std::vector<glm::vec3> vertices = { glm::vec3(-1.0f, -1.0f, 0.0f), glm::vec3(1.0f, -1.0f, 0.0f), glm::vec3(1.0f, 1.0f, 0.0f), glm::vec3(-1.0f, 1.0f, 0.0f) };
+    std::vector<uint16_t> indices = { 0, 1, 2, 0, 2, 3 };
+    index_count[LIGHT_PROXY_QUAD] = 6;
+    for (int level = 0; level < 3; level++)
+    {
+        std::vector<glm::vec3> sphereVertices;
+        std::vector<uint16_t> sphereIndices;
+        generateIcosphere(level, sphereVertices, sphereIndices);
+        LightProxy proxy = LightProxy(LIGHT_PROXY_ICOSPHERE_0 + level);
+        index_offset[proxy] = indices.size() * sizeof(uint16_t);
+        index_count[proxy] = GLsizei(sphereIndices.size());
+        base_vertex[proxy] = GLint(vertices.size());
+        vertices.insert(vertices.end(), sphereVertices.begin(), sphereVertices.end());
+        indices.insert(indices.end(), sphereIndices.begin(), sphereIndices.end());
+    }
+
+    glGenVertexArrays(1, &vertex_array);
+    glGenBuffers(1, &vertex_buffer);
+    glGenBuffers(1, &index_buffer);
+    glGenBuffers(1, &instance_buffer);
+    glBindVertexArray(vertex_array);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), indices.data(), GL_STATIC_DRAW);
+    // the light indices, pointed at the batch being drawn by drawInstances()
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    glEnableVertexAttribArray(LIGHT_INDEX_LOCATION);
+    glVertexAttribIPointer(LIGHT_INDEX_LOCATION, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void*)0);
+    glVertexAttribDivisor(LIGHT_INDEX_LOCATION, 1);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void LightProxies::upload()
+{
+    createMeshes();
+    if (grouped_lights.empty())
+        return;
+    if (grouped_lights.size() > instance_capacity)
+        instance_capacity = grouped_lights.size() + grouped_lights.size() / 2;
+    // orphan the storage instead of waiting on the draws of the last frame
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    glBufferData(GL_ARRAY_BUFFER, instance_capacity * sizeof(uint32_t), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, grouped_lights.size() * sizeof(uint32_t), grouped_lights.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void LightProxies::draw(LightProxy proxy, Shader& shader)
+{
+    drawInstances(proxy, batch_first[proxy], batch_count[proxy], shader);
+}
+
+void LightProxies::drawAll(LightProxy mesh, Shader& shader)
+{
+    drawInstances(mesh, 0, grouped_lights.size(), shader);
+}
+
+void LightProxies::drawInstances(LightProxy mesh, size_t first, size_t count, Shader& shader)
+{
+    if (count == 0)
+        return;
+    createMeshes();
+    shader.setUniformInt("proxyQuad", mesh == LIGHT_PROXY_QUAD ? 1 : 0);
+    glBindVertexArray(vertex_array);
+    // GL 3.3 has no base instance, start the instance attribute at the batch instead
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    glVertexAttribIPointer(LIGHT_INDEX_LOCATION, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void*)(first * sizeof(uint32_t)));
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, index_count[mesh], GL_UNSIGNED_SHORT, (void*)index_offset[mesh], GLsizei(count), base_vertex[mesh]);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
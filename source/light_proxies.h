@@ -0,0 +1,100 @@
+#ifndef _LIGHT_PROXIES_H_
+#define _LIGHT_PROXIES_H_
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+
+#include "shader_s.h"
+#include "thread_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// geometry a point light is rasterized with, from the cheapest to the tightest fitting
+enum LightProxy {
+    LIGHT_PROXY_QUAD,           // screen rectangle around the projected sphere, 2 triangles
+    LIGHT_PROXY_ICOSPHERE_0,    // 20 triangles
+    LIGHT_PROXY_ICOSPHERE_1,    // 80 triangles
+    LIGHT_PROXY_ICOSPHERE_2,    // 320 triangles
+    LIGHT_PROXY_COUNT
+};
+
+// projected light radius in pixels up to which a proxy is used, larger lights get the finest icosphere
+const float LIGHT_PROXY_QUAD_PIXELS = 16.0f;
+const float LIGHT_PROXY_ICOSPHERE_0_PIXELS = 64.0f;
+const float LIGHT_PROXY_ICOSPHERE_1_PIXELS = 192.0f;
+// lights classified by one job
+const size_t LIGHT_PROXY_LIGHTS_PER_JOB = 16384;
+
+// Proxy geometry of the point light volumes. The icospheres are generated at three tessellation levels and
+// scaled to enclose the unit sphere, so every pixel the light reaches is covered. classify() picks a proxy
+// for every light from its radius on screen and groups the lights by proxy, draw() renders one group as an
+// instanced batch whose instances are light indices; the shaders fetch the lights themselves from the light
+// buffers (see lightProxy.glsl). Small lights are drawn as quads, which also can't be stencil masked, and
+// lights reaching the near plane always as the finest icosphere, the rectangle is undefined for them.
+class LightProxies
+{
+public:
+    // what the last classify() did
+    struct Stats {
+        size_t lights[LIGHT_PROXY_COUNT];
+        size_t triangles;
+        double classifyMilliseconds;
+    };
+
+    // instanced light index attribute
+    static const GLuint LIGHT_INDEX_LOCATION = 2;
+
+    explicit LightProxies(ThreadPool* pool = &ThreadPool::shared());
+    // GL objects are left to the context teardown
+
+    // Projection the projected sizes are measured in
+    void setView(int height, float fovy, float zNear);
+    // Choose the proxy of the lights (indices into positionRadius, the first count lights when null) and group
+    // them by proxy. No GL calls.
+    void classify(const glm::vec4* positionRadius, const uint32_t* lights, size_t count, const glm::mat4& view);
+    // Upload the grouped light indices. GL thread only.
+    void upload();
+    // Draw the lights of a proxy as one instanced batch, the quads set proxyQuad in the shader in use
+    void draw(LightProxy proxy, Shader& shader);
+    // Draw every classified light with the mesh of a proxy, for the debug view of the volumes
+    void drawAll(LightProxy mesh, Shader& shader);
+
+    size_t count(LightProxy proxy) const { return batch_count[proxy]; }
+    const Stats& stats() const { return classify_stats; }
+
+    // Icosphere subdivided the given number of times (up to 2), counterclockwise outward and scaled so its
+    // faces enclose the unit sphere
+    static void generateIcosphere(int subdivisions, std::vector<glm::vec3>& vertices, std::vector<uint16_t>& indices);
+
+private:
+    LightProxies(const LightProxies&) = delete;
+    LightProxies& operator=(const LightProxies&) = delete;
+
+    void createMeshes();
+    void drawInstances(LightProxy mesh, size_t first, size_t count, Shader& shader);
+
+    ThreadPool* pool;
+    float focal_length;         // pixels per unit of tangent
+    float z_near;
+    // proxy of every light of the last classify(), and the lights grouped by proxy
+    std::vector<uint8_t> light_proxy;
+    std::vector<uint32_t> grouped_lights;
+    size_t batch_first[LIGHT_PROXY_COUNT];
+    size_t batch_count[LIGHT_PROXY_COUNT];
+    // the meshes share a vertex array, buffers and the instance buffer of light indices
+    GLuint vertex_array;
+    GLuint vertex_buffer;
+    GLuint index_buffer;
+    GLuint instance_buffer;
+    size_t instance_capacity;
+    GLsizei index_count[LIGHT_PROXY_COUNT];
+    size_t index_offset[LIGHT_PROXY_COUNT];
+    GLint base_vertex[LIGHT_PROXY_COUNT];
+    Stats classify_stats;
+};
+
+
+#endif
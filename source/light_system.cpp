@@ -0,0 +1,368 @@
+#include "light_system.h"
+
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIGHT_SYSTEM_SSE
+#include <emmintrin.h>
+#endif
+
+using std::vector;
+
+namespace {
+
+const float PI = 3.14159265358979f;
+const float TWO_PI = 2.0f * PI;
+
+// Parabolic sine approximation refined once, absolute error below 0.001 on [-pi, pi]. Plenty for
+// animation, and the SSE version below computes exactly the same thing.
+inline float fastSin(float x)
+{
+    float y = (4.0f / PI) * x - (4.0f / (PI * PI)) * x * std::fabs(x);
+    return 0.225f * (y * std::fabs(y) - y) + y;
+}
+
+// phase wrapped back into [-pi, pi)
+inline float wrapPhase(float phase)
+{
+    return phase - TWO_PI * std::floor((phase + PI) * (1.0f / TWO_PI));
+}
+
+#ifdef LIGHT_SYSTEM_SSE
+inline __m128 absPs(__m128 x)
+{
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+}
+
+inline __m128 floorPs(__m128 x)
+{
+    // truncate, then step down where truncating rounded a negative value up
+    __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.0f)));
+}
+
+inline __m128 wrapPhasePs(__m128 phase)
+{
+    __m128 turns = floorPs(_mm_mul_ps(_mm_add_ps(phase, _mm_set1_ps(PI)), _mm_set1_ps(1.0f / TWO_PI)));
+    return _mm_sub_ps(phase, _mm_mul_ps(turns, _mm_set1_ps(TWO_PI)));
+}
+
+inline __m128 fastSinPs(__m128 x)
+{
+    __m128 y = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(4.0f / PI), x), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.0f / (PI * PI)), x), absPs(x)));
+    return _mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.225f), _mm_sub_ps(_mm_mul_ps(y, absPs(y)), y)), y);
+}
+#endif
+
+}
+
+LightSystem::LightSystem(ThreadPool* pool)
+    :
+    pool(pool),
+    position_buffer(0),
+    color_buffer(0),
+    position_texture(0),
+    color_texture(0),
+    gpu_capacity(0),
+    frame_stats(),
+    layout_version(0),
+    position_version(0)
+{
+    changed_lights.reset();
+    dirty_positions.reset();
+    dirty_colors.reset();
+}
+
+size_t LightSystem::add(const glm::vec3& anchor, float radius, const glm::vec3& color)
+{
+    size_t light = size();
+    anchor_x.push_back(anchor.x);
+    anchor_y.push_back(anchor.y);
+    anchor_z.push_back(anchor.z);
+    orbit_radius.push_back(0.0f);
+    orbit_phase.push_back(0.0f);
+    orbit_speed.push_back(0.0f);
+    radii.push_back(radius);
+    color_r.push_back(color.x);
+    color_g.push_back(color.y);
+    color_b.push_back(color.z);
+    pos_x.push_back(anchor.x);
+    pos_y.push_back(anchor.y);
+    pos_z.push_back(anchor.z);
+    position_radius.push_back(glm::vec4(anchor, radius));
+    colors_rgba.push_back(glm::vec4(color, 0.0f));
+    block_bounds.resize((size() + LIGHT_BLOCK_SIZE - 1) / LIGHT_BLOCK_SIZE);
+    changed(light);
+    dirty_colors.add(light, light + 1);
+    layout_version++;
+    return light;
+}
+
+void LightSystem::remove(size_t light)
+{
+    size_t last = size() - 1;
+    if (light != last)
+    {
+        for (vector<float>* values : { &anchor_x, &anchor_y, &anchor_z, &orbit_radius, &orbit_phase, &orbit_speed,
+            &radii, &color_r, &color_g, &color_b, &pos_x, &pos_y, &pos_z })
+        {
+            (*values)[light] = (*values)[last];
+        }
+        position_radius[light] = position_radius[last];
+        colors_rgba[light] = colors_rgba[last];
+        changed(light);
+        dirty_colors.add(light, light + 1);
+    }
+    for (vector<float>* values : { &anchor_x, &anchor_y, &anchor_z, &orbit_radius, &orbit_phase, &orbit_speed,
+        &radii, &color_r, &color_g, &color_b, &pos_x, &pos_y, &pos_z })
+    {
+        values->pop_back();
+    }
+    position_radius.pop_back();
+    colors_rgba.pop_back();
+    block_bounds.resize((size() + LIGHT_BLOCK_SIZE - 1) / LIGHT_BLOCK_SIZE);
+    // the last block lost a light
+    if (size() > 0)
+        changed(size() - 1);
+    changed_lights.end = std::min(changed_lights.end, size());
+    dirty_positions.end = std::min(dirty_positions.end, size());
+    dirty_colors.end = std::min(dirty_colors.end, size());
+    layout_version++;
+}
+
+void LightSystem::clear()
+{
+    for (vector<float>* values : { &anchor_x, &anchor_y, &anchor_z, &orbit_radius, &orbit_phase, &orbit_speed,
+        &radii, &color_r, &color_g, &color_b, &pos_x, &pos_y, &pos_z })
+    {
+        values->clear();
+    }
+    position_radius.clear();
+    colors_rgba.clear();
+    block_bounds.clear();
+    changed_lights.reset();
+    dirty_positions.reset();
+    dirty_colors.reset();
+    layout_version++;
+}
+
+void LightSystem::reserve(size_t count)
+{
+    for (vector<float>* values : { &anchor_x, &anchor_y, &anchor_z, &orbit_radius, &orbit_phase, &orbit_speed,
+        &radii, &color_r, &color_g, &color_b, &pos_x, &pos_y, &pos_z })
+    {
+        values->reserve(count);
+    }
+    position_radius.reserve(count);
+    colors_rgba.reserve(count);
+}
+
+void LightSystem::setAnchor(size_t light, const glm::vec3& anchor)
+{
+    anchor_x[light] = anchor.x;
+    anchor_y[light] = anchor.y;
+    anchor_z[light] = anchor.z;
+    changed(light);
+}
+
+void LightSystem::setRadius(size_t light, float radius)
+{
+    radii[light] = radius;
+    changed(light);
+}
+
+void LightSystem::setColor(size_t light, const glm::vec3& color)
+{
+    color_r[light] = color.x;
+    color_g[light] = color.y;
+    color_b[light] = color.z;
+    colors_rgba[light] = glm::vec4(color, 0.0f);
+    dirty_colors.add(light, light + 1);
+}
+
+void LightSystem::setOrbit(size_t light, float radius, float phase, float speed)
+{
+    orbit_radius[light] = radius;
+    orbit_phase[light] = wrapPhase(phase);
+    orbit_speed[light] = speed;
+    changed(light);
+}
+
+void LightSystem::changed(size_t light)
+{
+    changed_lights.add(light, light + 1);
+}
+
+void LightSystem::update(float seconds)
+{
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    size_t firstBlock = 0, lastBlock = 0;
+    if (seconds != 0.0f)
+    {
+        lastBlock = block_bounds.size();
+    }
+    else if (!changed_lights.empty())
+    {
+        // whole blocks, their bounds are recomputed
+        firstBlock = changed_lights.begin / LIGHT_BLOCK_SIZE;
+        lastBlock = (changed_lights.end + LIGHT_BLOCK_SIZE - 1) / LIGHT_BLOCK_SIZE;
+    }
+
+    const size_t blocksPerJob = LIGHT_JOB_SIZE / LIGHT_BLOCK_SIZE;
+    const size_t jobs = (lastBlock - firstBlock + blocksPerJob - 1) / blocksPerJob;
+    parallelFor(jobs > 1 ? pool : nullptr, jobs, [&](size_t job) {
+        size_t begin = firstBlock + job * blocksPerJob;
+        updateBlocks(begin, std::min(begin + blocksPerJob, lastBlock), seconds);
+    });
+
+    size_t updated = std::min(lastBlock * LIGHT_BLOCK_SIZE, size()) - std::min(firstBlock * LIGHT_BLOCK_SIZE, size());
+    if (updated > 0)
+    {
+        dirty_positions.add(firstBlock * LIGHT_BLOCK_SIZE, std::min(lastBlock * LIGHT_BLOCK_SIZE, size()));
+        position_version++;
+    }
+    changed_lights.reset();
+    frame_stats.firstUpdated = std::min(firstBlock * LIGHT_BLOCK_SIZE, size());
+    frame_stats.updatedLights = updated;
+    frame_stats.updateMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void LightSystem::updateBlocks(size_t firstBlock, size_t lastBlock, float seconds)
+{
+    for (size_t block = firstBlock; block < lastBlock; block++)
+    {
+        const size_t begin = block * LIGHT_BLOCK_SIZE;
+        const size_t end = std::min(begin + LIGHT_BLOCK_SIZE, size());
+        glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+        size_t i = begin;
+#ifdef LIGHT_SYSTEM_SSE
+        const __m128 step = _mm_set1_ps(seconds);
+        const __m128 halfPi = _mm_set1_ps(0.5f * PI);
+        __m128 minX = _mm_set1_ps(FLT_MAX), minY = minX, minZ = minX;
+        __m128 maxX = _mm_set1_ps(-FLT_MAX), maxY = maxX, maxZ = maxX;
+        for (; i + 4 <= end; i += 4)
+        {
+            __m128 phase = wrapPhasePs(_mm_add_ps(_mm_loadu_ps(&orbit_phase[i]), _mm_mul_ps(_mm_loadu_ps(&orbit_speed[i]), step)));
+            _mm_storeu_ps(&orbit_phase[i], phase);
+            __m128 orbit = _mm_loadu_ps(&orbit_radius[i]);
+            __m128 x = _mm_add_ps(_mm_loadu_ps(&anchor_x[i]), _mm_mul_ps(orbit, fastSinPs(wrapPhasePs(_mm_add_ps(phase, halfPi)))));
+            __m128 y = _mm_loadu_ps(&anchor_y[i]);
+            __m128 z = _mm_add_ps(_mm_loadu_ps(&anchor_z[i]), _mm_mul_ps(orbit, fastSinPs(phase)));
+            __m128 radius = _mm_loadu_ps(&radii[i]);
+            _mm_storeu_ps(&pos_x[i], x);
+            _mm_storeu_ps(&pos_y[i], y);
+            _mm_storeu_ps(&pos_z[i], z);
+
+            minX = _mm_min_ps(minX, _mm_sub_ps(x, radius));
+            minY = _mm_min_ps(minY, _mm_sub_ps(y, radius));
+            minZ = _mm_min_ps(minZ, _mm_sub_ps(z, radius));
+            maxX = _mm_max_ps(maxX, _mm_add_ps(x, radius));
+            maxY = _mm_max_ps(maxY, _mm_add_ps(y, radius));
+            maxZ = _mm_max_ps(maxZ, _mm_add_ps(z, radius));
+
+            // interleave for the GPU
+            _MM_TRANSPOSE4_PS(x, y, z, radius);
+            _mm_storeu_ps(&position_radius[i].x, x);
+            _mm_storeu_ps(&position_radius[i + 1].x, y);
+            _mm_storeu_ps(&position_radius[i + 2].x, z);
+            _mm_storeu_ps(&position_radius[i + 3].x, radius);
+        }
+        alignas(16) float lanes[6][4];
+        _mm_store_ps(lanes[0], minX);
+        _mm_store_ps(lanes[1], minY);
+        _mm_store_ps(lanes[2], minZ);
+        _mm_store_ps(lanes[3], maxX);
+        _mm_store_ps(lanes[4], maxY);
+        _mm_store_ps(lanes[5], maxZ);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            boundsMin = glm::min(boundsMin, glm::vec3(lanes[0][lane], lanes[1][lane], lanes[2][lane]));
+            boundsMax = glm::max(boundsMax, glm::vec3(lanes[3][lane], lanes[4][lane], lanes[5][lane]));
+        }
+#endif
+        for (; i < end; i++)
+        {
+            float phase = wrapPhase(orbit_phase[i] + orbit_speed[i] * seconds);
+            orbit_phase[i] = phase;
+            pos_x[i] = anchor_x[i] + orbit_radius[i] * fastSin(wrapPhase(phase + 0.5f * PI));
+            pos_y[i] = anchor_y[i];
+            pos_z[i] = anchor_z[i] + orbit_radius[i] * fastSin(phase);
+            position_radius[i] = glm::vec4(pos_x[i], pos_y[i], pos_z[i], radii[i]);
+            boundsMin = glm::min(boundsMin, glm::vec3(position_radius[i]) - glm::vec3(radii[i]));
+            boundsMax = glm::max(boundsMax, glm::vec3(position_radius[i]) + glm::vec3(radii[i]));
+        }
+        block_bounds[block].min = boundsMin;
+        block_bounds[block].max = boundsMax;
+    }
+}
+
+void LightSystem::createBuffers()
+{
+    if (position_buffer)
+        return;
+    glGenBuffers(1, &position_buffer);
+    glGenBuffers(1, &color_buffer);
+    glGenTextures(1, &position_texture);
+    glGenTextures(1, &color_texture);
+    // a texture buffer needs a buffer with storage, upload() replaces it once there are lights
+    GLuint buffers[2] = { position_buffer, color_buffer };
+    GLuint textures[2] = { position_texture, color_texture };
+    for (int i = 0; i < 2; i++)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffers[i]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightSystem::upload()
+{
+    createBuffers();
+    frame_stats.uploadedBytes = 0;
+    if (size() > gpu_capacity)
+    {
+        // grow with some headroom and send everything, the storage is new
+        gpu_capacity = size() + size() / 2;
+        glBindBuffer(GL_ARRAY_BUFFER, position_buffer);
+        glBufferData(GL_ARRAY_BUFFER, gpu_capacity * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, color_buffer);
+        glBufferData(GL_ARRAY_BUFFER, gpu_capacity * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+        dirty_positions.add(0, size());
+        dirty_colors.add(0, size());
+    }
+
+    if (!dirty_positions.empty())
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, position_buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, dirty_positions.begin * sizeof(glm::vec4), (dirty_positions.end - dirty_positions.begin) * sizeof(glm::vec4),
+            &position_radius[dirty_positions.begin]);
+        frame_stats.uploadedBytes += (dirty_positions.end - dirty_positions.begin) * sizeof(glm::vec4);
+    }
+    if (!dirty_colors.empty())
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, color_buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, dirty_colors.begin * sizeof(glm::vec4), (dirty_colors.end - dirty_colors.begin) * sizeof(glm::vec4),
+            &colors_rgba[dirty_colors.begin]);
+        frame_stats.uploadedBytes += (dirty_colors.end - dirty_colors.begin) * sizeof(glm::vec4);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    dirty_positions.reset();
+    dirty_colors.reset();
+}
+
+void LightSystem::bind(Shader& shader, GLuint firstUnit)
+{
+    createBuffers();
+    glActiveTexture(GL_TEXTURE0 + firstUnit);
+    glBindTexture(GL_TEXTURE_BUFFER, position_texture);
+    shader.setUniformInt("lightPositionRadius", int(firstUnit));
+    glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+    glBindTexture(GL_TEXTURE_BUFFER, color_texture);
+    shader.setUniformInt("lightColors", int(firstUnit + 1));
+    glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,130 @@
+#ifndef _LIGHT_SYSTEM_H_
+#define _LIGHT_SYSTEM_H_
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+
+#include "shader_s.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// lights sharing one bounding box in blockBounds()
+const size_t LIGHT_BLOCK_SIZE = 64;
+// lights handled by one job of update(), a multiple of LIGHT_BLOCK_SIZE
+const size_t LIGHT_JOB_SIZE = 16384;
+
+// Point lights stored as structure of arrays. Every light sits on a circular orbit in the xz plane around
+// its anchor (a zero orbit radius keeps it on the anchor), update() advances the orbits four lights at a
+// time with SSE when available, in jobs on the thread pool, and refreshes the interleaved position/radius
+// and color arrays the GPU and LightClusters consume as well as the bounds of every block of lights.
+// upload() sends only the ranges that changed since the last upload, shaders read the lights from texture
+// buffers over the same storage.
+class LightSystem
+{
+public:
+    // texture units of the position/radius and the color buffer, bind() uses the two from firstUnit on
+    static const GLuint DEFAULT_TEXTURE_UNIT = 8;
+
+    struct Bounds {
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    // what the last update() and upload() did
+    struct Stats {
+        size_t firstUpdated;          // the lights update() placed are [firstUpdated, firstUpdated + updatedLights)
+        size_t updatedLights;
+        double updateMilliseconds;
+        size_t uploadedBytes;
+    };
+
+    explicit LightSystem(ThreadPool* pool = &ThreadPool::shared());
+    // GL objects are left to the context teardown
+
+    // Add a light at rest on its anchor, returns its index
+    size_t add(const glm::vec3& anchor, float radius, const glm::vec3& color);
+    // Remove a light, the last light moves into its index
+    void remove(size_t light);
+    void clear();
+    void reserve(size_t count);
+
+    void setAnchor(size_t light, const glm::vec3& anchor);
+    void setRadius(size_t light, float radius);
+    void setColor(size_t light, const glm::vec3& color);
+    // orbit around the anchor, phase in radians and speed in radians per second
+    void setOrbit(size_t light, float radius, float phase, float speed);
+
+    // Advance the orbits by seconds and refresh the positions and bounds. Every light is updated when the
+    // orbits move, otherwise only the lights changed since the last update. No GL calls.
+    void update(float seconds);
+    // Upload the changed ranges of the position/radius and color buffers. GL thread only.
+    void upload();
+    // Bind the light buffers as the samplerBuffers lightPositionRadius and lightColors of a shader in use
+    void bind(Shader& shader, GLuint firstUnit = DEFAULT_TEXTURE_UNIT);
+
+    size_t size() const { return anchor_x.size(); }
+    // interleaved world position and radius, valid after update()
+    const glm::vec4* positionRadius() const { return position_radius.data(); }
+    // interleaved color, alpha unused
+    const glm::vec4* colors() const { return colors_rgba.data(); }
+    glm::vec3 position(size_t light) const { return glm::vec3(pos_x[light], pos_y[light], pos_z[light]); }
+    float radius(size_t light) const { return radii[light]; }
+    // bounds of the spheres of lights [i * LIGHT_BLOCK_SIZE, (i + 1) * LIGHT_BLOCK_SIZE), valid after update()
+    const std::vector<Bounds>& blockBounds() const { return block_bounds; }
+    const Stats& stats() const { return frame_stats; }
+    // bumped by every add(), remove() and clear(), and by every update() that placed lights
+    uint64_t layoutVersion() const { return layout_version; }
+    uint64_t positionVersion() const { return position_version; }
+
+private:
+    // half open index range, empty when begin >= end
+    struct Range {
+        size_t begin;
+        size_t end;
+
+        void add(size_t first, size_t last) { begin = std::min(begin, first); end = std::max(end, last); }
+        void reset() { begin = SIZE_MAX; end = 0; }
+        bool empty() const { return begin >= end; }
+    };
+
+    LightSystem(const LightSystem&) = delete;
+    LightSystem& operator=(const LightSystem&) = delete;
+
+    void changed(size_t light);
+    // advance and place the lights of blocks [firstBlock, lastBlock) and compute their bounds
+    void updateBlocks(size_t firstBlock, size_t lastBlock, float seconds);
+    void createBuffers();
+
+    ThreadPool* pool;
+    // per light data
+    std::vector<float> anchor_x, anchor_y, anchor_z;
+    std::vector<float> orbit_radius, orbit_phase, orbit_speed;
+    std::vector<float> radii;
+    std::vector<float> color_r, color_g, color_b;
+    // derived by update()
+    std::vector<float> pos_x, pos_y, pos_z;
+    std::vector<glm::vec4> position_radius;
+    std::vector<glm::vec4> colors_rgba;
+    std::vector<Bounds> block_bounds;
+    // lights update() has to place, and ranges upload() has to send
+    Range changed_lights;
+    Range dirty_positions;
+    Range dirty_colors;
+    // GL buffers, their texture buffer views and the lights they have room for
+    GLuint position_buffer;
+    GLuint color_buffer;
+    GLuint position_texture;
+    GLuint color_texture;
+    size_t gpu_capacity;
+    Stats frame_stats;
+    uint64_t layout_version;
+    uint64_t position_version;
+};
+
+
+#endif
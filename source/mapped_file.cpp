@@ -0,0 +1,126 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+    :
+    base(nullptr),
+    length(0),
+#ifdef _WIN32
+    file_handle(INVALID_HANDLE_VALUE),
+    mapping_handle(nullptr)
+#else
+    file_descriptor(-1)
+#endif
+{
+}
+
+MappedFile::MappedFile(const std::string& path)
+    :
+    MappedFile()
+{
+    open(path);
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+#ifdef _WIN32
+    file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file_handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file_handle, &fileSize) || fileSize.QuadPart == 0)
+    {
+        close();
+        return false;
+    }
+
+    mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping_handle == nullptr)
+    {
+        close();
+        return false;
+    }
+
+    base = static_cast<const unsigned char*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    if (base == nullptr)
+    {
+        close();
+        return false;
+    }
+    length = size_t(fileSize.QuadPart);
+#else
+    file_descriptor = ::open(path.c_str(), O_RDONLY);
+    if (file_descriptor < 0)
+    {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(file_descriptor, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        close();
+        return false;
+    }
+
+    void* view = mmap(nullptr, size_t(fileStat.st_size), PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+    if (view == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    base = static_cast<const unsigned char*>(view);
+    length = size_t(fileStat.st_size);
+#endif
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (base)
+    {
+        UnmapViewOfFile(base);
+    }
+    if (mapping_handle)
+    {
+        CloseHandle(mapping_handle);
+    }
+    if (file_handle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(file_handle);
+    }
+    mapping_handle = nullptr;
+    file_handle = INVALID_HANDLE_VALUE;
+#else
+    if (base)
+    {
+        munmap(const_cast<unsigned char*>(base), length);
+    }
+    if (file_descriptor >= 0)
+    {
+        ::close(file_descriptor);
+    }
+    file_descriptor = -1;
+#endif
+    base = nullptr;
+    length = 0;
+}
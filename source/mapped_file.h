@@ -0,0 +1,43 @@
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapped view of a file
+class MappedFile
+{
+public:
+    // default constructor
+    MappedFile();
+    // open constructor, check isOpen() for the result
+    explicit MappedFile(const std::string& path);
+    // destructor
+    ~MappedFile();
+    // Map the whole file into memory, returns false if it can't be opened
+    bool open(const std::string& path);
+    // Unmap the file
+    void close();
+    // Is there a file currently mapped
+    bool isOpen() const { return base != nullptr; }
+    // Start of the mapped bytes
+    const unsigned char* data() const { return base; }
+    // Size of the mapped file in bytes
+    size_t size() const { return length; }
+
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* base;    // start of the mapped view
+    size_t length;                // size of the mapped view
+#ifdef _WIN32
+    void* file_handle;            // HANDLE of the opened file
+    void* mapping_handle;         // HANDLE of the file mapping object
+#else
+    int file_descriptor;          // descriptor of the opened file
+#endif
+};
+
+
+#endif
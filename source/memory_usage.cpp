@@ -0,0 +1,53 @@
+#include "memory_usage.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <sys/resource.h>
+#else
+#include <cstdio>
+#include <cstring>
+#endif
+
+MemoryUsage currentMemoryUsage()
+{
+    MemoryUsage usage = { 0, 0 };
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        usage.resident = counters.WorkingSetSize;
+        usage.peakResident = counters.PeakWorkingSetSize;
+    }
+#elif defined(__APPLE__)
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS)
+        usage.resident = info.resident_size;
+    rusage resources;
+    if (getrusage(RUSAGE_SELF, &resources) == 0)
+        usage.peakResident = size_t(resources.ru_maxrss);   // bytes on macOS
+#else
+    // VmRSS and VmHWM (high water mark) are reported in kB
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status)
+    {
+        char line[256];
+        while (fgets(line, sizeof(line), status))
+        {
+            unsigned long kilobytes = 0;
+            if (strncmp(line, "VmRSS:", 6) == 0 && sscanf(line + 6, "%lu", &kilobytes) == 1)
+                usage.resident = size_t(kilobytes) * 1024;
+            else if (strncmp(line, "VmHWM:", 6) == 0 && sscanf(line + 6, "%lu", &kilobytes) == 1)
+                usage.peakResident = size_t(kilobytes) * 1024;
+        }
+        fclose(status);
+    }
+#endif
+    return usage;
+}
@@ -0,0 +1,19 @@
+#ifndef _MEMORY_USAGE_H_
+#define _MEMORY_USAGE_H_
+
+#include <cstddef>
+
+// Resident set size of the process, what the OS actually keeps in physical memory for us
+struct MemoryUsage {
+    size_t resident;              // current resident bytes
+    size_t peakResident;          // highest resident bytes since the process started
+};
+
+// Queries the OS, both values are 0 where it can't be determined
+MemoryUsage currentMemoryUsage();
+
+// bytes to megabytes for logging
+inline double toMegabytes(size_t bytes) { return double(bytes) / (1024.0 * 1024.0); }
+
+
+#endif
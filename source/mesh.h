@@ -7,54 +7,356 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include "shader_s.h"
+#include "vertex_layout.h"
+#include "geometry_arena.h"
+#include "draw_batch.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <utility>
 #include <vector>
 using namespace std;
 
-struct Vertex {
-    // position
-    glm::vec3 Position;
-    // normal
-    glm::vec3 Normal;
-    // texCoords
-    glm::vec2 TexCoords;
-    // tangent
-    glm::vec3 Tangent;
-    // bitangent
-    glm::vec3 Bitangent;
-};
-
 struct Texture {
     unsigned int id;
     string type;
     string path;
 };
 
+// material texture referenced by a mesh, turned into a Texture once a GL context is available
+struct TextureRef {
+    string type;
+    string path;
+};
+
+// one level of detail, a range of the mesh's index buffer
+struct MeshLod {
+    unsigned int indexOffset;
+    unsigned int indexCount;
+    float error;                  // object space distance between this level and the full resolution surface
+    unsigned int clusterOffset;   // clusters splitting the level's index range
+    unsigned int clusterCount;
+};
+
+// a run of about a hundred triangles of a level, culled as a whole
+struct MeshCluster {
+    glm::vec3 center;             // object space bounding sphere
+    float radius;
+    glm::vec3 coneAxis;           // average triangle normal
+    float coneCutoff;             // sine of the normal cone's half angle, above 1 when the cone can't be used
+    unsigned int indexOffset;
+    unsigned int indexCount;
+};
+
+// how a render pass sees the meshes: turns the error of a level of detail into pixels and
+// describes the frustum and view direction the clusters are culled against
+struct LodView {
+    glm::mat4 viewProjection;
+    glm::vec3 eye;                // world space position of the viewer, or the view direction for orthographic views
+    float pixelsPerUnit;          // pixels covered by one unit at distance 1, or at any distance for orthographic views
+    bool orthographic;
+    float maxError;               // largest error in pixels a level may show
+    float hysteresis;             // a coarser level is only taken once its error drops below maxError * (1 - hysteresis)
+    bool cullClusters;            // draw the clusters surviving frustum and normal cone culling instead of the whole level
+
+    static LodView perspective(const glm::mat4& viewProjection, const glm::vec3& eye, float fovy, float viewportHeight,
+        float maxError, float hysteresis = 0.25f)
+    {
+        return LodView{ viewProjection, eye, viewportHeight / (2.0f * tanf(fovy * 0.5f)), false, maxError, hysteresis, true };
+    }
+
+    static LodView orthographicView(const glm::mat4& viewProjection, const glm::vec3& direction, float viewHeight, float viewportHeight,
+        float maxError, float hysteresis = 0.25f)
+    {
+        return LodView{ viewProjection, direction, viewportHeight / viewHeight, true, maxError, hysteresis, true };
+    }
+
+    // size in pixels of an object space error at the given distance from the viewer
+    float projectedError(float error, float distance) const
+    {
+        return orthographic ? error * pixelsPerUnit : error * pixelsPerUnit / distance;
+    }
+};
+
+// levels of detail last picked for the meshes of one object in one view, where the hysteresis of selectLod() starts.
+// Every object keeps its own per view: copies of a model sharing a mesh don't start from each other's level.
+struct LodState {
+    vector<unsigned int> levels;
+
+    unsigned int& level(size_t mesh)
+    {
+        if (mesh >= levels.size())
+            levels.resize(mesh + 1, 0);
+        return levels[mesh];
+    }
+};
+
+// object space bounding box of vertex positions, and the radius of the bounding sphere around the box center
+inline void computeBounds(const Vertex* vertices, size_t count, glm::vec3& boundsMin, glm::vec3& boundsMax, float& boundsRadius)
+{
+    boundsMin = boundsMax = glm::vec3(0.0f);
+    boundsRadius = 0.0f;
+    if (count == 0)
+        return;
+
+    boundsMin = boundsMax = vertices[0].Position;
+    for (size_t i = 1; i < count; i++)
+    {
+        boundsMin = glm::min(boundsMin, vertices[i].Position);
+        boundsMax = glm::max(boundsMax, vertices[i].Position);
+    }
+    // tighter than half the box diagonal for anything but a box
+    glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+    float radiusSquared = 0.0f;
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::vec3 offset = vertices[i].Position - center;
+        radiusSquared = glm::max(radiusSquared, glm::dot(offset, offset));
+    }
+    boundsRadius = sqrtf(radiusSquared);
+}
+
+// CPU side result of importing a mesh, everything needed to create the Mesh on the GL thread
+struct MeshData {
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+    vector<TextureRef> textures;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    float boundsRadius;           // bounding sphere around the box center
+    vector<MeshLod> lods;         // level 0 is the full mesh, the indices of the coarser levels follow it
+    vector<MeshCluster> clusters; // clusters of all levels
+};
+
+// what a Mesh does with its CPU copy of the geometry once it is in the arena. Nothing needs it to draw or
+// cull, keep it only for CPU side work on the triangles (e.g. comparing loads).
+enum class CpuGeometry { Release, Keep };
+
 class Mesh {
 public:
     /*  Mesh Data  */
-    vector<Vertex> vertices;
+    vector<Vertex> vertices;      // empty unless the mesh was created with CpuGeometry::Keep
     vector<unsigned int> indices;
     vector<Texture> textures;
-    unsigned int VAO;
+    unsigned int VAO;             // the arena's vertex array
+    GeometryArena* arena;         // shared buffers holding the mesh
+    GLint baseVertex;             // first vertex of the mesh in the arena
+    unsigned int firstIndex;      // first index of the mesh in the arena
+    unsigned int vertexCount;
+    unsigned int indexCount;      // indices of the full resolution level
+    GLenum indexType;             // GL_UNSIGNED_INT or GL_UNSIGNED_SHORT
+    VertexLayout layout;          // streams and encoding of the vertex buffer
+    // object space bounding box, and sphere around its center
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    float boundsRadius;
+    glm::vec3 boundsCenter() const { return (boundsMin + boundsMax) * 0.5f; }
+    // levels of detail, finest first
+    vector<MeshLod> lods;
+    // culling clusters of all levels, see MeshLod::clusterOffset
+    vector<MeshCluster> clusters;
     /*  Functions  */
-    // constructor
-    Mesh(const vector<Vertex>& vertices, const vector<unsigned int>& indices, const vector<Texture>& textures)
+    // constructor, the vectors are moved in and kept unless residency releases them after the upload
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures,
+        const VertexLayout& layout = VertexLayout(), CpuGeometry residency = CpuGeometry::Keep)
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        this->layout = layout;
+        this->vertices = std::move(vertices);
+        this->indices = std::move(indices);
+        this->textures = std::move(textures);
+        this->indexCount = (unsigned int)this->indices.size();
+        this->lods.push_back(MeshLod{ 0, indexCount, 0.0f, 0, 0 });
 
+        computeBounds();
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
+        if (residency == CpuGeometry::Release)
+            releaseGeometry();
+    }
+
+    // constructor from imported mesh data, textures are the GL textures resolved from data.textures.
+    // The geometry is moved out of data.
+    Mesh(MeshData&& data, vector<Texture> textures, const VertexLayout& layout = VertexLayout(),
+        CpuGeometry residency = CpuGeometry::Release)
+    {
+        this->layout = layout;
+        this->vertices = std::move(data.vertices);
+        this->indices = std::move(data.indices);
+        this->textures = std::move(textures);
+        this->lods = std::move(data.lods);
+        this->clusters = std::move(data.clusters);
+        if (lods.empty())
+            lods.push_back(MeshLod{ 0, (unsigned int)indices.size(), 0.0f, 0, 0 });
+        this->indexCount = lods[0].indexCount;
+        this->boundsMin = data.boundsMin;
+        this->boundsMax = data.boundsMax;
+        this->boundsRadius = data.boundsRadius;
+
+        setupMesh(vertices.data(), vertices.size(), indices.data(), indices.size());
+        if (residency == CpuGeometry::Release)
+            releaseGeometry();
     }
 
-    // render the mesh
-    void draw(Shader& shader)
+    // constructor for geometry that is already laid out in memory (e.g. a mapped mesh cache or data
+    // another owner still needs), the data is handed straight to the GPU and only copied when kept.
+    Mesh(const Vertex* vertexData, size_t vertexCount, const unsigned int* indexData, size_t indexCount, vector<MeshLod> lods,
+        vector<MeshCluster> clusters, vector<Texture> textures, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+        float boundsRadius, const VertexLayout& layout = VertexLayout(), CpuGeometry residency = CpuGeometry::Release)
+    {
+        this->layout = layout;
+        this->textures = std::move(textures);
+        this->lods = std::move(lods);
+        this->clusters = std::move(clusters);
+        if (this->lods.empty())
+            this->lods.push_back(MeshLod{ 0, (unsigned int)indexCount, 0.0f, 0, 0 });
+        this->indexCount = this->lods[0].indexCount;
+        this->boundsMin = boundsMin;
+        this->boundsMax = boundsMax;
+        this->boundsRadius = boundsRadius;
+
+        setupMesh(vertexData, vertexCount, indexData, indexCount);
+        if (residency == CpuGeometry::Keep)
+        {
+            vertices.assign(vertexData, vertexData + vertexCount);
+            indices.assign(indexData, indexData + indexCount);
+        }
+    }
+
+    // frees the CPU copy of the geometry, counts, bounds, levels and clusters stay
+    void releaseGeometry()
+    {
+        vector<Vertex>().swap(vertices);
+        vector<unsigned int>().swap(indices);
+    }
+
+    // size of the CPU copy of the geometry, 0 once released
+    size_t cpuGeometryBytes() const
+    {
+        return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int);
+    }
+
+    // size of the vertex and index buffers on the GPU
+    size_t geometryBytes() const
+    {
+        size_t indices = size_t(lods.back().indexOffset) + lods.back().indexCount;
+        return size_t(vertexCount) * layout.stride() + indices * indexSize();
+    }
+
+    // picks the coarsest level whose projected error stays within the view's limit, the previous choice
+    // (current, the object's level in this view) is kept while it is within the hysteresis band to avoid popping
+    unsigned int selectLod(const LodView& view, const glm::mat4& transform, unsigned int& current) const
+    {
+        if (lods.size() < 2)
+            return current = 0;
+
+        // distance from the viewer to the bounding sphere, errors scale with the transform
+        float scale = glm::max(glm::length(glm::vec3(transform[0])), glm::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+        glm::vec3 center = glm::vec3(transform * glm::vec4(boundsCenter(), 1.0f));
+        float radius = boundsRadius * scale;
+        float distance = glm::max(glm::length(center - view.eye) - radius, 1e-3f);
+
+        if (current >= lods.size())
+            current = 0;
+        if (view.projectedError(lods[current].error * scale, distance) > view.maxError)
+        {
+            while (current > 0 && view.projectedError(lods[current].error * scale, distance) > view.maxError)
+                current--;
+        }
+        else
+        {
+            const float coarserError = view.maxError * (1.0f - view.hysteresis);
+            while (current + 1 < lods.size() && view.projectedError(lods[current + 1].error * scale, distance) <= coarserError)
+                current++;
+        }
+        return current;
+    }
+
+    // byte offset of a level's first index in the arena's element buffer
+    const void* indexOffset(unsigned int lod = 0) const
+    {
+        return (void*)(size_t(firstIndex + lods[lod].indexOffset) * indexSize());
+    }
+
+    // render the mesh at the given level of detail, returns the triangles submitted
+    size_t draw(Shader& shader, unsigned int lod = 0)
+    {
+        bindTextures(shader);
+
+        // draw mesh
+        if (lod >= lods.size())
+            lod = (unsigned int)lods.size() - 1;
+        glBindVertexArray(VAO);
+        glDrawElementsBaseVertex(GL_TRIANGLES, lods[lod].indexCount, indexType, indexOffset(lod), baseVertex);
+        glBindVertexArray(0);
+
+        // always good practice to set everything back to defaults once configured.
+        glActiveTexture(GL_TEXTURE0);
+        return lods[lod].indexCount / 3;
+    }
+
+    // queues the clusters of a level that are inside the view's frustum and not facing away from it,
+    // or the whole level when the view doesn't cull clusters. transform is the object's transform.
+    // Returns the triangles queued.
+    size_t queue(DrawBatch& batch, unsigned int object, unsigned int lod, const glm::mat4& transform, const LodView& view)
+    {
+        const MeshLod& level = lods[lod < lods.size() ? lod : lods.size() - 1];
+        if (!view.cullClusters || level.clusterCount == 0)
+        {
+            batch.add(*this, object, level.indexOffset, level.indexCount);
+            return level.indexCount / 3;
+        }
+
+        // cull in object space: frustum planes of the combined matrix, viewer position or direction through the inverse transform
+        glm::mat4 objectToClip = view.viewProjection * transform;
+        glm::vec4 planes[6];
+        for (int i = 0; i < 3; i++)
+        {
+            glm::vec4 row(objectToClip[0][i], objectToClip[1][i], objectToClip[2][i], objectToClip[3][i]);
+            glm::vec4 w(objectToClip[0][3], objectToClip[1][3], objectToClip[2][3], objectToClip[3][3]);
+            planes[2 * i] = w + row;
+            planes[2 * i + 1] = w - row;
+        }
+        for (glm::vec4& plane : planes)
+            plane = plane / glm::length(glm::vec3(plane));
+        glm::mat4 worldToObject = glm::inverse(transform);
+        glm::vec3 viewer = glm::vec3(worldToObject * glm::vec4(view.eye, view.orthographic ? 0.0f : 1.0f));
+        if (view.orthographic)
+            viewer = glm::normalize(viewer);
+
+        size_t triangles = 0;
+        for (unsigned int c = level.clusterOffset; c < level.clusterOffset + level.clusterCount; c++)
+        {
+            const MeshCluster& cluster = clusters[c];
+            bool visible = true;
+            for (int p = 0; p < 6 && visible; p++)
+                visible = glm::dot(glm::vec3(planes[p]), cluster.center) + planes[p].w > -cluster.radius;
+            if (!visible)
+                continue;
+
+            // every triangle faces away when the view direction is inside the (sphere widened) normal cone
+            if (view.orthographic)
+            {
+                if (glm::dot(viewer, cluster.coneAxis) >= cluster.coneCutoff)
+                    continue;
+            }
+            else
+            {
+                glm::vec3 toCluster = cluster.center - viewer;
+                if (glm::dot(toCluster, cluster.coneAxis) >= cluster.coneCutoff * glm::length(toCluster) + cluster.radius)
+                    continue;
+            }
+
+            // the batch merges clusters that are adjacent in the index buffer
+            batch.add(*this, object, cluster.indexOffset, cluster.indexCount);
+            triangles += cluster.indexCount / 3;
+        }
+        return triangles;
+    }
+
+    // binds the textures and sets the per mesh uniforms
+    void bindTextures(Shader& shader)
     {
         // bind appropriate textures
         unsigned int diffuseNr = 1;
@@ -81,59 +383,50 @@ public:
             // and finally bind the texture
             glBindTexture(GL_TEXTURE_2D, textures[i].id);
         }
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+        // octahedral normals have to be decoded by the vertex shader
+        if (layout.has(VERTEX_NORMAL))
+            shader.setUniformBool("octahedralNormals", layout.normalFormat == NormalFormat::Octahedral);
     }
 
 private:
-    /*  Render data  */
-    unsigned int VBO, EBO;
-
     /*  Functions    */
-    // initializes all the buffer objects/arrays
-    void setupMesh()
+    size_t indexSize() const
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
+        return indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+    }
 
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+    // computes the object space bounds from the vertex positions
+    void computeBounds()
+    {
+        ::computeBounds(vertices.data(), vertices.size(), boundsMin, boundsMax, boundsRadius);
+    }
 
-        glBindVertexArray(0);
+    // copies the mesh into the arena of its layout and index type
+    void setupMesh(const Vertex* vertexData, size_t vertexCount, const unsigned int* indexData, size_t indexCount)
+    {
+        this->vertexCount = (unsigned int)vertexCount;
+        indexType = layout.indexType(vertexCount);
+        arena = &GeometryArena::get(layout, indexType);
+        VAO = arena->vao();
 
+        // only upload the streams the shaders read, in their packed encoding. The full float layout matches Vertex.
+        vector<unsigned char> packed;
+        const void* vertexSource = vertexData;
+        if (layout.streams != VERTEX_ALL || layout.normalFormat != NormalFormat::Float || layout.halfTexCoords)
+        {
+            layout.packVertices(vertexData, vertexCount, packed);
+            vertexSource = packed.data();
+        }
 
+        // indices stay relative to the mesh, draws add baseVertex
+        vector<unsigned short> shortIndices;
+        const void* indexSource = indexData;
+        if (indexType == GL_UNSIGNED_SHORT)
+        {
+            shortIndices.assign(indexData, indexData + indexCount);
+            indexSource = shortIndices.data();
+        }
+        arena->allocate(vertexSource, vertexCount, indexSource, indexCount, baseVertex, firstIndex);
     }
 
 };
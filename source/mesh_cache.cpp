@@ -0,0 +1,298 @@
+#include "mesh_cache.h"
+
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::endl;
+
+namespace {
+
+const char MESH_CACHE_MAGIC[4] = { 'D', 'S', 'M', 'C' };
+const uint64_t MESH_CACHE_ALIGNMENT = 16;
+
+// file header, followed by meshCount entries
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t vertexSize;      // sizeof(Vertex) when the cache was written
+    uint32_t meshCount;
+    uint64_t sourceSize;      // size of the source model file
+    int64_t sourceTime;       // modification time of the source model file
+};
+
+// per mesh entry, offsets are from the start of the file
+struct CacheEntry {
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t textureCount;
+    uint32_t textureBytes;
+    uint32_t lodCount;
+    uint32_t clusterCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    float boundsRadius;
+    uint32_t padding;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t textureOffset;
+    uint64_t lodOffset;       // lodCount MeshLod records
+    uint64_t clusterOffset;   // clusterCount MeshCluster records
+};
+
+uint64_t alignOffset(uint64_t offset)
+{
+    return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(MESH_CACHE_ALIGNMENT - 1);
+}
+
+// size and modification time used to detect a changed source file
+bool sourceStamp(const string& sourcePath, uint64_t& size, int64_t& time)
+{
+    std::error_code error;
+    size = uint64_t(fs::file_size(sourcePath, error));
+    if (error)
+        return false;
+    time = int64_t(fs::last_write_time(sourcePath, error).time_since_epoch().count());
+    return !error;
+}
+
+void writePadding(std::ofstream& out, uint64_t& offset)
+{
+    static const char zeros[MESH_CACHE_ALIGNMENT] = {};
+    uint64_t aligned = alignOffset(offset);
+    out.write(zeros, std::streamsize(aligned - offset));
+    offset = aligned;
+}
+
+}
+
+string MeshCache::cachePath(const string& sourcePath)
+{
+    return sourcePath + ".meshcache";
+}
+
+bool MeshCache::write(const string& sourcePath, const vector<MeshData>& meshes)
+{
+    CacheHeader header;
+    memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MESH_CACHE_VERSION;
+    header.vertexSize = sizeof(Vertex);
+    header.meshCount = uint32_t(meshes.size());
+    if (!sourceStamp(sourcePath, header.sourceSize, header.sourceTime))
+        return false;
+
+    // lay out the texture tables, vertex and index data after the entry table
+    vector<CacheEntry> entries(meshes.size());
+    uint64_t offset = sizeof(CacheHeader) + entries.size() * sizeof(CacheEntry);
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        const MeshData& mesh = meshes[i];
+        CacheEntry& entry = entries[i];
+        entry.vertexCount = uint32_t(mesh.vertices.size());
+        entry.indexCount = uint32_t(mesh.indices.size());
+        entry.textureCount = uint32_t(mesh.textures.size());
+        entry.textureBytes = 0;
+        for (const TextureRef& texture : mesh.textures)
+            entry.textureBytes += uint32_t(2 * sizeof(uint32_t) + texture.type.size() + texture.path.size());
+        entry.lodCount = uint32_t(mesh.lods.size());
+        entry.clusterCount = uint32_t(mesh.clusters.size());
+        memcpy(entry.boundsMin, &mesh.boundsMin[0], sizeof(entry.boundsMin));
+        memcpy(entry.boundsMax, &mesh.boundsMax[0], sizeof(entry.boundsMax));
+        entry.boundsRadius = mesh.boundsRadius;
+        entry.padding = 0;
+
+        entry.textureOffset = offset;
+        offset = alignOffset(offset + entry.textureBytes);
+        entry.lodOffset = offset;
+        offset = alignOffset(offset + uint64_t(entry.lodCount) * sizeof(MeshLod));
+        entry.clusterOffset = offset;
+        offset = alignOffset(offset + uint64_t(entry.clusterCount) * sizeof(MeshCluster));
+        entry.vertexOffset = offset;
+        offset = alignOffset(offset + uint64_t(entry.vertexCount) * sizeof(Vertex));
+        entry.indexOffset = offset;
+        offset = alignOffset(offset + uint64_t(entry.indexCount) * sizeof(unsigned int));
+    }
+
+    // write to a temporary file first so a crash never leaves a truncated cache behind
+    string path = cachePath(sourcePath);
+    string tempPath = path + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            cout << "MeshCache::write - unable to create " << tempPath << endl;
+            return false;
+        }
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(CacheEntry));
+        offset = sizeof(CacheHeader) + entries.size() * sizeof(CacheEntry);
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            const MeshData& mesh = meshes[i];
+            const CacheEntry& entry = entries[i];
+            for (const TextureRef& texture : mesh.textures)
+            {
+                uint32_t lengths[2] = { uint32_t(texture.type.size()), uint32_t(texture.path.size()) };
+                out.write(reinterpret_cast<const char*>(lengths), sizeof(lengths));
+                out.write(texture.type.data(), texture.type.size());
+                out.write(texture.path.data(), texture.path.size());
+            }
+            offset += entry.textureBytes;
+            writePadding(out, offset);
+
+            out.write(reinterpret_cast<const char*>(mesh.lods.data()), mesh.lods.size() * sizeof(MeshLod));
+            offset += mesh.lods.size() * sizeof(MeshLod);
+            writePadding(out, offset);
+
+            out.write(reinterpret_cast<const char*>(mesh.clusters.data()), mesh.clusters.size() * sizeof(MeshCluster));
+            offset += mesh.clusters.size() * sizeof(MeshCluster);
+            writePadding(out, offset);
+
+            out.write(reinterpret_cast<const char*>(mesh.vertices.data()), mesh.vertices.size() * sizeof(Vertex));
+            offset += mesh.vertices.size() * sizeof(Vertex);
+            writePadding(out, offset);
+
+            out.write(reinterpret_cast<const char*>(mesh.indices.data()), mesh.indices.size() * sizeof(unsigned int));
+            offset += mesh.indices.size() * sizeof(unsigned int);
+            writePadding(out, offset);
+        }
+
+        if (!out)
+        {
+            cout << "MeshCache::write - failed writing " << tempPath << endl;
+            out.close();
+            std::remove(tempPath.c_str());
+            return false;
+        }
+    }
+
+    std::error_code error;
+    fs::rename(tempPath, path, error);
+    if (error)
+    {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool MeshCache::open(const string& sourcePath)
+{
+    close();
+
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!sourceStamp(sourcePath, sourceSize, sourceTime))
+        return false;
+
+    if (!file.open(cachePath(sourcePath)))
+        return false;
+
+    const unsigned char* base = file.data();
+    const uint64_t fileSize = file.size();
+    if (fileSize < sizeof(CacheHeader))
+    {
+        close();
+        return false;
+    }
+
+    const CacheHeader* header = reinterpret_cast<const CacheHeader*>(base);
+    if (memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != MESH_CACHE_VERSION || header->vertexSize != sizeof(Vertex) ||
+        header->sourceSize != sourceSize || header->sourceTime != sourceTime ||
+        fileSize < sizeof(CacheHeader) + uint64_t(header->meshCount) * sizeof(CacheEntry))
+    {
+        // stale or from a different build, the caller falls back to a full import
+        close();
+        return false;
+    }
+
+    const CacheEntry* entries = reinterpret_cast<const CacheEntry*>(base + sizeof(CacheHeader));
+    mesh_records.resize(header->meshCount);
+    for (uint32_t i = 0; i < header->meshCount; i++)
+    {
+        const CacheEntry& entry = entries[i];
+        if (entry.textureOffset + entry.textureBytes > fileSize ||
+            entry.lodOffset + uint64_t(entry.lodCount) * sizeof(MeshLod) > fileSize ||
+            entry.clusterOffset + uint64_t(entry.clusterCount) * sizeof(MeshCluster) > fileSize ||
+            entry.vertexOffset + uint64_t(entry.vertexCount) * sizeof(Vertex) > fileSize ||
+            entry.indexOffset + uint64_t(entry.indexCount) * sizeof(unsigned int) > fileSize)
+        {
+            cout << "MeshCache::open - truncated cache " << cachePath(sourcePath) << endl;
+            close();
+            return false;
+        }
+
+        MeshCacheRecord& record = mesh_records[i];
+        record.vertices = reinterpret_cast<const Vertex*>(base + entry.vertexOffset);
+        record.vertexCount = entry.vertexCount;
+        record.indices = reinterpret_cast<const unsigned int*>(base + entry.indexOffset);
+        record.indexCount = entry.indexCount;
+        record.boundsMin = glm::vec3(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]);
+        record.boundsMax = glm::vec3(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]);
+        record.boundsRadius = entry.boundsRadius;
+        const MeshLod* lods = reinterpret_cast<const MeshLod*>(base + entry.lodOffset);
+        record.lods.assign(lods, lods + entry.lodCount);
+        const MeshCluster* clusters = reinterpret_cast<const MeshCluster*>(base + entry.clusterOffset);
+        record.clusters.assign(clusters, clusters + entry.clusterCount);
+        for (const MeshLod& lod : record.lods)
+        {
+            if (uint64_t(lod.indexOffset) + lod.indexCount > entry.indexCount ||
+                uint64_t(lod.clusterOffset) + lod.clusterCount > entry.clusterCount)
+            {
+                cout << "MeshCache::open - corrupt LOD table in " << cachePath(sourcePath) << endl;
+                close();
+                return false;
+            }
+        }
+        for (const MeshCluster& cluster : record.clusters)
+        {
+            if (uint64_t(cluster.indexOffset) + cluster.indexCount > entry.indexCount)
+            {
+                cout << "MeshCache::open - corrupt cluster table in " << cachePath(sourcePath) << endl;
+                close();
+                return false;
+            }
+        }
+
+        const unsigned char* cursor = base + entry.textureOffset;
+        const unsigned char* end = cursor + entry.textureBytes;
+        for (uint32_t t = 0; t < entry.textureCount; t++)
+        {
+            uint32_t lengths[2];
+            if (size_t(end - cursor) < sizeof(lengths))
+                break;
+            memcpy(lengths, cursor, sizeof(lengths));
+            cursor += sizeof(lengths);
+            if (uint64_t(end - cursor) < uint64_t(lengths[0]) + lengths[1])
+                break;
+            TextureRef texture;
+            texture.type.assign(reinterpret_cast<const char*>(cursor), lengths[0]);
+            cursor += lengths[0];
+            texture.path.assign(reinterpret_cast<const char*>(cursor), lengths[1]);
+            cursor += lengths[1];
+            record.textures.push_back(texture);
+        }
+        if (record.textures.size() != entry.textureCount)
+        {
+            // a model with some of its materials missing would load without complaint, import it instead
+            cout << "MeshCache::open - corrupt texture table in " << cachePath(sourcePath) << endl;
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void MeshCache::close()
+{
+    mesh_records.clear();
+    file.close();
+}
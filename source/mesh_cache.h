@@ -0,0 +1,51 @@
+#ifndef _MESH_CACHE_H_
+#define _MESH_CACHE_H_
+
+#include "mesh.h"
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Bump whenever the file layout, the contents of Vertex or the mesh processing change
+const uint32_t MESH_CACHE_VERSION = 5;
+
+// view of one mesh inside a mapped cache file, vertex and index pointers point into the mapping.
+// indices holds the index buffers of all levels of detail.
+struct MeshCacheRecord {
+    const Vertex* vertices;
+    uint32_t vertexCount;
+    const unsigned int* indices;
+    uint32_t indexCount;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    float boundsRadius;
+    std::vector<MeshLod> lods;
+    std::vector<MeshCluster> clusters;
+    std::vector<TextureRef> textures;
+};
+
+// Versioned binary cache of the processed meshes of a model file. The cache sits next to the
+// source file and is considered stale as soon as the source file's size or modification time changes.
+class MeshCache
+{
+public:
+    // Location of the cache file for a given model file
+    static std::string cachePath(const std::string& sourcePath);
+    // Write the meshes of a freshly imported model to its cache file
+    static bool write(const std::string& sourcePath, const std::vector<MeshData>& meshes);
+    // Map the cache of the given model file, returns false when it is missing, stale or malformed
+    bool open(const std::string& sourcePath);
+    // Unmap the cache, invalidates all records
+    void close();
+    // Cached meshes, valid while the cache is open
+    const std::vector<MeshCacheRecord>& records() const { return mesh_records; }
+
+private:
+    MappedFile file;                           // mapped cache file
+    std::vector<MeshCacheRecord> mesh_records; // meshes found in the file
+};
+
+
+#endif
@@ -0,0 +1,402 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+using std::vector;
+
+namespace {
+
+// smallest run of triangles optimizeOverdraw() may move on its own, each cluster boundary costs up to
+// one cache flush so small clusters would undo the vertex cache optimization
+const size_t OVERDRAW_CLUSTER_TRIANGLES = 128;
+
+// the attributes that decide whether two vertices are the same
+struct WeldKey {
+    float values[8];
+
+    explicit WeldKey(const Vertex& vertex)
+    {
+        memcpy(values, &vertex.Position[0], 3 * sizeof(float));
+        memcpy(values + 3, &vertex.Normal[0], 3 * sizeof(float));
+        memcpy(values + 6, &vertex.TexCoords[0], 2 * sizeof(float));
+    }
+
+    bool operator==(const WeldKey& other) const
+    {
+        return memcmp(values, other.values, sizeof(values)) == 0;
+    }
+};
+
+struct WeldKeyHash {
+    size_t operator()(const WeldKey& key) const
+    {
+        // FNV-1a over the raw bits
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(key.values);
+        size_t hash = 2166136261u;
+        for (size_t i = 0; i < sizeof(key.values); i++)
+            hash = (hash ^ bytes[i]) * 16777619u;
+        return hash;
+    }
+};
+
+}
+
+VertexCacheStats analyzeVertexCache(const vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize)
+{
+    VertexCacheStats stats = { 0.0f, 0.0f };
+    if (indices.empty() || vertexCount == 0)
+        return stats;
+
+    // FIFO cache, a vertex is in the cache while fewer than cacheSize misses happened since it was loaded
+    vector<size_t> loadedAt(vertexCount, 0);
+    size_t misses = 0;
+    for (unsigned int index : indices)
+    {
+        if (loadedAt[index] == 0 || misses - loadedAt[index] >= cacheSize)
+        {
+            misses++;
+            loadedAt[index] = misses;
+        }
+    }
+
+    stats.acmr = float(misses) / float(indices.size() / 3);
+    stats.atvr = float(misses) / float(vertexCount);
+    return stats;
+}
+
+size_t weldVertices(MeshData& mesh)
+{
+    const size_t vertexCount = mesh.vertices.size();
+    vector<unsigned int> remap(vertexCount);
+    vector<Vertex> welded;
+    welded.reserve(vertexCount);
+
+    std::unordered_map<WeldKey, unsigned int, WeldKeyHash> unique;
+    unique.reserve(vertexCount);
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        const Vertex& vertex = mesh.vertices[i];
+        auto inserted = unique.insert(std::make_pair(WeldKey(vertex), (unsigned int)welded.size()));
+        if (inserted.second)
+        {
+            welded.push_back(vertex);
+        }
+        else
+        {
+            // accumulate the tangent frames of the merged corners
+            Vertex& target = welded[inserted.first->second];
+            target.Tangent += vertex.Tangent;
+            target.Bitangent += vertex.Bitangent;
+        }
+        remap[i] = inserted.first->second;
+    }
+
+    for (Vertex& vertex : welded)
+    {
+        float tangentLength = glm::length(vertex.Tangent);
+        float bitangentLength = glm::length(vertex.Bitangent);
+        if (tangentLength > 0.0f)
+            vertex.Tangent /= tangentLength;
+        if (bitangentLength > 0.0f)
+            vertex.Bitangent /= bitangentLength;
+    }
+
+    for (unsigned int& index : mesh.indices)
+        index = remap[index];
+
+    size_t removed = vertexCount - welded.size();
+    mesh.vertices.swap(welded);
+    return removed;
+}
+
+void optimizeVertexCache(vector<unsigned int>& indices, size_t vertexCount, vector<size_t>* clusters, unsigned int cacheSize)
+{
+    const size_t triangleCount = indices.size() / 3;
+    if (clusters)
+        clusters->clear();
+    if (triangleCount == 0)
+        return;
+
+    // vertex -> triangle adjacency
+    vector<unsigned int> offsets(vertexCount + 1, 0);
+    for (unsigned int index : indices)
+        offsets[index + 1]++;
+    for (size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] += offsets[v];
+    vector<unsigned int> adjacency(indices.size());
+    vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+        adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+    vector<unsigned int> live(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        live[v] = offsets[v + 1] - offsets[v];
+
+    vector<unsigned int> cacheTime(vertexCount, 0);
+    vector<bool> emitted(triangleCount, false);
+    vector<unsigned int> deadEnd;
+    deadEnd.reserve(indices.size());
+    vector<unsigned int> candidates;
+    vector<unsigned int> output;
+    output.reserve(indices.size());
+    unsigned int timestamp = cacheSize + 1;
+    size_t cursor = 0;
+
+    // when the fan runs dead we continue with a recently used vertex, or the next one in input order
+    auto skipDeadEnd = [&]() -> long long {
+        while (!deadEnd.empty())
+        {
+            unsigned int vertex = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[vertex] > 0)
+                return vertex;
+        }
+        for (; cursor < vertexCount; cursor++)
+        {
+            if (live[cursor] > 0)
+                return (long long)cursor;
+        }
+        return -1;
+    };
+
+    long long fanning = skipDeadEnd();
+    size_t clusterStart = 0;
+    if (clusters)
+        clusters->push_back(0);
+    while (fanning >= 0)
+    {
+        // emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for (unsigned int a = offsets[fanning]; a < offsets[fanning + 1]; a++)
+        {
+            unsigned int triangle = adjacency[a];
+            if (emitted[triangle])
+                continue;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int vertex = indices[3 * triangle + k];
+                output.push_back(vertex);
+                deadEnd.push_back(vertex);
+                candidates.push_back(vertex);
+                live[vertex]--;
+                if (timestamp - cacheTime[vertex] > cacheSize)
+                    cacheTime[vertex] = timestamp++;
+            }
+            emitted[triangle] = true;
+        }
+
+        // continue with the candidate that is still in the cache after its remaining triangles are emitted
+        long long best = -1;
+        int bestPriority = -1;
+        for (unsigned int vertex : candidates)
+        {
+            if (live[vertex] == 0)
+                continue;
+            int priority = 0;
+            if (timestamp - cacheTime[vertex] + 2 * live[vertex] <= cacheSize)
+                priority = int(timestamp - cacheTime[vertex]);
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                best = vertex;
+            }
+        }
+
+        if (best < 0)
+        {
+            // dead end, a natural place for a cluster boundary
+            best = skipDeadEnd();
+            if (clusters && best >= 0 && output.size() - clusterStart >= 3 * OVERDRAW_CLUSTER_TRIANGLES)
+            {
+                clusterStart = output.size();
+                clusters->push_back(clusterStart);
+            }
+        }
+        fanning = best;
+    }
+
+    indices.swap(output);
+}
+
+void optimizeOverdraw(vector<unsigned int>& indices, const vector<Vertex>& vertices, const vector<size_t>& clusters)
+{
+    if (clusters.size() < 2)
+        return;
+
+    struct Cluster {
+        size_t begin;
+        size_t end;
+        glm::vec3 centroid;       // area weighted
+        glm::vec3 normal;         // area weighted
+        float sortKey;
+    };
+
+    vector<Cluster> sorted(clusters.size());
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (size_t c = 0; c < clusters.size(); c++)
+    {
+        Cluster& cluster = sorted[c];
+        cluster.begin = clusters[c];
+        cluster.end = c + 1 < clusters.size() ? clusters[c + 1] : indices.size();
+        cluster.centroid = glm::vec3(0.0f);
+        cluster.normal = glm::vec3(0.0f);
+        float area = 0.0f;
+        for (size_t i = cluster.begin; i < cluster.end; i += 3)
+        {
+            const glm::vec3& p0 = vertices[indices[i]].Position;
+            const glm::vec3& p1 = vertices[indices[i + 1]].Position;
+            const glm::vec3& p2 = vertices[indices[i + 2]].Position;
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float triangleArea = glm::length(normal);
+            cluster.centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            cluster.normal += normal;
+            area += triangleArea;
+        }
+        meshCentroid += cluster.centroid;
+        meshArea += area;
+        if (area > 0.0f)
+            cluster.centroid /= area;
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    // clusters facing away from the center occlude the rest of the mesh more often, draw them first
+    for (Cluster& cluster : sorted)
+    {
+        float length = glm::length(cluster.normal);
+        cluster.sortKey = length > 0.0f ? glm::dot(cluster.centroid - meshCentroid, cluster.normal / length) : 0.0f;
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+    vector<unsigned int> output;
+    output.reserve(indices.size());
+    for (const Cluster& cluster : sorted)
+        output.insert(output.end(), indices.begin() + cluster.begin, indices.begin() + cluster.end);
+    indices.swap(output);
+}
+
+void optimizeVertexFetch(MeshData& mesh)
+{
+    const unsigned int unused = ~0u;
+    vector<unsigned int> remap(mesh.vertices.size(), unused);
+    vector<Vertex> ordered;
+    ordered.reserve(mesh.vertices.size());
+    for (unsigned int& index : mesh.indices)
+    {
+        if (remap[index] == unused)
+        {
+            remap[index] = (unsigned int)ordered.size();
+            ordered.push_back(mesh.vertices[index]);
+        }
+        index = remap[index];
+    }
+    mesh.vertices.swap(ordered);
+}
+
+namespace {
+
+// bounding sphere and normal cone of the triangles in indices[begin, end)
+MeshCluster makeCluster(const MeshData& mesh, size_t begin, size_t end)
+{
+    MeshCluster cluster;
+    cluster.indexOffset = (unsigned int)begin;
+    cluster.indexCount = (unsigned int)(end - begin);
+
+    glm::vec3 boundsMin = mesh.vertices[mesh.indices[begin]].Position;
+    glm::vec3 boundsMax = boundsMin;
+    glm::vec3 normalSum(0.0f);
+    for (size_t i = begin; i < end; i += 3)
+    {
+        const glm::vec3& p0 = mesh.vertices[mesh.indices[i]].Position;
+        const glm::vec3& p1 = mesh.vertices[mesh.indices[i + 1]].Position;
+        const glm::vec3& p2 = mesh.vertices[mesh.indices[i + 2]].Position;
+        boundsMin = glm::min(boundsMin, glm::min(p0, glm::min(p1, p2)));
+        boundsMax = glm::max(boundsMax, glm::max(p0, glm::max(p1, p2)));
+        normalSum += glm::cross(p1 - p0, p2 - p0);
+    }
+
+    cluster.center = (boundsMin + boundsMax) * 0.5f;
+    cluster.radius = 0.0f;
+    for (size_t i = begin; i < end; i++)
+        cluster.radius = std::max(cluster.radius, glm::length(mesh.vertices[mesh.indices[i]].Position - cluster.center));
+
+    // the cone has to contain every triangle normal, it's only useful while narrower than a hemisphere
+    float normalLength = glm::length(normalSum);
+    cluster.coneAxis = normalLength > 0.0f ? normalSum / normalLength : glm::vec3(0.0f, 0.0f, 1.0f);
+    float minDot = normalLength > 0.0f ? 1.0f : -1.0f;
+    for (size_t i = begin; i < end; i += 3)
+    {
+        const glm::vec3& p0 = mesh.vertices[mesh.indices[i]].Position;
+        glm::vec3 normal = glm::cross(mesh.vertices[mesh.indices[i + 1]].Position - p0, mesh.vertices[mesh.indices[i + 2]].Position - p0);
+        float length = glm::length(normal);
+        if (length > 0.0f)
+            minDot = std::min(minDot, glm::dot(normal / length, cluster.coneAxis));
+    }
+    cluster.coneCutoff = minDot > 0.1f ? std::sqrt(1.0f - minDot * minDot) : 2.0f;
+    return cluster;
+}
+
+}
+
+void buildClusters(MeshData& mesh)
+{
+    mesh.clusters.clear();
+    for (MeshLod& lod : mesh.lods)
+    {
+        lod.clusterOffset = (unsigned int)mesh.clusters.size();
+        const size_t end = size_t(lod.indexOffset) + lod.indexCount;
+        size_t begin = lod.indexOffset;
+        glm::vec3 normalSum(0.0f);
+        for (size_t i = begin; i < end; i += 3)
+        {
+            const glm::vec3& p0 = mesh.vertices[mesh.indices[i]].Position;
+            glm::vec3 normal = glm::cross(mesh.vertices[mesh.indices[i + 1]].Position - p0, mesh.vertices[mesh.indices[i + 2]].Position - p0);
+            size_t triangles = (i - begin) / 3;
+
+            // past the minimum size a cluster also ends where the triangle stream jumps or turns away
+            bool split = triangles >= CLUSTER_MAX_TRIANGLES;
+            if (!split && triangles >= CLUSTER_MIN_TRIANGLES)
+            {
+                const unsigned int* previous = &mesh.indices[i - 3];
+                const unsigned int* current = &mesh.indices[i];
+                bool connected = false;
+                for (int a = 0; a < 3; a++)
+                    for (int b = 0; b < 3; b++)
+                        connected = connected || previous[a] == current[b];
+                float lengths = glm::length(normal) * glm::length(normalSum);
+                split = !connected || (lengths > 0.0f && glm::dot(normal, normalSum) < 0.5f * lengths);
+            }
+            if (split)
+            {
+                mesh.clusters.push_back(makeCluster(mesh, begin, i));
+                begin = i;
+                normalSum = glm::vec3(0.0f);
+            }
+            normalSum += normal;
+        }
+        if (begin < end)
+            mesh.clusters.push_back(makeCluster(mesh, begin, end));
+        lod.clusterCount = (unsigned int)mesh.clusters.size() - lod.clusterOffset;
+    }
+}
+
+MeshOptimizationReport optimizeMesh(MeshData& mesh)
+{
+    MeshOptimizationReport report;
+    report.verticesBefore = mesh.vertices.size();
+    report.before = analyzeVertexCache(mesh.indices, mesh.vertices.size());
+
+    weldVertices(mesh);
+    vector<size_t> clusters;
+    optimizeVertexCache(mesh.indices, mesh.vertices.size(), &clusters);
+    optimizeOverdraw(mesh.indices, mesh.vertices, clusters);
+    optimizeVertexFetch(mesh);
+
+    report.verticesAfter = mesh.vertices.size();
+    report.after = analyzeVertexCache(mesh.indices, mesh.vertices.size());
+    return report;
+}
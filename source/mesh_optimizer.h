@@ -0,0 +1,57 @@
+#ifndef _MESH_OPTIMIZER_H_
+#define _MESH_OPTIMIZER_H_
+
+#include "mesh.h"
+
+#include <cstddef>
+#include <vector>
+
+// size of the FIFO used to simulate the post-transform vertex cache
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+// size range of the clusters built by buildClusters()
+const unsigned int CLUSTER_MIN_TRIANGLES = 64;
+const unsigned int CLUSTER_MAX_TRIANGLES = 128;
+
+// post-transform cache efficiency of an index buffer
+struct VertexCacheStats {
+    float acmr;                   // average cache miss ratio, transformed vertices per triangle (0.5 - 3)
+    float atvr;                   // average transform to vertex ratio, transformed vertices per vertex (1 is ideal)
+};
+
+// what optimizeMesh() did to a mesh
+struct MeshOptimizationReport {
+    size_t verticesBefore;
+    size_t verticesAfter;
+    VertexCacheStats before;
+    VertexCacheStats after;
+};
+
+// Simulates a FIFO vertex cache over the triangle list
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = VERTEX_CACHE_SIZE);
+
+// Merges vertices with identical position, normal and texture coordinates, their tangent frames get averaged.
+// Returns the number of vertices removed.
+size_t weldVertices(MeshData& mesh);
+
+// Reorders the triangles for the post-transform vertex cache (Tipsify). When clusters isn't null it receives
+// the first index of every run the algorithm started from a dead end, which optimizeOverdraw() can reorder.
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount, std::vector<size_t>* clusters = nullptr,
+    unsigned int cacheSize = VERTEX_CACHE_SIZE);
+
+// Sorts the clusters so the ones facing away from the mesh center are drawn first, which lets the depth
+// test reject more of the fragments behind them. The triangle order inside a cluster is kept.
+void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, const std::vector<size_t>& clusters);
+
+// Renumbers the vertices in the order the index buffer first references them and drops unused ones.
+void optimizeVertexFetch(MeshData& mesh);
+
+// Splits the index range of every level of detail into culling clusters of CLUSTER_MIN_TRIANGLES to
+// CLUSTER_MAX_TRIANGLES triangles in their current order, with bounding spheres and normal cones.
+void buildClusters(MeshData& mesh);
+
+// The whole pipeline: weld, vertex cache order, overdraw order and vertex fetch order
+MeshOptimizationReport optimizeMesh(MeshData& mesh);
+
+
+#endif
@@ -0,0 +1,260 @@
+#include "mesh_simplifier.h"
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+using std::vector;
+
+MeshSimplifier::MeshSimplifier(const vector<Vertex>& vertices_, const vector<unsigned int>& indices_)
+    :
+    vertices(vertices_),
+    current_indices(indices_),
+    quadrics(vertices_.size(), Quadric{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }),
+    locked(vertices_.size(), false),
+    max_error(0.0f)
+{
+    // every vertex starts with the planes of the triangles around it
+    for (size_t i = 0; i + 2 < current_indices.size(); i += 3)
+    {
+        Quadric plane = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+        addPlane(plane, vertices[current_indices[i]].Position, vertices[current_indices[i + 1]].Position, vertices[current_indices[i + 2]].Position);
+        for (int k = 0; k < 3; k++)
+            addQuadric(quadrics[current_indices[i + k]], plane);
+    }
+
+    // an edge used by a single triangle is either on a hole or on an attribute seam (welded vertices
+    // only share an index when all their attributes match), moving its vertices would open a crack
+    std::unordered_map<uint64_t, unsigned int> edgeUse;
+    edgeUse.reserve(current_indices.size());
+    for (size_t i = 0; i + 2 < current_indices.size(); i += 3)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int a = current_indices[i + k];
+            unsigned int b = current_indices[i + (k + 1) % 3];
+            edgeUse[(uint64_t(std::min(a, b)) << 32) | std::max(a, b)]++;
+        }
+    }
+    for (const auto& edge : edgeUse)
+    {
+        if (edge.second == 1)
+        {
+            locked[size_t(edge.first >> 32)] = true;
+            locked[size_t(edge.first & 0xffffffffu)] = true;
+        }
+    }
+}
+
+size_t MeshSimplifier::simplify(size_t targetTriangles)
+{
+    const size_t vertexCount = vertices.size();
+    size_t triangleCount = current_indices.size() / 3;
+    vector<unsigned int> offsets, adjacency, remap;
+    vector<Collapse> collapses;
+    vector<bool> touched;
+
+    while (triangleCount > targetTriangles)
+    {
+        // vertex -> triangle adjacency of the current level
+        offsets.assign(vertexCount + 1, 0);
+        for (unsigned int index : current_indices)
+            offsets[index + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            offsets[v + 1] += offsets[v];
+        adjacency.resize(current_indices.size());
+        vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < current_indices.size(); i++)
+            adjacency[fill[current_indices[i]]++] = (unsigned int)(i / 3);
+
+        // cheapest direction of every edge, interior edges show up once per triangle so only take one of them
+        collapses.clear();
+        for (size_t i = 0; i < current_indices.size(); i += 3)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int a = current_indices[i + k];
+                unsigned int b = current_indices[i + (k + 1) % 3];
+                if (a > b || (locked[a] && locked[b]))
+                    continue;
+
+                Quadric q = quadrics[a];
+                addQuadric(q, quadrics[b]);
+                Collapse collapse = { a, b, locked[a] ? HUGE_VAL : evaluate(q, vertices[b].Position) };
+                if (!locked[b])
+                {
+                    double reverse = evaluate(q, vertices[a].Position);
+                    if (reverse < collapse.cost)
+                        collapse = Collapse{ b, a, reverse };
+                }
+                collapses.push_back(collapse);
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+        // apply independent collapses, the neighbourhood of a collapse stays fixed for the rest of the pass
+        // so the flip test sees the final positions
+        remap.resize(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++)
+            remap[v] = (unsigned int)v;
+        touched.assign(vertexCount, false);
+        const size_t wanted = triangleCount - targetTriangles;
+        size_t removed = 0;
+        size_t applied = 0;
+        for (const Collapse& collapse : collapses)
+        {
+            if (removed >= wanted)
+                break;
+            if (touched[collapse.from] || touched[collapse.to] || flipsTriangle(collapse.from, collapse.to, offsets, adjacency))
+                continue;
+
+            for (unsigned int a = offsets[collapse.from]; a < offsets[collapse.from + 1]; a++)
+            {
+                const unsigned int* triangle = &current_indices[3 * adjacency[a]];
+                if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+                    removed++;
+                for (int k = 0; k < 3; k++)
+                    touched[triangle[k]] = true;
+            }
+            touched[collapse.to] = true;
+
+            remap[collapse.from] = collapse.to;
+            addQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+            max_error = std::max(max_error, float(std::sqrt(collapse.cost)));
+            applied++;
+        }
+        if (applied == 0)
+            break;
+
+        // rewrite the index buffer, dropping the triangles that became degenerate
+        size_t write = 0;
+        for (size_t i = 0; i < current_indices.size(); i += 3)
+        {
+            unsigned int a = remap[current_indices[i]];
+            unsigned int b = remap[current_indices[i + 1]];
+            unsigned int c = remap[current_indices[i + 2]];
+            if (a == b || b == c || a == c)
+                continue;
+            current_indices[write++] = a;
+            current_indices[write++] = b;
+            current_indices[write++] = c;
+        }
+        current_indices.resize(write);
+        triangleCount = write / 3;
+    }
+    return triangleCount;
+}
+
+bool MeshSimplifier::flipsTriangle(unsigned int from, unsigned int to, const vector<unsigned int>& offsets, const vector<unsigned int>& adjacency) const
+{
+    for (unsigned int a = offsets[from]; a < offsets[from + 1]; a++)
+    {
+        const unsigned int* triangle = &current_indices[3 * adjacency[a]];
+        if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+            continue;
+
+        glm::vec3 p[3], moved[3];
+        for (int k = 0; k < 3; k++)
+        {
+            p[k] = vertices[triangle[k]].Position;
+            moved[k] = triangle[k] == from ? vertices[to].Position : p[k];
+        }
+        glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+        if (glm::dot(before, after) <= 0.0f)
+            return true;
+    }
+    return false;
+}
+
+void MeshSimplifier::addPlane(Quadric& q, const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2)
+{
+    glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+    double length = glm::length(normal);
+    if (length == 0.0)
+        return;
+
+    double area = 0.5 * length;
+    double nx = normal.x / length, ny = normal.y / length, nz = normal.z / length;
+    double d = -(nx * p0.x + ny * p0.y + nz * p0.z);
+    q.a00 += area * nx * nx; q.a01 += area * nx * ny; q.a02 += area * nx * nz;
+    q.a11 += area * ny * ny; q.a12 += area * ny * nz; q.a22 += area * nz * nz;
+    q.b0 += area * nx * d; q.b1 += area * ny * d; q.b2 += area * nz * d;
+    q.c += area * d * d;
+    q.weight += area;
+}
+
+void MeshSimplifier::addQuadric(Quadric& target, const Quadric& source)
+{
+    target.a00 += source.a00; target.a01 += source.a01; target.a02 += source.a02;
+    target.a11 += source.a11; target.a12 += source.a12; target.a22 += source.a22;
+    target.b0 += source.b0; target.b1 += source.b1; target.b2 += source.b2;
+    target.c += source.c;
+    target.weight += source.weight;
+}
+
+double MeshSimplifier::evaluate(const Quadric& q, const glm::vec3& p)
+{
+    double x = p.x, y = p.y, z = p.z;
+    double error = x * x * q.a00 + y * y * q.a11 + z * z * q.a22
+        + 2.0 * (x * y * q.a01 + x * z * q.a02 + y * z * q.a12)
+        + 2.0 * (x * q.b0 + y * q.b1 + z * q.b2) + q.c;
+    // area weighted sum of squared distances, divide by the area to get a squared distance
+    return q.weight > 0.0 ? std::max(error, 0.0) / q.weight : 0.0;
+}
+
+void buildLodChain(MeshData& mesh)
+{
+    mesh.lods.clear();
+    mesh.lods.push_back(MeshLod{ 0, (unsigned int)mesh.indices.size(), 0.0f, 0, 0 });
+
+    size_t triangles = mesh.indices.size() / 3;
+    if (triangles / 2 < LOD_MIN_TRIANGLES)
+        return;
+
+    MeshSimplifier simplifier(mesh.vertices, mesh.indices);
+    while (mesh.lods.size() < LOD_MAX_LEVELS && triangles / 2 >= LOD_MIN_TRIANGLES)
+    {
+        size_t remaining = simplifier.simplify(triangles / 2);
+        // most of what's left is locked, another level wouldn't be worth its memory
+        if (remaining > triangles * 3 / 4)
+            break;
+
+        vector<unsigned int> level = simplifier.indices();
+        optimizeVertexCache(level, mesh.vertices.size());
+        mesh.lods.push_back(MeshLod{ (unsigned int)mesh.indices.size(), (unsigned int)level.size(), simplifier.error(), 0, 0 });
+        mesh.indices.insert(mesh.indices.end(), level.begin(), level.end());
+        triangles = remaining;
+    }
+}
+
+bool extractPreview(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, const vector<MeshLod>& lods,
+    const vector<MeshCluster>& clusters, MeshData& preview)
+{
+    if (lods.size() < 2)
+        return false;
+
+    // the levels share the vertex buffer, renumber the vertices the coarsest one uses in order of first use
+    const MeshLod& level = lods.back();
+    vector<unsigned int> remap(vertexCount, UINT32_MAX);
+    preview.vertices.clear();
+    preview.indices.resize(level.indexCount);
+    for (unsigned int i = 0; i < level.indexCount; i++)
+    {
+        unsigned int& vertex = remap[indices[level.indexOffset + i]];
+        if (vertex == UINT32_MAX)
+        {
+            vertex = (unsigned int)preview.vertices.size();
+            preview.vertices.push_back(vertices[indices[level.indexOffset + i]]);
+        }
+        preview.indices[i] = vertex;
+    }
+
+    preview.clusters.assign(clusters.begin() + level.clusterOffset, clusters.begin() + level.clusterOffset + level.clusterCount);
+    for (MeshCluster& cluster : preview.clusters)
+        cluster.indexOffset -= level.indexOffset;
+    preview.lods.assign(1, MeshLod{ 0, level.indexCount, level.error, 0, level.clusterCount });
+    return true;
+}
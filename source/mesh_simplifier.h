@@ -0,0 +1,69 @@
+#ifndef _MESH_SIMPLIFIER_H_
+#define _MESH_SIMPLIFIER_H_
+
+#include "mesh.h"
+
+#include <cstddef>
+#include <vector>
+
+// LOD generation stops once a level has fewer triangles than this
+const size_t LOD_MIN_TRIANGLES = 256;
+// most levels generated per mesh, the full resolution level included
+const size_t LOD_MAX_LEVELS = 6;
+
+// Quadric error edge collapse simplifier. Vertices collapse onto one of their neighbours, so every level
+// references the original vertex buffer and only needs its own index buffer. Quadrics and collapses
+// persist between simplify() calls which makes successive calls build a LOD chain.
+class MeshSimplifier
+{
+public:
+    MeshSimplifier(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices);
+    // Collapse edges until at most targetTriangles remain or nothing can be collapsed anymore.
+    // Returns the triangles left.
+    size_t simplify(size_t targetTriangles);
+    // Current index buffer
+    const std::vector<unsigned int>& indices() const { return current_indices; }
+    // Largest object space distance between the simplified and the original surface so far
+    float error() const { return max_error; }
+
+private:
+    // symmetric 4x4 matrix, the squared distance to a set of planes weighted by their area
+    struct Quadric {
+        double a00, a01, a02, a11, a12, a22;
+        double b0, b1, b2;
+        double c;
+        double weight;
+    };
+
+    struct Collapse {
+        unsigned int from;
+        unsigned int to;
+        double cost;
+    };
+
+    static void addPlane(Quadric& q, const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2);
+    static void addQuadric(Quadric& target, const Quadric& source);
+    static double evaluate(const Quadric& q, const glm::vec3& p);
+
+    // true when moving from onto to would flip one of the triangles around from
+    bool flipsTriangle(unsigned int from, unsigned int to, const std::vector<unsigned int>& offsets, const std::vector<unsigned int>& adjacency) const;
+
+    const std::vector<Vertex>& vertices;
+    std::vector<unsigned int> current_indices;
+    std::vector<Quadric> quadrics;
+    std::vector<bool> locked;      // boundary and seam vertices keep their place
+    float max_error;
+};
+
+// Appends simplified levels to mesh.indices and describes all of them, the full resolution one
+// included, in mesh.lods. Each level has about half the triangles of the previous one.
+void buildLodChain(MeshData& mesh);
+
+// Copies the coarsest level of a mesh with a LOD chain into preview as a standalone single level mesh,
+// keeping only the vertices it references, the level's clusters and the full mesh's bounds. Returns false
+// when there is no coarser level to preview.
+bool extractPreview(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, const std::vector<MeshLod>& lods,
+    const std::vector<MeshCluster>& clusters, MeshData& preview);
+
+
+#endif
@@ -15,87 +15,133 @@
 #include "stb/stb_image.h"
 
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "memory_usage.h"
+#include "obj_loader.h"
 #include "shader_s.h"
+#include "texture_loader.h"
+#include "thread_pool.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <unordered_map>
 using namespace std;
 
 unsigned int textureFromFile(const char *path, const string &directory, bool gamma = false);
 
+class ModelLoader;
+
 class Model {
 public:
     /*  Model Data */
     unordered_map<std::string, Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
-    
+
     /*  Model Data */
     vector<Mesh> meshes;
     string directory;
     bool gammaCorrection;
+    VertexLayout layout;    // vertex streams uploaded for the meshes, only what the model's shaders read
+    CpuGeometry cpuGeometry;    // whether the meshes keep their vertices and indices after the upload
+    // object space bounds of the meshes published so far, box and sphere around its center
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    float boundsRadius;
     /*  Functions   */
-    // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    // constructor for a model that gets filled in by a ModelLoader
+    Model() : gammaCorrection(false), cpuGeometry(CpuGeometry::Release), boundsMin(0.0f), boundsMax(0.0f), boundsRadius(0.0f)
     {
-        loadModel(path);
     }
 
-    // draws the model, and thus all its meshes
-    void draw(Shader& shader)
+    // constructor, expects a filepath to a 3D model. Imports and uploads it on the calling thread.
+    Model(string const &path, bool gamma = false, const VertexLayout& layout = VertexLayout(), CpuGeometry cpuGeometry = CpuGeometry::Release);
+
+    // draws the model, and thus all its meshes, at full resolution. Returns the triangles submitted.
+    size_t draw(Shader& shader)
     {
+        size_t triangles = 0;
         for (unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].draw(shader);
+            triangles += meshes[i].draw(shader);
+        return triangles;
     }
 
-private:
-    /*  Functions   */
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const &path)
+    // queues every mesh at the level of detail picked for the view as one object of the batch, only
+    // the clusters the view can see when it culls clusters. lods holds the levels this object last had in
+    // the view. Returns the triangles queued.
+    size_t draw(DrawBatch& batch, const glm::mat4& transform, const LodView& view, LodState& lods,
+        const DrawBatch::Material& material = DrawBatch::Material{ glm::vec3(1.0f), glm::vec4(0.0f) })
     {
-        // read file via ASSIMP
-        Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-        // check for errors
-        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
-        {
-            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+        unsigned int object = batch.addObject(transform, material);
+        size_t triangles = 0;
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            triangles += meshes[i].queue(batch, object, meshes[i].selectLod(view, transform, lods.level(i)), transform, view);
+        return triangles;
+    }
+
+    // merges the bounds of the meshes, the sphere encloses theirs
+    void computeBounds()
+    {
+        boundsMin = boundsMax = glm::vec3(0.0f);
+        boundsRadius = 0.0f;
+        if (meshes.empty())
             return;
-        }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
 
-        // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        boundsMin = meshes[0].boundsMin;
+        boundsMax = meshes[0].boundsMax;
+        for (const Mesh& mesh : meshes)
+        {
+            boundsMin = glm::min(boundsMin, mesh.boundsMin);
+            boundsMax = glm::max(boundsMax, mesh.boundsMax);
+        }
+        glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+        for (const Mesh& mesh : meshes)
+            boundsRadius = glm::max(boundsRadius, glm::length(mesh.boundsCenter() - center) + mesh.boundsRadius);
+        // never looser than the box
+        boundsRadius = glm::min(boundsRadius, glm::length(boundsMax - boundsMin) * 0.5f);
     }
 
-    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+private:
+    friend class ModelLoader;
+
+    /*  Functions   */
+    // collects the meshes of a node and then those of its children in a recursive fashion.
+    static void collectMeshes(const aiNode *node, const aiScene *scene, vector<aiMesh*> &sceneMeshes)
     {
-        // process each mesh located at the current node
+        // collect each mesh located at the current node
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
         {
             // the node object only contains indices to index the actual objects in the scene. 
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
         }
-        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
+        // after we've collected all of the meshes (if any) we then recursively collect each of the children nodes
         for (unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            collectMeshes(node->mChildren[i], scene, sceneMeshes);
         }
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    // converts an ASSIMP mesh into vertex/index arrays. Doesn't touch OpenGL so it can run on any thread.
+    static MeshData processMesh(const aiMesh *mesh, const aiScene *scene)
     {
         // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
+        MeshData data;
+        vector<Vertex>& vertices = data.vertices;
+        vector<unsigned int>& indices = data.indices;
+        vertices.reserve(mesh->mNumVertices);
+        indices.reserve(mesh->mNumFaces * 3);
         // Walk through each of the mesh's vertices
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
@@ -149,19 +195,21 @@ private:
             else {
                 vertex.Bitangent = glm::vec3(0.0f, 0.0f, 0.0f);
             }
-    
+
             vertices.push_back(vertex);        
         }
         // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
         for (unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
-            aiFace face = mesh->mFaces[i];
+            const aiFace& face = mesh->mFaces[i];
             // retrieve all indices of the face and store them in the indices vector
             for (unsigned int j = 0; j < face.mNumIndices; j++)
                 indices.push_back(face.mIndices[j]);
         }
+        // object space bounds
+        ::computeBounds(vertices.data(), vertices.size(), data.boundsMin, data.boundsMax, data.boundsRadius);
         // process materials
-        aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+        const aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
         // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
         // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
         // Same applies to other texture as the following list summarizes:
@@ -169,96 +217,610 @@ private:
         // specular: texture_specularN
         // normal: texture_normalN
         // 1. diffuse maps
-        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+        collectMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", data.textures);
         // 2. specular maps
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        collectMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", data.textures);
         // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+        collectMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", data.textures);
         // 4. height maps
-        //std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-        //textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
-        std::vector<Texture> reflectionMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_reflection");
-        textures.insert(textures.end(), reflectionMaps.begin(), reflectionMaps.end());
+        //collectMaterialTextures(material, aiTextureType_AMBIENT, "texture_height", data.textures);
+        collectMaterialTextures(material, aiTextureType_AMBIENT, "texture_reflection", data.textures);
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        return data;
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+    // frees the vertex and face arrays of an ASSIMP mesh once processMesh converted them, the scene stays
+    // valid for its destructor. Materials are left alone, they're shared.
+    static void releaseSourceMesh(aiMesh *mesh)
+    {
+        delete[] mesh->mVertices;
+        mesh->mVertices = nullptr;
+        delete[] mesh->mNormals;
+        mesh->mNormals = nullptr;
+        delete[] mesh->mTangents;
+        mesh->mTangents = nullptr;
+        delete[] mesh->mBitangents;
+        mesh->mBitangents = nullptr;
+        for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_TEXTURECOORDS; i++)
+        {
+            delete[] mesh->mTextureCoords[i];
+            mesh->mTextureCoords[i] = nullptr;
+        }
+        delete[] mesh->mFaces;
+        mesh->mFaces = nullptr;
+        mesh->mNumFaces = 0;
+        mesh->mNumVertices = 0;
+    }
+
+    // records the paths of all material textures of a given type, the textures are loaded later on the GL thread.
+    static void collectMaterialTextures(const aiMaterial *mat, aiTextureType type, const string &typeName, vector<TextureRef> &textures)
     {
-        vector<Texture> textures;
         for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            if (textures_loaded.find(str.C_Str()) != textures_loaded.end()) {
-                textures.push_back(textures_loaded[str.C_Str()]);
-            }
-            else {
-                Texture texture;
-                texture.id = textureFromFile(str.C_Str(), this->directory, type == aiTextureType_HEIGHT);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded[str.C_Str()] = texture;
-            }
+            TextureRef texture;
+            texture.type = typeName;
+            texture.path = str.C_Str();
+            textures.push_back(texture);
+        }
+    }
+
+    // loads the textures referenced by a mesh if they're not loaded yet.
+    // the required info is returned as Texture structs.
+    vector<Texture> loadMaterialTextures(const vector<TextureRef> &references)
+    {
+        vector<Texture> textures;
+        for (const TextureRef& reference : references)
+        {
+            // normal maps come from aiTextureType_HEIGHT which is loaded gamma corrected
+            textures.push_back(loadTexture(reference.path, reference.type, reference.type == "texture_normal"));
         }
         return textures;
     }
+
+    // returns the texture for the given path, loading it only if it isn't loaded yet.
+    Texture loadTexture(const string &path, const string &typeName, bool gamma)
+    {
+        auto loaded = textures_loaded.find(path);
+        if (loaded != textures_loaded.end()) {
+            return loaded->second;
+        }
+
+        Texture texture;
+        texture.id = textureFromFile(path.c_str(), this->directory, gamma);
+        texture.type = typeName;
+        texture.path = path;
+        textures_loaded[path] = texture;
+        return texture;
+    }
 };
 
-unsigned int textureFromFile(const char *path, const string &directory, bool gamma)
-{
-    string filename = string(path);
-    filename = directory + '/' + filename;
+// Loads models in two phases. The CPU phase (mesh cache mapping, OBJ parsing or ASSIMP import for other
+// formats, vertex conversion and index flattening) runs on a thread pool, in parallel across models and across the meshes of a model.
+// The GL phase (texture loading and Mesh::setupMesh) stays on the thread owning the GL context, which
+// consumes finished meshes from a queue in update() or finish().
+// Meshes are handed to their Model as soon as they are resident, in mesh order, so a render loop calling
+// update() every frame draws whatever has arrived. With previews enabled the coarsest level of every mesh
+// is uploaded on its own first and swapped for the full mesh once that one is resident.
+class ModelLoader {
+public:
+    // a null pool runs the CPU phase inline on the calling thread
+    explicit ModelLoader(ThreadPool* pool = &ThreadPool::shared()) : pool(pool), previews(false)
+    {
+    }
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    ~ModelLoader()
+    {
+        // the CPU jobs reference our queue, never leave them running
+        finish();
+    }
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
+    // queues the import of a model file into target, which has to outlive the load.
+    // cpuGeometry decides whether the meshes keep a CPU copy of their geometry after the upload.
+    void load(Model& target, string const &path, bool gamma = false, const VertexLayout& layout = VertexLayout(),
+        CpuGeometry cpuGeometry = CpuGeometry::Release)
     {
-        GLenum internalFormat;
-        GLenum dataFormat;
-        if (nrComponents == 1)
+        shared_ptr<Import> import = make_shared<Import>();
+        import->model = &target;
+        import->path = path;
+        import->startTime = std::chrono::high_resolution_clock::now();
+        import->meshBase = target.meshes.size();
+        target.gammaCorrection = gamma;
+        target.layout = layout;
+        target.cpuGeometry = cpuGeometry;
+        // retrieve the directory path of the filepath
+        target.directory = path.substr(0, path.find_last_of('/'));
+        import->buildPreviews = previews;
+        imports.push_back(import);
+
+        if (pool)
+            pool->submit([this, import] { importModel(import); });
+        else
+            importModel(import);
+    }
+
+    // upload the coarsest level of each mesh before the mesh itself, for loads queued from now on. The
+    // previews take extra room in the geometry arenas, which never gives ranges back.
+    void setPreviews(bool enabled)
+    {
+        previews = enabled;
+    }
+
+    // creates the GL objects of the meshes that finished their CPU phase and hands them to their models,
+    // returns how many were uploaded. Previews go first. With a budget the uploads stop once it is used up
+    // (at least one is done per call) and the rest waits for the next call.
+    size_t update(double budgetMilliseconds = 0.0)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        std::deque<ReadyMesh> ready;
+        // the jobs write meshCount before they set cpuDone, both are only read once cpuDone is seen under the
+        // lock. SIZE_MAX for the imports still in their CPU phase.
+        vector<size_t> doneMeshCounts(imports.size(), SIZE_MAX);
         {
-            internalFormat = dataFormat = GL_RED;
+            std::lock_guard<std::mutex> lock(readyMutex);
+            ready.swap(readyMeshes);
+            for (size_t i = 0; i < imports.size(); i++)
+            {
+                if (imports[i]->cpuDone)
+                    doneMeshCounts[i] = imports[i]->meshCount;
+            }
         }
-        else if (nrComponents == 3)
+        std::stable_partition(ready.begin(), ready.end(), [](const ReadyMesh& mesh) { return mesh.preview; });
+        size_t uploaded = 0;
+        while (!ready.empty())
         {
-            internalFormat = gamma ? GL_SRGB : GL_RGB;
-            dataFormat = GL_RGB;
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            if (budgetMilliseconds > 0.0 && uploaded > 0 && elapsed.count() >= budgetMilliseconds)
+                break;
+            const ReadyMesh& mesh = ready.front();
+            uploadMesh(*mesh.import, mesh.index, mesh.preview);
+            ready.pop_front();
+            uploaded++;
         }
-        else if (nrComponents == 4)
+        if (!ready.empty())
         {
-            internalFormat = gamma ? GL_SRGB_ALPHA : GL_RGBA;
-            dataFormat = GL_RGBA;
+            // over budget, these stay ahead of whatever finished in the meantime
+            std::lock_guard<std::mutex> lock(readyMutex);
+            readyMeshes.insert(readyMeshes.begin(), ready.begin(), ready.end());
         }
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, dataFormat, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        for (size_t i = 0, snapshot = 0; i < imports.size(); snapshot++)
+        {
+            Import& import = *imports[i];
+            publishMeshes(import);
+            if (doneMeshCounts[snapshot] != SIZE_MAX && import.uploadedCount == doneMeshCounts[snapshot])
+            {
+                finalizeModel(import);
+                imports.erase(imports.begin() + i);
+            }
+            else
+            {
+                i++;
+            }
+        }
+        return uploaded;
+    }
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // blocks until every queued model is loaded, uploading meshes as they become ready.
+    void finish()
+    {
+        while (!idle())
+        {
+            {
+                std::unique_lock<std::mutex> lock(readyMutex);
+                readyCondition.wait(lock, [this] { return !readyMeshes.empty() || cpuPhaseIdle(); });
+            }
+            update();
+        }
+    }
+
+    // meshes uploaded at full detail so far, over all models this loader loaded
+    size_t residentMeshes() const
+    {
+        return resident_meshes;
+    }
 
-        stbi_image_free(data);
+    // true when there's nothing left to load
+    bool idle() const
+    {
+        return imports.empty();
     }
-    else
+
+    // imports a file through ASSIMP and converts its meshes on the calling thread, without the mesh
+    // optimizations. This is the path the OBJ loader replaces, kept callable for benchmarks.
+    static bool importWithAssimp(string const &path, vector<MeshData>& meshes)
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+            return false;
+        vector<aiMesh*> sceneMeshes;
+        Model::collectMeshes(scene->mRootNode, scene, sceneMeshes);
+        meshes.clear();
+        for (const aiMesh* mesh : sceneMeshes)
+            meshes.push_back(Model::processMesh(mesh, scene));
+        return true;
     }
 
-    return textureID;
+private:
+    // what the CPU phase did to one mesh, summed up for the model once its last mesh is done
+    struct MeshReport {
+        MeshOptimizationReport optimization;
+        size_t triangles;
+        size_t lods;
+        size_t coarsestTriangles;
+        size_t clusters;
+    };
+
+    // state shared between the jobs loading one model
+    struct Import {
+        Model* model;
+        string path;
+        std::chrono::high_resolution_clock::time_point startTime;
+        // CPU phase
+        unique_ptr<Assimp::Importer> importer;
+        const aiScene* scene = nullptr;
+        vector<aiMesh*> sceneMeshes;
+        vector<bool> ownsSource;          // the scene mesh is referenced once, its arrays can go after processing
+        vector<MeshData> meshData;        // one slot per mesh, each written by its own job only. Kept until the
+                                          // model is finalized, the mesh cache is written from it.
+        MeshCache cache;                  // mapped when loading from the mesh cache
+        vector<MeshData> previews;        // coarsest level of each mesh, freed once uploaded
+        vector<MeshReport> reports;       // what processing did to each mesh, one slot per mesh like meshData
+        bool fromCache = false;
+        bool buildPreviews = false;
+        bool parsedObj = false;           // meshData came from the ObjLoader, there is no scene
+        size_t meshCount = 0;
+        std::atomic<size_t> meshesRemaining{ 0 };
+        bool cpuDone = false;             // guarded by readyMutex
+        // GL phase
+        vector<unique_ptr<Mesh>> uploaded;   // latest resident version of each mesh not yet handed to the model
+        vector<bool> fullDetail;             // the full mesh is resident, a late preview is dropped
+        size_t uploadedCount = 0;            // full meshes resident
+        size_t meshBase = 0;                 // first of the model's meshes that belongs to this load
+        size_t published = 0;                // meshes handed to the model, always the first ones
+    };
+
+    struct ReadyMesh {
+        shared_ptr<Import> import;
+        size_t index;
+        bool preview;
+    };
+
+    // CPU phase of a model: maps its mesh cache or imports the file and queues a job per mesh
+    void importModel(shared_ptr<Import> import)
+    {
+        // a valid mesh cache lets us skip ASSIMP entirely
+        if (import->cache.open(import->path))
+        {
+            import->fromCache = true;
+            import->meshCount = import->cache.records().size();
+            if (!import->buildPreviews || import->meshCount == 0)
+            {
+                for (size_t i = 0; i < import->meshCount; i++)
+                    pushReady(import, i, false);
+                finishCpuPhase(*import);
+                return;
+            }
+
+            // the records are ready to upload, only the previews have to be cut out of them
+            import->previews.resize(import->meshCount);
+            import->meshesRemaining = import->meshCount;
+            for (size_t i = 0; i < import->meshCount; i++)
+            {
+                if (pool)
+                    pool->submit([this, import, i] { processCachedMesh(import, i); });
+                else
+                    processCachedMesh(import, i);
+            }
+            return;
+        }
+
+        // OBJ files have their own parser, ASSIMP stays the fallback for everything else
+        if (ObjLoader::canLoad(import->path))
+        {
+            if (ObjLoader::load(import->path, import->meshData, pool))
+            {
+                import->parsedObj = true;
+                import->meshCount = import->meshData.size();
+                import->previews.resize(import->meshCount);
+                import->reports.resize(import->meshCount);
+                import->meshesRemaining = import->meshCount;
+                for (size_t i = 0; i < import->meshCount; i++)
+                {
+                    if (pool)
+                        pool->submit([this, import, i] { processMesh(import, i); });
+                    else
+                        processMesh(import, i);
+                }
+                return;
+            }
+            cout << "ModelLoader - falling back to ASSIMP for " << import->path << endl;
+        }
+
+        // read file via ASSIMP
+        import->importer.reset(new Assimp::Importer());
+        import->scene = import->importer->ReadFile(import->path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        // check for errors
+        const aiScene* scene = import->scene;
+        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+        {
+            cout << "ERROR::ASSIMP:: " << import->importer->GetErrorString() << endl;
+            import->importer.reset();
+            finishCpuPhase(*import);
+            return;
+        }
+
+        Model::collectMeshes(scene->mRootNode, scene, import->sceneMeshes);
+        import->meshCount = import->sceneMeshes.size();
+        // a mesh instanced by several nodes gets converted once per node and has to keep its arrays
+        std::unordered_map<const aiMesh*, size_t> references;
+        for (const aiMesh* mesh : import->sceneMeshes)
+            references[mesh]++;
+        import->ownsSource.resize(import->meshCount);
+        for (size_t i = 0; i < import->meshCount; i++)
+            import->ownsSource[i] = references[import->sceneMeshes[i]] == 1;
+        import->meshData.resize(import->meshCount);
+        import->previews.resize(import->meshCount);
+        import->reports.resize(import->meshCount);
+        import->meshesRemaining = import->meshCount;
+        if (import->meshCount == 0)
+        {
+            finishCpuPhase(*import);
+            return;
+        }
+
+        for (size_t i = 0; i < import->meshCount; i++)
+        {
+            if (pool)
+                pool->submit([this, import, i] { processMesh(import, i); });
+            else
+                processMesh(import, i);
+        }
+    }
+
+    // CPU phase of a single mesh
+    void processMesh(shared_ptr<Import> import, size_t index)
+    {
+        MeshData& data = import->meshData[index];
+        if (!import->parsedObj)
+        {
+            data = Model::processMesh(import->sceneMeshes[index], import->scene);
+            // the converted copy is all we need from here on, don't keep both until the whole model is done
+            if (import->ownsSource[index])
+                Model::releaseSourceMesh(import->sceneMeshes[index]);
+        }
+        // weld the per corner vertices and reorder for the vertex cache, overdraw and vertex fetch
+        MeshOptimizationReport report = optimizeMesh(data);
+        // simplified levels of detail are appended to the index buffer
+        buildLodChain(data);
+        // and every level gets split into clusters for culling
+        buildClusters(data);
+        import->reports[index] = MeshReport{ report, data.lods[0].indexCount / 3, data.lods.size(), data.lods.back().indexCount / 3,
+            data.clusters.size() };
+        if (import->buildPreviews && extractPreview(data.vertices.data(), data.vertices.size(), data.indices.data(), data.lods, data.clusters,
+            import->previews[index]))
+        {
+            MeshData& preview = import->previews[index];
+            preview.textures = data.textures;
+            preview.boundsMin = data.boundsMin;
+            preview.boundsMax = data.boundsMax;
+            preview.boundsRadius = data.boundsRadius;
+            pushReady(import, index, true);
+        }
+        pushReady(import, index, false);
+
+        if (--import->meshesRemaining == 0)
+        {
+            // last mesh of the model, the ASSIMP scene is no longer needed
+            import->importer.reset();
+            import->scene = nullptr;
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - import->startTime;
+            printImportSummary(*import, elapsed.count());
+            // store the processed meshes so the next run can skip the import
+            if (!MeshCache::write(import->path, import->meshData))
+            {
+                cout << "ModelLoader - unable to write mesh cache for " << import->path << endl;
+            }
+            finishCpuPhase(*import);
+        }
+    }
+
+    // one report for the whole model, written in a single call since the workers of other models log as well.
+    // The cache ratios are averaged over the triangles (ACMR) and the vertices (ATVR) of the meshes
+    static void printImportSummary(const Import& import, double milliseconds)
+    {
+        size_t verticesBefore = 0, verticesAfter = 0, triangles = 0, coarsestTriangles = 0, clusters = 0, lods = 0;
+        double acmrBefore = 0.0, acmrAfter = 0.0, atvrBefore = 0.0, atvrAfter = 0.0;
+        for (const MeshReport& report : import.reports)
+        {
+            const MeshOptimizationReport& optimization = report.optimization;
+            verticesBefore += optimization.verticesBefore;
+            verticesAfter += optimization.verticesAfter;
+            triangles += report.triangles;
+            coarsestTriangles += report.coarsestTriangles;
+            clusters += report.clusters;
+            lods = std::max(lods, report.lods);
+            acmrBefore += double(optimization.before.acmr) * report.triangles;
+            acmrAfter += double(optimization.after.acmr) * report.triangles;
+            atvrBefore += double(optimization.before.atvr) * optimization.verticesBefore;
+            atvrAfter += double(optimization.after.atvr) * optimization.verticesAfter;
+        }
+        std::ostringstream line;
+        line << "ModelLoader - " << import.path << " imported with " << (import.parsedObj ? "the OBJ loader" : "ASSIMP") << " in "
+            << milliseconds << " ms: " << import.reports.size() << " meshes, " << verticesBefore << " -> " << verticesAfter << " vertices";
+        if (triangles > 0)
+            line << ", ACMR " << acmrBefore / triangles << " -> " << acmrAfter / triangles;
+        if (verticesBefore > 0 && verticesAfter > 0)
+            line << ", ATVR " << atvrBefore / verticesBefore << " -> " << atvrAfter / verticesAfter;
+        line << ", up to " << lods << " LODs, " << triangles << " -> " << coarsestTriangles << " triangles, " << clusters << " clusters\n";
+        cout << line.str() << std::flush;
+    }
+
+    // CPU phase of a mesh loaded from the mesh cache, only runs when previews are built
+    void processCachedMesh(shared_ptr<Import> import, size_t index)
+    {
+        const MeshCacheRecord& record = import->cache.records()[index];
+        if (extractPreview(record.vertices, record.vertexCount, record.indices, record.lods, record.clusters, import->previews[index]))
+        {
+            MeshData& preview = import->previews[index];
+            preview.textures = record.textures;
+            preview.boundsMin = record.boundsMin;
+            preview.boundsMax = record.boundsMax;
+            preview.boundsRadius = record.boundsRadius;
+            pushReady(import, index, true);
+        }
+        pushReady(import, index, false);
+        if (--import->meshesRemaining == 0)
+            finishCpuPhase(*import);
+    }
+
+    void pushReady(const shared_ptr<Import>& import, size_t index, bool preview)
+    {
+        // notify while holding the lock, the loader may be gone as soon as it is released
+        std::lock_guard<std::mutex> lock(readyMutex);
+        readyMeshes.push_back(ReadyMesh{ import, index, preview });
+        readyCondition.notify_one();
+    }
+
+    void finishCpuPhase(Import& import)
+    {
+        std::lock_guard<std::mutex> lock(readyMutex);
+        import.cpuDone = true;
+        readyCondition.notify_one();
+    }
+
+    // true when no model is waiting on its CPU phase, readyMutex must be held
+    bool cpuPhaseIdle() const
+    {
+        for (const shared_ptr<Import>& import : imports)
+        {
+            if (!import->cpuDone)
+                return false;
+        }
+        return true;
+    }
+
+    // GL phase of a single mesh or of its preview
+    void uploadMesh(Import& import, size_t index, bool preview)
+    {
+        if (import.uploaded.empty())
+        {
+            import.uploaded.resize(import.meshCount);
+            import.fullDetail.resize(import.meshCount);
+        }
+
+        Model& model = *import.model;
+        if (preview)
+        {
+            MeshData data = std::move(import.previews[index]);
+            if (!import.fullDetail[index])
+            {
+                vector<Texture> textures = model.loadMaterialTextures(data.textures);
+                import.uploaded[index].reset(new Mesh(std::move(data), std::move(textures), model.layout));
+            }
+            return;
+        }
+
+        if (import.fromCache)
+        {
+            const MeshCacheRecord& record = import.cache.records()[index];
+            // vertex and index data go directly from the mapping to the arena
+            import.uploaded[index].reset(new Mesh(record.vertices, record.vertexCount, record.indices, record.indexCount, record.lods, record.clusters,
+                model.loadMaterialTextures(record.textures), record.boundsMin, record.boundsMax, record.boundsRadius, model.layout, model.cpuGeometry));
+        }
+        else
+        {
+            // the mesh cache may still be written from the data, upload it in place and leave it there.
+            // finalizeModel() moves it into the mesh or frees it.
+            const MeshData& data = import.meshData[index];
+            import.uploaded[index].reset(new Mesh(data.vertices.data(), data.vertices.size(), data.indices.data(), data.indices.size(), data.lods,
+                data.clusters, model.loadMaterialTextures(data.textures), data.boundsMin, data.boundsMax, data.boundsRadius, model.layout));
+        }
+        import.fullDetail[index] = true;
+        import.uploadedCount++;
+        resident_meshes++;
+    }
+
+    // hands the resident meshes to the model. Previews and full meshes replace what the model shows
+    // for the mesh, new meshes are only appended after the ones before them so the order matches a serial load.
+    void publishMeshes(Import& import)
+    {
+        if (import.uploaded.empty())
+            return;
+
+        vector<Mesh>& meshes = import.model->meshes;
+        for (size_t i = 0; i < import.published; i++)
+        {
+            if (import.uploaded[i])
+            {
+                meshes[import.meshBase + i] = std::move(*import.uploaded[i]);
+                import.uploaded[i].reset();
+            }
+        }
+        while (import.published < import.meshCount && import.uploaded[import.published])
+        {
+            meshes.push_back(std::move(*import.uploaded[import.published]));
+            import.uploaded[import.published].reset();
+            import.published++;
+        }
+        import.model->computeBounds();
+    }
+
+    void finalizeModel(Import& import)
+    {
+        Model& model = *import.model;
+        size_t geometryBytes = 0, cpuGeometryBytes = 0;
+        for (size_t i = 0; i < import.meshCount; i++)
+        {
+            Mesh& mesh = model.meshes[import.meshBase + i];
+            // the CPU phase is over so the mesh cache is written, the imported geometry is free to go
+            if (!import.fromCache && model.cpuGeometry == CpuGeometry::Keep)
+            {
+                mesh.vertices = std::move(import.meshData[i].vertices);
+                mesh.indices = std::move(import.meshData[i].indices);
+            }
+            geometryBytes += mesh.geometryBytes();
+            cpuGeometryBytes += mesh.cpuGeometryBytes();
+        }
+        import.uploaded.clear();
+        vector<MeshData>().swap(import.meshData);
+        vector<MeshData>().swap(import.previews);
+        import.cache.close();
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - import.startTime;
+        MemoryUsage memory = currentMemoryUsage();
+        cout << "ModelLoader - " << import.path << (import.fromCache ? " loaded from mesh cache" : " loaded") << " in " << elapsed.count() << " ms, "
+            << geometryBytes / 1024 << " KB of geometry at " << model.layout.stride() << " bytes per vertex, "
+            << cpuGeometryBytes / 1024 << " KB kept on the CPU, RSS " << toMegabytes(memory.resident) << " MB (peak "
+            << toMegabytes(memory.peakResident) << " MB)" << endl;
+    }
+
+    ThreadPool* pool;
+    bool previews;
+    size_t resident_meshes = 0;
+    vector<shared_ptr<Import>> imports;    // models still loading, only touched by the GL thread
+    std::deque<ReadyMesh> readyMeshes;     // meshes whose CPU phase finished
+    std::mutex readyMutex;
+    std::condition_variable readyCondition;
+};
+
+inline Model::Model(string const &path, bool gamma, const VertexLayout& layout, CpuGeometry cpuGeometry)
+    : gammaCorrection(gamma), layout(layout), cpuGeometry(cpuGeometry), boundsMin(0.0f), boundsMax(0.0f), boundsRadius(0.0f)
+{
+    ModelLoader loader(nullptr);
+    loader.load(*this, path, gamma, layout, cpuGeometry);
+    loader.finish();
+}
+
+// queues the texture on the shared TextureLoader, the returned texture is a placeholder until it's uploaded
+unsigned int textureFromFile(const char *path, const string &directory, bool gamma)
+{
+    string filename = string(path);
+    filename = directory + '/' + filename;
+
+    return TextureLoader::shared().load(filename, gamma);
 }
 
 #endif
@@ -0,0 +1,616 @@
+#include "obj_loader.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::endl;
+
+namespace {
+
+// index of a missing vt or vn
+const int OBJ_MISSING = INT_MIN;
+
+// one corner of a triangle, 0-based indices. Negative OBJ indices count back from the end of what the
+// chunk parsed so far and still need the element count of the previous chunks, relative has a bit set for them.
+struct ObjCorner {
+    int position;
+    int texcoord;
+    int normal;
+    int relative;
+};
+
+enum { RELATIVE_POSITION = 1, RELATIVE_TEXCOORD = 2, RELATIVE_NORMAL = 4 };
+
+// a usemtl line, the material applies from the given corner of the chunk on
+struct ObjMaterialSwitch {
+    size_t corner;
+    string name;
+};
+
+// what one chunk of lines contained
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+    vector<float> positions;      // xyz
+    vector<float> texcoords;      // uv
+    vector<float> normals;        // xyz
+    vector<ObjCorner> corners;    // three per triangle
+    vector<ObjMaterialSwitch> materials;
+    vector<string> libraries;
+    bool failed = false;
+};
+
+const double POWERS_OF_TEN[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline bool isDigit(char c)
+{
+    return unsigned(c - '0') < 10u;
+}
+
+inline const char* skipSpaces(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
+
+// Parses a decimal float without locale lookups or strtod's generality: the digits are accumulated into a 64 bit
+// integer and scaled once by an exact power of ten. Returns the end of the number, p itself when there was none.
+const char* parseFloat(const char* p, const char* end, float& value)
+{
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;              // significant digits in mantissa, 19 always fit
+    bool any = false;
+    for (; p < end && isDigit(*p); p++)
+    {
+        any = true;
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + uint64_t(*p - '0');
+            digits += mantissa != 0;
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && isDigit(*p); p++)
+        {
+            any = true;
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + uint64_t(*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+    if (!any)
+        return start;
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* e = p + 1;
+        bool negativeExponent = false;
+        if (e < end && (*e == '-' || *e == '+'))
+        {
+            negativeExponent = *e == '-';
+            e++;
+        }
+        if (e < end && isDigit(*e))
+        {
+            int power = 0;
+            for (; e < end && isDigit(*e); e++)
+                power = std::min(power * 10 + (*e - '0'), 1000);
+            exponent += negativeExponent ? -power : power;
+            p = e;
+        }
+    }
+
+    double result = double(mantissa);
+    if (exponent < 0 && exponent >= -22)
+        result /= POWERS_OF_TEN[-exponent];
+    else if (exponent > 0 && exponent <= 22)
+        result *= POWERS_OF_TEN[exponent];
+    else if (exponent != 0)
+        result *= std::pow(10.0, double(exponent));
+    value = float(negative ? -result : result);
+    return p;
+}
+
+const char* parseInt(const char* p, const char* end, int& value, bool& valid)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+    valid = p < end && isDigit(*p);
+    int result = 0;
+    for (; p < end && isDigit(*p); p++)
+        result = result * 10 + (*p - '0');
+    value = negative ? -result : result;
+    return p;
+}
+
+// turns a 1-based or negative OBJ index into a 0-based one, count is what the chunk parsed so far
+inline int chunkIndex(int index, size_t count, int flag, int& relative)
+{
+    if (index > 0)
+        return index - 1;
+    relative |= flag;
+    return int(count) + index;
+}
+
+// rest of the line without surrounding blanks
+string lineArgument(const char* p, const char* end)
+{
+    p = skipSpaces(p, end);
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+        end--;
+    return string(p, end);
+}
+
+bool startsWith(const char* p, const char* end, const char* keyword)
+{
+    size_t length = strlen(keyword);
+    return size_t(end - p) > length && memcmp(p, keyword, length) == 0 && (p[length] == ' ' || p[length] == '\t');
+}
+
+void parseChunk(ObjChunk& chunk)
+{
+    vector<ObjCorner> polygon;
+    const char* p = chunk.begin;
+    while (p < chunk.end)
+    {
+        const char* lineEnd = static_cast<const char*>(memchr(p, '\n', size_t(chunk.end - p)));
+        if (!lineEnd)
+            lineEnd = chunk.end;
+        p = skipSpaces(p, lineEnd);
+
+        if (lineEnd - p >= 2 && p[0] == 'v')
+        {
+            float values[3] = { 0.0f, 0.0f, 0.0f };
+            if (p[1] == ' ' || p[1] == '\t')
+            {
+                const char* q = p + 1;
+                for (int i = 0; i < 3; i++)
+                    q = parseFloat(skipSpaces(q, lineEnd), lineEnd, values[i]);
+                chunk.positions.insert(chunk.positions.end(), values, values + 3);
+            }
+            else if (p[1] == 't')
+            {
+                const char* q = p + 2;
+                for (int i = 0; i < 2; i++)
+                    q = parseFloat(skipSpaces(q, lineEnd), lineEnd, values[i]);
+                chunk.texcoords.insert(chunk.texcoords.end(), values, values + 2);
+            }
+            else if (p[1] == 'n')
+            {
+                const char* q = p + 2;
+                for (int i = 0; i < 3; i++)
+                    q = parseFloat(skipSpaces(q, lineEnd), lineEnd, values[i]);
+                chunk.normals.insert(chunk.normals.end(), values, values + 3);
+            }
+        }
+        else if (lineEnd - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            // v, v/vt, v//vn or v/vt/vn corners
+            polygon.clear();
+            const char* q = skipSpaces(p + 1, lineEnd);
+            while (q < lineEnd && *q != '\r' && *q != '#')
+            {
+                ObjCorner corner = { 0, OBJ_MISSING, OBJ_MISSING, 0 };
+                int index;
+                bool valid;
+                q = parseInt(q, lineEnd, index, valid);
+                if (!valid || index == 0)
+                {
+                    chunk.failed = true;
+                    return;
+                }
+                corner.position = chunkIndex(index, chunk.positions.size() / 3, RELATIVE_POSITION, corner.relative);
+                if (q < lineEnd && *q == '/')
+                {
+                    q++;
+                    if (q < lineEnd && *q != '/')
+                    {
+                        q = parseInt(q, lineEnd, index, valid);
+                        if (valid && index != 0)
+                            corner.texcoord = chunkIndex(index, chunk.texcoords.size() / 2, RELATIVE_TEXCOORD, corner.relative);
+                    }
+                    if (q < lineEnd && *q == '/')
+                    {
+                        q = parseInt(q + 1, lineEnd, index, valid);
+                        if (valid && index != 0)
+                            corner.normal = chunkIndex(index, chunk.normals.size() / 3, RELATIVE_NORMAL, corner.relative);
+                    }
+                }
+                polygon.push_back(corner);
+                q = skipSpaces(q, lineEnd);
+            }
+            // fan triangulation, like aiProcess_Triangulate does for convex polygons
+            for (size_t i = 2; i < polygon.size(); i++)
+            {
+                chunk.corners.push_back(polygon[0]);
+                chunk.corners.push_back(polygon[i - 1]);
+                chunk.corners.push_back(polygon[i]);
+            }
+        }
+        else if (startsWith(p, lineEnd, "usemtl"))
+        {
+            chunk.materials.push_back(ObjMaterialSwitch{ chunk.corners.size(), lineArgument(p + 6, lineEnd) });
+        }
+        else if (startsWith(p, lineEnd, "mtllib"))
+        {
+            chunk.libraries.push_back(lineArgument(p + 6, lineEnd));
+        }
+        p = lineEnd + 1;
+    }
+}
+
+// texture maps of a material in the order Model::processMesh collects them
+struct ObjMaterial {
+    vector<TextureRef> diffuse, specular, normal, reflection;
+};
+
+void parseMaterialLibrary(const string& path, std::map<string, ObjMaterial>& materials)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        cout << "ObjLoader - unable to open material library " << path << endl;
+        return;
+    }
+
+    ObjMaterial* current = nullptr;
+    string line;
+    while (std::getline(file, line))
+    {
+        const char* p = skipSpaces(line.data(), line.data() + line.size());
+        const char* end = line.data() + line.size();
+        if (startsWith(p, end, "newmtl"))
+        {
+            current = &materials[lineArgument(p + 6, end)];
+            continue;
+        }
+        if (!current)
+            continue;
+
+        // options like -bm come before the file name, which is the last argument
+        vector<TextureRef>* target = nullptr;
+        const char* type = nullptr;
+        size_t keyword = 0;
+        if (startsWith(p, end, "map_Kd")) { target = &current->diffuse; type = "texture_diffuse"; keyword = 6; }
+        else if (startsWith(p, end, "map_Ks")) { target = &current->specular; type = "texture_specular"; keyword = 6; }
+        else if (startsWith(p, end, "map_Bump") || startsWith(p, end, "map_bump")) { target = &current->normal; type = "texture_normal"; keyword = 8; }
+        else if (startsWith(p, end, "bump")) { target = &current->normal; type = "texture_normal"; keyword = 4; }
+        else if (startsWith(p, end, "map_Ka")) { target = &current->reflection; type = "texture_reflection"; keyword = 6; }
+        if (!target)
+            continue;
+
+        string argument = lineArgument(p + keyword, end);
+        size_t space = argument.find_last_of(" \t");
+        TextureRef texture;
+        texture.type = type;
+        texture.path = space == string::npos ? argument : argument.substr(space + 1);
+        target->push_back(texture);
+    }
+}
+
+// element range a triangle range of a chunk resolves its relative indices against
+struct ObjChunkBase {
+    size_t positions;
+    size_t texcoords;
+    size_t normals;
+};
+
+// corners of one material, as ranges of the chunks' corner arrays
+struct ObjCornerRange {
+    size_t chunk;
+    size_t begin;
+    size_t end;
+};
+
+struct ObjGroup {
+    string material;
+    vector<ObjCornerRange> ranges;
+};
+
+// builds the vertices and indices of one material, vertices are the distinct v/vt/vn triples in order of first use
+bool buildMesh(const ObjGroup& group, const vector<ObjChunk>& chunks, const vector<ObjChunkBase>& bases,
+    const vector<float>& positions, const vector<float>& texcoords, const vector<float>& normals, MeshData& mesh)
+{
+    const int positionCount = int(positions.size() / 3);
+    const int texcoordCount = int(texcoords.size() / 2);
+    const int normalCount = int(normals.size() / 3);
+
+    // vertices made from the same position are chained, in practice the chains are a few entries long
+    vector<int> first(positionCount, -1);
+    vector<int> next;
+    vector<int> vertexPosition, vertexTexcoord, vertexNormal;
+    bool missingNormals = false, anyTexcoords = false;
+
+    for (const ObjCornerRange& range : group.ranges)
+    {
+        const ObjChunkBase& base = bases[range.chunk];
+        for (size_t c = range.begin; c < range.end; c++)
+        {
+            const ObjCorner& corner = chunks[range.chunk].corners[c];
+            int position = corner.position + ((corner.relative & RELATIVE_POSITION) ? int(base.positions) : 0);
+            int texcoord = corner.texcoord;
+            if (texcoord != OBJ_MISSING && (corner.relative & RELATIVE_TEXCOORD))
+                texcoord += int(base.texcoords);
+            int normal = corner.normal;
+            if (normal != OBJ_MISSING && (corner.relative & RELATIVE_NORMAL))
+                normal += int(base.normals);
+            if (position < 0 || position >= positionCount || (texcoord != OBJ_MISSING && (texcoord < 0 || texcoord >= texcoordCount)) ||
+                (normal != OBJ_MISSING && (normal < 0 || normal >= normalCount)))
+            {
+                return false;
+            }
+
+            int vertex = first[position];
+            while (vertex >= 0 && (vertexTexcoord[vertex] != texcoord || vertexNormal[vertex] != normal))
+                vertex = next[vertex];
+            if (vertex < 0)
+            {
+                vertex = int(vertexPosition.size());
+                next.push_back(first[position]);
+                first[position] = vertex;
+                vertexPosition.push_back(position);
+                vertexTexcoord.push_back(texcoord);
+                vertexNormal.push_back(normal);
+                missingNormals |= normal == OBJ_MISSING;
+                anyTexcoords |= texcoord != OBJ_MISSING;
+            }
+            mesh.indices.push_back(unsigned(vertex));
+        }
+    }
+
+    vector<Vertex>& vertices = mesh.vertices;
+    vertices.resize(vertexPosition.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        Vertex& vertex = vertices[i];
+        const float* position = &positions[size_t(vertexPosition[i]) * 3];
+        vertex.Position = glm::vec3(position[0], position[1], position[2]);
+        vertex.Normal = glm::vec3(0.0f);
+        if (vertexNormal[i] != OBJ_MISSING)
+        {
+            const float* normal = &normals[size_t(vertexNormal[i]) * 3];
+            vertex.Normal = glm::vec3(normal[0], normal[1], normal[2]);
+        }
+        // flipped like aiProcess_FlipUVs
+        vertex.TexCoords = glm::vec2(0.0f);
+        if (vertexTexcoord[i] != OBJ_MISSING)
+        {
+            const float* texcoord = &texcoords[size_t(vertexTexcoord[i]) * 2];
+            vertex.TexCoords = glm::vec2(texcoord[0], 1.0f - texcoord[1]);
+        }
+        vertex.Tangent = glm::vec3(0.0f);
+        vertex.Bitangent = glm::vec3(0.0f);
+    }
+
+    // area weighted face normals for the vertices the file gave none
+    if (missingNormals)
+    {
+        for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3)
+        {
+            const unsigned* triangle = &mesh.indices[t];
+            glm::vec3 faceNormal = glm::cross(vertices[triangle[1]].Position - vertices[triangle[0]].Position,
+                vertices[triangle[2]].Position - vertices[triangle[0]].Position);
+            for (int k = 0; k < 3; k++)
+            {
+                if (vertexNormal[triangle[k]] == OBJ_MISSING)
+                    vertices[triangle[k]].Normal += faceNormal;
+            }
+        }
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            float length = glm::length(vertices[i].Normal);
+            if (vertexNormal[i] == OBJ_MISSING && length > 0.0f)
+                vertices[i].Normal /= length;
+        }
+    }
+
+    // tangent frames from the texture coordinates, like aiProcess_CalcTangentSpace
+    if (anyTexcoords)
+    {
+        for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3)
+        {
+            Vertex& v0 = vertices[mesh.indices[t]];
+            Vertex& v1 = vertices[mesh.indices[t + 1]];
+            Vertex& v2 = vertices[mesh.indices[t + 2]];
+            glm::vec3 edge1 = v1.Position - v0.Position, edge2 = v2.Position - v0.Position;
+            glm::vec2 delta1 = v1.TexCoords - v0.TexCoords, delta2 = v2.TexCoords - v0.TexCoords;
+            float determinant = delta1.x * delta2.y - delta2.x * delta1.y;
+            if (std::fabs(determinant) < 1e-12f)
+                continue;
+            float scale = 1.0f / determinant;
+            glm::vec3 tangent = (edge1 * delta2.y - edge2 * delta1.y) * scale;
+            glm::vec3 bitangent = (edge2 * delta1.x - edge1 * delta2.x) * scale;
+            for (Vertex* vertex : { &v0, &v1, &v2 })
+            {
+                vertex->Tangent += tangent;
+                vertex->Bitangent += bitangent;
+            }
+        }
+        for (Vertex& vertex : vertices)
+        {
+            glm::vec3 tangent = vertex.Tangent - vertex.Normal * glm::dot(vertex.Normal, vertex.Tangent);
+            glm::vec3 bitangent = vertex.Bitangent - vertex.Normal * glm::dot(vertex.Normal, vertex.Bitangent);
+            vertex.Tangent = glm::length(tangent) > 0.0f ? glm::normalize(tangent) : glm::vec3(0.0f);
+            vertex.Bitangent = glm::length(bitangent) > 0.0f ? glm::normalize(bitangent) : glm::vec3(0.0f);
+        }
+    }
+
+    computeBounds(vertices.data(), vertices.size(), mesh.boundsMin, mesh.boundsMax, mesh.boundsRadius);
+    return true;
+}
+
+}
+
+bool ObjLoader::canLoad(const string& path)
+{
+    size_t dot = path.find_last_of('.');
+    if (dot == string::npos || path.size() - dot != 4)
+        return false;
+    string extension = path.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return char(tolower(c)); });
+    return extension == "obj";
+}
+
+bool ObjLoader::load(const string& path, vector<MeshData>& meshes, ThreadPool* pool)
+{
+    MappedFile file(path);
+    if (!file.isOpen())
+    {
+        cout << "ObjLoader - unable to open " << path << endl;
+        return false;
+    }
+
+    // chunks of whole lines
+    const char* text = reinterpret_cast<const char*>(file.data());
+    const char* textEnd = text + file.size();
+    vector<ObjChunk> chunks;
+    for (const char* begin = text; begin < textEnd; )
+    {
+        const char* end = begin + std::min(OBJ_CHUNK_BYTES, size_t(textEnd - begin));
+        if (end < textEnd)
+        {
+            const char* lineBreak = static_cast<const char*>(memchr(end, '\n', size_t(textEnd - end)));
+            end = lineBreak ? lineBreak + 1 : textEnd;
+        }
+        chunks.emplace_back();
+        chunks.back().begin = begin;
+        chunks.back().end = end;
+        begin = end;
+    }
+
+    parallelFor(pool, chunks.size(), [&chunks](size_t i) { parseChunk(chunks[i]); });
+
+    // stitch the chunks: element offsets for the relative indices, one group per material in order of first use
+    vector<ObjChunkBase> bases(chunks.size());
+    ObjChunkBase total = { 0, 0, 0 };
+    vector<ObjGroup> groups;
+    std::map<string, size_t> groupIndex;
+    size_t currentGroup = SIZE_MAX;
+    auto selectMaterial = [&](const string& name) {
+        auto found = groupIndex.find(name);
+        if (found == groupIndex.end())
+        {
+            found = groupIndex.emplace(name, groups.size()).first;
+            groups.push_back(ObjGroup{ name, {} });
+        }
+        currentGroup = found->second;
+    };
+    selectMaterial("");
+    vector<string> libraries;
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        const ObjChunk& chunk = chunks[i];
+        if (chunk.failed)
+        {
+            cout << "ObjLoader - malformed face in " << path << endl;
+            return false;
+        }
+        bases[i] = total;
+        total.positions += chunk.positions.size() / 3;
+        total.texcoords += chunk.texcoords.size() / 2;
+        total.normals += chunk.normals.size() / 3;
+        libraries.insert(libraries.end(), chunk.libraries.begin(), chunk.libraries.end());
+
+        size_t begin = 0;
+        for (const ObjMaterialSwitch& material : chunk.materials)
+        {
+            if (material.corner > begin)
+                groups[currentGroup].ranges.push_back(ObjCornerRange{ i, begin, material.corner });
+            begin = material.corner;
+            selectMaterial(material.name);
+        }
+        if (chunk.corners.size() > begin)
+            groups[currentGroup].ranges.push_back(ObjCornerRange{ i, begin, chunk.corners.size() });
+    }
+
+    vector<float> positions, texcoords, normals;
+    positions.reserve(total.positions * 3);
+    texcoords.reserve(total.texcoords * 2);
+    normals.reserve(total.normals * 3);
+    for (ObjChunk& chunk : chunks)
+    {
+        positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+        texcoords.insert(texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+        normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+        vector<float>().swap(chunk.positions);
+        vector<float>().swap(chunk.texcoords);
+        vector<float>().swap(chunk.normals);
+    }
+
+    std::map<string, ObjMaterial> materials;
+    const string directory = path.substr(0, path.find_last_of("/\\") + 1);
+    for (const string& library : libraries)
+        parseMaterialLibrary(directory + library, materials);
+
+    // drop the groups without triangles, e.g. the default one of a file starting with usemtl
+    groups.erase(std::remove_if(groups.begin(), groups.end(), [](const ObjGroup& group) { return group.ranges.empty(); }), groups.end());
+    if (groups.empty())
+    {
+        cout << "ObjLoader - no faces in " << path << endl;
+        return false;
+    }
+
+    vector<MeshData> result(groups.size());
+    std::atomic<bool> valid(true);
+    parallelFor(pool, groups.size(), [&](size_t g) {
+        if (!buildMesh(groups[g], chunks, bases, positions, texcoords, normals, result[g]))
+        {
+            valid = false;
+            return;
+        }
+        auto material = materials.find(groups[g].material);
+        if (material != materials.end())
+        {
+            vector<TextureRef>& textures = result[g].textures;
+            for (const vector<TextureRef>* maps : { &material->second.diffuse, &material->second.specular, &material->second.normal, &material->second.reflection })
+                textures.insert(textures.end(), maps->begin(), maps->end());
+        }
+    });
+    if (!valid)
+    {
+        cout << "ObjLoader - face index out of range in " << path << endl;
+        return false;
+    }
+
+    meshes = std::move(result);
+    return true;
+}
@@ -0,0 +1,31 @@
+#ifndef _OBJ_LOADER_H_
+#define _OBJ_LOADER_H_
+
+#include "mesh.h"
+#include "thread_pool.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// bytes of OBJ text parsed per job, chunks end at the next line break
+const size_t OBJ_CHUNK_BYTES = 1024 * 1024;
+
+// Wavefront OBJ importer that skips ASSIMP. The file is mapped and split into chunks of whole lines
+// which are parsed in parallel, the chunks are then stitched together and the v/vt/vn triples of every
+// material become the vertices and indices of one MeshData, the way ASSIMP's importer followed by
+// Model::processMesh would produce them (polygons fanned into triangles, flipped texture coordinates,
+// tangents from the texture coordinates). Texture maps are read from the mtllib files.
+class ObjLoader
+{
+public:
+    // True for the files this loader handles (.obj)
+    static bool canLoad(const std::string& path);
+    // Parse a file into one MeshData per material. The caller takes part in the parsing so it's safe to call
+    // from a job of the pool. A null pool parses on the calling thread only. Returns false when the file
+    // can't be read or is malformed, the caller should fall back to ASSIMP then.
+    static bool load(const std::string& path, std::vector<MeshData>& meshes, ThreadPool* pool = &ThreadPool::shared());
+};
+
+
+#endif
@@ -0,0 +1,417 @@
+#include "point_shadows.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+
+namespace {
+
+const uint8_t NO_TIER = 0xFF;
+const uint32_t NO_LIGHT = UINT32_MAX;
+// a light keeps its tier until its size is this far past the threshold, so it doesn't flip between two tiers
+const float TIER_HYSTERESIS = 0.25f;
+
+int slotCount()
+{
+    int count = 0;
+    for (int t = 0; t < POINT_SHADOW_TIERS; t++)
+        count += POINT_SHADOW_TIER_SLOTS[t];
+    return count;
+}
+
+int tierForPixels(float pixels)
+{
+    for (int t = 0; t < POINT_SHADOW_TIERS; t++)
+    {
+        if (pixels >= POINT_SHADOW_TIER_PIXELS[t])
+            return t;
+    }
+    return POINT_SHADOW_TIERS - 1;
+}
+
+}
+
+PointShadows::PointShadows()
+    :
+    focal_length(1.0f),
+    z_near(0.1f),
+    max_lights(8),
+    frame(0),
+    layout_version(UINT64_MAX),
+    casters_version(0),
+    dirty_begin(SIZE_MAX),
+    dirty_end(0),
+    textures(),
+    table_buffer(0),
+    table_texture(0),
+    table_capacity(0),
+    clear_array(0),
+    clear_buffer(0),
+    frame_stats()
+{
+    for (int t = 0; t < POINT_SHADOW_TIERS; t++)
+    {
+        Slot free = { NO_LIGHT, glm::vec4(0.0f), 0, 0, false, false };
+        slots[t].assign(POINT_SHADOW_TIER_SLOTS[t], free);
+    }
+}
+
+void PointShadows::setView(int height, float fovy, float zNear)
+{
+    // pixels per world unit at a view depth of one
+    focal_length = 0.5f * float(height) / std::tan(0.5f * fovy);
+    z_near = zNear;
+}
+
+void PointShadows::setMaxLights(size_t count)
+{
+    max_lights = std::min(count, size_t(slotCount()));
+}
+
+int PointShadows::freeSlot(int tier) const
+{
+    for (int s = 0; s < POINT_SHADOW_TIER_SLOTS[tier]; s++)
+    {
+        if (slots[tier][s].light == NO_LIGHT)
+            return s;
+    }
+    return -1;
+}
+
+void PointShadows::take(int tier, int slot, uint32_t light)
+{
+    Slot& s = slots[tier][slot];
+    s.light = light;
+    s.drawn = false;
+    s.published = false;
+    light_tier[light] = uint8_t(tier);
+    light_slot[light] = uint16_t(slot);
+}
+
+void PointShadows::release(int tier, int slot)
+{
+    Slot& s = slots[tier][slot];
+    if (s.light == NO_LIGHT)
+        return;
+    // the lighting stops sampling the slot right away, it's about to hold another light
+    publish(s.light, -1);
+    light_tier[s.light] = NO_TIER;
+    s.light = NO_LIGHT;
+    s.drawn = false;
+    s.published = false;
+}
+
+void PointShadows::publish(uint32_t light, int32_t value)
+{
+    if (slot_table[light] == value)
+        return;
+    slot_table[light] = value;
+    dirty_begin = std::min(dirty_begin, size_t(light));
+    dirty_end = std::max(dirty_end, size_t(light) + 1);
+}
+
+void PointShadows::select(const LightSystem& lights, const uint32_t* visible, size_t count, const glm::mat4& view,
+    uint64_t castersVersion, bool dynamicCasters)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    Clock::time_point start = Clock::now();
+    frame++;
+    casters_version = castersVersion;
+    for (int t = 0; t < POINT_SHADOW_TIERS; t++)
+        updates[t].clear();
+
+    // the light indices are only stable between adds and removes
+    const size_t lightCount = lights.size();
+    if (lights.layoutVersion() != layout_version || slot_table.size() != lightCount)
+    {
+        layout_version = lights.layoutVersion();
+        for (int t = 0; t < POINT_SHADOW_TIERS; t++)
+        {
+            for (Slot& s : slots[t])
+            {
+                s.light = NO_LIGHT;
+                s.drawn = false;
+                s.published = false;
+            }
+        }
+        slot_table.assign(lightCount, -1);
+        light_tier.assign(lightCount, NO_TIER);
+        light_slot.assign(lightCount, 0);
+        dirty_begin = 0;
+        dirty_end = lightCount;
+    }
+
+    // importance: projected radius in pixels times brightness, a light around the camera covers the screen
+    const glm::vec4* spheres = lights.positionRadius();
+    const glm::vec4* colors = lights.colors();
+    const glm::vec4 depthAxis = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+    auto projectedPixels = [&](const glm::vec4& sphere) {
+        float depth = depthAxis.x * sphere.x + depthAxis.y * sphere.y + depthAxis.z * sphere.z + depthAxis.w;
+        return depth - sphere.w <= z_near ? 1e6f : sphere.w * focal_length / depth;
+    };
+    ranked.clear();
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t light = visible ? visible[i] : uint32_t(i);
+        const glm::vec4& color = colors[light];
+        float brightness = std::max(0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z, 1e-3f);
+        ranked.push_back(std::make_pair(projectedPixels(spheres[light]) * brightness, light));
+    }
+    size_t chosen = std::min(max_lights, ranked.size());
+    std::nth_element(ranked.begin(), ranked.begin() + chosen, ranked.end(),
+        [](const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b) { return a.first > b.first; });
+    std::sort(ranked.begin(), ranked.begin() + chosen,
+        [](const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b) { return a.first > b.first; });
+    ranked.resize(chosen);
+
+    // slots of lights that weren't chosen become free
+    for (int t = 0; t < POINT_SHADOW_TIERS; t++)
+    {
+        for (int s = 0; s < POINT_SHADOW_TIER_SLOTS[t]; s++)
+        {
+            uint32_t light = slots[t][s].light;
+            if (light != NO_LIGHT && std::none_of(ranked.begin(), ranked.end(),
+                [light](const std::pair<float, uint32_t>& r) { return r.second == light; }))
+            {
+                release(t, s);
+            }
+        }
+    }
+
+    // the chosen lights that outgrew or shrank below their tier move, when the tier has room. A light that
+    // didn't get the tier it wanted keeps its slot rather than being drawn again every frame.
+    std::vector<uint8_t> wanted(chosen);
+    for (size_t i = 0; i < chosen; i++)
+    {
+        uint32_t light = ranked[i].second;
+        float pixels = projectedPixels(spheres[light]);
+        int tier = tierForPixels(pixels);
+        int current = light_tier[light];
+        if (current != NO_TIER && tier != current)
+        {
+            bool finer = tier < current && pixels >= POINT_SHADOW_TIER_PIXELS[tier] * (1.0f + TIER_HYSTERESIS);
+            bool coarser = tier > current && pixels < POINT_SHADOW_TIER_PIXELS[current] * (1.0f - TIER_HYSTERESIS);
+            int slot = finer || coarser ? freeSlot(tier) : -1;
+            if (slot >= 0)
+            {
+                release(current, light_slot[light]);
+                take(tier, slot, light);
+            }
+            else
+            {
+                tier = current;
+            }
+        }
+        wanted[i] = uint8_t(tier);
+    }
+
+    // the others get a free slot, most important first: of their tier, else coarser, else finer
+    for (size_t i = 0; i < chosen; i++)
+    {
+        uint32_t light = ranked[i].second;
+        if (light_tier[light] != NO_TIER)
+            continue;
+        int order[POINT_SHADOW_TIERS];
+        int n = 0;
+        for (int t = wanted[i]; t < POINT_SHADOW_TIERS; t++)
+            order[n++] = t;
+        for (int t = wanted[i] - 1; t >= 0; t--)
+            order[n++] = t;
+        for (int k = 0; k < n; k++)
+        {
+            int slot = freeSlot(order[k]);
+            if (slot >= 0)
+            {
+                take(order[k], slot, light);
+                break;
+            }
+        }
+    }
+
+    // updates of the frame: slots never drawn by importance, then out of date ones, longest waiting first
+    struct Candidate {
+        uint64_t key;
+        int tier;
+        int slot;
+    };
+    std::vector<Candidate> candidates;
+    frame_stats = Stats();
+    for (size_t i = 0; i < chosen; i++)
+    {
+        uint32_t light = ranked[i].second;
+        int t = light_tier[light];
+        if (t == NO_TIER)
+            continue;
+        frame_stats.shadowed++;
+        int s = light_slot[light];
+        const Slot& slot = slots[t][s];
+        if (!slot.drawn)
+            candidates.push_back(Candidate{ uint64_t(i), t, s });
+        else if (dynamicCasters || slot.castersVersion != castersVersion || slot.sphere != spheres[light])
+            candidates.push_back(Candidate{ (uint64_t(1) << 32) + slot.drawnFrame, t, s });
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.key < b.key; });
+    size_t updated = std::min(candidates.size(), size_t(POINT_SHADOW_UPDATES_PER_FRAME));
+    for (size_t i = 0; i < updated; i++)
+        updates[candidates[i].tier].push_back(Update{ candidates[i].slot, spheres[slots[candidates[i].tier][candidates[i].slot].light] });
+
+    frame_stats.updated = updated;
+    frame_stats.waiting = candidates.size() - updated;
+    for (int t = 0; t < POINT_SHADOW_TIERS; t++)
+    {
+        for (const Slot& slot : slots[t])
+        {
+            if (slot.published)
+                frame_stats.published++;
+        }
+    }
+    frame_stats.selectMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void PointShadows::createTextures()
+{
+    if (table_buffer)
+        return;
+
+    GLenum format, type, attachment;
+    FrameBuffer::describeFormat(GL_DEPTH_COMPONENT24, format, type, attachment);
+    for (int t = 0; t < POINT_SHADOW_TIERS; t++)
+    {
+        int size = POINT_SHADOW_TIER_SIZE[t];
+        glGenTextures(1, &textures[t]);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[t]);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, POINT_SHADOW_TIER_SLOTS[t] * 6, 0, format, type, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        framebuffers[t].reset(new FrameBuffer(size, size));
+        framebuffers[t]->attachSharedLayered(textures[t], GL_DEPTH_COMPONENT24);
+        framebuffers[t]->check();
+    }
+
+    // a texture buffer needs a buffer with storage, finish() replaces it once there are lights
+    glGenBuffers(1, &table_buffer);
+    glGenTextures(1, &table_texture);
+    glBindBuffer(GL_TEXTURE_BUFFER, table_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(int32_t), NULL, GL_DYNAMIC_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, table_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, table_buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    // one triangle covering the viewport, clears the faces being updated
+    float triangle[] = { -1.0f, -1.0f, 0.0f, 3.0f, -1.0f, 0.0f, -1.0f, 3.0f, 0.0f };
+    glGenVertexArrays(1, &clear_array);
+    glGenBuffers(1, &clear_buffer);
+    glBindVertexArray(clear_array);
+    glBindBuffer(GL_ARRAY_BUFFER, clear_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(triangle), triangle, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void PointShadows::import(RenderGraph& graph, RenderGraph::Resource* tiers)
+{
+    createTextures();
+    for (int t = 0; t < POINT_SHADOW_TIERS; t++)
+    {
+        RenderTextureDesc desc{ POINT_SHADOW_TIER_SIZE[t], POINT_SHADOW_TIER_SIZE[t], GL_DEPTH_COMPONENT24, GL_NEAREST,
+            GL_CLAMP_TO_EDGE, POINT_SHADOW_TIER_SLOTS[t] * 6 };
+        tiers[t] = graph.importTexture("point shadows " + std::to_string(t), textures[t], desc);
+    }
+}
+
+bool PointShadows::beginTier(int tier, Shader& shader)
+{
+    if (updates[tier].empty())
+        return false;
+    createTextures();
+
+    int size = POINT_SHADOW_TIER_SIZE[tier];
+    framebuffers[tier]->bindOutput();
+    glViewport(0, 0, size, size);
+    glEnable(GL_DEPTH_TEST);
+
+    shader.setUniformInt("updateCount", int(updates[tier].size()));
+    for (size_t i = 0; i < updates[tier].size(); i++)
+    {
+        Update& update = updates[tier][i];
+        std::string index = "[" + std::to_string(i) + "]";
+        shader.setUniformVec4f("updateSpheres" + index, update.sphere);
+        shader.setUniformInt("updateLayers" + index, update.slot * 6);
+
+        Slot& slot = slots[tier][update.slot];
+        slot.sphere = update.sphere;
+        slot.castersVersion = casters_version;
+        slot.drawnFrame = frame;
+        slot.drawn = true;
+    }
+
+    // only the faces of the updates are cleared, the other slots keep their maps
+    shader.setUniformBool("clearFaces", true);
+    glDepthFunc(GL_ALWAYS);
+    glBindVertexArray(clear_array);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glDepthFunc(GL_LESS);
+    shader.setUniformBool("clearFaces", false);
+    return true;
+}
+
+void PointShadows::finish(size_t lightCount)
+{
+    createTextures();
+    for (int t = 0; t < POINT_SHADOW_TIERS; t++)
+    {
+        for (int s = 0; s < POINT_SHADOW_TIER_SLOTS[t]; s++)
+        {
+            Slot& slot = slots[t][s];
+            if (slot.light == NO_LIGHT || !slot.drawn || slot.published)
+                continue;
+            publish(slot.light, t * 256 + s);
+            slot.published = true;
+        }
+    }
+
+    lightCount = std::min(lightCount, slot_table.size());
+    if (lightCount > table_capacity)
+    {
+        // grow with some headroom and send everything, the storage is new
+        table_capacity = lightCount + lightCount / 2;
+        glBindBuffer(GL_TEXTURE_BUFFER, table_buffer);
+        glBufferData(GL_TEXTURE_BUFFER, table_capacity * sizeof(int32_t), NULL, GL_DYNAMIC_DRAW);
+        dirty_begin = 0;
+        dirty_end = lightCount;
+    }
+    dirty_end = std::min(dirty_end, lightCount);
+    if (dirty_begin < dirty_end)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, table_buffer);
+        glBufferSubData(GL_TEXTURE_BUFFER, dirty_begin * sizeof(int32_t), (dirty_end - dirty_begin) * sizeof(int32_t),
+            &slot_table[dirty_begin]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    dirty_begin = SIZE_MAX;
+    dirty_end = 0;
+}
+
+void PointShadows::bind(Shader& shader, GLuint firstUnit)
+{
+    createTextures();
+    for (int t = 0; t < POINT_SHADOW_TIERS; t++)
+    {
+        glActiveTexture(GL_TEXTURE0 + firstUnit + t);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[t]);
+        shader.setUniformInt("pointShadowTier" + std::to_string(t), int(firstUnit + t));
+    }
+    glActiveTexture(GL_TEXTURE0 + firstUnit + POINT_SHADOW_TIERS);
+    glBindTexture(GL_TEXTURE_BUFFER, table_texture);
+    shader.setUniformInt("lightShadowSlots", int(firstUnit + POINT_SHADOW_TIERS));
+    glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,132 @@
+#ifndef _POINT_SHADOWS_H_
+#define _POINT_SHADOWS_H_
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+
+#include "framebuffer.h"
+#include "light_system.h"
+#include "render_graph.h"
+#include "shader_s.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// shadow map tiers from the finest: the size of a cube face and how many lights a tier holds
+const int POINT_SHADOW_TIERS = 3;
+const int POINT_SHADOW_TIER_SIZE[POINT_SHADOW_TIERS] = { 512, 256, 128 };
+const int POINT_SHADOW_TIER_SLOTS[POINT_SHADOW_TIERS] = { 2, 6, 16 };
+// projected light radius in pixels a light needs to get a tier
+const float POINT_SHADOW_TIER_PIXELS[POINT_SHADOW_TIERS] = { 192.0f, 64.0f, 0.0f };
+// lights whose shadow maps are drawn per frame, the cost of the shadows doesn't grow with the lights
+// (also the lights the geometry shader of pointShadow.glsl loops over)
+const int POINT_SHADOW_UPDATES_PER_FRAME = 4;
+// the tiers, then the slot table
+const GLuint POINT_SHADOW_TEXTURE_UNIT = 10;
+
+// Omnidirectional shadows of the most important point lights. select() ranks the visible lights by their size on
+// screen times their brightness, gives the first ones a slot of the tier their size calls for and picks which of
+// them get their shadow maps drawn this frame: lights new to a slot first, then the ones whose light or casters
+// changed, longest waiting first, at most POINT_SHADOW_UPDATES_PER_FRAME. Every tier is a depth texture array with
+// six layers (cube faces) per slot, drawn in one layered pass whose geometry shader sends each triangle to the faces
+// of the lights being updated. The faces hold the distance to the light over its radius. The lighting finds a
+// light's slot in a table indexed like the light buffers (-1 unshadowed), a slot is only published once drawn.
+class PointShadows
+{
+public:
+    // what the last select() and draw did
+    struct Stats {
+        size_t shadowed;             // lights with a slot
+        size_t published;            // of those, with a drawn shadow map
+        size_t updated;              // lights drawn this frame
+        size_t waiting;              // lights whose maps are out of date after this frame
+        double selectMilliseconds;
+    };
+
+    PointShadows();
+    // GL objects are left to the context teardown
+
+    // Projection the projected sizes are measured in
+    void setView(int height, float fovy, float zNear);
+    // Most lights shadowed at once, up to the slots of all tiers
+    void setMaxLights(size_t count);
+    // Choose the shadowed lights among the given ones (indices into lights, the first count when null) and the
+    // updates of this frame. castersVersion changes when the shadow casters did, dynamic casters make every shadow
+    // map out of date. No GL calls.
+    void select(const LightSystem& lights, const uint32_t* visible, size_t count, const glm::mat4& view,
+        uint64_t castersVersion, bool dynamicCasters);
+
+    // The tier textures as render graph resources
+    void import(RenderGraph& graph, RenderGraph::Resource* tiers);
+    // Bind the layered FrameBuffer of a tier, clear the faces of its updates and set the shader's update uniforms.
+    // Returns false when the tier has nothing to draw, otherwise the casters are drawn next. GL thread only.
+    bool beginTier(int tier, Shader& shader);
+    // Publish the slots drawn by the tiers and upload the slot table. GL thread only.
+    void finish(size_t lightCount);
+    // Bind the tiers and the slot table to the samplers of pointShadow.Sample, for the lighting shader in use
+    void bind(Shader& shader, GLuint firstUnit = POINT_SHADOW_TEXTURE_UNIT);
+
+    // the lights beginTier() set up, e.g. for picking the level of detail of the casters
+    size_t updateCount(int tier) const { return updates[tier].size(); }
+    const glm::vec4& updateSphere(int tier, size_t update) const { return updates[tier][update].sphere; }
+    size_t maxLights() const { return max_lights; }
+    const Stats& stats() const { return frame_stats; }
+
+private:
+    struct Slot {
+        uint32_t light;              // UINT32_MAX when free
+        glm::vec4 sphere;            // of the light when it was drawn
+        uint64_t castersVersion;
+        unsigned int drawnFrame;
+        bool drawn;                  // since the light got the slot
+        bool published;
+    };
+
+    // a light drawn this frame
+    struct Update {
+        int slot;
+        glm::vec4 sphere;
+    };
+
+    PointShadows(const PointShadows&) = delete;
+    PointShadows& operator=(const PointShadows&) = delete;
+
+    // first free slot of a tier, -1 when it is full
+    int freeSlot(int tier) const;
+    void take(int tier, int slot, uint32_t light);
+    void release(int tier, int slot);
+    void publish(uint32_t light, int32_t value);
+    void createTextures();
+
+    float focal_length;
+    float z_near;
+    size_t max_lights;
+    unsigned int frame;
+    uint64_t layout_version;
+    uint64_t casters_version;
+    std::vector<Slot> slots[POINT_SHADOW_TIERS];
+    std::vector<Update> updates[POINT_SHADOW_TIERS];
+    // tier * 256 + slot of every light, what the lighting sees
+    std::vector<int32_t> slot_table;
+    size_t dirty_begin;
+    size_t dirty_end;
+    // scratch of select()
+    std::vector<std::pair<float, uint32_t>> ranked;
+    std::vector<uint8_t> light_tier;
+    std::vector<uint16_t> light_slot;
+    // GL objects
+    GLuint textures[POINT_SHADOW_TIERS];
+    std::unique_ptr<FrameBuffer> framebuffers[POINT_SHADOW_TIERS];
+    GLuint table_buffer;
+    GLuint table_texture;
+    size_t table_capacity;
+    GLuint clear_array;
+    GLuint clear_buffer;
+    Stats frame_stats;
+};
+
+
+#endif
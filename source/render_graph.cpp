@@ -0,0 +1,446 @@
+#include "render_graph.h"
+
+#include <algorithm>
+#include <iostream>
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::endl;
+
+RenderGraph::Resource RenderGraph::PassBuilder::create(const string& name, const RenderTextureDesc& desc)
+{
+    graph.resources.push_back(ResourceNode{ name, desc, false, 0, -1, -1, -1 });
+    Resource version = graph.addVersion(int(graph.resources.size()) - 1, pass);
+    graph.passes[pass].writes.push_back(version);
+    return version;
+}
+
+RenderGraph::Resource RenderGraph::PassBuilder::read(Resource resource)
+{
+    graph.passes[pass].reads.push_back(resource);
+    return resource;
+}
+
+RenderGraph::Resource RenderGraph::PassBuilder::write(Resource resource)
+{
+    // drawing on top keeps whatever produced the current contents alive
+    graph.passes[pass].reads.push_back(resource);
+    return overwrite(resource);
+}
+
+RenderGraph::Resource RenderGraph::PassBuilder::overwrite(Resource resource)
+{
+    Resource version = graph.addVersion(graph.versions[resource].resource, pass);
+    graph.passes[pass].writes.push_back(version);
+    return version;
+}
+
+RenderGraph::RenderGraph()
+    :
+    frame(0),
+    frame_stats()
+{
+}
+
+RenderGraph::~RenderGraph()
+{
+    framebuffers.clear();
+    for (const PhysicalTexture& texture : physical_textures)
+        glDeleteTextures(1, &texture.id);
+}
+
+void RenderGraph::reset()
+{
+    resources.clear();
+    versions.clear();
+    passes.clear();
+    presented.clear();
+    order.clear();
+}
+
+RenderGraph::Resource RenderGraph::backbuffer(int width, int height)
+{
+    resources.push_back(ResourceNode{ "backbuffer", RenderTextureDesc{ width, height, GL_RGBA8, GL_NEAREST, GL_CLAMP_TO_EDGE, 0 }, true, 0, -1, -1, -1 });
+    return addVersion(int(resources.size()) - 1, -1);
+}
+
+RenderGraph::Resource RenderGraph::importTexture(const string& name, GLuint texture, const RenderTextureDesc& desc)
+{
+    resources.push_back(ResourceNode{ name, desc, true, texture, -1, -1, -1 });
+    return addVersion(int(resources.size()) - 1, -1);
+}
+
+RenderGraph::PassBuilder RenderGraph::addPass(const string& name, Execute execute)
+{
+    passes.push_back(PassNode{ name, std::move(execute), {}, {}, false });
+    return PassBuilder(*this, int(passes.size()) - 1);
+}
+
+void RenderGraph::present(Resource resource)
+{
+    presented.push_back(resource);
+}
+
+void RenderGraph::execute()
+{
+    frame++;
+    cullPasses();
+    schedulePasses();
+    allocateTextures();
+
+    frame_stats.declaredPasses = passes.size();
+    frame_stats.executedPasses = order.size();
+    frame_stats.framebufferBinds = 0;
+
+    const FrameBuffer* bound = nullptr;
+    bool backbufferBound = false;
+    for (int index : order)
+    {
+        PassNode& pass = passes[index];
+        if (bindsOwnTarget(pass))
+        {
+            // whatever it binds, the next pass binds its own target again
+            bound = nullptr;
+            backbufferBound = false;
+        }
+        else if (!pass.writes.empty())
+        {
+            int width, height;
+            FrameBuffer* output = target(pass, width, height);
+            // consecutive passes drawing into the same textures share the binding
+            if (output ? output != bound : !backbufferBound)
+            {
+                if (output)
+                    output->bindOutput();
+                else
+                    FrameBuffer::unbind();
+                bound = output;
+                backbufferBound = !output;
+                frame_stats.framebufferBinds++;
+            }
+            glViewport(0, 0, width, height);
+        }
+        pass.execute(*this);
+    }
+
+    trimTextures();
+}
+
+GLuint RenderGraph::texture(Resource resource) const
+{
+    const ResourceNode& node = resources[versions[resource].resource];
+    if (node.imported)
+        return node.texture;
+    return node.physical >= 0 ? physical_textures[node.physical].id : 0;
+}
+
+void RenderGraph::bindTexture(GLuint unit, Resource resource) const
+{
+    const ResourceNode& node = resources[versions[resource].resource];
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(node.desc.layers > 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D, texture(resource));
+}
+
+void RenderGraph::bindRead(Resource resource)
+{
+    const ResourceNode& node = resources[versions[resource].resource];
+    if (node.imported)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        return;
+    }
+    framebuffer(vector<int>(1, node.physical))->bindRead();
+}
+
+vector<string> RenderGraph::schedule() const
+{
+    vector<string> names;
+    for (int index : order)
+        names.push_back(passes[index].name);
+    return names;
+}
+
+RenderGraph::Resource RenderGraph::addVersion(int resource, int writer)
+{
+    versions.push_back(VersionNode{ resource, writer });
+    return Resource(versions.size() - 1);
+}
+
+void RenderGraph::cullPasses()
+{
+    // walk back from the presented versions through the writers of everything a live pass reads
+    vector<int> stack;
+    for (PassNode& pass : passes)
+        pass.live = false;
+    for (Resource resource : presented)
+    {
+        if (versions[resource].writer >= 0)
+            stack.push_back(versions[resource].writer);
+    }
+    while (!stack.empty())
+    {
+        int index = stack.back();
+        stack.pop_back();
+        if (passes[index].live)
+            continue;
+        passes[index].live = true;
+        for (Resource resource : passes[index].reads)
+        {
+            int writer = versions[resource].writer;
+            if (writer >= 0 && !passes[writer].live)
+                stack.push_back(writer);
+        }
+    }
+}
+
+void RenderGraph::schedulePasses()
+{
+    // a pass waits for the writers of what it reads and for every earlier pass touching a texture it writes.
+    // Handles only come from earlier declarations, so declaration order always satisfies this.
+    const int count = int(passes.size());
+    vector<vector<int>> successors(count);
+    vector<int> waiting(count, 0);
+    for (int later = 0; later < count; later++)
+    {
+        if (!passes[later].live)
+            continue;
+        for (int earlier = 0; earlier < later; earlier++)
+        {
+            if (!passes[earlier].live)
+                continue;
+            bool dependent = false;
+            for (Resource read : passes[later].reads)
+                dependent = dependent || versions[read].writer == earlier;
+            for (Resource write : passes[later].writes)
+            {
+                int resource = versions[write].resource;
+                for (Resource other : passes[earlier].reads)
+                    dependent = dependent || versions[other].resource == resource;
+                for (Resource other : passes[earlier].writes)
+                    dependent = dependent || versions[other].resource == resource;
+            }
+            if (dependent)
+            {
+                successors[earlier].push_back(later);
+                waiting[later]++;
+            }
+        }
+    }
+
+    // of the passes that are ready, take one drawing into the same textures as the previous pass first
+    // to save a render target switch, then the earliest declared
+    vector<int> ready;
+    for (int i = 0; i < count; i++)
+    {
+        if (passes[i].live && waiting[i] == 0)
+            ready.push_back(i);
+    }
+    auto sameTarget = [this](int a, int b) {
+        if (passes[a].writes.size() != passes[b].writes.size() || passes[a].writes.empty())
+            return false;
+        for (size_t i = 0; i < passes[a].writes.size(); i++)
+        {
+            if (versions[passes[a].writes[i]].resource != versions[passes[b].writes[i]].resource)
+                return false;
+        }
+        return true;
+    };
+    order.clear();
+    while (!ready.empty())
+    {
+        size_t pick = std::min_element(ready.begin(), ready.end()) - ready.begin();
+        if (!order.empty())
+        {
+            for (size_t i = 0; i < ready.size(); i++)
+            {
+                if (sameTarget(order.back(), ready[i]) && (!sameTarget(order.back(), ready[pick]) || ready[i] < ready[pick]))
+                    pick = i;
+            }
+        }
+        int index = ready[pick];
+        ready.erase(ready.begin() + pick);
+        order.push_back(index);
+        for (int successor : successors[index])
+        {
+            if (--waiting[successor] == 0)
+                ready.push_back(successor);
+        }
+    }
+}
+
+void RenderGraph::allocateTextures()
+{
+    for (ResourceNode& resource : resources)
+    {
+        resource.physical = -1;
+        resource.firstUse = -1;
+        resource.lastUse = -1;
+    }
+    for (int position = 0; position < int(order.size()); position++)
+    {
+        const PassNode& pass = passes[order[position]];
+        for (const vector<Resource>* list : { &pass.reads, &pass.writes })
+        {
+            for (Resource version : *list)
+            {
+                ResourceNode& resource = resources[versions[version].resource];
+                if (resource.firstUse < 0)
+                    resource.firstUse = position;
+                resource.lastUse = position;
+            }
+        }
+    }
+
+    // walk the schedule, textures whose last user already ran go back to the pool for the next ones
+    for (PhysicalTexture& texture : physical_textures)
+        texture.busy = false;
+    frame_stats.transientBytes = 0;
+    frame_stats.unaliasedBytes = 0;
+    for (int position = 0; position < int(order.size()); position++)
+    {
+        for (ResourceNode& resource : resources)
+        {
+            if (!resource.imported && resource.firstUse == position)
+            {
+                resource.physical = acquireTexture(resource.desc);
+                frame_stats.unaliasedBytes += textureBytes(resource.desc);
+            }
+        }
+        for (ResourceNode& resource : resources)
+        {
+            if (!resource.imported && resource.lastUse == position)
+                physical_textures[resource.physical].busy = false;
+        }
+    }
+
+    frame_stats.allocatedBytes = 0;
+    for (const PhysicalTexture& texture : physical_textures)
+    {
+        if (texture.lastFrame == frame)
+            frame_stats.transientBytes += textureBytes(texture.desc);
+        frame_stats.allocatedBytes += textureBytes(texture.desc);
+    }
+}
+
+int RenderGraph::acquireTexture(const RenderTextureDesc& desc)
+{
+    for (size_t i = 0; i < physical_textures.size(); i++)
+    {
+        PhysicalTexture& texture = physical_textures[i];
+        if (!texture.busy && texture.desc == desc)
+        {
+            texture.busy = true;
+            texture.lastFrame = frame;
+            return int(i);
+        }
+    }
+
+    GLenum format, type, attachment;
+    FrameBuffer::describeFormat(desc.format, format, type, attachment);
+    GLuint id;
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0, format, type, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, desc.filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, desc.filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, desc.wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, desc.wrap);
+    if (desc.wrap == GL_CLAMP_TO_BORDER)
+    {
+        float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    physical_textures.push_back(PhysicalTexture{ desc, id, frame, true });
+    return int(physical_textures.size()) - 1;
+}
+
+void RenderGraph::trimTextures()
+{
+    for (size_t i = 0; i < physical_textures.size(); )
+    {
+        const PhysicalTexture& texture = physical_textures[i];
+        if (texture.lastFrame + RENDER_GRAPH_KEEP_FRAMES > frame)
+        {
+            i++;
+            continue;
+        }
+
+        // a culled pass or a resize left it unused, drop the framebuffers using it first
+        for (auto it = framebuffers.begin(); it != framebuffers.end(); )
+        {
+            if (std::find(it->first.begin(), it->first.end(), texture.id) != it->first.end())
+                it = framebuffers.erase(it);
+            else
+                ++it;
+        }
+        glDeleteTextures(1, &texture.id);
+        physical_textures.erase(physical_textures.begin() + i);
+    }
+}
+
+FrameBuffer* RenderGraph::target(const PassNode& pass, int& width, int& height)
+{
+    vector<int> physical;
+    for (Resource version : pass.writes)
+    {
+        const ResourceNode& resource = resources[versions[version].resource];
+        width = resource.desc.width;
+        height = resource.desc.height;
+        if (resource.imported)
+        {
+            if (pass.writes.size() > 1)
+                cout << "RenderGraph - pass " << pass.name << " mixes the backbuffer with textures, only the backbuffer is bound" << endl;
+            return nullptr;
+        }
+        physical.push_back(resource.physical);
+    }
+    return framebuffer(physical);
+}
+
+bool RenderGraph::bindsOwnTarget(const PassNode& pass) const
+{
+    for (Resource version : pass.writes)
+    {
+        const ResourceNode& resource = resources[versions[version].resource];
+        if (resource.imported && resource.texture)
+            return true;
+    }
+    return false;
+}
+
+FrameBuffer* RenderGraph::framebuffer(const vector<int>& physical)
+{
+    vector<GLuint> key;
+    for (int index : physical)
+        key.push_back(physical_textures[index].id);
+    std::unique_ptr<FrameBuffer>& framebuffer = framebuffers[key];
+    if (!framebuffer)
+    {
+        const RenderTextureDesc& desc = physical_textures[physical[0]].desc;
+        framebuffer.reset(new FrameBuffer(desc.width, desc.height));
+        for (int index : physical)
+            framebuffer->attachShared(physical_textures[index].id, physical_textures[index].desc.format);
+        framebuffer->check();
+    }
+    return framebuffer.get();
+}
+
+size_t RenderGraph::textureBytes(const RenderTextureDesc& desc)
+{
+    size_t texelBytes;
+    switch (desc.format)
+    {
+    case GL_RGBA32F: texelBytes = 16; break;
+    case GL_RGB32F: texelBytes = 12; break;
+    // three channel formats are padded to four by most drivers
+    case GL_RGBA16F: case GL_RGB16F: case GL_RG32F: texelBytes = 8; break;
+    case GL_RG8: case GL_RG: texelBytes = 2; break;
+    case GL_LUMINANCE8: case GL_LUMINANCE: texelBytes = 1; break;
+    case GL_LUMINANCE16: case GL_LUMINANCE8_ALPHA8: case GL_LUMINANCE_ALPHA: texelBytes = 2; break;
+    default: texelBytes = 4; break;
+    }
+    return size_t(desc.width) * desc.height * texelBytes;
+}
@@ -0,0 +1,166 @@
+#ifndef _RENDER_GRAPH_H_
+#define _RENDER_GRAPH_H_
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include "framebuffer.h"
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// physical textures nobody used for this many frames are deleted
+const unsigned int RENDER_GRAPH_KEEP_FRAMES = 3;
+
+// size and format of a texture the graph allocates
+struct RenderTextureDesc {
+    int width;
+    int height;
+    GLenum format;                // internal format, any FrameBuffer knows
+    GLint filter;
+    GLint wrap;                   // GL_CLAMP_TO_BORDER samples a white border, for shadow maps
+    int layers;                   // 0 for a 2D texture, the layers of a 2D array texture (imported textures only)
+
+    bool operator==(const RenderTextureDesc& other) const
+    {
+        return width == other.width && height == other.height && format == other.format && filter == other.filter && wrap == other.wrap &&
+            layers == other.layers;
+    }
+};
+
+// One frame as a list of passes declaring the textures they read and write. The frame is declared
+// again every frame, then execute() culls the passes nothing presented depends on, orders the rest,
+// gives the transient textures physical ones (textures whose lifetimes don't overlap share one) and runs
+// the passes with their render targets bound. Resource handles are versions: writing a texture returns a
+// new handle, so a pass that starts over (e.g. a debug view) leaves the passes drawing the old contents
+// without readers and they get culled.
+class RenderGraph
+{
+public:
+    // versioned texture handle, valid for the frame it was declared in
+    typedef int Resource;
+    typedef std::function<void(RenderGraph&)> Execute;
+
+    // declares what a pass reads and writes, returned by addPass()
+    class PassBuilder
+    {
+    public:
+        // New transient texture written by the pass. Its contents start out undefined (it may be a texture
+        // another pass used earlier in the frame), the pass has to clear or overwrite all of it.
+        Resource create(const std::string& name, const RenderTextureDesc& desc);
+        // The pass samples or blits the texture
+        Resource read(Resource resource);
+        // The pass draws on top of the texture's contents, returns the new version
+        Resource write(Resource resource);
+        // The pass replaces the texture's contents, returns the new version without depending on the old one
+        Resource overwrite(Resource resource);
+
+    private:
+        friend class RenderGraph;
+        PassBuilder(RenderGraph& graph, int pass) : graph(graph), pass(pass) {}
+
+        RenderGraph& graph;
+        int pass;
+    };
+
+    // what the last execute() did
+    struct Stats {
+        size_t declaredPasses;
+        size_t executedPasses;
+        size_t framebufferBinds;      // render target changes between passes
+        size_t transientBytes;        // physical textures of the frame
+        size_t unaliasedBytes;        // what the frame's transient textures would take without sharing
+        size_t allocatedBytes;        // every physical texture, unused ones included until they are trimmed
+    };
+
+    RenderGraph();
+    ~RenderGraph();
+
+    // Forget the passes and resources of the previous frame, physical textures are kept for reuse
+    void reset();
+    // The default framebuffer as a resource of the given size, overwritten or written by the passes drawing on screen
+    Resource backbuffer(int width, int height);
+    // A texture kept outside the graph (e.g. shadow maps living across frames). It is never allocated or aliased,
+    // and passes writing it bind their render target themselves.
+    Resource importTexture(const std::string& name, GLuint texture, const RenderTextureDesc& desc);
+    // Add a pass, it runs in execute() with its render target bound and the viewport covering it
+    PassBuilder addPass(const std::string& name, Execute execute);
+    // Mark the version of a resource the frame produces, the passes it depends on are kept
+    void present(Resource resource);
+    // Cull, schedule, allocate and run the passes
+    void execute();
+
+    // GL texture behind a transient resource, only valid while the graph executes
+    GLuint texture(Resource resource) const;
+    // bind a transient resource's texture to a texture unit
+    void bindTexture(GLuint unit, Resource resource) const;
+    // bind a transient resource as GL_READ_FRAMEBUFFER, e.g. to blit its depth
+    void bindRead(Resource resource);
+
+    const Stats& stats() const { return frame_stats; }
+    // names of the passes the last execute() ran, in order
+    std::vector<std::string> schedule() const;
+
+private:
+    struct ResourceNode {
+        std::string name;
+        RenderTextureDesc desc;
+        bool imported;               // the backbuffer or an imported texture, not allocated by the graph
+        GLuint texture;              // the imported texture, 0 for the backbuffer
+        int physical;                // index into physical_textures during execute()
+        int firstUse;                // first and last position in the schedule
+        int lastUse;
+    };
+
+    struct VersionNode {
+        int resource;
+        int writer;                  // pass producing this version, -1 for the initial one
+    };
+
+    struct PassNode {
+        std::string name;
+        Execute execute;
+        std::vector<Resource> reads;       // versions the pass depends on
+        std::vector<Resource> writes;      // versions the pass produces, its render target
+        bool live;
+    };
+
+    struct PhysicalTexture {
+        RenderTextureDesc desc;
+        GLuint id;
+        unsigned int lastFrame;            // frame it was last used in
+        bool busy;                         // holds a resource at the current point of the schedule
+    };
+
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    Resource addVersion(int resource, int writer);
+    void cullPasses();
+    void schedulePasses();
+    void allocateTextures();
+    int acquireTexture(const RenderTextureDesc& desc);
+    void trimTextures();
+    // render target of a pass, creating the FrameBuffer for its attachments on first use
+    FrameBuffer* target(const PassNode& pass, int& width, int& height);
+    // whether a pass writes an imported texture and binds its own render target
+    bool bindsOwnTarget(const PassNode& pass) const;
+    FrameBuffer* framebuffer(const std::vector<int>& physical);
+    static size_t textureBytes(const RenderTextureDesc& desc);
+
+    std::vector<ResourceNode> resources;
+    std::vector<VersionNode> versions;
+    std::vector<PassNode> passes;
+    std::vector<Resource> presented;
+    std::vector<int> order;                                   // live passes in execution order
+    std::vector<PhysicalTexture> physical_textures;
+    std::map<std::vector<GLuint>, std::unique_ptr<FrameBuffer>> framebuffers;  // keyed by attached textures
+    unsigned int frame;
+    Stats frame_stats;
+};
+
+
+#endif
@@ -0,0 +1,190 @@
+#include "scene_bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+// squared distance from a point to a box, 0 inside it
+float boxDistanceSquared(const glm::vec3& min, const glm::vec3& max, const glm::vec3& point)
+{
+    glm::vec3 outside = glm::max(min - point, glm::vec3(0.0f)) + glm::max(point - max, glm::vec3(0.0f));
+    return glm::dot(outside, outside);
+}
+
+}
+
+SceneBvh::SceneBvh()
+    :
+    frame_stats()
+{
+}
+
+SceneBvh::Bounds SceneBvh::transformBounds(const glm::vec3& boundsMin, const glm::vec3& boundsMax, float boundsRadius, const glm::mat4& transform)
+{
+    // the box around the transformed box: its center moves, its half extent goes through the absolute linear part
+    glm::vec3 center = glm::vec3(transform * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+    glm::vec3 halfExtent = (boundsMax - boundsMin) * 0.5f;
+    glm::vec3 extent(0.0f);
+    float scale = 0.0f;
+    for (int column = 0; column < 3; column++)
+    {
+        glm::vec3 axis(transform[column]);
+        extent += glm::abs(axis) * halfExtent[column];
+        scale = std::max(scale, glm::length(axis));
+    }
+    Bounds bounds;
+    bounds.min = center - extent;
+    bounds.max = center + extent;
+    bounds.sphere = glm::vec4(center, boundsRadius * scale);
+    return bounds;
+}
+
+void SceneBvh::update(const Bounds* bounds, size_t count)
+{
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    frame_stats.rebuilt = false;
+    frame_stats.refitObjects = 0;
+
+    if (count != object_bounds.size())
+    {
+        object_bounds.assign(bounds, bounds + count);
+        build();
+    }
+    else
+    {
+        moved_objects.clear();
+        for (size_t i = 0; i < count; i++)
+        {
+            if (memcmp(&object_bounds[i], &bounds[i], sizeof(Bounds)) != 0)
+            {
+                object_bounds[i] = bounds[i];
+                moved_objects.push_back(uint32_t(i));
+            }
+        }
+        frame_stats.refitObjects = moved_objects.size();
+        if (moved_objects.size() * 4 < count)
+        {
+            for (uint32_t object : moved_objects)
+            {
+                if (tree.markRefit(object))
+                    boundLeaf(tree.itemLeaf(object));
+            }
+            tree.refitMarked();
+        }
+        else if (!moved_objects.empty())
+        {
+            for (uint32_t leaf : tree.leaves())
+                boundLeaf(leaf);
+            tree.mergeAll();
+            if (tree.degraded())
+                build();
+        }
+    }
+    frame_stats.objects = count;
+    frame_stats.updateMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void SceneBvh::build()
+{
+    const std::vector<Bounds>& bounds = object_bounds;
+    tree.build(bounds.size(), SCENE_BVH_LEAF_SIZE, 1, [&bounds](uint32_t object) { return glm::vec3(bounds[object].sphere); });
+    for (uint32_t leaf : tree.leaves())
+        boundLeaf(leaf);
+    tree.finishBuild();
+    frame_stats.rebuilt = true;
+    frame_stats.refitObjects = bounds.size();
+}
+
+void SceneBvh::boundLeaf(uint32_t leaf)
+{
+    const BvhTree::Node& node = tree.nodes()[leaf];
+    const std::vector<uint32_t>& slots = tree.slots();
+    glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+    for (uint32_t i = node.first; i < node.first + node.count; i++)
+    {
+        const Bounds& bounds = object_bounds[slots[i]];
+        min = glm::min(min, bounds.min);
+        max = glm::max(max, bounds.max);
+    }
+    tree.setBounds(leaf, min, max);
+}
+
+size_t SceneBvh::cull(const glm::mat4& viewProjection, std::vector<uint32_t>& visible) const
+{
+    glm::vec4 planes[6];
+    BvhTree::frustumPlanes(viewProjection, planes);
+
+    const size_t first = visible.size();
+    if (tree.empty())
+        return 0;
+
+    const std::vector<uint32_t>& slots = tree.slots();
+    size_t visited = tree.cull(planes, 0, BvhTree::ALL_PLANES,
+        [&](const BvhTree::Node& node) {
+            // inside every plane, the whole subtree is visible
+            visible.insert(visible.end(), slots.begin() + node.first, slots.begin() + node.first + node.count);
+        },
+        [&](const BvhTree::Node& leaf, uint32_t leafPlanes) {
+            for (uint32_t i = leaf.first; i < leaf.first + leaf.count; i++)
+            {
+                const Bounds& bounds = object_bounds[slots[i]];
+                // the sphere rejects cheaply, the box is tighter for the rest
+                bool inside = true;
+                for (int plane = 0; plane < 6 && inside; plane++)
+                {
+                    const glm::vec4& p = planes[plane];
+                    if (leafPlanes & (1u << plane))
+                        inside = p.x * bounds.sphere.x + p.y * bounds.sphere.y + p.z * bounds.sphere.z + p.w + bounds.sphere.w >= 0.0f;
+                }
+                uint32_t mask = leafPlanes;
+                if (inside && BvhTree::boxInFrustum(planes, bounds.min, bounds.max, mask))
+                    visible.push_back(slots[i]);
+            }
+        });
+    std::sort(visible.begin() + first, visible.end());
+    return visited;
+}
+
+size_t SceneBvh::cullSphere(const glm::vec4& sphere, std::vector<uint32_t>& visible) const
+{
+    const size_t first = visible.size();
+    size_t visited = 0;
+    if (tree.empty())
+        return visited;
+
+    const std::vector<BvhTree::Node>& nodes = tree.nodes();
+    const std::vector<uint32_t>& slots = tree.slots();
+    const glm::vec3 center(sphere);
+    const float radiusSquared = sphere.w * sphere.w;
+    uint32_t stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const BvhTree::Node& node = nodes[stack[--top]];
+        visited++;
+        if (boxDistanceSquared(node.min, node.max, center) > radiusSquared)
+            continue;
+        if (node.child == 0)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; i++)
+            {
+                const Bounds& bounds = object_bounds[slots[i]];
+                float reach = sphere.w + bounds.sphere.w;
+                glm::vec3 offset = glm::vec3(bounds.sphere) - center;
+                if (glm::dot(offset, offset) <= reach * reach && boxDistanceSquared(bounds.min, bounds.max, center) <= radiusSquared)
+                    visible.push_back(slots[i]);
+            }
+        }
+        else
+        {
+            stack[top++] = node.child + 1;
+            stack[top++] = node.child;
+        }
+    }
+    std::sort(visible.begin() + first, visible.end());
+    return visited;
+}
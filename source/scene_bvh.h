@@ -0,0 +1,75 @@
+#ifndef _SCENE_BVH_H_
+#define _SCENE_BVH_H_
+
+#include <glm/glm.hpp>
+
+#include "bvh_tree.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// most objects in a leaf of the hierarchy
+const size_t SCENE_BVH_LEAF_SIZE = 4;
+
+// Bounding volume hierarchy over the world space bounds of the scene's objects (model instances), used to cull
+// them against the camera frustum, the frusta of the shadow cascades and the spheres of the shadowed point lights.
+// update() takes the bounds of every object each frame: the tree is rebuilt with median splits when objects were
+// added or removed, otherwise the leaves of the objects whose bounds changed are refit, and the tree is rebuilt
+// once refitting has left it much looser than it was built. The cull queries walk the tree, accept whole subtrees
+// inside the volume and test the objects of straddling leaves by their sphere, then by their box. No GL calls.
+class SceneBvh
+{
+public:
+    // world space bounds of an object, box and sphere (xyz center, w radius)
+    struct Bounds {
+        glm::vec3 min;
+        glm::vec3 max;
+        glm::vec4 sphere;
+    };
+
+    // what the last update() did
+    struct Stats {
+        size_t objects;
+        size_t refitObjects;
+        bool rebuilt;
+        double updateMilliseconds;
+    };
+
+    SceneBvh();
+
+    // Bounds of object space box and sphere under a transform
+    static Bounds transformBounds(const glm::vec3& boundsMin, const glm::vec3& boundsMax, float boundsRadius, const glm::mat4& transform);
+
+    // Bring the tree up to date with the bounds of the objects, indexed like the scene's objects
+    void update(const Bounds* bounds, size_t count);
+    // Append the objects touching the frustum of viewProjection, in increasing order. Returns the nodes visited.
+    size_t cull(const glm::mat4& viewProjection, std::vector<uint32_t>& visible) const;
+    // Append the objects whose boxes touch a sphere (xyz center, w radius), in increasing order. Returns the nodes visited.
+    size_t cullSphere(const glm::vec4& sphere, std::vector<uint32_t>& visible) const;
+
+    // bounds the tree holds for an object, and around all of them
+    const Bounds& objectBounds(uint32_t object) const { return object_bounds[object]; }
+    bool empty() const { return object_bounds.empty(); }
+    glm::vec3 boundsMin() const { return tree.nodes().empty() ? glm::vec3(0.0f) : tree.nodes()[0].min; }
+    glm::vec3 boundsMax() const { return tree.nodes().empty() ? glm::vec3(0.0f) : tree.nodes()[0].max; }
+    size_t nodeCount() const { return tree.nodes().size(); }
+    const Stats& stats() const { return frame_stats; }
+
+private:
+    SceneBvh(const SceneBvh&) = delete;
+    SceneBvh& operator=(const SceneBvh&) = delete;
+
+    void build();
+    void boundLeaf(uint32_t leaf);
+
+    // the objects in slots, without padding
+    BvhTree tree;
+    std::vector<Bounds> object_bounds;
+    // scratch of update()
+    std::vector<uint32_t> moved_objects;
+    Stats frame_stats;
+};
+
+
+#endif
@@ -0,0 +1,243 @@
+#include "shadow_cascades.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+namespace {
+
+// light space box of points, z is the depth away from the light
+struct LightBox {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+LightBox lightBox(const glm::mat4& lightView, const glm::vec3* points, int count)
+{
+    LightBox box = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+    for (int i = 0; i < count; i++)
+    {
+        glm::vec4 p = lightView * glm::vec4(points[i], 1.0f);
+        glm::vec3 light(p.x, p.y, -p.z);
+        box.min = glm::min(box.min, light);
+        box.max = glm::max(box.max, light);
+    }
+    return box;
+}
+
+}
+
+ShadowCascades::ShadowCascades(int size, int count)
+    :
+    map_size(size),
+    cascade_count(std::min(std::max(count, 1), SHADOW_MAX_CASCADES)),
+    shadow_distance(30.0f),
+    split_lambda(0.75f),
+    cascades(),
+    depth_axis(0.0f, 0.0f, 1.0f, 0.0f),
+    static_texture(0),
+    static_drawn_version(),
+    static_drawn(),
+    composite_texture(0),
+    static_version(0),
+    dynamic_casters(false),
+    frame_stats()
+{
+}
+
+void ShadowCascades::setCount(int count)
+{
+    cascade_count = std::min(std::max(count, 1), SHADOW_MAX_CASCADES);
+}
+
+void ShadowCascades::setSplits(float shadowDistance, float lambda)
+{
+    shadow_distance = shadowDistance;
+    split_lambda = lambda;
+}
+
+void ShadowCascades::fit(const glm::mat4& view, float fovy, float aspect, float zNear, const glm::vec3& lightDirection,
+    const glm::vec3& sceneMin, const glm::vec3& sceneMax)
+{
+    // view depth of a world position, for the shader to pick the cascade with
+    depth_axis = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+
+    const glm::vec3 sceneCorners[8] = {
+        glm::vec3(sceneMin.x, sceneMin.y, sceneMin.z), glm::vec3(sceneMax.x, sceneMin.y, sceneMin.z),
+        glm::vec3(sceneMin.x, sceneMax.y, sceneMin.z), glm::vec3(sceneMax.x, sceneMax.y, sceneMin.z),
+        glm::vec3(sceneMin.x, sceneMin.y, sceneMax.z), glm::vec3(sceneMax.x, sceneMin.y, sceneMax.z),
+        glm::vec3(sceneMin.x, sceneMax.y, sceneMax.z), glm::vec3(sceneMax.x, sceneMax.y, sceneMax.z)
+    };
+
+    // no point in splitting the view depth where there is nothing to receive a shadow
+    float receiversNear = FLT_MAX, receiversFar = -FLT_MAX;
+    for (const glm::vec3& corner : sceneCorners)
+    {
+        float depth = glm::dot(glm::vec3(depth_axis), corner) + depth_axis.w;
+        receiversNear = std::min(receiversNear, depth);
+        receiversFar = std::max(receiversFar, depth);
+    }
+    float nearDepth = std::max(receiversNear, zNear);
+    float farDepth = std::min(receiversFar, shadow_distance);
+    if (farDepth <= nearDepth)
+    {
+        // the scene is behind the camera or beyond the shadow distance, the shader finds no cascade
+        for (int i = 0; i < cascade_count; i++)
+            cascades[i].splitNear = cascades[i].splitFar = 0.0f;
+        return;
+    }
+
+    const glm::vec3 up = std::abs(lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    const glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), lightDirection, up);
+    const glm::mat4 inverseView = glm::inverse(view);
+    const LightBox scene = lightBox(lightView, sceneCorners, 8);
+    const float tanY = std::tan(0.5f * fovy);
+    const float tanX = tanY * aspect;
+
+    float splitNear = nearDepth;
+    for (int i = 0; i < cascade_count; i++)
+    {
+        // practical split scheme
+        float fraction = float(i + 1) / float(cascade_count);
+        float logarithmic = nearDepth * std::pow(farDepth / nearDepth, fraction);
+        float uniform = nearDepth + (farDepth - nearDepth) * fraction;
+        float splitFar = i + 1 == cascade_count ? farDepth : split_lambda * logarithmic + (1.0f - split_lambda) * uniform;
+
+        glm::vec3 corners[8];
+        for (int c = 0; c < 8; c++)
+        {
+            float depth = c < 4 ? splitNear : splitFar;
+            glm::vec4 corner(((c & 1) ? 1.0f : -1.0f) * depth * tanX, ((c & 2) ? 1.0f : -1.0f) * depth * tanY, -depth, 1.0f);
+            corners[c] = glm::vec3(inverseView * corner);
+        }
+        LightBox slice = lightBox(lightView, corners, 8);
+
+        // the window covers the slice where it overlaps the receivers
+        glm::vec2 windowMin(std::max(slice.min.x, scene.min.x), std::max(slice.min.y, scene.min.y));
+        glm::vec2 windowMax(std::min(slice.max.x, scene.max.x), std::min(slice.max.y, scene.max.y));
+        windowMax = glm::max(windowMax, windowMin);
+
+        // square window with two texels to spare for the snapping, grown to the next size step
+        float extent = std::max(std::max(windowMax.x - windowMin.x, windowMax.y - windowMin.y), 1e-3f) * (1.0f + 2.0f / float(map_size));
+        extent = std::exp2(std::ceil(std::log2(extent) * SHADOW_EXTENT_STEPS_PER_OCTAVE) / SHADOW_EXTENT_STEPS_PER_OCTAVE);
+        float texel = extent / float(map_size);
+        glm::vec2 center = (windowMin + windowMax) * 0.5f;
+        float left = std::floor((center.x - 0.5f * extent) / texel) * texel;
+        float bottom = std::floor((center.y - 0.5f * extent) / texel) * texel;
+
+        // casters between the light and the window are anywhere in the scene's depth range
+        float depthNear = scene.min.z - texel;
+        float depthFar = std::min(slice.max.z, scene.max.z) + texel;
+
+        Cascade& cascade = cascades[i];
+        cascade.viewProjection = glm::ortho(left, left + extent, bottom, bottom + extent, depthNear, depthFar) * lightView;
+        cascade.splitNear = splitNear;
+        cascade.splitFar = splitFar;
+        cascade.extent = extent;
+        cascade.depthRange = depthFar - depthNear;
+        splitNear = splitFar;
+    }
+}
+
+RenderTextureDesc ShadowCascades::desc() const
+{
+    return RenderTextureDesc{ map_size, map_size, GL_DEPTH_COMPONENT24, GL_NEAREST, GL_CLAMP_TO_BORDER, SHADOW_MAX_CASCADES };
+}
+
+GLuint ShadowCascades::arrayTexture(GLuint& texture) const
+{
+    if (texture)
+        return texture;
+
+    GLenum format, type, attachment;
+    FrameBuffer::describeFormat(GL_DEPTH_COMPONENT24, format, type, attachment);
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, map_size, map_size, SHADOW_MAX_CASCADES, 0, format, type, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    // outside its window a cascade is unshadowed
+    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    return texture;
+}
+
+FrameBuffer* ShadowCascades::layerFramebuffer(std::unique_ptr<FrameBuffer>& framebuffer, GLuint& texture, int layer) const
+{
+    if (!framebuffer)
+    {
+        framebuffer.reset(new FrameBuffer(map_size, map_size));
+        framebuffer->attachSharedLayer(arrayTexture(texture), GL_DEPTH_COMPONENT24, layer);
+        framebuffer->check();
+    }
+    return framebuffer.get();
+}
+
+void ShadowCascades::setCasters(uint64_t staticVersion, bool dynamicCasters)
+{
+    static_version = staticVersion;
+    dynamic_casters = dynamicCasters;
+    frame_stats = Stats();
+}
+
+RenderGraph::Resource ShadowCascades::import(RenderGraph& graph)
+{
+    GLuint texture = dynamic_casters ? arrayTexture(composite_texture) : arrayTexture(static_texture);
+    return graph.importTexture("shadow cascades", texture, desc());
+}
+
+bool ShadowCascades::bindStatic(int cascade)
+{
+    const glm::mat4& viewProjection = cascades[cascade].viewProjection;
+    if (static_drawn[cascade] && static_drawn_version[cascade] == static_version &&
+        std::memcmp(&static_view_projection[cascade], &viewProjection, sizeof(glm::mat4)) == 0)
+    {
+        frame_stats.staticCached++;
+        return false;
+    }
+    static_view_projection[cascade] = viewProjection;
+    static_drawn_version[cascade] = static_version;
+    static_drawn[cascade] = true;
+    frame_stats.staticDrawn++;
+
+    layerFramebuffer(static_framebuffers[cascade], static_texture, cascade)->bindOutput();
+    glViewport(0, 0, map_size, map_size);
+    return true;
+}
+
+bool ShadowCascades::bindDynamic(int cascade)
+{
+    if (!dynamic_casters)
+        return false;
+    frame_stats.composited++;
+
+    // the depth of the static casters is where the dynamic ones start from
+    layerFramebuffer(static_framebuffers[cascade], static_texture, cascade)->bindRead();
+    layerFramebuffer(composite_framebuffers[cascade], composite_texture, cascade)->bindOutput();
+    glBlitFramebuffer(0, 0, map_size, map_size, 0, 0, map_size, map_size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glViewport(0, 0, map_size, map_size);
+    return true;
+}
+
+void ShadowCascades::setUniforms(Shader& shader) const
+{
+    float splits[SHADOW_MAX_CASCADES] = {};
+    float depthRanges[SHADOW_MAX_CASCADES] = {};
+    for (int i = 0; i < cascade_count; i++)
+    {
+        shader.setUniformMat4("lightSpaceMatrices[" + std::to_string(i) + "]", cascades[i].viewProjection);
+        splits[i] = cascades[i].splitFar;
+        depthRanges[i] = cascades[i].depthRange;
+    }
+    shader.setUniformInt("cascadeCount", cascade_count);
+    shader.setUniformVec4fv("cascadeSplits", splits);
+    shader.setUniformVec4fv("cascadeDepthRanges", depthRanges);
+    shader.setUniformVec4fv("viewDepthAxis", &depth_axis[0]);
+}
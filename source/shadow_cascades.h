@@ -0,0 +1,111 @@
+#ifndef _SHADOW_CASCADES_H_
+#define _SHADOW_CASCADES_H_
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+
+#include "framebuffer.h"
+#include "render_graph.h"
+#include "shader_s.h"
+
+#include <cstdint>
+#include <memory>
+
+// most cascades, the layers of the shadow map array and the size of the shader's arrays
+const int SHADOW_MAX_CASCADES = 4;
+// texels per side of every cascade
+const int SHADOW_CASCADE_SIZE = 1024;
+// the window of a cascade only takes sizes 2^(n / steps), so it keeps its texel size while the camera moves a little
+const float SHADOW_EXTENT_STEPS_PER_OCTAVE = 4.0f;
+
+// Cascaded shadow maps of a directional light. The view frustum up to the shadow distance is split into slices
+// (practical split scheme, blending logarithmic and uniform splits by lambda) and every slice gets one layer of a
+// depth texture array. fit() clamps the slices to the depth range of the receivers, and fits every cascade's
+// orthographic window around the part of its slice inside the receivers' box, then snaps the window to whole
+// texels and its size to a few steps per octave so the shadow edges don't crawl. The lighting picks the cascade
+// from the view depth and samples only that layer (deferredShading.glsl).
+// The static casters are cached: a cascade's static layer is only drawn again when its matrix (the light, the camera
+// or the fit moved it) or the version of the static casters changed. With dynamic casters around, every cascade is
+// the static layer blitted into a second array with the dynamic casters drawn on top, and the lighting samples that.
+class ShadowCascades
+{
+public:
+    struct Cascade {
+        glm::mat4 viewProjection;     // world to the cascade's clip space
+        float splitNear;              // view depth range of the slice
+        float splitFar;
+        float extent;                 // world size of the square window
+        float depthRange;             // world size of the depth range
+    };
+
+    // what the shadow pass of the frame drew
+    struct Stats {
+        int staticDrawn;              // cascades whose static layer was out of date
+        int staticCached;             // cascades reusing their static layer
+        int composited;               // cascades with the dynamic casters drawn on top
+    };
+
+    explicit ShadowCascades(int size = SHADOW_CASCADE_SIZE, int count = SHADOW_MAX_CASCADES);
+    // GL objects are left to the context teardown
+
+    // Number of cascades used, up to SHADOW_MAX_CASCADES
+    void setCount(int count);
+    // Slices end at the shadow distance, lambda 0 splits uniformly and 1 logarithmically
+    void setSplits(float shadowDistance, float lambda);
+    // Fit the cascades to a camera and the bounding box of the scene, which receives and casts the shadows.
+    // No GL calls.
+    void fit(const glm::mat4& view, float fovy, float aspect, float zNear, const glm::vec3& lightDirection,
+        const glm::vec3& sceneMin, const glm::vec3& sceneMax);
+
+    // Casters of the frame, after fit() and before import(): the version of the static ones (ShadowCasterTracker)
+    // and whether there are dynamic ones to draw
+    void setCasters(uint64_t staticVersion, bool dynamicCasters);
+    // The texture array the lighting samples as a render graph resource
+    RenderGraph::Resource import(RenderGraph& graph);
+    // When the static layer of a cascade is out of date, bind it and set the viewport, and return true for the
+    // static casters to be drawn into it (cleared). False when the cached layer is still good. GL thread only.
+    bool bindStatic(int cascade);
+    // With dynamic casters, copy the static layer of a cascade into the one the lighting samples, bind that and
+    // set the viewport, and return true for the dynamic casters to be drawn on top. GL thread only.
+    bool bindDynamic(int cascade);
+    // Set the cascade uniforms of the lighting shader in use
+    void setUniforms(Shader& shader) const;
+
+    int count() const { return cascade_count; }
+    int size() const { return map_size; }
+    const Cascade& cascade(int index) const { return cascades[index]; }
+    const Stats& stats() const { return frame_stats; }
+
+private:
+    ShadowCascades(const ShadowCascades&) = delete;
+    ShadowCascades& operator=(const ShadowCascades&) = delete;
+
+    RenderTextureDesc desc() const;
+    // create the depth array on first use
+    GLuint arrayTexture(GLuint& texture) const;
+    // FrameBuffer of a layer, created on first use
+    FrameBuffer* layerFramebuffer(std::unique_ptr<FrameBuffer>& framebuffer, GLuint& texture, int layer) const;
+
+    int map_size;
+    int cascade_count;
+    float shadow_distance;
+    float split_lambda;
+    Cascade cascades[SHADOW_MAX_CASCADES];
+    glm::vec4 depth_axis;         // view depth = dot(xyz, position) + w
+    // static casters, and what each layer was drawn with
+    GLuint static_texture;
+    std::unique_ptr<FrameBuffer> static_framebuffers[SHADOW_MAX_CASCADES];
+    glm::mat4 static_view_projection[SHADOW_MAX_CASCADES];
+    uint64_t static_drawn_version[SHADOW_MAX_CASCADES];
+    bool static_drawn[SHADOW_MAX_CASCADES];
+    // static and dynamic casters, only created once something moves
+    GLuint composite_texture;
+    std::unique_ptr<FrameBuffer> composite_framebuffers[SHADOW_MAX_CASCADES];
+    uint64_t static_version;
+    bool dynamic_casters;
+    Stats frame_stats;
+};
+
+
+#endif
@@ -0,0 +1,75 @@
+#include "shadow_caster_tracker.h"
+
+#include <cstring>
+
+ShadowCasterTracker::ShadowCasterTracker()
+    :
+    frame(0),
+    static_version(0),
+    dynamic_count(0)
+{
+}
+
+void ShadowCasterTracker::begin()
+{
+    frame++;
+    dynamic_count = 0;
+}
+
+bool ShadowCasterTracker::add(uint64_t id, const glm::mat4& transform, uint64_t signature)
+{
+    std::unordered_map<uint64_t, Caster>::iterator found = casters.find(id);
+    if (found == casters.end())
+    {
+        // new casters join the static ones, a scene being loaded isn't moving
+        casters[id] = Caster{ transform, signature, frame - SHADOW_DYNAMIC_FRAMES, frame, false };
+        static_version++;
+        return false;
+    }
+
+    Caster& caster = found->second;
+    caster.seenFrame = frame;
+    if (caster.signature != signature || std::memcmp(&caster.transform, &transform, sizeof(glm::mat4)) != 0)
+    {
+        caster.transform = transform;
+        caster.signature = signature;
+        caster.changedFrame = frame;
+    }
+    // starting or settling moves it between the static and the dynamic casters
+    bool dynamic = frame - caster.changedFrame < SHADOW_DYNAMIC_FRAMES;
+    if (dynamic != caster.dynamic)
+    {
+        caster.dynamic = dynamic;
+        static_version++;
+    }
+    if (dynamic)
+        dynamic_count++;
+    return dynamic;
+}
+
+void ShadowCasterTracker::end()
+{
+    for (std::unordered_map<uint64_t, Caster>::iterator it = casters.begin(); it != casters.end(); )
+    {
+        if (it->second.seenFrame == frame)
+        {
+            ++it;
+            continue;
+        }
+        if (!it->second.dynamic)
+            static_version++;
+        it = casters.erase(it);
+    }
+}
+
+uint64_t ShadowCasterTracker::hash(const void* data, size_t bytes, uint64_t seed)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t h = seed;
+    for (size_t i = 0; i < bytes; i++)
+    {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
@@ -0,0 +1,54 @@
+#ifndef _SHADOW_CASTER_TRACKER_H_
+#define _SHADOW_CASTER_TRACKER_H_
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+// frames a caster stays dynamic after it last changed, so something being dragged around doesn't move between
+// the static and the dynamic casters every other frame
+const unsigned int SHADOW_DYNAMIC_FRAMES = 8;
+
+// Change tracking of the shadow casters. Every frame the casters are added with an id, their transform and a
+// signature of what they draw (e.g. the meshes streamed in so far). A caster that changed within the last
+// SHADOW_DYNAMIC_FRAMES frames is dynamic, the others are static. staticVersion() changes whenever the static
+// casters do: one of them changes or goes away, or a caster starts or stops being dynamic. The light and the
+// fit of the shadow maps aren't tracked here, ShadowCascades compares the cascade matrices for them.
+class ShadowCasterTracker
+{
+public:
+    ShadowCasterTracker();
+
+    // Start the casters of a new frame
+    void begin();
+    // Add a caster of this frame, returns whether it is dynamic
+    bool add(uint64_t id, const glm::mat4& transform, uint64_t signature);
+    // Finish the frame, casters that weren't added are gone
+    void end();
+
+    uint64_t staticVersion() const { return static_version; }
+    size_t dynamicCount() const { return dynamic_count; }
+    size_t casterCount() const { return casters.size(); }
+
+    // FNV-1a of a range of bytes, for building signatures
+    static uint64_t hash(const void* data, size_t bytes, uint64_t seed = 14695981039346656037ull);
+
+private:
+    struct Caster {
+        glm::mat4 transform;
+        uint64_t signature;
+        unsigned int changedFrame;
+        unsigned int seenFrame;
+        bool dynamic;
+    };
+
+    std::unordered_map<uint64_t, Caster> casters;
+    unsigned int frame;
+    uint64_t static_version;
+    size_t dynamic_count;
+};
+
+
+#endif
@@ -0,0 +1,277 @@
+#include "texture_cache.h"
+#include "mapped_file.h"
+
+#include "stb/stb_image.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+
+// S3TC formats come from GL_EXT_texture_compression_s3tc and GL_EXT_texture_sRGB, not every loader defines them
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::endl;
+
+namespace {
+
+const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+const uint32_t KTX_ENDIANNESS = 0x04030201;
+const uint32_t KTX_MAX_LEVELS = 32;
+
+// KTX 1.1 file header, followed by the key/value data and then imageSize + pixels for every level
+struct KtxHeader {
+    unsigned char identifier[12];
+    uint32_t endianness;
+    uint32_t glType;                  // 0 for compressed formats
+    uint32_t glTypeSize;
+    uint32_t glFormat;                // 0 for compressed formats
+    uint32_t glInternalFormat;
+    uint32_t glBaseInternalFormat;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t numberOfArrayElements;
+    uint32_t numberOfFaces;
+    uint32_t numberOfMipmapLevels;
+    uint32_t bytesOfKeyValueData;
+};
+
+string& cacheDirectory()
+{
+    static string directory = "OpenGL/texcache";
+    return directory;
+}
+
+GLenum baseInternalFormat(BlockFormat format)
+{
+    switch (format)
+    {
+    case BlockFormat::BC1: return GL_RGB;
+    case BlockFormat::BC3: return GL_RGBA;
+    default: return GL_RED;
+    }
+}
+
+bool blockFormatFromInternal(uint32_t internalFormat, BlockFormat& format)
+{
+    switch (internalFormat)
+    {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: format = BlockFormat::BC1; return true;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: format = BlockFormat::BC3; return true;
+    case GL_COMPRESSED_RED_RGTC1: format = BlockFormat::BC4; return true;
+    default: return false;
+    }
+}
+
+}
+
+void TextureCache::setDirectory(const string& directory)
+{
+    cacheDirectory() = directory;
+}
+
+string TextureCache::directory()
+{
+    return cacheDirectory();
+}
+
+uint64_t TextureCache::contentHash(const unsigned char* data, size_t size)
+{
+    // FNV-1a over 64 bit words, seeded with the cache version and finished with a 64 bit mix
+    const uint64_t prime = 1099511628211ull;
+    uint64_t hash = 14695981039346656037ull ^ (uint64_t(TEXTURE_CACHE_VERSION) * 0x9E3779B97F4A7C15ull);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ data[i]) * prime;
+    hash ^= uint64_t(size);
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+string TextureCache::cachePath(uint64_t hash)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.ktx", (unsigned long long)hash);
+    return cacheDirectory() + "/" + name;
+}
+
+GLenum TextureCache::internalFormat(BlockFormat format, bool srgb)
+{
+    switch (format)
+    {
+    case BlockFormat::BC1: return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case BlockFormat::BC3: return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    // there's no sRGB RGTC, single channel textures were never gamma corrected
+    default: return GL_COMPRESSED_RED_RGTC1;
+    }
+}
+
+bool TextureCache::compress(const unsigned char* fileData, size_t fileSize, CompressedTexture& texture)
+{
+    // expand to RGBA like the uncompressed path, the block encoders read 4 bytes per texel
+    int width, height, components;
+    unsigned char* decoded = stbi_load_from_memory(fileData, int(fileSize), &width, &height, &components, 4);
+    if (!decoded)
+        return false;
+    vector<unsigned char> pixels(decoded, decoded + size_t(width) * height * 4);
+    stbi_image_free(decoded);
+
+    vector<MipLevel> mips;
+    buildMipChain(pixels, width, height, mips);
+    texture.format = chooseBlockFormat(pixels.data(), width, height, components);
+
+    size_t total = 0;
+    texture.levels.clear();
+    for (const MipLevel& mip : mips)
+    {
+        size_t size = compressedSize(texture.format, mip.width, mip.height);
+        texture.levels.push_back(MipLevel{ mip.width, mip.height, total, size });
+        total += size;
+    }
+    texture.data.resize(total);
+    for (size_t level = 0; level < mips.size(); level++)
+    {
+        compressImage(&pixels[mips[level].offset], mips[level].width, mips[level].height, texture.format,
+            &texture.data[texture.levels[level].offset]);
+    }
+    return true;
+}
+
+bool TextureCache::read(const string& path, CompressedTexture& texture)
+{
+    MappedFile file;
+    if (!file.open(path) || file.size() < sizeof(KtxHeader))
+        return false;
+
+    KtxHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0 || header.endianness != KTX_ENDIANNESS ||
+        header.glType != 0 || header.glFormat != 0 || header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth != 0 ||
+        header.numberOfArrayElements != 0 || header.numberOfFaces != 1 || header.numberOfMipmapLevels == 0 ||
+        header.numberOfMipmapLevels > KTX_MAX_LEVELS || !blockFormatFromInternal(header.glInternalFormat, texture.format))
+    {
+        cout << "TextureCache::read - unsupported or corrupt file " << path << endl;
+        return false;
+    }
+
+    size_t offset = sizeof(KtxHeader) + size_t(header.bytesOfKeyValueData);
+    int width = int(header.pixelWidth), height = int(header.pixelHeight);
+    texture.levels.clear();
+    size_t total = 0;
+    vector<size_t> fileOffsets;
+    for (uint32_t level = 0; level < header.numberOfMipmapLevels; level++)
+    {
+        uint32_t imageSize;
+        if (offset + sizeof(imageSize) > file.size())
+            break;
+        memcpy(&imageSize, file.data() + offset, sizeof(imageSize));
+        offset += sizeof(imageSize);
+        if (imageSize != compressedSize(texture.format, width, height) || offset + imageSize > file.size())
+            break;
+        fileOffsets.push_back(offset);
+        texture.levels.push_back(MipLevel{ width, height, total, imageSize });
+        total += imageSize;
+        // levels are padded to 4 bytes
+        offset += (size_t(imageSize) + 3) & ~size_t(3);
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+    }
+    if (texture.levels.size() != header.numberOfMipmapLevels)
+    {
+        cout << "TextureCache::read - truncated file " << path << endl;
+        return false;
+    }
+
+    texture.data.resize(total);
+    for (size_t level = 0; level < texture.levels.size(); level++)
+        memcpy(&texture.data[texture.levels[level].offset], file.data() + fileOffsets[level], texture.levels[level].size);
+    return true;
+}
+
+bool TextureCache::write(const string& path, const CompressedTexture& texture)
+{
+    if (texture.levels.empty())
+        return false;
+
+    KtxHeader header = {};
+    memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+    header.endianness = KTX_ENDIANNESS;
+    header.glTypeSize = 1;
+    header.glInternalFormat = internalFormat(texture.format, false);
+    header.glBaseInternalFormat = baseInternalFormat(texture.format);
+    header.pixelWidth = uint32_t(texture.levels[0].width);
+    header.pixelHeight = uint32_t(texture.levels[0].height);
+    header.numberOfFaces = 1;
+    header.numberOfMipmapLevels = uint32_t(texture.levels.size());
+
+    std::error_code error;
+    fs::create_directories(fs::path(path).parent_path(), error);
+
+    // write to a temporary file first so a crash never leaves a truncated file behind. The same image
+    // can be compressed by two threads at once (e.g. loaded with and without gamma), each gets its own file.
+    string tempPath = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            cout << "TextureCache::write - unable to create " << tempPath << endl;
+            return false;
+        }
+
+        static const char zeros[4] = {};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const MipLevel& level : texture.levels)
+        {
+            uint32_t imageSize = uint32_t(level.size);
+            out.write(reinterpret_cast<const char*>(&imageSize), sizeof(imageSize));
+            out.write(reinterpret_cast<const char*>(&texture.data[level.offset]), level.size);
+            out.write(zeros, std::streamsize(((level.size + 3) & ~size_t(3)) - level.size));
+        }
+
+        if (!out)
+        {
+            cout << "TextureCache::write - failed writing " << tempPath << endl;
+            out.close();
+            std::remove(tempPath.c_str());
+            return false;
+        }
+    }
+
+    fs::rename(tempPath, path, error);
+    if (error)
+    {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,49 @@
+#ifndef _TEXTURE_CACHE_H_
+#define _TEXTURE_CACHE_H_
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include "block_compression.h"
+#include "texture_loader.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Bump whenever the block encoders or the mip filter change, old cache files are then never looked up again
+const uint32_t TEXTURE_CACHE_VERSION = 1;
+
+// block compressed mip chain, levels index into data
+struct CompressedTexture {
+    BlockFormat format;
+    std::vector<MipLevel> levels;
+    std::vector<unsigned char> data;
+};
+
+// On-disk cache of block compressed textures as KTX 1.1 files. Files are named after a hash of the
+// source image's bytes, so the same image under different paths is compressed once and an edited image
+// gets a new entry. Images are cached the way stb_image decodes them, the vertical flip set with
+// stbi_set_flip_vertically_on_load() has to be the same for every run sharing a cache directory.
+class TextureCache
+{
+public:
+    // Directory holding the cache files, "OpenGL/texcache" by default. Created on the first write.
+    static void setDirectory(const std::string& directory);
+    static std::string directory();
+    // Hash of an image file's contents
+    static uint64_t contentHash(const unsigned char* data, size_t size);
+    // Location of the cache file for a content hash
+    static std::string cachePath(uint64_t hash);
+    // Decode an image file held in memory, build its mip chain and compress every level
+    static bool compress(const unsigned char* fileData, size_t fileSize, CompressedTexture& texture);
+    // Load a cache file, returns false when it is missing or malformed
+    static bool read(const std::string& path, CompressedTexture& texture);
+    // Store a compressed texture
+    static bool write(const std::string& path, const CompressedTexture& texture);
+    // GL internal format of a block format, srgb selects the sRGB variant where there is one
+    static GLenum internalFormat(BlockFormat format, bool srgb);
+};
+
+
+#endif
@@ -0,0 +1,345 @@
+#include "texture_loader.h"
+#include "texture_cache.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_LOADER_SSE2
+#include <emmintrin.h>
+#endif
+
+using std::string;
+using std::vector;
+using std::shared_ptr;
+using std::cout;
+using std::endl;
+
+namespace {
+
+// averages 2x2 blocks of an RGBA8 image, odd edges reuse the last row/column
+void downsample(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight)
+{
+    for (int y = 0; y < dstHeight; y++)
+    {
+        const unsigned char* row0 = src + size_t(std::min(2 * y, srcHeight - 1)) * srcWidth * 4;
+        const unsigned char* row1 = src + size_t(std::min(2 * y + 1, srcHeight - 1)) * srcWidth * 4;
+        unsigned char* out = dst + size_t(y) * dstWidth * 4;
+
+        int x = 0;
+#ifdef TEXTURE_LOADER_SSE2
+        // two output pixels per iteration from 4 source pixels of both rows
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i rounding = _mm_set1_epi16(2);
+        for (; x + 2 <= dstWidth && 2 * x + 4 <= srcWidth; x += 2)
+        {
+            __m128i top = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8));
+            __m128i bottom = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8));
+            // vertical sums as 16 bit lanes: left holds pixels 0,1 and right pixels 2,3
+            __m128i left = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+            __m128i right = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+            // horizontal sums: pixel 0 + 1 and pixel 2 + 3 end up in the low half
+            left = _mm_add_epi16(left, _mm_srli_si128(left, 8));
+            right = _mm_add_epi16(right, _mm_srli_si128(right, 8));
+            __m128i sum = _mm_unpacklo_epi64(left, right);
+            sum = _mm_srli_epi16(_mm_add_epi16(sum, rounding), 2);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * 4), _mm_packus_epi16(sum, sum));
+        }
+#endif
+        for (; x < dstWidth; x++)
+        {
+            const int x0 = std::min(2 * x, srcWidth - 1) * 4;
+            const int x1 = std::min(2 * x + 1, srcWidth - 1) * 4;
+            for (int c = 0; c < 4; c++)
+            {
+                out[x * 4 + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+            }
+        }
+    }
+}
+
+}
+
+void buildMipChain(vector<unsigned char>& pixels, int width, int height, vector<MipLevel>& levels)
+{
+    levels.clear();
+    levels.push_back(MipLevel{ width, height, 0, size_t(width) * height * 4 });
+
+    // reserve the whole chain up front so the level pointers stay valid
+    size_t total = size_t(width) * height * 4;
+    for (int w = width, h = height; w > 1 || h > 1; )
+    {
+        w = std::max(w / 2, 1);
+        h = std::max(h / 2, 1);
+        total += size_t(w) * h * 4;
+    }
+    pixels.resize(total);
+
+    size_t offset = size_t(width) * height * 4;
+    while (width > 1 || height > 1)
+    {
+        const MipLevel& source = levels.back();
+        int levelWidth = std::max(width / 2, 1);
+        int levelHeight = std::max(height / 2, 1);
+        downsample(&pixels[source.offset], source.width, source.height, &pixels[offset], levelWidth, levelHeight);
+        levels.push_back(MipLevel{ levelWidth, levelHeight, offset, size_t(levelWidth) * levelHeight * 4 });
+        offset += size_t(levelWidth) * levelHeight * 4;
+        width = levelWidth;
+        height = levelHeight;
+    }
+}
+
+TextureLoader::TextureLoader(ThreadPool& pool_)
+    :
+    pool(pool_),
+    pending_count(0),
+    decoding_count(0),
+    pbo_id(0),
+    s3tc_supported(false),
+    srgb_s3tc_supported(false),
+    uploaded_bytes(0),
+    uncompressed_bytes(0)
+{
+    glGenBuffers(1, &pbo_id);
+
+    // S3TC isn't core, RGTC (BC4) is
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i = 0; i < extensionCount; i++)
+    {
+        const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, GLuint(i)));
+        if (!name)
+            continue;
+        if (strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+            s3tc_supported = true;
+        else if (strcmp(name, "GL_EXT_texture_sRGB") == 0 || strcmp(name, "GL_EXT_texture_compression_s3tc_srgb") == 0)
+            srgb_s3tc_supported = true;
+    }
+    if (!s3tc_supported)
+        cout << "TextureLoader - no S3TC support, BC1/BC3 textures are decoded in software" << endl;
+}
+
+TextureLoader::~TextureLoader()
+{
+    std::unique_lock<std::mutex> lock(ready_mutex);
+    ready_condition.wait(lock, [this] { return decoding_count == 0; });
+}
+
+TextureLoader& TextureLoader::shared()
+{
+    static TextureLoader loader;
+    return loader;
+}
+
+GLuint TextureLoader::load(const string& path, bool gamma, bool clampTransparent)
+{
+    const string key = path + (gamma ? "|srgb" : "|linear");
+    auto found = loaded.find(key);
+    if (found != loaded.end())
+    {
+        return found->second;
+    }
+
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+
+    // neutral placeholder texel until the image is ready
+    const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    loaded[key] = textureID;
+
+    shared_ptr<Request> request = std::make_shared<Request>();
+    request->id = textureID;
+    request->path = path;
+    request->gamma = gamma;
+    request->clampTransparent = clampTransparent;
+    request->components = 0;
+    request->compressed = false;
+    request->fromCache = false;
+    request->format = BlockFormat::BC1;
+    request->failed = false;
+
+    pending_count++;
+    decoding_count++;
+    pool.submit([this, request] { decode(request); });
+    return textureID;
+}
+
+bool TextureLoader::canUpload(BlockFormat format, bool gamma) const
+{
+    if (format == BlockFormat::BC4)
+        return true;
+    return s3tc_supported && (!gamma || srgb_s3tc_supported);
+}
+
+void TextureLoader::decode(shared_ptr<Request> request)
+{
+    // the cache is keyed by the file's contents, so the file has to be read either way
+    MappedFile file(request->path);
+    CompressedTexture texture;
+    if (file.isOpen())
+    {
+        const string cachePath = TextureCache::cachePath(TextureCache::contentHash(file.data(), file.size()));
+        if (TextureCache::read(cachePath, texture))
+        {
+            request->fromCache = true;
+        }
+        else if (TextureCache::compress(file.data(), file.size(), texture))
+        {
+            if (!TextureCache::write(cachePath, texture))
+                cout << "TextureLoader - unable to cache " << request->path << endl;
+        }
+        else
+        {
+            request->failed = true;
+        }
+    }
+    else
+    {
+        request->failed = true;
+    }
+
+    if (!request->failed)
+    {
+        request->format = texture.format;
+        request->components = texture.format == BlockFormat::BC4 ? 1 : (texture.format == BlockFormat::BC1 ? 3 : 4);
+        if (canUpload(texture.format, request->gamma))
+        {
+            request->compressed = true;
+            request->levels = std::move(texture.levels);
+            request->pixels = std::move(texture.data);
+        }
+        else
+        {
+            // software fallback, decode every level back to RGBA8
+            size_t total = 0;
+            for (const MipLevel& level : texture.levels)
+            {
+                request->levels.push_back(MipLevel{ level.width, level.height, total, size_t(level.width) * level.height * 4 });
+                total += request->levels.back().size;
+            }
+            request->pixels.resize(total);
+            for (size_t level = 0; level < texture.levels.size(); level++)
+            {
+                const MipLevel& mip = request->levels[level];
+                decompressImage(&texture.data[texture.levels[level].offset], mip.width, mip.height, texture.format, &request->pixels[mip.offset]);
+            }
+        }
+    }
+
+    // notify while holding the lock, the loader may be destroyed as soon as decoding_count drops
+    std::lock_guard<std::mutex> lock(ready_mutex);
+    ready.push_back(request);
+    decoding_count--;
+    ready_condition.notify_all();
+}
+
+void TextureLoader::update(size_t uploadBudget)
+{
+    size_t uploaded = 0;
+    while (uploaded == 0 || uploaded < uploadBudget)
+    {
+        shared_ptr<Request> request;
+        {
+            std::lock_guard<std::mutex> lock(ready_mutex);
+            if (ready.empty())
+                break;
+            request = ready.front();
+            ready.pop_front();
+        }
+
+        if (request->failed)
+        {
+            std::cout << "Texture failed to load at path: " << request->path << std::endl;
+        }
+        else
+        {
+            uploaded += request->pixels.size();
+            upload(*request);
+        }
+        pending_count--;
+    }
+}
+
+void TextureLoader::finish()
+{
+    while (pending_count > 0)
+    {
+        {
+            std::unique_lock<std::mutex> lock(ready_mutex);
+            ready_condition.wait(lock, [this] { return !ready.empty(); });
+        }
+        update(~size_t(0));
+    }
+}
+
+void TextureLoader::upload(Request& request)
+{
+    GLenum internalFormat;
+    if (request.compressed)
+        internalFormat = TextureCache::internalFormat(request.format, request.gamma);
+    else if (request.components == 1)
+        internalFormat = GL_RED;
+    else if (request.components == 3)
+        internalFormat = request.gamma ? GL_SRGB : GL_RGB;
+    else
+        internalFormat = request.gamma ? GL_SRGB_ALPHA : GL_RGBA;
+
+    // stream the whole chain through the PBO, orphaning the previous contents so we never wait on the GPU
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_id);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, request.pixels.size(), NULL, GL_STREAM_DRAW);
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, request.pixels.size(), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    // with a PBO bound the data pointers are offsets into the buffer, fall back to client memory if mapping failed
+    uintptr_t base = 0;
+    if (mapped)
+    {
+        memcpy(mapped, request.pixels.data(), request.pixels.size());
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    else
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        base = reinterpret_cast<uintptr_t>(request.pixels.data());
+    }
+
+    glBindTexture(GL_TEXTURE_2D, request.id);
+    size_t uncompressed = 0;
+    for (size_t level = 0; level < request.levels.size(); level++)
+    {
+        const MipLevel& mip = request.levels[level];
+        if (request.compressed)
+        {
+            glCompressedTexImage2D(GL_TEXTURE_2D, GLint(level), internalFormat, mip.width, mip.height, 0, GLsizei(mip.size),
+                reinterpret_cast<const void*>(base + mip.offset));
+        }
+        else
+        {
+            glTexImage2D(GL_TEXTURE_2D, GLint(level), internalFormat, mip.width, mip.height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                reinterpret_cast<const void*>(base + mip.offset));
+        }
+        uncompressed += size_t(mip.width) * mip.height * 4;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    uploaded_bytes += request.pixels.size();
+    uncompressed_bytes += uncompressed;
+
+    GLint wrap = (request.clampTransparent && request.components == 4 && !request.gamma) ? GL_CLAMP_TO_EDGE : GL_REPEAT; // use GL_CLAMP_TO_EDGE to prevent semi-transparent borders. Due to interpolation it takes texels from next repeat
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(request.levels.size() - 1));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    cout << "TextureLoader - " << request.path << ": " << blockFormatName(request.format)
+        << (request.fromCache ? " from texture cache" : " compressed") << (request.compressed ? "" : ", decoded in software") << ", "
+        << request.levels.size() << " levels, " << request.pixels.size() / 1024 << " KB (" << uncompressed / 1024 << " KB as RGBA8)" << endl;
+
+    // the CPU copy is no longer needed
+    vector<unsigned char>().swap(request.pixels);
+}
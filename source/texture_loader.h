@@ -0,0 +1,98 @@
+#ifndef _TEXTURE_LOADER_H_
+#define _TEXTURE_LOADER_H_
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include "block_compression.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// one level of a mip chain stored in a contiguous pixel buffer
+struct MipLevel {
+    int width;
+    int height;
+    size_t offset;                // byte offset of the level in the buffer
+    size_t size;                  // bytes of the level
+};
+
+// Streams 2D textures in without stalling the render thread. Images are decoded and their mip chain
+// is built on worker threads, update() then uploads the finished ones through a pixel buffer object.
+// Until then the returned texture holds a 1x1 placeholder texel. Textures are block compressed and
+// kept in the TextureCache, drivers without a format get the blocks decoded back to RGBA8 on the worker.
+class TextureLoader
+{
+public:
+    // default bytes uploaded per update() call
+    static const size_t DEFAULT_UPLOAD_BUDGET = 16 * 1024 * 1024;
+
+    explicit TextureLoader(ThreadPool& pool = ThreadPool::shared());
+    // waits for the decode jobs, GL objects are left to the context teardown
+    ~TextureLoader();
+    // Queue a texture for loading and return its (placeholder) id, the same file is only loaded once.
+    // clampTransparent uses GL_CLAMP_TO_EDGE for linear RGBA images to prevent semi-transparent borders.
+    GLuint load(const std::string& path, bool gamma, bool clampTransparent = false);
+    // Upload decoded textures, at least one and then up to uploadBudget bytes. GL thread only.
+    void update(size_t uploadBudget = DEFAULT_UPLOAD_BUDGET);
+    // Block until every queued texture is uploaded. GL thread only.
+    void finish();
+    // Textures queued but not uploaded yet
+    size_t pending() const { return pending_count; }
+    // Bytes of texture data uploaded so far, and what they would have taken as RGBA8
+    size_t uploadedBytes() const { return uploaded_bytes; }
+    size_t uncompressedBytes() const { return uncompressed_bytes; }
+    // Loader used by textureFromFile() and loadTexture(), created on first use (needs a GL context)
+    static TextureLoader& shared();
+
+private:
+    struct Request {
+        GLuint id;
+        std::string path;
+        bool gamma;
+        bool clampTransparent;
+        int components;           // channels in the source image
+        bool compressed;          // pixels holds blocks of format, otherwise RGBA8 texels
+        bool fromCache;           // the blocks came from the TextureCache
+        BlockFormat format;
+        std::vector<MipLevel> levels;
+        std::vector<unsigned char> pixels;
+        bool failed;
+    };
+
+    TextureLoader(const TextureLoader&) = delete;
+    TextureLoader& operator=(const TextureLoader&) = delete;
+
+    // worker side: load the compressed mip chain from the cache or build and cache it
+    void decode(std::shared_ptr<Request> request);
+    // whether the driver can sample the format, with sRGB decoding when gamma is set
+    bool canUpload(BlockFormat format, bool gamma) const;
+    // GL side: re-specify the placeholder with the decoded mip chain
+    void upload(Request& request);
+
+    ThreadPool& pool;
+    std::map<std::string, GLuint> loaded;           // path + gamma flag -> texture id
+    std::deque<std::shared_ptr<Request>> ready;     // decoded, waiting for upload
+    std::mutex ready_mutex;
+    std::condition_variable ready_condition;
+    std::atomic<size_t> pending_count;              // queued and not uploaded yet
+    std::atomic<size_t> decoding_count;             // decode jobs still running
+    GLuint pbo_id;                                  // streaming pixel unpack buffer
+    bool s3tc_supported;                            // GL_EXT_texture_compression_s3tc, BC1 and BC3
+    bool srgb_s3tc_supported;                       // GL_EXT_texture_sRGB, their sRGB variants
+    size_t uploaded_bytes;
+    size_t uncompressed_bytes;
+};
+
+// Builds the 2x2 box filtered mip chain of an RGBA8 image. pixels holds the base level on input, the
+// smaller levels get appended behind it and levels describes all of them, base level included.
+void buildMipChain(std::vector<unsigned char>& pixels, int width, int height, std::vector<MipLevel>& levels);
+
+
+#endif
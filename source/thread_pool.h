@@ -0,0 +1,140 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads executing queued jobs in FIFO order.
+// Jobs must never block waiting on other jobs of the same pool.
+class ThreadPool
+{
+public:
+    // creates the workers, by default one per hardware thread minus the one running the GL context
+    explicit ThreadPool(unsigned int threadCount = defaultThreadCount())
+        : stopping(false)
+    {
+        threadCount = std::max(threadCount, 1u);
+        for (unsigned int i = 0; i < threadCount; i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    // finishes the queued jobs and joins the workers
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueCondition.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    // queues a job, the returned future holds its result
+    template <class F>
+    auto submit(F&& job) -> std::future<decltype(job())>
+    {
+        typedef decltype(job()) Result;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+        std::future<Result> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            jobs.emplace([task] { (*task)(); });
+        }
+        queueCondition.notify_one();
+        return result;
+    }
+
+    // number of worker threads
+    unsigned int size() const { return (unsigned int)workers.size(); }
+
+    // pool shared by the loaders of the application
+    static ThreadPool& shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    static unsigned int defaultThreadCount()
+    {
+        unsigned int hardwareThreads = std::thread::hardware_concurrency();
+        return hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+
+private:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueCondition.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop();
+            }
+            job();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> jobs;
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    bool stopping;
+};
+
+// Runs job(0) ... job(count - 1) on the pool and the calling thread. The caller only waits for indices some
+// thread already claimed, so it never waits on a queued job and can itself be a job of the pool.
+inline void parallelFor(ThreadPool* pool, size_t count, const std::function<void(size_t)>& job)
+{
+    struct State {
+        std::function<void(size_t)> job;
+        size_t count;
+        std::atomic<size_t> next{ 0 };
+        std::atomic<size_t> completed{ 0 };
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    state->job = job;
+    state->count = count;
+
+    auto work = [](const std::shared_ptr<State>& state) {
+        for (size_t i = state->next++; i < state->count; i = state->next++)
+        {
+            state->job(i);
+            if (++state->completed == state->count)
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->done.notify_all();
+            }
+        }
+    };
+
+    if (pool)
+    {
+        size_t helpers = std::min(size_t(pool->size()), count > 0 ? count - 1 : 0);
+        for (size_t i = 0; i < helpers; i++)
+            pool->submit([state, work] { work(state); });
+    }
+    work(state);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&state] { return state->completed == state->count; });
+}
+
+#endif
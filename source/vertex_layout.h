@@ -0,0 +1,226 @@
+#ifndef VERTEX_LAYOUT_H
+#define VERTEX_LAYOUT_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+// GLM
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+struct Vertex {
+    // position
+    glm::vec3 Position;
+    // normal
+    glm::vec3 Normal;
+    // texCoords
+    glm::vec2 TexCoords;
+    // tangent
+    glm::vec3 Tangent;
+    // bitangent
+    glm::vec3 Bitangent;
+};
+
+// vertex streams a mesh can upload, attribute locations are fixed so shaders work with any layout
+enum VertexStream {
+    VERTEX_POSITION = 1 << 0,     // location 0
+    VERTEX_NORMAL = 1 << 1,       // location 1
+    VERTEX_TEXCOORDS = 1 << 2,    // location 2
+    VERTEX_TANGENTS = 1 << 3,     // location 3 (and 4 for float bitangents)
+    VERTEX_ALL = VERTEX_POSITION | VERTEX_NORMAL | VERTEX_TEXCOORDS | VERTEX_TANGENTS
+};
+
+// GPU encoding of the normal and tangent streams
+enum class NormalFormat {
+    Float,            // 3 floats each, bitangents stored explicitly
+    Packed1010102,    // GL_INT_2_10_10_10_REV, tangent w holds the bitangent sign
+    Octahedral        // normal as 2 snorm16 (decoded in the vertex shader), tangents as Packed1010102
+};
+
+// Describes which vertex streams a mesh uploads and how they are encoded. Meshes always come in as
+// full Vertex arrays, the layout is applied when the GL buffers are created.
+struct VertexLayout {
+    unsigned int streams;
+    NormalFormat normalFormat;
+    bool halfTexCoords;           // texture coordinates as GL_HALF_FLOAT
+    bool shortIndices;            // GL_UNSIGNED_SHORT indices when the vertex count allows it
+
+    VertexLayout(unsigned int streams = VERTEX_ALL, NormalFormat normalFormat = NormalFormat::Float,
+        bool halfTexCoords = false, bool shortIndices = false)
+        : streams(streams), normalFormat(normalFormat), halfTexCoords(halfTexCoords), shortIndices(shortIndices)
+    {
+    }
+
+    // the given streams with every packing option enabled
+    static VertexLayout compact(unsigned int streams, NormalFormat normalFormat = NormalFormat::Packed1010102)
+    {
+        return VertexLayout(streams | VERTEX_POSITION, normalFormat, true, true);
+    }
+
+    bool has(VertexStream stream) const { return (streams & stream) != 0; }
+
+    // bytes per vertex on the GPU
+    unsigned int stride() const
+    {
+        unsigned int size = 0;
+        if (has(VERTEX_POSITION))
+            size += 3 * sizeof(float);
+        if (has(VERTEX_NORMAL))
+            size += normalFormat == NormalFormat::Float ? 3 * sizeof(float) : sizeof(uint32_t);
+        if (has(VERTEX_TEXCOORDS))
+            size += halfTexCoords ? sizeof(uint32_t) : 2 * sizeof(float);
+        if (has(VERTEX_TANGENTS))
+            size += normalFormat == NormalFormat::Float ? 6 * sizeof(float) : sizeof(uint32_t);
+        return size;
+    }
+
+    GLenum indexType(size_t vertexCount) const
+    {
+        return shortIndices && vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
+
+    // converts full vertices into the interleaved layout described by stride()
+    void packVertices(const Vertex* vertices, size_t count, std::vector<unsigned char>& out) const
+    {
+        const unsigned int vertexSize = stride();
+        out.resize(count * vertexSize);
+        unsigned char* cursor = out.data();
+        for (size_t i = 0; i < count; i++)
+        {
+            const Vertex& vertex = vertices[i];
+            if (has(VERTEX_POSITION))
+                write(cursor, &vertex.Position[0], 3 * sizeof(float));
+            if (has(VERTEX_NORMAL))
+            {
+                if (normalFormat == NormalFormat::Float)
+                    write(cursor, &vertex.Normal[0], 3 * sizeof(float));
+                else if (normalFormat == NormalFormat::Octahedral)
+                    write(cursor, glm::packSnorm2x16(encodeOctahedral(vertex.Normal)));
+                else
+                    write(cursor, glm::packSnorm3x10_1x2(glm::vec4(safeNormalize(vertex.Normal), 0.0f)));
+            }
+            if (has(VERTEX_TEXCOORDS))
+            {
+                if (halfTexCoords)
+                    write(cursor, glm::packHalf2x16(vertex.TexCoords));
+                else
+                    write(cursor, &vertex.TexCoords[0], 2 * sizeof(float));
+            }
+            if (has(VERTEX_TANGENTS))
+            {
+                if (normalFormat == NormalFormat::Float)
+                {
+                    write(cursor, &vertex.Tangent[0], 3 * sizeof(float));
+                    write(cursor, &vertex.Bitangent[0], 3 * sizeof(float));
+                }
+                else
+                {
+                    // the bitangent is rebuilt in the shader as cross(normal, tangent.xyz) * tangent.w
+                    float handedness = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f : 1.0f;
+                    write(cursor, glm::packSnorm3x10_1x2(glm::vec4(safeNormalize(vertex.Tangent), handedness)));
+                }
+            }
+        }
+    }
+
+    // sets the attribute pointers of the bound VAO for the bound GL_ARRAY_BUFFER
+    void setupAttributes() const
+    {
+        const GLsizei vertexSize = GLsizei(stride());
+        size_t offset = 0;
+        if (has(VERTEX_POSITION))
+        {
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertexSize, (void*)offset);
+            offset += 3 * sizeof(float);
+        }
+        if (has(VERTEX_NORMAL))
+        {
+            glEnableVertexAttribArray(1);
+            if (normalFormat == NormalFormat::Float)
+            {
+                glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, vertexSize, (void*)offset);
+                offset += 3 * sizeof(float);
+            }
+            else if (normalFormat == NormalFormat::Octahedral)
+            {
+                glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, vertexSize, (void*)offset);
+                offset += sizeof(uint32_t);
+            }
+            else
+            {
+                glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, vertexSize, (void*)offset);
+                offset += sizeof(uint32_t);
+            }
+        }
+        if (has(VERTEX_TEXCOORDS))
+        {
+            glEnableVertexAttribArray(2);
+            if (halfTexCoords)
+            {
+                glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, vertexSize, (void*)offset);
+                offset += sizeof(uint32_t);
+            }
+            else
+            {
+                glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, vertexSize, (void*)offset);
+                offset += 2 * sizeof(float);
+            }
+        }
+        if (has(VERTEX_TANGENTS))
+        {
+            glEnableVertexAttribArray(3);
+            if (normalFormat == NormalFormat::Float)
+            {
+                glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, vertexSize, (void*)offset);
+                glEnableVertexAttribArray(4);
+                glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, vertexSize, (void*)(offset + 3 * sizeof(float)));
+                offset += 6 * sizeof(float);
+            }
+            else
+            {
+                glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, vertexSize, (void*)offset);
+                offset += sizeof(uint32_t);
+            }
+        }
+    }
+
+private:
+    template<class T>
+    static void write(unsigned char*& cursor, const T& value)
+    {
+        write(cursor, &value, sizeof(T));
+    }
+
+    static void write(unsigned char*& cursor, const void* data, size_t size)
+    {
+        memcpy(cursor, data, size);
+        cursor += size;
+    }
+
+    static glm::vec3 safeNormalize(const glm::vec3& v)
+    {
+        float length = glm::length(v);
+        return length > 0.0f ? v / length : glm::vec3(0.0f, 0.0f, 1.0f);
+    }
+
+    // maps a unit vector onto the [-1,1] square of an octahedron unfolded into the xy plane
+    static glm::vec2 encodeOctahedral(const glm::vec3& normal)
+    {
+        glm::vec3 n = normal / (fabs(normal.x) + fabs(normal.y) + fabs(normal.z) + 1e-20f);
+        glm::vec2 e(n.x, n.y);
+        if (n.z < 0.0f)
+        {
+            e.x = (1.0f - fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+            e.y = (1.0f - fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+        }
+        return e;
+    }
+};
+
+
+#endif